@@ -19,6 +19,11 @@
 
 #include <stdutils/uchar_vector.h>
 
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
 // unsecure versions, suitable for public keys
 inline unsigned int countLeading0s(const std::vector<unsigned char>& data)
 {
@@ -34,32 +39,212 @@ inline unsigned int countLeading0s(const std::string& numeral, char zeroSymbol)
     return i;
 }
 
+// Base58 conversion works on 32 bit limbs rather than a BIGNUM. Encoding keeps
+// five base58 digits per limb and decoding 32 bits, so each input chunk costs a
+// single multiply-add per limb. Inputs up to BASE58_STACK_BYTES bytes, which
+// covers addresses and extended keys, are converted without allocating.
+const uint32_t BASE58_LIMB = 656356768; // 58^5
+const size_t BASE58_STACK_BYTES = 128;
+const size_t BASE58_STACK_LIMBS = BASE58_STACK_BYTES / 3 + 2;
+
+// Upper bound on the number of characters toBase58() writes for size bytes.
+inline size_t base58MaxEncodedSize(size_t size)
+{
+    return size * 138 / 100 + 1;
+}
+
+// Writes data in base58 to out, which must have room for base58MaxEncodedSize(size) characters.
+// Returns the number of characters written.
+inline size_t toBase58(const unsigned char* data, size_t size, char* out, const char* _base58chars = DEFAULT_BASE58_CHARS)
+{
+    size_t zeros = 0;
+    for (; (zeros < size) && (data[zeros] == 0); zeros++);
+
+    uint32_t stackLimbs[BASE58_STACK_LIMBS];
+    std::vector<uint32_t> heapLimbs;
+    uint32_t* limbs = stackLimbs;
+    if (size > BASE58_STACK_BYTES)
+    {
+        heapLimbs.resize(size / 3 + 2);
+        limbs = &heapLimbs[0];
+    }
+
+    // Little endian limbs in base 58^5.
+    size_t nLimbs = 0;
+    for (size_t i = zeros; i < size;)
+    {
+        size_t chunk = std::min<size_t>(4, size - i);
+        uint64_t carry = 0;
+        for (size_t j = 0; j < chunk; j++) { carry = (carry << 8) | data[i++]; }
+
+        unsigned int shift = 8 * chunk;
+        for (size_t k = 0; k < nLimbs; k++)
+        {
+            carry += (uint64_t)limbs[k] << shift;
+            limbs[k] = carry % BASE58_LIMB;
+            carry /= BASE58_LIMB;
+        }
+        for (; carry; carry /= BASE58_LIMB) { limbs[nLimbs++] = carry % BASE58_LIMB; }
+    }
+
+    char* p = out;
+    for (size_t i = 0; i < zeros; i++) { *p++ = _base58chars[0]; }
+    if (nLimbs == 0) return p - out;
+
+    // The top limb without its leading zeros, then five digits for each of the others.
+    char top[5];
+    size_t nTop = 0;
+    for (uint32_t limb = limbs[nLimbs - 1]; limb; limb /= 58) { top[nTop++] = _base58chars[limb % 58]; }
+    while (nTop) { *p++ = top[--nTop]; }
+
+    for (size_t k = nLimbs - 1; k-- > 0;)
+    {
+        uint32_t limb = limbs[k];
+        for (int j = 4; j >= 0; j--)
+        {
+            p[j] = _base58chars[limb % 58];
+            limb /= 58;
+        }
+        p += 5;
+    }
+    return p - out;
+}
+
+inline std::string toBase58(const std::vector<unsigned char>& data, const char* _base58chars = DEFAULT_BASE58_CHARS)
+{
+    std::string base58(base58MaxEncodedSize(data.size()), '\0');
+    base58.resize(toBase58(data.data(), data.size(), &base58[0], _base58chars));
+    return base58;
+}
+
+// Characters outside the alphabet are skipped, as they always have been, so
+// input with stray whitespace still decodes. Checksums catch anything worse.
+inline void fromBase58(const std::string& base58, std::vector<unsigned char>& bytes, const char* _base58chars = DEFAULT_BASE58_CHARS)
+{
+    signed char digits[256];
+    std::memset(digits, -1, sizeof(digits));
+    for (int i = 0; i < 58; i++) { digits[(unsigned char)_base58chars[i]] = i; }
+
+    uint32_t stackLimbs[BASE58_STACK_LIMBS];
+    std::vector<uint32_t> heapLimbs;
+    uint32_t* limbs = stackLimbs;
+    if (base58.size() / 5 + 2 > BASE58_STACK_LIMBS)
+    {
+        heapLimbs.resize(base58.size() / 5 + 2);
+        limbs = &heapLimbs[0];
+    }
+
+    // Little endian 32 bit limbs, taking up to five digits at a time.
+    size_t nLimbs = 0;
+    uint64_t chunk = 0;
+    uint64_t multiplier = 1;
+    for (size_t i = 0; i <= base58.size(); i++)
+    {
+        if (i < base58.size())
+        {
+            signed char digit = digits[(unsigned char)base58[i]];
+            if (digit < 0) continue;
+            chunk = chunk * 58 + digit;
+            multiplier *= 58;
+            if (multiplier < BASE58_LIMB) continue;
+        }
+        else if (multiplier == 1) break;
+
+        uint64_t carry = chunk;
+        for (size_t k = 0; k < nLimbs; k++)
+        {
+            carry += (uint64_t)limbs[k] * multiplier;
+            limbs[k] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        for (; carry; carry >>= 32) { limbs[nLimbs++] = (uint32_t)carry; }
+
+        chunk = 0;
+        multiplier = 1;
+    }
+
+    bytes.assign(countLeading0s(base58, _base58chars[0]), 0);
+    if (nLimbs == 0) return;
+    bytes.reserve(bytes.size() + nLimbs * 4);
+
+    uint32_t top = limbs[nLimbs - 1];
+    int shift = 24;
+    for (; (top >> shift) == 0; shift -= 8);
+    for (; shift >= 0; shift -= 8) { bytes.push_back((unsigned char)(top >> shift)); }
+
+    for (size_t k = nLimbs - 1; k-- > 0;)
+    {
+        for (shift = 24; shift >= 0; shift -= 8) { bytes.push_back((unsigned char)(limbs[k] >> shift)); }
+    }
+}
+
+// First four bytes of the double SHA-256 of data.
+inline void base58CheckChecksum(const unsigned char* data, size_t size, unsigned char checksum[4])
+{
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256_CTX sha256;
+    SHA256_Init(&sha256);
+    SHA256_Update(&sha256, data, size);
+    SHA256_Final(hash, &sha256);
+    SHA256_Init(&sha256);
+    SHA256_Update(&sha256, hash, SHA256_DIGEST_LENGTH);
+    SHA256_Final(hash, &sha256);
+    std::memcpy(checksum, hash, 4);
+}
+
+// Base58 of the version bytes, the payload and their checksum. Only the returned string is allocated
+// unless the input is larger than BASE58_STACK_BYTES.
+inline std::string toBase58Check(const unsigned char* version, size_t versionSize, const unsigned char* payload, size_t payloadSize, const char* _base58chars = DEFAULT_BASE58_CHARS)
+{
+    size_t size = versionSize + payloadSize + 4;
+
+    unsigned char stackData[BASE58_STACK_BYTES];
+    char stackChars[BASE58_STACK_BYTES * 138 / 100 + 1];
+    std::vector<unsigned char> heapData;
+    std::vector<char> heapChars;
+    unsigned char* data = stackData;
+    char* chars = stackChars;
+    if (size > BASE58_STACK_BYTES)
+    {
+        heapData.resize(size);
+        heapChars.resize(base58MaxEncodedSize(size));
+        data = &heapData[0];
+        chars = &heapChars[0];
+    }
+
+    if (versionSize > 0) { std::memcpy(data, version, versionSize); }
+    if (payloadSize > 0) { std::memcpy(data + versionSize, payload, payloadSize); }
+    base58CheckChecksum(data, size - 4, data + size - 4);
+
+    return std::string(chars, toBase58(data, size, chars, _base58chars));
+}
+
 inline std::string toBase58Check(const std::vector<unsigned char>& payload, unsigned char version, const char* _base58chars = DEFAULT_BASE58_CHARS)
 {
-    uchar_vector data;
-    data.push_back(version);                                        // prepend version byte
-    data += payload;
-    uchar_vector checksum = sha256_2(data);
-    checksum.assign(checksum.begin(), checksum.begin() + 4);        // compute checksum
-    data += checksum;                                               // append checksum
-    BigInt bn(data);
-    std::string base58check = bn.getInBase(58, _base58chars);             // convert to base58
-    std::string leading0s(countLeading0s(data), _base58chars[0]);         // prepend leading 0's (1 in base58)
-    return leading0s + base58check;
+    return toBase58Check(&version, 1, payload.data(), payload.size(), _base58chars);
 }
 
 inline std::string toBase58Check(const std::vector<unsigned char>& payload, const std::vector<unsigned char>& version = std::vector<unsigned char>(), const char* _base58chars = DEFAULT_BASE58_CHARS)
 {
-    uchar_vector data;
-    data += version;                                            // prepend version byte
-    data += payload;
-    uchar_vector checksum = sha256_2(data);
-    checksum.assign(checksum.begin(), checksum.begin() + 4);        // compute checksum
-    data += checksum;                                               // append checksum
-    BigInt bn(data);
-    std::string base58check = bn.getInBase(58, _base58chars);             // convert to base58
-    std::string leading0s(countLeading0s(data), _base58chars[0]);         // prepend leading 0's (1 in base58)
-    return leading0s + base58check;
+    return toBase58Check(version.data(), version.size(), payload.data(), payload.size(), _base58chars);
+}
+
+// Decodes base58check and strips the checksum.
+//    returns true if the checksum is valid.
+//    returns false and does not modify bytes if invalid.
+inline bool fromBase58CheckBytes(const std::string& base58check, std::vector<unsigned char>& bytes, const char* _base58chars = DEFAULT_BASE58_CHARS)
+{
+    std::vector<unsigned char> decoded;
+    fromBase58(base58check, decoded, _base58chars);
+    if (decoded.size() < 4) return false;                                   // not enough bytes
+
+    unsigned char checksum[4];
+    base58CheckChecksum(decoded.data(), decoded.size() - 4, checksum);
+    if (std::memcmp(checksum, &decoded[decoded.size() - 4], 4) != 0) return false;
+
+    decoded.resize(decoded.size() - 4);
+    bytes.swap(decoded);
+    return true;
 }
 
 // fromBase58Check() - gets payload and version from a base58check string.
@@ -67,16 +252,8 @@ inline std::string toBase58Check(const std::vector<unsigned char>& payload, cons
 //    returns false and does not modify parameters if invalid.
 inline bool fromBase58Check(const std::string& base58check, std::vector<unsigned char>& payload, unsigned int& version, const char* _base58chars = DEFAULT_BASE58_CHARS)
 {
-    BigInt bn(base58check, 58, _base58chars);                                // convert from base58
-    uchar_vector bytes = bn.getBytes();
-    if (bytes.size() < 4) return false;                                     // not enough bytes
-    uchar_vector checksum = uchar_vector(bytes.end() - 4, bytes.end());
-    bytes.assign(bytes.begin(), bytes.end() - 4);                           // split string into payload part and checksum part
-    uchar_vector leading0s(countLeading0s(base58check, _base58chars[0]), 0); // prepend leading 0's
-    bytes = leading0s + bytes;
-    uchar_vector hashBytes = sha256_2(bytes);
-    hashBytes.assign(hashBytes.begin(), hashBytes.begin() + 4);
-    if (hashBytes != checksum) return false;                                // verify checksum
+    std::vector<unsigned char> bytes;
+    if (!fromBase58CheckBytes(base58check, bytes, _base58chars) || bytes.empty()) return false;
     version = bytes[0];
     payload.assign(bytes.begin() + 1, bytes.end());
     return true;
@@ -84,31 +261,13 @@ inline bool fromBase58Check(const std::string& base58check, std::vector<unsigned
 
 inline bool fromBase58Check(const std::string& base58check, std::vector<unsigned char>& payload, const char* _base58chars = DEFAULT_BASE58_CHARS)
 {
-    BigInt bn(base58check, 58, _base58chars);                                // convert from base58
-    uchar_vector bytes = bn.getBytes();
-    if (bytes.size() < 4) return false;                                     // not enough bytes
-    uchar_vector checksum = uchar_vector(bytes.end() - 4, bytes.end());
-    bytes.assign(bytes.begin(), bytes.end() - 4);                           // split string into payload part and checksum part
-    uchar_vector leading0s(countLeading0s(base58check, _base58chars[0]), 0); // prepend leading 0's
-    bytes = leading0s + bytes;
-    uchar_vector hashBytes = sha256_2(bytes);
-    hashBytes.assign(hashBytes.begin(), hashBytes.begin() + 4);
-    if (hashBytes != checksum) return false;                                // verify checksum
-    payload.assign(bytes.begin(), bytes.end());
-    return true;
+    return fromBase58CheckBytes(base58check, payload, _base58chars);
 }
 
 inline bool isBase58CheckValid(const std::string& base58check, const char* _base58chars = DEFAULT_BASE58_CHARS)
 {
-    BigInt bn(base58check, 58, _base58chars);                                // convert from base58
-    uchar_vector bytes = bn.getBytes();
-    uchar_vector checksum = uchar_vector(bytes.end() - 4, bytes.end());
-    bytes.assign(bytes.begin(), bytes.end() - 4);                           // split string into payload part and checksum part
-    uchar_vector leading0s(countLeading0s(base58check, _base58chars[0]), 0); // prepend leading 0's
-    bytes = leading0s + bytes;
-    uchar_vector hashBytes = sha256_2(bytes);
-    hashBytes.assign(hashBytes.begin(), hashBytes.begin() + 4);
-    return (hashBytes == checksum);                                         // verify checksum
+    std::vector<unsigned char> bytes;
+    return fromBase58CheckBytes(base58check, bytes, _base58chars);
 }
 // and secure versions, suitable for private keys - Not done yet
 // Should use templates.
@@ -474,6 +474,26 @@ void CoinNodeMessage::setMessage(uint32_t magic, CoinNodeStructure* pPayload)
         PongMessage* pMessage = static_cast<PongMessage*>(pPayload);
         this->pPayload = new PongMessage(*pMessage);
     }
+    else if (command == "getcfilters") {
+        this->header = MessageHeader(magic, command.c_str(), pPayload->getSize(), pPayload->getChecksum());
+        GetCFiltersMessage* pMessage = static_cast<GetCFiltersMessage*>(pPayload);
+        this->pPayload = new GetCFiltersMessage(*pMessage);
+    }
+    else if (command == "cfilter") {
+        this->header = MessageHeader(magic, command.c_str(), pPayload->getSize(), pPayload->getChecksum());
+        CFilterMessage* pMessage = static_cast<CFilterMessage*>(pPayload);
+        this->pPayload = new CFilterMessage(*pMessage);
+    }
+    else if (command == "getcfheaders") {
+        this->header = MessageHeader(magic, command.c_str(), pPayload->getSize(), pPayload->getChecksum());
+        GetCFHeadersMessage* pMessage = static_cast<GetCFHeadersMessage*>(pPayload);
+        this->pPayload = new GetCFHeadersMessage(*pMessage);
+    }
+    else if (command == "cfheaders") {
+        this->header = MessageHeader(magic, command.c_str(), pPayload->getSize(), pPayload->getChecksum());
+        CFHeadersMessage* pMessage = static_cast<CFHeadersMessage*>(pPayload);
+        this->pPayload = new CFHeadersMessage(*pMessage);
+    }
     else {
         string error_msg = "Unrecognized command: ";
         error_msg += command;
@@ -588,6 +608,22 @@ void CoinNodeMessage::setSerialized(const uchar_vector& bytes)
         this->pPayload =
             new PongMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
     }
+    else if (command == "getcfilters") {
+        this->pPayload =
+            new GetCFiltersMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+    }
+    else if (command == "cfilter") {
+        this->pPayload =
+            new CFilterMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+    }
+    else if (command == "getcfheaders") {
+        this->pPayload =
+            new GetCFHeadersMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+    }
+    else if (command == "cfheaders") {
+        this->pPayload =
+            new CFHeadersMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+    }
     else {
         string error_msg = "Unrecognized command: ";
         error_msg += command;
@@ -2259,3 +2295,161 @@ std::string PongMessage::toIndentedString(uint spaces) const
     return "";
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// class GetCFiltersMessage implementation
+//
+uchar_vector GetCFiltersMessage::getSerialized() const
+{
+    uchar_vector rval;
+    rval.push_back(filterType);
+    rval += uint_to_vch(startHeight, LITTLE_ENDIAN_);
+    rval += uchar_vector(stopHash).getReverse();
+    return rval;
+}
+
+void GetCFiltersMessage::setSerialized(const uchar_vector& bytes)
+{
+    if (bytes.size() < 37) {
+        throw std::runtime_error("Invalid data - GetCFiltersMessage too small.");
+    }
+
+    filterType = bytes[0];
+    startHeight = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + 1, bytes.begin() + 5), LITTLE_ENDIAN_);
+    stopHash.assign(bytes.begin() + 5, bytes.begin() + 37);
+    stopHash.reverse();
+}
+
+std::string GetCFiltersMessage::toString() const
+{
+    stringstream ss;
+    ss << "filterType: " << (int)filterType << ", startHeight: " << startHeight << ", stopHash: " << stopHash.getHex();
+    return ss.str();
+}
+
+std::string GetCFiltersMessage::toIndentedString(uint spaces) const
+{
+    stringstream ss;
+    ss << blankSpaces(spaces) << "filterType: " << (int)filterType << endl
+       << blankSpaces(spaces) << "startHeight: " << startHeight << endl
+       << blankSpaces(spaces) << "stopHash: " << stopHash.getHex();
+    return ss.str();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// class CFilterMessage implementation
+//
+uchar_vector CFilterMessage::getSerialized() const
+{
+    uchar_vector rval;
+    rval.push_back(filterType);
+    rval += uchar_vector(blockHash).getReverse();
+    rval += VarInt(filter.size()).getSerialized();
+    rval += filter;
+    return rval;
+}
+
+void CFilterMessage::setSerialized(const uchar_vector& bytes)
+{
+    if (bytes.size() < 34) {
+        throw std::runtime_error("Invalid data - CFilterMessage too small.");
+    }
+
+    filterType = bytes[0];
+    blockHash.assign(bytes.begin() + 1, bytes.begin() + 33);
+    blockHash.reverse();
+
+    VarInt filterSize(uchar_vector(bytes.begin() + 33, bytes.end()));
+    uint pos = 33 + filterSize.getSize();
+    if (bytes.size() < pos + filterSize.value) {
+        throw std::runtime_error("Invalid data - CFilterMessage too short.");
+    }
+
+    filter.assign(bytes.begin() + pos, bytes.begin() + pos + filterSize.value);
+}
+
+std::string CFilterMessage::toString() const
+{
+    stringstream ss;
+    ss << "filterType: " << (int)filterType << ", blockHash: " << blockHash.getHex() << ", filter: " << filter.getHex();
+    return ss.str();
+}
+
+std::string CFilterMessage::toIndentedString(uint spaces) const
+{
+    stringstream ss;
+    ss << blankSpaces(spaces) << "filterType: " << (int)filterType << endl
+       << blankSpaces(spaces) << "blockHash: " << blockHash.getHex() << endl
+       << blankSpaces(spaces) << "filter: " << filter.getHex();
+    return ss.str();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// class CFHeadersMessage implementation
+//
+uchar_vector CFHeadersMessage::getSerialized() const
+{
+    uchar_vector rval;
+    rval.push_back(filterType);
+    rval += uchar_vector(stopHash).getReverse();
+    rval += uchar_vector(prevFilterHeader).getReverse();
+    rval += VarInt(filterHashes.size()).getSerialized();
+    for (auto& filterHash: filterHashes) { rval += uchar_vector(filterHash).getReverse(); }
+    return rval;
+}
+
+void CFHeadersMessage::setSerialized(const uchar_vector& bytes)
+{
+    if (bytes.size() < 66) {
+        throw std::runtime_error("Invalid data - CFHeadersMessage too small.");
+    }
+
+    filterType = bytes[0];
+    stopHash.assign(bytes.begin() + 1, bytes.begin() + 33);
+    stopHash.reverse();
+    prevFilterHeader.assign(bytes.begin() + 33, bytes.begin() + 65);
+    prevFilterHeader.reverse();
+
+    VarInt count(uchar_vector(bytes.begin() + 65, bytes.end()));
+    uint pos = 65 + count.getSize();
+    if (bytes.size() < pos + 32*count.value) {
+        throw std::runtime_error("Invalid data - CFHeadersMessage too short.");
+    }
+
+    filterHashes.clear();
+    for (uint i = 0; i < count.value; i++) {
+        uchar_vector filterHash(bytes.begin() + pos, bytes.begin() + pos + 32); pos += 32;
+        filterHash.reverse();
+        filterHashes.push_back(filterHash);
+    }
+}
+
+std::string CFHeadersMessage::toString() const
+{
+    stringstream ss;
+    ss << "filterType: " << (int)filterType << ", stopHash: " << stopHash.getHex() << ", prevFilterHeader: " << prevFilterHeader.getHex()
+       << ", filterHashes: [";
+    for (uint i = 0; i < filterHashes.size(); i++) {
+        if (i > 0) ss << ", ";
+        ss << i << ": " << filterHashes[i].getHex();
+    }
+    ss << "]";
+    return ss.str();
+}
+
+std::string CFHeadersMessage::toIndentedString(uint spaces) const
+{
+    stringstream ss;
+    ss << blankSpaces(spaces) << "filterType: " << (int)filterType << endl
+       << blankSpaces(spaces) << "stopHash: " << stopHash.getHex() << endl
+       << blankSpaces(spaces) << "prevFilterHeader: " << prevFilterHeader.getHex() << endl
+       << blankSpaces(spaces) << "filterHashes:" << endl;
+    for (uint i = 0; i < filterHashes.size(); i++) {
+        stringstream is;
+        is << i;
+        ss << blankSpaces(spaces + 8 - is.str().size()) << is.str() << ": " << filterHashes[i].getHex() << endl;
+    }
+    return ss.str();
+}
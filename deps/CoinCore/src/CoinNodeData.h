@@ -34,6 +34,7 @@ void SetAddressVersion(unsigned char version);
 void SetMultiSigAddressVersion(unsigned char version);
 
 #define NODE_NETWORK                  1
+#define NODE_COMPACT_FILTERS          (1 << 6)
 
 #define MSG_ERROR                     0
 #define MSG_TX                        1
@@ -1019,5 +1020,80 @@ public:
     std::string toIndentedString(uint spaces = 0) const;
 };
 
+// BIP157 compact block filter messages. Block and filter hashes are stored
+// reversed from the wire, like other block hashes.
+class GetCFiltersMessage : public CoinNodeStructure
+{
+public:
+    uint8_t filterType;
+    uint32_t startHeight;
+    uchar_vector stopHash;
+
+    GetCFiltersMessage(uint8_t filterType_ = 0, uint32_t startHeight_ = 0, const uchar_vector& stopHash_ = g_zero32bytes)
+        : filterType(filterType_), startHeight(startHeight_), stopHash(stopHash_) { }
+    GetCFiltersMessage(const uchar_vector& bytes) { setSerialized(bytes); }
+
+    const char* getCommand() const { return "getcfilters"; }
+    uint64_t getSize() const { return 37; }
+
+    uchar_vector getSerialized() const;
+    void setSerialized(const uchar_vector& bytes);
+
+    std::string toString() const;
+    std::string toIndentedString(uint spaces = 0) const;
+};
+
+class CFilterMessage : public CoinNodeStructure
+{
+public:
+    uint8_t filterType;
+    uchar_vector blockHash;
+    uchar_vector filter;
+
+    CFilterMessage(uint8_t filterType_ = 0, const uchar_vector& blockHash_ = g_zero32bytes, const uchar_vector& filter_ = uchar_vector())
+        : filterType(filterType_), blockHash(blockHash_), filter(filter_) { }
+    CFilterMessage(const uchar_vector& bytes) { setSerialized(bytes); }
+
+    const char* getCommand() const { return "cfilter"; }
+    uint64_t getSize() const { return 33 + VarInt(filter.size()).getSize() + filter.size(); }
+
+    uchar_vector getSerialized() const;
+    void setSerialized(const uchar_vector& bytes);
+
+    std::string toString() const;
+    std::string toIndentedString(uint spaces = 0) const;
+};
+
+class GetCFHeadersMessage : public GetCFiltersMessage
+{
+public:
+    GetCFHeadersMessage(uint8_t filterType_ = 0, uint32_t startHeight_ = 0, const uchar_vector& stopHash_ = g_zero32bytes)
+        : GetCFiltersMessage(filterType_, startHeight_, stopHash_) { }
+    GetCFHeadersMessage(const uchar_vector& bytes) { setSerialized(bytes); }
+
+    const char* getCommand() const { return "getcfheaders"; }
+};
+
+class CFHeadersMessage : public CoinNodeStructure
+{
+public:
+    uint8_t filterType;
+    uchar_vector stopHash;
+    uchar_vector prevFilterHeader;
+    std::vector<uchar_vector> filterHashes;
+
+    CFHeadersMessage() : filterType(0), stopHash(g_zero32bytes), prevFilterHeader(g_zero32bytes) { }
+    CFHeadersMessage(const uchar_vector& bytes) { setSerialized(bytes); }
+
+    const char* getCommand() const { return "cfheaders"; }
+    uint64_t getSize() const { return 65 + VarInt(filterHashes.size()).getSize() + 32*filterHashes.size(); }
+
+    uchar_vector getSerialized() const;
+    void setSerialized(const uchar_vector& bytes);
+
+    std::string toString() const;
+    std::string toIndentedString(uint spaces = 0) const;
+};
+
 } // namespace Coin
 
@@ -0,0 +1,329 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GolombFilter.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "GolombFilter.h"
+#include "CoinNodeData.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+
+using namespace Coin;
+
+namespace {
+
+inline uint64_t rotl64(uint64_t x, int b)
+{
+    return (x << b) | (x >> (64 - b));
+}
+
+inline uint64_t read_le64(const unsigned char* p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) { v = (v << 8) | p[i]; }
+    return v;
+}
+
+// High 64 bits of a 64x64 bit product, i.e. maps x uniformly onto [0, n).
+inline uint64_t map_into_range(uint64_t x, uint64_t n)
+{
+#if defined(__SIZEOF_INT128__)
+    return (uint64_t)(((unsigned __int128)x * n) >> 64);
+#else
+    uint64_t x_hi = x >> 32, x_lo = x & 0xffffffff;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xffffffff;
+
+    uint64_t lo_lo = x_lo * n_lo;
+    uint64_t hi_lo = x_hi * n_lo;
+    uint64_t lo_hi = x_lo * n_hi;
+    uint64_t hi_hi = x_hi * n_hi;
+
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+    return hi_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+}
+
+class BitWriter
+{
+public:
+    BitWriter(uchar_vector& out) : out_(out), nbits_(0) { }
+
+    void write(uint64_t value, int nbits)
+    {
+        while (nbits > 0)
+        {
+            if (nbits_ == 0) { out_.push_back(0); }
+            int n = std::min(nbits, 8 - nbits_);
+            unsigned char bits = (unsigned char)((value >> (nbits - n)) & ((1 << n) - 1));
+            out_.back() |= bits << (8 - nbits_ - n);
+            nbits_ = (nbits_ + n) % 8;
+            nbits -= n;
+        }
+    }
+
+    void writeUnary(uint64_t q)
+    {
+        while (q >= 32)
+        {
+            write(0xffffffff, 32);
+            q -= 32;
+        }
+        write((((uint64_t)1 << q) - 1) << 1, (int)q + 1);
+    }
+
+private:
+    uchar_vector& out_;
+    int nbits_; // bits used in the last byte
+};
+
+class BitReader
+{
+public:
+    BitReader(const uchar_vector& in, size_t offset) : in_(in), pos_(offset), nbits_(0) { }
+
+    uint64_t read(int nbits)
+    {
+        uint64_t value = 0;
+        while (nbits > 0)
+        {
+            if (pos_ >= in_.size()) throw std::runtime_error("GolombFilter - unexpected end of filter.");
+            int n = std::min(nbits, 8 - nbits_);
+            unsigned char bits = (in_[pos_] >> (8 - nbits_ - n)) & ((1 << n) - 1);
+            value = (value << n) | bits;
+            nbits_ += n;
+            if (nbits_ == 8) { pos_++; nbits_ = 0; }
+            nbits -= n;
+        }
+        return value;
+    }
+
+    uint64_t readUnary()
+    {
+        uint64_t q = 0;
+        while (true)
+        {
+            if (pos_ >= in_.size()) throw std::runtime_error("GolombFilter - unexpected end of filter.");
+
+            // Skip whole bytes of ones at once
+            if (nbits_ == 0 && in_[pos_] == 0xff)
+            {
+                q += 8;
+                pos_++;
+                continue;
+            }
+
+            if (!read(1)) return q;
+            q++;
+        }
+    }
+
+private:
+    const uchar_vector& in_;
+    size_t pos_;
+    int nbits_;
+};
+
+}
+
+uint64_t GolombFilter::sipHash(uint64_t k0, uint64_t k1, const unsigned char* data, size_t len)
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+#define SIPROUND do { \
+    v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32); \
+    v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32); \
+} while (0)
+
+    size_t blocks = len / 8;
+    for (size_t i = 0; i < blocks; i++)
+    {
+        uint64_t m = read_le64(data + 8 * i);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    uint64_t b = (uint64_t)len << 56;
+    const unsigned char* tail = data + 8 * blocks;
+    for (size_t i = 0; i < len % 8; i++) { b |= (uint64_t)tail[i] << (8 * i); }
+
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+#undef SIPROUND
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+GolombFilter::GolombFilter(const uchar_vector& blockHash, const std::vector<uchar_vector>& elements, uint8_t p, uint64_t m)
+    : p_(p), m_(m)
+{
+    setKey(blockHash);
+
+    std::set<uchar_vector> unique;
+    for (auto& element: elements) { if (!element.empty()) unique.insert(element); }
+    n_ = unique.size();
+
+    std::vector<uint64_t> hashed;
+    hashed.reserve(n_);
+    for (auto& element: unique) { hashed.push_back(hashElement(element)); }
+    std::sort(hashed.begin(), hashed.end());
+
+    encoded_ = VarInt(n_).getSerialized();
+    dataOffset_ = encoded_.size();
+
+    BitWriter writer(encoded_);
+    uint64_t last = 0;
+    for (auto value: hashed)
+    {
+        uint64_t delta = value - last;
+        writer.writeUnary(delta >> p_);
+        writer.write(delta & (((uint64_t)1 << p_) - 1), p_);
+        last = value;
+    }
+}
+
+GolombFilter::GolombFilter(const uchar_vector& blockHash, const uchar_vector& encoded, uint8_t p, uint64_t m)
+    : p_(p), m_(m), encoded_(encoded)
+{
+    setKey(blockHash);
+
+    if (encoded.empty()) throw std::runtime_error("GolombFilter - empty filter.");
+    VarInt n(encoded);
+    if (n.value > 0xffffffff) throw std::runtime_error("GolombFilter - too many elements.");
+    n_ = (uint32_t)n.value;
+    dataOffset_ = n.getSize();
+}
+
+bool GolombFilter::match(const uchar_vector& element) const
+{
+    std::vector<uchar_vector> elements(1, element);
+    return matchAny(elements);
+}
+
+bool GolombFilter::matchAny(const std::vector<uchar_vector>& elements) const
+{
+    std::vector<uint64_t> hashed;
+    hashElements(elements, hashed);
+    return matchAnyHashed(hashed);
+}
+
+void GolombFilter::hashElements(const std::vector<uchar_vector>& elements, std::vector<uint64_t>& hashed) const
+{
+    hashed.resize(elements.size());
+    for (size_t i = 0; i < elements.size(); i++) { hashed[i] = hashElement(elements[i]); }
+}
+
+bool GolombFilter::matchAnyHashed(const std::vector<uint64_t>& hashed) const
+{
+    if (n_ == 0 || hashed.empty()) return false;
+
+    std::vector<uint64_t> values = decode();
+
+    // Values are uniform over [0, N*M). Shifting out floor(log2(M)) bits leaves fewer
+    // than 2N buckets, so each holds about one value.
+    int shift = 0;
+    while (((uint64_t)1 << (shift + 1)) <= m_) { shift++; }
+    size_t nBuckets = (size_t)((((uint64_t)n_ * m_) - 1) >> shift) + 1;
+
+    std::vector<uint32_t> starts(nBuckets + 1, 0);
+    for (auto value: values)
+    {
+        if ((value >> shift) >= nBuckets) throw std::runtime_error("GolombFilter - value out of range.");
+        starts[(value >> shift) + 1]++;
+    }
+    for (size_t i = 1; i <= nBuckets; i++) { starts[i] += starts[i - 1]; }
+
+    for (auto query: hashed)
+    {
+        size_t bucket = query >> shift;
+        if (bucket >= nBuckets) continue;
+        for (uint32_t i = starts[bucket]; i < starts[bucket + 1]; i++)
+        {
+            if (values[i] == query) return true;
+        }
+    }
+    return false;
+}
+
+std::vector<uint64_t> GolombFilter::decode() const
+{
+    std::vector<uint64_t> values;
+    values.reserve(n_);
+
+    BitReader reader(encoded_, dataOffset_);
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < n_; i++)
+    {
+        uint64_t q = reader.readUnary();
+        value += (q << p_) | reader.read(p_);
+        values.push_back(value);
+    }
+    return values;
+}
+
+uchar_vector GolombFilter::getHash() const
+{
+    return sha256_2(encoded_).getReverse();
+}
+
+uchar_vector GolombFilter::getHeaderFromHash(const uchar_vector& filterHash, const uchar_vector& prevHeader)
+{
+    if (filterHash.size() != 32) throw std::runtime_error("GolombFilter - invalid filter hash.");
+    if (prevHeader.size() != 32) throw std::runtime_error("GolombFilter - invalid previous filter header.");
+    return sha256_2(filterHash.getReverse() + prevHeader.getReverse()).getReverse();
+}
+
+std::vector<uchar_vector> GolombFilter::getBasicFilterElements(const CoinBlock& block, const std::vector<uchar_vector>& prevOutScripts)
+{
+    std::vector<uchar_vector> elements;
+    for (auto& tx: block.txs)
+    {
+        for (auto& txOut: tx.outputs)
+        {
+            const uchar_vector& script = txOut.scriptPubKey;
+            if (script.empty() || script[0] == 0x6a) continue; // OP_RETURN
+            elements.push_back(script);
+        }
+    }
+
+    for (auto& script: prevOutScripts) { if (!script.empty()) elements.push_back(script); }
+    return elements;
+}
+
+uint64_t GolombFilter::hashElement(const uchar_vector& element) const
+{
+    uint64_t hash = sipHash(k0_, k1_, element.empty() ? NULL : &element[0], element.size());
+    return map_into_range(hash, (uint64_t)n_ * m_);
+}
+
+void GolombFilter::setKey(const uchar_vector& blockHash)
+{
+    if (blockHash.size() != 32) throw std::runtime_error("GolombFilter - invalid block hash.");
+
+    uchar_vector key = blockHash.getReverse();
+    k0_ = read_le64(&key[0]);
+    k1_ = read_le64(&key[8]);
+}
@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GolombFilter.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#ifndef GOLOMB_FILTER_H__
+#define GOLOMB_FILTER_H__
+
+#include <stdutils/uchar_vector.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace Coin {
+
+class CoinBlock;
+
+// Golomb-coded set filters as used by BIP158 compact block filters.
+//
+// Elements are hashed with SipHash-2-4 keyed by the first 16 bytes of the
+// block hash into [0, N*M), sorted, and the differences Golomb-Rice coded with
+// parameter P. Matching never gives false negatives; false positives happen
+// at a rate of about 1/M per queried element.
+//
+// Block and filter hashes are passed in the byte order used elsewhere for
+// block hashes (reversed from the wire), as returned by hash().
+class GolombFilter
+{
+public:
+    static const uint8_t BASIC_FILTER_TYPE = 0;
+    static const uint8_t BASIC_P = 19;
+    static const uint64_t BASIC_M = 784931;
+
+    GolombFilter() : p_(BASIC_P), m_(BASIC_M), n_(0), k0_(0), k1_(0), encoded_(1, 0), dataOffset_(1) { }
+
+    // Builds a filter from elements. Duplicates and empty elements are ignored.
+    GolombFilter(const uchar_vector& blockHash, const std::vector<uchar_vector>& elements, uint8_t p = BASIC_P, uint64_t m = BASIC_M);
+
+    // Wraps a serialized filter as received in a cfilter message.
+    GolombFilter(const uchar_vector& blockHash, const uchar_vector& encoded, uint8_t p = BASIC_P, uint64_t m = BASIC_M);
+
+    uint32_t getN() const { return n_; }
+    const uchar_vector& getEncoded() const { return encoded_; }
+
+    bool match(const uchar_vector& element) const;
+    bool matchAny(const std::vector<uchar_vector>& elements) const;
+
+    // Hashes elements into this filter's range for matchAnyHashed. Lets a caller
+    // reuse one buffer across many filters.
+    void hashElements(const std::vector<uchar_vector>& elements, std::vector<uint64_t>& hashed) const;
+
+    // Decodes the filter once into a sorted set indexed by the top bits of each value,
+    // then looks up every query in constant time. Queries need not be sorted, so
+    // matching many thousands of scripts costs little more than hashing them.
+    bool matchAnyHashed(const std::vector<uint64_t>& hashed) const;
+
+    // Decodes all hashed values in the filter, sorted.
+    std::vector<uint64_t> decode() const;
+
+    uchar_vector getHash() const;
+    uchar_vector getHeader(const uchar_vector& prevHeader) const { return getHeaderFromHash(getHash(), prevHeader); }
+
+    // Filter header chaining as in BIP157, given only the filter hash as sent in cfheaders.
+    static uchar_vector getHeaderFromHash(const uchar_vector& filterHash, const uchar_vector& prevHeader);
+
+    // The basic filter of a block: all output scripts except empty and OP_RETURN ones,
+    // and the scripts of all outputs spent by the block, passed in prevOutScripts.
+    static std::vector<uchar_vector> getBasicFilterElements(const CoinBlock& block, const std::vector<uchar_vector>& prevOutScripts);
+
+    static uint64_t sipHash(uint64_t k0, uint64_t k1, const unsigned char* data, size_t len);
+
+private:
+    uint64_t hashElement(const uchar_vector& element) const;
+    void setKey(const uchar_vector& blockHash);
+
+    uint8_t p_;
+    uint64_t m_;
+    uint32_t n_;
+    uint64_t k0_;
+    uint64_t k1_;
+    uchar_vector encoded_;  // CompactSize N followed by the bit stream
+    size_t dataOffset_;     // start of the bit stream in encoded_
+};
+
+} // namespace Coin
+
+#endif // GOLOMB_FILTER_H__
@@ -80,16 +80,19 @@ inline uchar_vector sha1(const uchar_vector& data)
     return rval;
 }
 
+// HMAC() writes to a static buffer when given none, so pass our own to stay thread safe.
 inline uchar_vector hmac_sha256(const uchar_vector& key, const uchar_vector& data)
 {
-    unsigned char* digest = HMAC(EVP_sha256(), (unsigned char*)&key[0], key.size(), (unsigned char*)&data[0], data.size(), NULL, NULL);
-    return uchar_vector(digest, 32);
+    uchar_vector digest(32);
+    HMAC(EVP_sha256(), (unsigned char*)&key[0], key.size(), (unsigned char*)&data[0], data.size(), &digest[0], NULL);
+    return digest;
 }
 
 inline uchar_vector hmac_sha512(const uchar_vector& key, const uchar_vector& data)
 {
-    unsigned char* digest = HMAC(EVP_sha512(), (unsigned char*)&key[0], key.size(), (unsigned char*)&data[0], data.size(), NULL, NULL);
-    return uchar_vector(digest, 64);
+    uchar_vector digest(64);
+    HMAC(EVP_sha512(), (unsigned char*)&key[0], key.size(), (unsigned char*)&data[0], data.size(), &digest[0], NULL);
+    return digest;
 }
 
 inline uchar_vector hash9(const uchar_vector& data)
@@ -0,0 +1,117 @@
+#include <Base58Check.h>
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+
+// The BIGNUM based conversion the codec replaced.
+string referenceBase58(const uchar_vector& data, const char* base58chars)
+{
+    string leading0s(countLeading0s(data), base58chars[0]);
+    unsigned int zeros = countLeading0s(data);
+    if (zeros == data.size()) return leading0s;
+    return leading0s + BigInt(data).getInBase(58, base58chars);
+}
+
+uchar_vector randomData(size_t size)
+{
+    uchar_vector data(size);
+    size_t zeros = rand() % 4 == 0 ? rand() % 4 : 0;
+    for (size_t i = 0; i < size; i++) { data[i] = i < zeros ? 0 : rand() & 0xff; }
+    return data;
+}
+
+unsigned int g_failures = 0;
+
+void check(bool condition, const string& description)
+{
+    if (condition) return;
+    cout << "FAILED: " << description << endl;
+    g_failures++;
+}
+
+}
+
+int main()
+{
+    // From bitcoin core's base58_encode_decode.json
+    const char* vectors[][2] = {
+        { "", "" },
+        { "61", "2g" },
+        { "626262", "a3gV" },
+        { "636363", "aPEr" },
+        { "73696d706c792061206c6f6e6720737472696e67", "2cFupjhnEsSn59qHXstmK2ffpLv2" },
+        { "00eb15231dfceb60925886b67d065299925915aeb172c06647", "1NS17iag9jJgTHD1VXjvLCEnZuQ3rJDE9L" },
+        { "516b6fcd0f", "ABnLTmg" },
+        { "bf4f89001e670274dd", "3SEo3LWLoPntC" },
+        { "572e4794", "3EFU7m" },
+        { "ecac89cad93923c02321", "EJDM8drfXA6uyA" },
+        { "10c8511e", "Rt5zm" },
+        { "00000000000000000000", "1111111111" }
+    };
+
+    for (auto& vector: vectors)
+    {
+        uchar_vector data(vector[0]);
+        check(toBase58(data) == vector[1], string("encode ") + vector[0]);
+
+        std::vector<unsigned char> decoded;
+        fromBase58(vector[1], decoded);
+        check(uchar_vector(decoded) == data, string("decode ") + vector[1]);
+    }
+
+    srand(1);
+    const char* alphabets[] = { BITCOIN_BASE58_CHARS, RIPPLE_BASE58_CHARS };
+    for (auto alphabet: alphabets)
+    {
+        for (unsigned int i = 0; i < 2000; i++)
+        {
+            // Past BASE58_STACK_BYTES now and then to cover the heap buffers.
+            uchar_vector data = randomData(i % 10 == 0 ? rand() % 300 : rand() % 90);
+            string base58 = toBase58(data, alphabet);
+            check(base58 == referenceBase58(data, alphabet), "encode " + data.getHex());
+
+            std::vector<unsigned char> decoded;
+            fromBase58(base58, decoded, alphabet);
+            check(uchar_vector(decoded) == data, "decode " + base58);
+
+            unsigned char version = data.empty() ? 0 : data[0];
+            string base58check = toBase58Check(data, version, alphabet);
+            uchar_vector payload;
+            unsigned int decodedVersion;
+            check(fromBase58Check(base58check, payload, decodedVersion, alphabet) && payload == data && decodedVersion == version, "base58check " + base58check);
+        }
+    }
+
+    // Checksums
+    uchar_vector hash("eb15231dfceb60925886b67d065299925915aeb1");
+    string address = toBase58Check(hash, 0);
+    uchar_vector data = uchar_vector("00") + hash;
+    uchar_vector checksum = sha256_2(data);
+    data += uchar_vector(checksum.begin(), checksum.begin() + 4);
+    check(address == referenceBase58(data, DEFAULT_BASE58_CHARS), "address " + address);
+    check(isBase58CheckValid(address), "valid " + address);
+
+    string corrupted = address;
+    corrupted[10] = corrupted[10] == 'a' ? 'b' : 'a';
+    uchar_vector payload;
+    unsigned int version;
+    check(!isBase58CheckValid(corrupted) && !fromBase58Check(corrupted, payload, version) && payload.empty(), "corrupted " + corrupted);
+    check(!isBase58CheckValid("") && !isBase58CheckValid("1"), "too short");
+
+    // Characters outside the alphabet are skipped.
+    check(fromBase58Check(address + " \n", payload, version) && payload == hash && version == 0, "whitespace");
+
+    if (g_failures)
+    {
+        cout << g_failures << " failure(s)." << endl;
+        return 1;
+    }
+
+    cout << "OK" << endl;
+    return 0;
+}
@@ -0,0 +1,293 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// bench.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// Microbenchmarks for CoinCore primitives.
+//
+// Each benchmark is repeated until it has run for at least --mintime
+// milliseconds, and the time per call is reported as JSON. Given a baseline
+// written by an earlier run, each result also shows its change from it.
+//
+
+#include <CoinNodeData.h>
+#include <MerkleTree.h>
+#include <BloomFilter.h>
+#include <hdkeys.h>
+#include <secp256k1_openssl.h>
+#include <Base58Check.h>
+#include <hash.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace Coin;
+using namespace CoinCrypto;
+using namespace std;
+
+namespace
+{
+
+struct Result
+{
+    string name;
+    uint64_t iterations;
+    double nsPerOp;
+};
+
+// Keeps the compiler from dropping work whose result is unused.
+volatile size_t g_sink = 0;
+
+unsigned int g_minTime = 200; // milliseconds
+string g_filter;
+vector<Result> g_results;
+
+void bench(const string& name, function<void()> op)
+{
+    if (!g_filter.empty() && name.find(g_filter) == string::npos) return;
+
+    op(); // warm up
+
+    // Double the batch size until a batch takes long enough to time reliably.
+    uint64_t iterations = 1;
+    while (true)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; i++) { op(); }
+        uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+        if (ns >= g_minTime * 1000000ull)
+        {
+            g_results.push_back(Result{ name, iterations, (double)ns / iterations });
+            cerr << "  " << left << setw(40) << name << right << setw(14) << fixed << setprecision(1) << (double)ns / iterations << " ns/op" << endl;
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+// Reads ns_per_op for each name out of the JSON written by writeResults.
+map<string, double> readBaseline(const string& filename)
+{
+    ifstream file(filename);
+    if (!file.good()) throw runtime_error("Failed to open baseline " + filename + ".");
+
+    stringstream ss;
+    ss << file.rdbuf();
+    string json = ss.str();
+
+    map<string, double> baseline;
+    const string NAME = "\"name\": \"";
+    const string NS_PER_OP = "\"ns_per_op\": ";
+    size_t pos = 0;
+    while ((pos = json.find(NAME, pos)) != string::npos)
+    {
+        pos += NAME.size();
+        size_t end = json.find('"', pos);
+        size_t value = json.find(NS_PER_OP, end);
+        if (end == string::npos || value == string::npos) break;
+        baseline[json.substr(pos, end - pos)] = strtod(json.c_str() + value + NS_PER_OP.size(), NULL);
+        pos = value;
+    }
+    return baseline;
+}
+
+void writeResults(ostream& os, const map<string, double>& baseline)
+{
+    os << "{" << endl << "    \"benchmarks\": [" << endl;
+    for (size_t i = 0; i < g_results.size(); i++)
+    {
+        const Result& result = g_results[i];
+        os << "        { \"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+           << ", \"ns_per_op\": " << fixed << setprecision(1) << result.nsPerOp;
+
+        auto it = baseline.find(result.name);
+        if (it != baseline.end() && it->second > 0)
+        {
+            // Relative change in time per op, so negative is faster.
+            os << ", \"baseline_ns_per_op\": " << it->second
+               << ", \"change\": " << setprecision(4) << (result.nsPerOp - it->second) / it->second;
+        }
+        os << " }" << (i + 1 < g_results.size() ? "," : "") << endl;
+    }
+    os << "    ]" << endl << "}" << endl;
+}
+
+void showChanges(const map<string, double>& baseline)
+{
+    cerr << endl << "Change from baseline (negative is faster)" << endl;
+    for (auto& result: g_results)
+    {
+        auto it = baseline.find(result.name);
+        cerr << "  " << left << setw(40) << result.name << right;
+        if (it == baseline.end() || it->second <= 0) { cerr << setw(14) << "new" << endl; continue; }
+        cerr << setw(13) << showpos << fixed << setprecision(1) << 100.0 * (result.nsPerOp - it->second) / it->second << "%" << noshowpos << endl;
+    }
+}
+
+uchar_vector bytes(size_t size, unsigned char seed)
+{
+    uchar_vector data(size);
+    for (size_t i = 0; i < size; i++) { data[i] = (unsigned char)(seed + i * 31); }
+    return data;
+}
+
+// A two input, two output pay to pubkey hash transaction.
+Transaction makeTx(unsigned int n)
+{
+    Transaction tx;
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        tx.inputs.push_back(TxIn(OutPoint(bytes(32, n + i), i), bytes(107, n), 0xffffffff));
+    }
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        uchar_vector script("76a914");
+        script += bytes(20, n * 2 + i);
+        script += uchar_vector("88ac");
+        tx.outputs.push_back(TxOut(100000 * (n + 1), script));
+    }
+    return tx;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    string baselineFile;
+    string outFile;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg(argv[i]);
+        if (arg.find("--mintime=") == 0)        { g_minTime = strtoul(arg.c_str() + 10, NULL, 10); }
+        else if (arg.find("--filter=") == 0)    { g_filter = arg.substr(9); }
+        else if (arg.find("--baseline=") == 0)  { baselineFile = arg.substr(11); }
+        else if (arg.find("--out=") == 0)       { outFile = arg.substr(6); }
+        else
+        {
+            cerr << "# Usage: " << argv[0] << " [--mintime=<ms>] [--filter=<substring>] [--baseline=<json file>] [--out=<json file>]" << endl;
+            return -1;
+        }
+    }
+
+    try
+    {
+        map<string, double> baseline;
+        if (!baselineFile.empty()) { baseline = readBaseline(baselineFile); }
+
+        cerr << "Running benchmarks..." << endl;
+
+        // Serialization
+        Transaction tx = makeTx(1);
+        uchar_vector txBytes = tx.getSerialized();
+        bench("tx.serialize", [&]() { g_sink += tx.getSerialized().size(); });
+        bench("tx.deserialize", [&]() { Transaction t(txBytes); g_sink += t.inputs.size(); });
+        bench("tx.hash", [&]() { g_sink += tx.hash()[0]; });
+
+        CoinBlock block;
+        block.blockHeader = CoinBlockHeader(1, bytes(32, 1), g_zero32bytes, 1231006505, 0x1d00ffff, 0);
+        for (unsigned int i = 0; i < 1000; i++) { block.txs.push_back(makeTx(i)); }
+        block.updateMerkleRoot();
+        uchar_vector blockBytes = block.getSerialized();
+        bench("block.serialize.1000tx", [&]() { g_sink += block.getSerialized().size(); });
+        bench("block.deserialize.1000tx", [&]() { CoinBlock b(blockBytes); g_sink += b.txs.size(); });
+
+        // Hashes
+        uchar_vector header = block.blockHeader.getSerialized();
+        uchar_vector kilobyte = bytes(1024, 2);
+        uchar_vector pubkey = bytes(33, 2);
+        bench("sha256_2.80B", [&]() { g_sink += sha256_2(header)[0]; });
+        bench("sha256_2.1KB", [&]() { g_sink += sha256_2(kilobyte)[0]; });
+        bench("hash160.33B", [&]() { g_sink += hash160(pubkey)[0]; });
+        bench("hash9.80B", [&]() { g_sink += hash9(header)[0]; });
+        bench("scrypt_1024_1_1_256.80B", [&]() { g_sink += scrypt_1024_1_1_256(header)[0]; });
+
+        // Merkle trees
+        vector<uchar_vector> txHashes;
+        for (auto& t: block.txs) { txHashes.push_back(t.hash()); }
+        MerkleTree merkleTree(txHashes);
+        bench("merkletree.getRoot.1000tx", [&]() { g_sink += merkleTree.getRoot()[0]; });
+
+        vector<MerkleLeaf> leaves;
+        for (size_t i = 0; i < txHashes.size(); i++) { leaves.push_back(MerkleLeaf(txHashes[i], i % 100 == 0)); }
+        PartialMerkleTree partialTree(leaves);
+        vector<uchar_vector> partialHashes = partialTree.getMerkleHashesVector();
+        uchar_vector partialFlags = partialTree.getFlags();
+        bench("partialmerkletree.setCompressed.1000tx", [&]()
+        {
+            PartialMerkleTree tree;
+            tree.setCompressed(partialTree.getNTxs(), partialHashes, partialFlags);
+            g_sink += tree.getTxHashes().size();
+        });
+
+        // BIP32
+        HDSeed seed(bytes(32, 3));
+        HDKeychain prv(seed.getMasterKey(), seed.getMasterChainCode());
+        HDKeychain pub = prv.getPublic();
+        uint32_t child = 0;
+        bench("hdkeychain.getChild.private", [&]() { g_sink += prv.getChild(child++ & 0x7fffffff).depth(); });
+        bench("hdkeychain.getChild.public", [&]() { g_sink += pub.getChild(child++ & 0x7fffffff).depth(); });
+
+        // ECDSA
+        secp256k1_key key;
+        key.newKey();
+        uchar_vector digest = sha256_2(txBytes);
+        bytes_t signature = secp256k1_sign(key, digest);
+        bench("secp256k1_sign", [&]() { g_sink += secp256k1_sign(key, digest).size(); });
+        bench("secp256k1_verify", [&]() { g_sink += secp256k1_verify(key, digest, signature); });
+
+        // Bloom filters
+        vector<uchar_vector> elements;
+        for (unsigned int i = 0; i < 1000; i++) { elements.push_back(bytes(20, i)); }
+        BloomFilter filter(elements.size(), 0.001, 0, 0);
+        size_t element = 0;
+        bench("bloomfilter.insert.20B", [&]() { filter.insert(elements[element++ % elements.size()]); });
+        uchar_vector miss = bytes(20, 0xff);
+        bench("bloomfilter.match.hit", [&]() { g_sink += filter.match(elements[element++ % elements.size()]); });
+        bench("bloomfilter.match.miss", [&]() { g_sink += filter.match(miss); });
+
+        // Base58Check
+        uchar_vector payload = bytes(20, 4);
+        string address = toBase58Check(payload, 0);
+        bench("base58check.encode.address", [&]() { g_sink += toBase58Check(payload, 0).size(); });
+        bench("base58check.decode.address", [&]()
+        {
+            bytes_t decoded;
+            unsigned int version;
+            g_sink += fromBase58Check(address, decoded, version);
+        });
+
+        if (!baseline.empty()) { showChanges(baseline); }
+
+        if (outFile.empty())
+        {
+            writeResults(cout, baseline);
+        }
+        else
+        {
+            ofstream out(outFile);
+            writeResults(out, baseline);
+            if (!out.good()) throw runtime_error("Failed to write " + outFile + ".");
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// golombfilter_test.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// Checks GolombFilter against the SipHash-2-4 reference vector and the
+// BIP158 testnet vectors, then round trips larger random filters.
+//
+
+#include "GolombFilter.h"
+#include "CoinNodeData.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+using namespace Coin;
+using namespace std;
+
+static unsigned int failures = 0;
+
+static void check(const string& name, bool ok)
+{
+    cout << "  " << name << (ok ? " OK" : " FAILED") << endl;
+    if (!ok) failures++;
+}
+
+static void checkHex(const string& name, const uchar_vector& actual, const string& expected)
+{
+    cout << "  " << name << ": " << actual.getHex();
+    if (actual == uchar_vector(expected))
+    {
+        cout << " OK" << endl;
+    }
+    else
+    {
+        cout << " FAILED (expected " << expected << ")" << endl;
+        failures++;
+    }
+}
+
+static std::mt19937_64 g_rng(158);
+
+static uchar_vector randomBytes(size_t size)
+{
+    uchar_vector data(size);
+    for (auto& byte: data) { byte = (unsigned char)g_rng(); }
+    return data;
+}
+
+static void testSipHash()
+{
+    cout << "SipHash-2-4" << endl;
+
+    // Reference vector from the SipHash paper: key 00..0f, message 00..0e
+    unsigned char message[15];
+    for (int i = 0; i < 15; i++) { message[i] = i; }
+    uint64_t hash = GolombFilter::sipHash(0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL, message, sizeof(message));
+    check("15-byte message", hash == 0xa129ca6149be45e5ULL);
+}
+
+static void testVectors()
+{
+    cout << "BIP158 testnet vectors" << endl;
+
+    // Block 0: the genesis coinbase output is the only element
+    uchar_vector genesisHash("000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943");
+    uchar_vector genesisScript("4104678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac");
+    GolombFilter genesis(genesisHash, std::vector<uchar_vector>(1, genesisScript));
+    checkHex("block 0 filter", genesis.getEncoded(), "019dfca8");
+    checkHex("block 0 header", genesis.getHeader(uchar_vector(32, 0)), "21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750");
+    check("block 0 matches its script", genesis.match(genesisScript));
+    check("block 0 rejects another script", !genesis.match(uchar_vector("76a914000000000000000000000000000000000000000088ac")));
+
+    GolombFilter parsed(genesisHash, uchar_vector("019dfca8"));
+    check("parsed block 0 has one element", parsed.getN() == 1);
+    check("parsed block 0 matches its script", parsed.match(genesisScript));
+
+    // Blocks 2 and 3: filters as served, chained onto the previous headers
+    GolombFilter block2(uchar_vector("000000006c02c8ea6e4ff69651f7fcde348fb9d557a06e6957b65552002a7820"), uchar_vector("0174a170"));
+    checkHex("block 2 header", block2.getHeader(uchar_vector("d7bdac13a59d745b1add0d2ce852f1a0442e8945fc1bf3848d3cbffd88c24fe1")), "186afd11ef2b5e7e3504f2e8cbf8df28a1fd251fe53d60dff8b1467d1b386cf0");
+    checkHex("block 2 header from hash", GolombFilter::getHeaderFromHash(block2.getHash(), uchar_vector("d7bdac13a59d745b1add0d2ce852f1a0442e8945fc1bf3848d3cbffd88c24fe1")), "186afd11ef2b5e7e3504f2e8cbf8df28a1fd251fe53d60dff8b1467d1b386cf0");
+
+    GolombFilter block3(uchar_vector("000000008b896e272758da5297bcd98fdc6d97c9b765ecec401e286dc1fdbe10"), uchar_vector("016cf7a0"));
+    checkHex("block 3 header", block3.getHeader(uchar_vector("186afd11ef2b5e7e3504f2e8cbf8df28a1fd251fe53d60dff8b1467d1b386cf0")), "8d63aadf5ab7257cb6d2316a57b16f517bff1c6388f124ec4c04af1212729d2a");
+}
+
+static void testEmpty()
+{
+    cout << "empty filter" << endl;
+
+    uchar_vector blockHash = randomBytes(32);
+    GolombFilter empty(blockHash, std::vector<uchar_vector>());
+    checkHex("encoding", empty.getEncoded(), "00");
+    check("matches nothing", !empty.match(randomBytes(25)) && !empty.matchAny(std::vector<uchar_vector>(1, randomBytes(25))));
+
+    // Empty elements are not added
+    GolombFilter onlyEmpty(blockHash, std::vector<uchar_vector>(3, uchar_vector()));
+    check("empty elements ignored", onlyEmpty.getN() == 0);
+}
+
+static void testBasicFilterElements()
+{
+    cout << "basic filter elements" << endl;
+
+    Transaction tx;
+    tx.outputs.push_back(TxOut(1000, uchar_vector("76a914111111111111111111111111111111111111111188ac")));
+    tx.outputs.push_back(TxOut(0, uchar_vector("6a0401020304")));    // OP_RETURN
+    tx.outputs.push_back(TxOut(0, uchar_vector()));                 // empty
+    tx.outputs.push_back(TxOut(2000, uchar_vector("a914222222222222222222222222222222222222222287")));
+
+    CoinBlock block;
+    block.txs.push_back(tx);
+
+    std::vector<uchar_vector> prevOutScripts;
+    prevOutScripts.push_back(uchar_vector("0020" + uchar_vector(32, 0x33).getHex()));
+    prevOutScripts.push_back(uchar_vector());
+
+    std::vector<uchar_vector> elements = GolombFilter::getBasicFilterElements(block, prevOutScripts);
+    check("output and spent scripts only", elements.size() == 3);
+    check("op_return skipped", std::find(elements.begin(), elements.end(), uchar_vector("6a0401020304")) == elements.end());
+    check("spent script included", std::find(elements.begin(), elements.end(), prevOutScripts[0]) != elements.end());
+}
+
+static void testRoundTrip()
+{
+    cout << "round trip" << endl;
+
+    uchar_vector blockHash = randomBytes(32);
+    std::vector<uchar_vector> elements;
+    for (int i = 0; i < 3000; i++) { elements.push_back(randomBytes(25)); }
+
+    GolombFilter built(blockHash, elements);
+    GolombFilter parsed(blockHash, built.getEncoded());
+    check("element count", parsed.getN() == elements.size());
+    check("decoded count", parsed.decode().size() == elements.size());
+
+    bool allMatch = true;
+    for (auto& element: elements) { if (!parsed.match(element)) allMatch = false; }
+    check("every element matches", allMatch);
+
+    // Duplicates do not change the filter
+    std::vector<uchar_vector> doubled(elements);
+    doubled.insert(doubled.end(), elements.begin(), elements.begin() + 100);
+    check("duplicates ignored", GolombFilter(blockHash, doubled).getEncoded() == built.getEncoded());
+
+    // With M = 784931 a false positive is about 1 in 784931 per query
+    std::vector<uchar_vector> queries;
+    for (int i = 0; i < 100000; i++) { queries.push_back(randomBytes(25)); }
+    unsigned int falsePositives = 0;
+    for (auto& query: queries) { if (parsed.match(query)) falsePositives++; }
+    cout << "  false positives: " << falsePositives << " of " << queries.size() << endl;
+    check("false positive rate", falsePositives <= 5);
+
+    queries.push_back(elements[1234]);
+    check("matchAny finds one member among many", parsed.matchAny(queries));
+
+    std::vector<uint64_t> hashed;
+    parsed.hashElements(queries, hashed);
+    check("matchAnyHashed agrees", parsed.matchAnyHashed(hashed));
+
+    // A different block hash keys a different filter
+    GolombFilter otherKey(randomBytes(32), built.getEncoded());
+    unsigned int stillMatching = 0;
+    for (int i = 0; i < 100; i++) { if (otherKey.match(elements[i])) stillMatching++; }
+    check("filters are keyed by block hash", stillMatching < 5);
+
+    bool threw = false;
+    try { GolombFilter bad(uchar_vector(31, 0), elements); } catch (const std::exception&) { threw = true; }
+    check("rejects a short block hash", threw);
+}
+
+int main()
+{
+    try
+    {
+        testSipHash();
+        testVectors();
+        testEmpty();
+        testBasicFilterElements();
+        testRoundTrip();
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+
+    if (failures)
+    {
+        cout << failures << " check(s) failed." << endl;
+        return 1;
+    }
+
+    cout << "All checks passed." << endl;
+    return 0;
+}
@@ -0,0 +1,102 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// secp256k1_parallel_test.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// Signs the same hashes on one thread and then on several at once with
+// RFC 6979 nonces, and checks the signatures are identical and valid.
+//
+
+#include <CoinCore/secp256k1_openssl.h>
+#include <CoinCore/hash.h>
+#include <stdutils/uchar_vector.h>
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace CoinCrypto;
+using namespace std;
+
+const size_t SIGNATURES = 2000;
+const size_t KEYS = 50;
+const unsigned int THREADS = 8;
+
+static uchar_vector toBytes(const string& str)
+{
+    return uchar_vector(str.begin(), str.end());
+}
+
+int main()
+{
+    try
+    {
+        vector<bytes_t> privkeys;
+        for (size_t i = 0; i < KEYS; i++) { privkeys.push_back(sha256(toBytes("key " + to_string(i)))); }
+
+        vector<bytes_t> hashes;
+        for (size_t i = 0; i < SIGNATURES; i++) { hashes.push_back(sha256(toBytes("message " + to_string(i)))); }
+
+        cout << "Signing " << SIGNATURES << " hashes on one thread..." << flush;
+        vector<bytes_t> serial(SIGNATURES);
+        for (size_t i = 0; i < SIGNATURES; i++)
+        {
+            secp256k1_key key;
+            key.setPrivKey(privkeys[i % KEYS]);
+            serial[i] = secp256k1_sign_rfc6979(key, hashes[i]);
+        }
+        cout << "done." << endl;
+
+        cout << "Signing " << SIGNATURES << " hashes on " << THREADS << " threads..." << flush;
+        vector<bytes_t> parallel(SIGNATURES);
+        atomic<size_t> next(0);
+        vector<thread> threads;
+        for (unsigned int t = 0; t < THREADS; t++)
+        {
+            threads.push_back(thread([&]()
+            {
+                size_t i;
+                while ((i = next.fetch_add(1)) < SIGNATURES)
+                {
+                    secp256k1_key key;
+                    key.setPrivKey(privkeys[i % KEYS]);
+                    parallel[i] = secp256k1_sign_rfc6979(key, hashes[i]);
+                }
+            }));
+        }
+        for (auto& t: threads) { t.join(); }
+        cout << "done." << endl;
+
+        size_t mismatched = 0;
+        size_t invalid = 0;
+        for (size_t i = 0; i < SIGNATURES; i++)
+        {
+            if (parallel[i] != serial[i])
+            {
+                cout << "Signature " << i << " differs:" << endl << "  " << uchar_vector(serial[i]).getHex() << endl << "  " << uchar_vector(parallel[i]).getHex() << endl;
+                mismatched++;
+            }
+
+            secp256k1_key key;
+            key.setPrivKey(privkeys[i % KEYS]);
+            if (!secp256k1_verify(key, hashes[i], parallel[i])) { invalid++; }
+        }
+
+        cout << "Mismatched: " << mismatched << ", invalid: " << invalid << endl;
+        if (mismatched || invalid) return 1;
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -2;
+    }
+
+    cout << "All signatures match." << endl;
+    return 0;
+}
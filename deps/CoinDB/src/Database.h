@@ -17,6 +17,8 @@
 
 #include <string>
 #include <memory>   // std::unique_ptr
+#include <utility>  // std::move
+#include <cstddef>
 #include <cstdlib>  // std::exit
 #include <iostream>
 
@@ -27,11 +29,17 @@
 #  include <odb/transaction.hxx>
 #  include <odb/schema-catalog.hxx>
 #  include <odb/mysql/database.hxx>
+#  include <odb/mysql/connection-factory.hxx>
+#  include <odb/mysql/statement.hxx>
+#  include <odb/mysql/transaction.hxx>
 #elif defined(DATABASE_SQLITE)
 #  include <odb/connection.hxx>
 #  include <odb/transaction.hxx>
 #  include <odb/schema-catalog.hxx>
 #  include <odb/sqlite/database.hxx>
+#  include <odb/sqlite/connection-factory.hxx>
+#  include <odb/sqlite/statement.hxx>
+#  include <odb/sqlite/transaction.hxx>
 #elif defined(DATABASE_PGSQL)
 #  include <odb/pgsql/database.hxx>
 #elif defined(DATABASE_ORACLE)
@@ -45,6 +53,35 @@
 namespace CoinDB
 {
 
+// Each concurrent read runs its transaction on its own pooled connection.
+//
+// Within one Vault, the vault's shared_mutex still orders reads against writes:
+// read-only calls hold it shared and may overlap each other, but a write holds
+// it exclusively and so waits for running reads and holds off new ones. Only
+// VaultSnapshot reads, which skip that lock, and other processes sharing the
+// file overlap a write at the database level.
+const std::size_t DEFAULT_MAX_DB_CONNECTIONS = 8;
+
+#if defined(DATABASE_SQLITE)
+// The odb pool opens connections in sqlite shared-cache mode unless told
+// otherwise. Shared-cache connections use table-level locks within the cache
+// and ignore WAL snapshots between each other, so a reader would wait on (or
+// fail with SQLITE_LOCKED against) a writer in the same process. Each pooled
+// connection gets a private cache instead.
+const int SQLITE_POOL_OPEN_FLAGS = SQLITE_OPEN_PRIVATECACHE;
+
+// In WAL mode a read transaction sees a consistent snapshot as of its first
+// statement and takes no lock that a writer on another connection has to wait
+// for, or that has to wait for one. A long-lived reader does keep checkpoints
+// from resetting the log. The journal mode is persistent so this only does
+// work the first time.
+inline void enableWriteAheadLog(odb::database& db)
+{
+    odb::connection_ptr c(db.connection());
+    c->execute("PRAGMA journal_mode=WAL");
+}
+#endif
+
 inline std::unique_ptr<odb::database>
 open_database (int& argc, char* argv[], bool create = false)
 {
@@ -74,9 +111,11 @@ open_database (int& argc, char* argv[], bool create = false)
 #if defined(DATABASE_MYSQL)
   unique_ptr<database> db (new odb::mysql::database (argc, argv));
 #elif defined(DATABASE_SQLITE)
+  unique_ptr<odb::sqlite::connection_factory> f (
+    new odb::sqlite::connection_pool_factory (DEFAULT_MAX_DB_CONNECTIONS));
   unique_ptr<database> db (
     new odb::sqlite::database (
-      argc, argv, false, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE));
+      argc, argv, false, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_POOL_OPEN_FLAGS, true, "", std::move (f)));
 
   // Create the database schema. Due to bugs in SQLite foreign key
   // support for DDL statements, we need to temporarily disable
@@ -93,6 +132,8 @@ open_database (int& argc, char* argv[], bool create = false)
 
         c->execute ("PRAGMA foreign_keys=ON");
     }
+
+    enableWriteAheadLog (*db);
 #elif defined(DATABASE_PGSQL)
   unique_ptr<database> db (new odb::pgsql::database (argc, argv));
 #elif defined(DATABASE_ORACLE)
@@ -105,16 +146,18 @@ open_database (int& argc, char* argv[], bool create = false)
 }
 
 inline std::unique_ptr<odb::database>
-openDatabase(const std::string& user, const std::string& passwd, const std::string& dbname, bool create = false)
+openDatabase(const std::string& user, const std::string& passwd, const std::string& dbname, bool create = false, std::size_t max_connections = DEFAULT_MAX_DB_CONNECTIONS)
 {
     using namespace odb::core;
 
 #if defined(DATABASE_MYSQL)
-    std::unique_ptr<odb::database> db(new odb::mysql::database(user, passwd, dbname));
+    std::unique_ptr<odb::mysql::connection_factory> factory(new odb::mysql::connection_pool_factory(max_connections));
+    std::unique_ptr<odb::database> db(new odb::mysql::database(user, passwd, dbname, "", 0, 0, "", 0, std::move(factory)));
 #elif defined(DATABASE_SQLITE)
-    int flags = SQLITE_OPEN_READWRITE;
+    int flags = SQLITE_OPEN_READWRITE | SQLITE_POOL_OPEN_FLAGS;
     if (create) flags |= SQLITE_OPEN_CREATE;
-    std::unique_ptr<database> db(new odb::sqlite::database(dbname, flags, false));
+    std::unique_ptr<odb::sqlite::connection_factory> factory(new odb::sqlite::connection_pool_factory(max_connections));
+    std::unique_ptr<database> db(new odb::sqlite::database(dbname, flags, false, "", std::move(factory)));
 #endif
 
   // Create the database schema. Due to bugs in SQLite foreign key
@@ -138,7 +181,45 @@ openDatabase(const std::string& user, const std::string& passwd, const std::stri
 #endif
     }
 
+#if defined(DATABASE_SQLITE)
+    enableWriteAheadLog(*db);
+#endif
+
     return db;
 }
 
+#if defined(DATABASE_MYSQL) || defined(DATABASE_SQLITE)
+// Runs "UPDATE <table of T> SET <assignments>" as a single statement in the current
+// transaction, the way erase_query() runs a DELETE. The assignments are a query so that
+// columns come from the generated query columns and values bind as parameters, and they
+// normally end with "WHERE" and a condition. SQLite does not accept a table-qualified
+// column to the left of "=", so write that one with column(). Objects already in the
+// session are not refreshed. Returns the number of rows changed.
+template <typename T>
+unsigned long long update_query(const odb::query<T>& assignments)
+{
+#if defined(DATABASE_MYSQL)
+    namespace backend = odb::mysql;
+    typedef odb::access::object_traits_impl<T, odb::id_mysql> object_traits;
+#else
+    namespace backend = odb::sqlite;
+    typedef odb::access::object_traits_impl<T, odb::id_sqlite> object_traits;
+#endif
+
+    // clause() takes a query that does not open with a keyword for a condition and puts WHERE in front of it.
+    std::string clause(assignments.clause());
+    if (clause.compare(0, 6, "WHERE ") == 0) { clause.erase(0, 6); }
+
+    std::string text("UPDATE ");
+    text += object_traits::table_name;
+    text += " SET ";
+    text += clause;
+
+    assignments.init_parameters();
+    backend::connection& conn(backend::transaction::current().connection());
+    backend::update_statement st(conn, text, false, assignments.parameters_binding());
+    return st.execute();
+}
+#endif
+
 }
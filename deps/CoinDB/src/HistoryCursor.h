@@ -0,0 +1,118 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// HistoryCursor.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include "Schema.h"
+
+#include <stdutils/uchar_vector.h>
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <string>
+
+namespace CoinDB
+{
+
+// Filters applied by the database for paged history queries.
+// Empty names and zero timestamps mean no restriction.
+struct HistoryFilter
+{
+    HistoryFilter() : role_flags(TxOut::ROLE_BOTH), txout_status_flags(TxOut::BOTH), tx_status_flags(Tx::ALL), hide_change(true), min_timestamp(0), max_timestamp(0) { }
+
+    std::string account_name;
+    std::string bin_name;
+    int         role_flags;
+    int         txout_status_flags;
+    int         tx_status_flags;
+    bool        hide_change;
+    uint32_t    min_timestamp;
+    uint32_t    max_timestamp;
+};
+
+// Keyset position in history, ordered newest first by (tx timestamp, tx id, txout id).
+// A page read from a cursor starts with the row after its position, so rows inserted
+// at the head of the history never shift later pages. The token only holds database
+// ids, so it stays valid across processes for the same vault.
+class HistoryCursor
+{
+public:
+    static const unsigned char TOKEN_VERSION = 1;
+
+    HistoryCursor() : timestamp_(0), tx_id_(0), txout_id_(0), end_(false) { }
+    HistoryCursor(uint32_t timestamp, unsigned long tx_id, unsigned long txout_id = 0) : timestamp_(timestamp), tx_id_(tx_id), txout_id_(txout_id), end_(false) { }
+
+    // An empty token is the start of history.
+    explicit HistoryCursor(const std::string& token) : timestamp_(0), tx_id_(0), txout_id_(0), end_(false)
+    {
+        if (token.empty()) return;
+
+        if (token.size() != 42 || !std::all_of(token.begin(), token.end(), [](char c) { return isxdigit((unsigned char)c) != 0; })) throw std::runtime_error("Invalid history resume token.");
+
+        uchar_vector data;
+        data.setHex(token);
+        if (data.size() != 21 || data[0] != TOKEN_VERSION) throw std::runtime_error("Invalid history resume token.");
+
+        timestamp_ = (uint32_t)readInt(data, 1, 4);
+        tx_id_ = (unsigned long)readInt(data, 5, 8);
+        txout_id_ = (unsigned long)readInt(data, 13, 8);
+        if (tx_id_ == 0) throw std::runtime_error("Invalid history resume token.");
+    }
+
+    bool isStart() const { return tx_id_ == 0; }
+    bool isEnd() const { return end_; }
+
+    // Empty at the start and once history is exhausted.
+    std::string token() const
+    {
+        if (isStart() || end_) return std::string();
+
+        uchar_vector data;
+        data.push_back((unsigned char)TOKEN_VERSION);
+        writeInt(data, timestamp_, 4);
+        writeInt(data, tx_id_, 8);
+        writeInt(data, txout_id_, 8);
+        return data.getHex();
+    }
+
+    uint32_t timestamp() const { return timestamp_; }
+    unsigned long tx_id() const { return tx_id_; }
+    unsigned long txout_id() const { return txout_id_; }
+
+    void advance(uint32_t timestamp, unsigned long tx_id, unsigned long txout_id = 0)
+    {
+        timestamp_ = timestamp;
+        tx_id_ = tx_id;
+        txout_id_ = txout_id;
+    }
+
+    void setEnd() { end_ = true; }
+
+private:
+    static uint64_t readInt(const uchar_vector& data, std::size_t pos, std::size_t size)
+    {
+        uint64_t n = 0;
+        for (std::size_t i = 0; i < size; i++) { n = (n << 8) | data[pos + i]; }
+        return n;
+    }
+
+    static void writeInt(uchar_vector& data, uint64_t n, std::size_t size)
+    {
+        for (std::size_t i = size; i > 0; i--) { data.push_back((unsigned char)(n >> (8 * (i - 1)))); }
+    }
+
+    uint32_t timestamp_;
+    unsigned long tx_id_;
+    unsigned long txout_id_;
+    bool end_;
+};
+
+}
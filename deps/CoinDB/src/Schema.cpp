@@ -27,6 +27,9 @@
 #include <boost/archive/text_iarchive.hpp>
 
 #include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 //#define ENABLE_CRYPTO
 
@@ -487,23 +490,20 @@ std::string AccountBin::account_name() const
 SigningScriptVector AccountBin::generateSigningScripts()
 {
     SigningScriptVector signingscripts;
+    std::vector<KeyVector> keys = deriveSigningKeys(0, next_script_index_);
     for (uint32_t i = 0; i < next_script_index_; i++)
     {
         std::string label;
         auto it = script_label_map_.find(i);
         if (it != script_label_map_.end())   { label = it->second; }
         SigningScript::status_t status = (index_ == CHANGE_INDEX) ? SigningScript::CHANGE : SigningScript::ISSUED;
-        std::shared_ptr<SigningScript> signingscript(new SigningScript(shared_from_this(), i, label, status));
-        signingscripts.push_back(signingscript);
-    }
-
-    script_count_ = next_script_index_ + unused_pool_size();
-    for (uint32_t i = next_script_index_; i < script_count_; i++)
-    {
-        std::shared_ptr<SigningScript> signingscript(new SigningScript(shared_from_this(), i));
+        std::shared_ptr<SigningScript> signingscript(new SigningScript(shared_from_this(), i, keys[i], label, status));
         signingscripts.push_back(signingscript);
     }
 
+    script_count_ = next_script_index_;
+    SigningScriptVector unused_signingscripts = newSigningScripts(unused_pool_size());
+    signingscripts.insert(signingscripts.end(), unused_signingscripts.begin(), unused_signingscripts.end());
     return signingscripts;
 }
 
@@ -552,6 +552,78 @@ std::shared_ptr<SigningScript> AccountBin::newSigningScript(const std::string& l
     return signingscript;
 }
 
+SigningScriptVector AccountBin::newSigningScripts(uint32_t count)
+{
+    return newSigningScripts(deriveSigningKeys(script_count_, count));
+}
+
+SigningScriptVector AccountBin::newSigningScripts(const std::vector<KeyVector>& keys)
+{
+    SigningScriptVector signingscripts;
+    for (auto& script_keys: keys)
+    {
+        if (script_keys.empty() || script_keys[0]->index() != script_count_) throw std::runtime_error("AccountBin::newSigningScripts() - keys were not derived for the next script index.");
+
+        std::shared_ptr<SigningScript> signingscript(new SigningScript(shared_from_this(), script_count_++, script_keys));
+        signingscripts.push_back(signingscript);
+    }
+    return signingscripts;
+}
+
+std::vector<KeyVector> AccountBin::deriveSigningKeys(uint32_t first_index, uint32_t count) const
+{
+    std::shared_ptr<Account> account = this->account();
+    if (!account) throw std::runtime_error("AccountBin::deriveSigningKeys() - account is null.");
+
+    std::vector<std::shared_ptr<Keychain>> keychains(this->keychains().begin(), this->keychains().end());
+    return deriveSigningKeys(keychains, account->compressed_keys(), first_index, count);
+}
+
+std::vector<KeyVector> AccountBin::deriveSigningKeys(const std::vector<std::shared_ptr<Keychain>>& keychains, bool compressed_keys, uint32_t first_index, uint32_t count)
+{
+    std::vector<KeyVector> keys(count, KeyVector(keychains.size()));
+
+    auto derive = [&](uint32_t begin, uint32_t step)
+    {
+        for (uint32_t i = begin; i < count; i += step)
+        {
+            for (std::size_t k = 0; k < keychains.size(); k++) { keys[i][k] = std::make_shared<Key>(keychains[k], first_index + i, compressed_keys); }
+        }
+    };
+
+    // Thread startup costs more than a handful of derivations
+    const uint32_t MIN_KEYS_PER_THREAD = 16;
+    uint32_t thread_count = std::min(std::max(std::thread::hardware_concurrency(), 1u), (uint32_t)(count * keychains.size() / MIN_KEYS_PER_THREAD));
+    if (thread_count < 2)
+    {
+        derive(0, 1);
+        return keys;
+    }
+
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < thread_count; t++)
+    {
+        threads.push_back(std::thread([&, t]()
+        {
+            try
+            {
+                derive(t, thread_count);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) { error = std::current_exception(); }
+            }
+        }));
+    }
+    for (auto& thread: threads) { thread.join(); }
+    if (error) std::rethrow_exception(error);
+
+    return keys;
+}
+
 void AccountBin::markSigningScriptIssued(uint32_t script_index)
 {
     if (script_index >= next_script_index_)
@@ -620,6 +692,20 @@ SigningScript::SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t i
         keys_.push_back(key);
     }
 
+    initScripts();
+}
+
+SigningScript::SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t index, const KeyVector& keys, const std::string& label, status_t status)
+    : account_(account_bin->account()), account_bin_(account_bin), index_(index), label_(label), status_(status), keys_(keys)
+{
+    if (!account_) throw std::runtime_error("SigningScript::SigningScript() - account is null.");
+    if (keys_.size() != account_bin_->keychains().size()) throw std::runtime_error("SigningScript::SigningScript() - wrong number of keys.");
+
+    initScripts();
+}
+
+void SigningScript::initScripts()
+{
     // sort keys into canonical order
     std::sort(keys_.begin(), keys_.end(), [](std::shared_ptr<Key> key1, std::shared_ptr<Key> key2) { return key1->pubkey() < key2->pubkey(); });
 
@@ -657,7 +743,7 @@ SigningScript::SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t i
         txoutscript_ = txoutscript;
     }
 
-    account_bin_->setScriptLabel(index, label);
+    account_bin_->setScriptLabel(index_, label_);
 }
 
 void SigningScript::label(const std::string& label)
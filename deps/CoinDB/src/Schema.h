@@ -57,7 +57,7 @@ typedef odb::nullable<unsigned long> null_id_t;
 ////////////////////
 
 #define SCHEMA_BASE_VERSION 12
-#define SCHEMA_VERSION      22
+#define SCHEMA_VERSION      23
 
 #ifdef ODB_COMPILER
 #pragma db model version(SCHEMA_BASE_VERSION, SCHEMA_VERSION, open)
@@ -456,6 +456,12 @@ public:
     uint32_t minsigs() const { return minsigs_; }
 
     std::shared_ptr<SigningScript> newSigningScript(const std::string& label = "");
+    SigningScriptVector newSigningScripts(uint32_t count);
+    SigningScriptVector newSigningScripts(const std::vector<KeyVector>& keys); // keys must have been derived starting at script_count()
+    std::vector<KeyVector> deriveSigningKeys(uint32_t first_index, uint32_t count) const; // derives in parallel, touches no shared state
+
+    // Same, from keychains copied out of a bin while its account was loaded. Needs no session.
+    static std::vector<KeyVector> deriveSigningKeys(const std::vector<std::shared_ptr<Keychain>>& keychains, bool compressed_keys, uint32_t first_index, uint32_t count);
     void markSigningScriptIssued(uint32_t script_index);
 
     void keychains(const KeychainSet& keychains) { keychains_ = keychains; keychains__ = keychains; } // only used for imported account bins
@@ -848,6 +854,7 @@ public:
     static std::vector<status_t>    getStatusFlags(int status);
 
     SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t index, const std::string& label = "", status_t status = UNUSED);
+    SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t index, const KeyVector& keys, const std::string& label = "", status_t status = UNUSED); // keys already derived for index
     SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t index, const bytes_t& txinscript, const bytes_t& txoutscript, const std::string& label = "", status_t status = UNUSED)
         : account_(account_bin->account()), account_bin_(account_bin), index_(index), label_(label), status_(status), txinscript_(txinscript), txoutscript_(txoutscript) { }
 
@@ -880,6 +887,8 @@ private:
     friend class odb::access;
     SigningScript() { }
 
+    void initScripts();
+
     #pragma db id auto
     unsigned long id_;
 
@@ -1577,6 +1586,58 @@ private:
 
 typedef std::vector<std::shared_ptr<Tx>> txs_t;
 
+// Per-account history with running balances, maintained by Vault in the same transaction
+// as the tx changes. There is one entry for each account with txouts in a tx, holding the
+// net effect of the tx on the account. Entries are ordered by (sort_height, tx_id):
+// confirmed txs by block height, then unconfirmed txs. Balances include the entry itself.
+// The tx and account are stored as plain ids so entries can outlive a deleted tx within
+// the transaction that deletes it.
+#pragma db object pointer(std::shared_ptr)
+class LedgerEntry
+{
+public:
+    static const uint32_t UNCONFIRMED_HEIGHT = 0xffffffff;
+
+    LedgerEntry(unsigned long account_id, unsigned long tx_id, uint32_t sort_height, int64_t delta)
+        : account_id_(account_id), tx_id_(tx_id), sort_height_(sort_height), delta_(delta), confirmed_balance_(0), balance_(0) { }
+
+    unsigned long id() const { return id_; }
+    unsigned long account_id() const { return account_id_; }
+    unsigned long tx_id() const { return tx_id_; }
+
+    uint32_t sort_height() const { return sort_height_; }
+    bool confirmed() const { return sort_height_ != UNCONFIRMED_HEIGHT; }
+
+    int64_t delta() const { return delta_; }
+
+    void confirmed_balance(int64_t confirmed_balance) { confirmed_balance_ = confirmed_balance; }
+    int64_t confirmed_balance() const { return confirmed_balance_; }
+
+    void balance(int64_t balance) { balance_ = balance; }
+    int64_t balance() const { return balance_; }
+
+private:
+    friend class odb::access;
+    LedgerEntry() { }
+
+    #pragma db id auto
+    unsigned long id_;
+
+    unsigned long account_id_;
+
+    #pragma db index
+    unsigned long tx_id_;
+
+    uint32_t sort_height_;
+    int64_t delta_;
+    int64_t confirmed_balance_;
+    int64_t balance_;
+
+    #pragma db index("LedgerEntry_position_i") unique members(account_id_, sort_height_, tx_id_)
+};
+
+typedef std::vector<std::shared_ptr<LedgerEntry>> ledger_entries_t;
+
 
 // Views
 #pragma db view \
@@ -2008,6 +2069,81 @@ struct ConfirmedTxView
     uint32_t block_height;
 };
 
+// Hashes in stored merkle blocks for which we have no transaction yet
+#pragma db view \
+    object(MerkleBlock) \
+    table("MerkleBlock_hashes" = "t": "t.object_id = " + MerkleBlock::id_) \
+    object(Tx left: "t.value = " + Tx::hash_) \
+    query(Tx::id_.is_null())
+struct PendingConfirmationView
+{
+    #pragma db column("t.value")
+    bytes_t tx_hash;
+
+    #pragma db column(MerkleBlock::blockheader_)
+    unsigned long blockheader_id;
+};
+
+// Ids of the stored blocks. The merkle block id is null for a header stored without one.
+#pragma db view \
+    object(BlockHeader) \
+    object(MerkleBlock left: MerkleBlock::blockheader_)
+struct BlockIdView
+{
+    #pragma db column(BlockHeader::id_)
+    unsigned long blockheader_id;
+
+    #pragma db column(MerkleBlock::id_)
+    null_id_t merkleblock_id;
+
+    #pragma db column(BlockHeader::height_)
+    uint32_t height;
+};
+
+#pragma db view \
+    object(LedgerEntry) \
+    object(Account: LedgerEntry::account_id_ == Account::id_) \
+    object(Tx: LedgerEntry::tx_id_ == Tx::id_)
+struct LedgerEntryView
+{
+    #pragma db column(LedgerEntry::id_)
+    unsigned long id;
+
+    #pragma db column(Account::name_)
+    std::string account_name;
+
+    #pragma db column(Tx::id_)
+    unsigned long tx_id;
+
+    #pragma db column(Tx::hash_)
+    bytes_t tx_hash;
+
+    #pragma db column(Tx::unsigned_hash_)
+    bytes_t tx_unsigned_hash;
+
+    #pragma db column(Tx::timestamp_)
+    uint32_t tx_timestamp;
+
+    #pragma db column(Tx::status_)
+    Tx::status_t tx_status;
+
+    #pragma db column(LedgerEntry::sort_height_)
+    uint32_t sort_height;
+
+    #pragma db column(LedgerEntry::delta_)
+    int64_t delta;
+
+    #pragma db column(LedgerEntry::confirmed_balance_)
+    int64_t confirmed_balance;
+
+    #pragma db column(LedgerEntry::balance_)
+    int64_t balance;
+
+    bool confirmed() const { return sort_height != LedgerEntry::UNCONFIRMED_HEIGHT; }
+    uint32_t height() const { return confirmed() ? sort_height : 0; }
+    const bytes_t& hash() const { return tx_status == Tx::UNSIGNED ? tx_unsigned_hash : tx_hash; }
+};
+
 #pragma db view \
     object(MerkleBlock) query(MerkleBlock::txsinserted_ == false)
 struct IncompleteBlockCountView
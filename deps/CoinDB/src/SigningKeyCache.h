@@ -0,0 +1,140 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// SigningKeyCache.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include <CoinCore/typedefs.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+namespace CoinDB
+{
+
+// Private keys derived while signing a batch of transactions, looked up by
+// public key. Keys are kept in blocks locked out of swap and are wiped when
+// the cache is destroyed, so a key shared by many inputs is derived once and
+// never paged to disk.
+class SigningKeyCache
+{
+public:
+    static const std::size_t MAX_KEY_SIZE = 32;
+
+    SigningKeyCache() : size_(0) { }
+    ~SigningKeyCache() { clear(); }
+
+    std::size_t size() const { return size_; }
+
+    // Returns the key's slot, or -1 if not cached.
+    long find(const bytes_t& pubkey) const
+    {
+        auto it = slots_.find(pubkey);
+        return it == slots_.end() ? -1 : (long)it->second;
+    }
+
+    // Copies privkey into the cache, wipes privkey and returns the new slot.
+    std::size_t insert(const bytes_t& pubkey, secure_bytes_t& privkey)
+    {
+        if (privkey.empty() || privkey.size() > MAX_KEY_SIZE)
+        {
+            if (!privkey.empty()) { wipe(&privkey[0], privkey.size()); }
+            throw std::runtime_error("SigningKeyCache::insert - invalid private key size.");
+        }
+
+        std::size_t slot = size_;
+        if (slot % SLOTS_PER_BLOCK == 0) { blocks_.push_back(allocateBlock()); }
+
+        unsigned char* p = slotData(slot);
+        p[0] = (unsigned char)privkey.size();
+        std::memcpy(p + 1, &privkey[0], privkey.size());
+        wipe(&privkey[0], privkey.size());
+
+        slots_[pubkey] = slot;
+        size_++;
+        return slot;
+    }
+
+    // Callers must wipe the returned copy once done with it.
+    bytes_t get(std::size_t slot) const
+    {
+        if (slot >= size_) throw std::out_of_range("SigningKeyCache::get - invalid slot.");
+
+        const unsigned char* p = slotData(slot);
+        return bytes_t(p + 1, p + 1 + p[0]);
+    }
+
+    void clear()
+    {
+        for (auto& block: blocks_) { freeBlock(block); }
+        blocks_.clear();
+        slots_.clear();
+        size_ = 0;
+    }
+
+    static void wipe(void* p, std::size_t n)
+    {
+        volatile unsigned char* q = (volatile unsigned char*)p;
+        while (n--) { *q++ = 0; }
+    }
+
+private:
+    SigningKeyCache(const SigningKeyCache&) = delete;
+    SigningKeyCache& operator=(const SigningKeyCache&) = delete;
+
+    static const std::size_t SLOT_SIZE = MAX_KEY_SIZE + 1; // length byte, then key
+    static const std::size_t SLOTS_PER_BLOCK = 124;
+    static const std::size_t BLOCK_SIZE = SLOT_SIZE * SLOTS_PER_BLOCK; // fits in a page
+
+    static unsigned char* allocateBlock()
+    {
+        unsigned char* block = (unsigned char*)std::calloc(1, BLOCK_SIZE);
+        if (!block) throw std::bad_alloc();
+
+        // Best effort: locking fails without privileges or past RLIMIT_MEMLOCK, and the keys are wiped either way.
+#if defined(_WIN32)
+        VirtualLock(block, BLOCK_SIZE);
+#else
+        mlock(block, BLOCK_SIZE);
+#endif
+        return block;
+    }
+
+    static void freeBlock(unsigned char* block)
+    {
+        wipe(block, BLOCK_SIZE);
+#if defined(_WIN32)
+        VirtualUnlock(block, BLOCK_SIZE);
+#else
+        munlock(block, BLOCK_SIZE);
+#endif
+        std::free(block);
+    }
+
+    unsigned char* slotData(std::size_t slot) const
+    {
+        return blocks_[slot / SLOTS_PER_BLOCK] + (slot % SLOTS_PER_BLOCK) * SLOT_SIZE;
+    }
+
+    std::vector<unsigned char*> blocks_;
+    std::map<bytes_t, std::size_t> slots_;
+    std::size_t size_;
+};
+
+}
@@ -12,10 +12,37 @@
 #include "SynchedVault.h"
 
 #include <logger/logger.h>
+#include <logger/metrics.h>
 
 using namespace CoinDB;
 using namespace CoinQ;
 
+void SynchedVaultMutex::lock()
+{
+    static metrics::histogram& waitTime = metrics::get_histogram("synchedvault.lock.wait");
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    m_mutex.lock();
+    m_acquired = std::chrono::steady_clock::now();
+    waitTime.record(std::chrono::duration_cast<std::chrono::microseconds>(m_acquired - start).count());
+}
+
+bool SynchedVaultMutex::try_lock()
+{
+    if (!m_mutex.try_lock()) return false;
+    m_acquired = std::chrono::steady_clock::now();
+    return true;
+}
+
+void SynchedVaultMutex::unlock()
+{
+    static metrics::histogram& holdTime = metrics::get_histogram("synchedvault.lock.hold");
+
+    // Read before unlocking, the next owner overwrites it
+    holdTime.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_acquired).count());
+    m_mutex.unlock();
+}
+
 const std::string SynchedVault::getStatusString(status_t status)
 {
     switch (status)
@@ -44,6 +71,7 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
     m_filterFalsePositiveRate(0.001),
     m_filterTweak(0),
     m_filterFlags(0),
+    m_bUseCompactFilters(false),
     m_networkSync(coinParams),
     m_bBlockTreeLoaded(false),
     m_bConnected(false),
@@ -189,7 +217,7 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
         LOGGER(trace) << "SynchedVault - Received new transaction " << cointx.hash().getHex() << std::endl;
 
         if (!m_vault) return;
-        std::lock_guard<std::mutex> lock(m_vaultMutex);
+        std::lock_guard<SynchedVaultMutex> lock(m_vaultMutex);
         if (!m_vault) return;
 
         try
@@ -213,7 +241,7 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
         LOGGER(trace) << "SynchedVault - Received merkle transaction " << cointx.hash().getHex() << " in block " << chainmerkleblock.hash().getHex() << std::endl;
 
         if (!m_vault) return;
-        std::lock_guard<std::mutex> lock(m_vaultMutex);
+        std::lock_guard<SynchedVaultMutex> lock(m_vaultMutex);
         if (!m_vault) return;
 
         try
@@ -238,7 +266,7 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
         LOGGER(trace) << "SynchedVault - Received transaction confirmation " << uchar_vector(txhash).getHex() << " in block " << chainmerkleblock.hash().getHex() << std::endl;
 
         if (!m_vault) return;
-        std::lock_guard<std::mutex> lock(m_vaultMutex);
+        std::lock_guard<SynchedVaultMutex> lock(m_vaultMutex);
         if (!m_vault) return;
 
         try
@@ -263,7 +291,7 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
 
         if (!m_vault) return;
         if (!m_bInsertMerkleBlocks) return;
-        std::lock_guard<std::mutex> lock(m_vaultMutex);
+        std::lock_guard<SynchedVaultMutex> lock(m_vaultMutex);
         if (!m_vault) return;
         if (!m_bInsertMerkleBlocks) return;
 
@@ -324,7 +352,7 @@ void SynchedVault::openVault(const std::string& dbuser, const std::string& dbpas
     LOGGER(trace) << "SynchedVault::openVault(" << dbuser << ", ..., " << dbname << ", " << (bCreate ? "true" : "false") << ", " << version << ", " << network << ", " << (migrate ? "true" : "false") << ")" << std::endl;
 
     {
-        std::lock_guard<std::mutex> lock(m_vaultMutex);
+        std::lock_guard<SynchedVaultMutex> lock(m_vaultMutex);
         m_notifyVaultClosed();
         if (m_vault) delete m_vault;
         m_vault = new Vault;
@@ -357,6 +385,13 @@ void SynchedVault::openVault(const std::string& dbuser, const std::string& dbpas
             updateSyncHeader(merkleblock->blockheader()->height(), merkleblock->blockheader()->hash());
             m_notifyMerkleBlockInserted(merkleblock);
         });
+        m_vault->subscribeReorg([this](uint32_t height, const std::vector<unsigned long>& txIds, const std::vector<bytes_t>& txHashes)
+        {
+            // Unconfirmed txs are propagated again
+            for (auto& txHash: txHashes) { m_networkSync.addToMempool(txHash); }
+            m_notifyReorg(height, txIds, txHashes);
+        });
+        m_vault->subscribeChangeSet([this](const VaultChangeSet& changes) { m_notifyChangeSet(changes); });
         m_vault->subscribeTxInsertionError([this](std::shared_ptr<Tx> tx, std::string description) { m_notifyTxInsertionError(tx, description); });
         m_vault->subscribeMerkleBlockInsertionError([this](std::shared_ptr<MerkleBlock> merkleblock, std::string description) { m_notifyMerkleBlockInsertionError(merkleblock, description); });
         m_vault->subscribeTxConfirmationError([this](std::shared_ptr<MerkleBlock> merkleblock, bytes_t txhash) { m_notifyTxConfirmationError(merkleblock, txhash); });
@@ -372,11 +407,12 @@ void SynchedVault::closeVault()
 
     {
         if (!m_vault) return;
-        std::lock_guard<std::mutex> lock(m_vaultMutex);
+        std::lock_guard<SynchedVaultMutex> lock(m_vaultMutex);
         if (!m_vault) return;
 
         m_bInsertMerkleBlocks = false;
         m_networkSync.stopSynchingBlocks();
+        m_networkSync.clearMempool();
         delete m_vault;
         m_vault = nullptr;
     }
@@ -415,7 +451,7 @@ void SynchedVault::suspendBlockUpdates()
 
     if (!m_vault) return;
     if (!m_bInsertMerkleBlocks) return;
-    std::lock_guard<std::mutex> lock(m_vaultMutex);
+    std::lock_guard<SynchedVaultMutex> lock(m_vaultMutex);
     m_bInsertMerkleBlocks = false;
 }
 
@@ -426,7 +462,7 @@ void SynchedVault::syncBlocks()
     if (!m_bConnected) throw std::runtime_error("Not connected.");
 
     if (!m_vault) throw std::runtime_error("No vault is open.");
-    std::lock_guard<std::mutex> lock(m_vaultMutex);
+    std::lock_guard<SynchedVaultMutex> lock(m_vaultMutex);
     if (!m_vault) throw std::runtime_error("No vault is open.");
 
     uint32_t startTime = m_vault->getMaxFirstBlockTimestamp();
@@ -436,7 +472,7 @@ void SynchedVault::syncBlocks()
         return;
     }
 
-    m_networkSync.setBloomFilter(m_vault->getBloomFilter(0.001, 0, 0));
+    updateFilter_unwrapped();
 
     std::vector<bytes_t> locatorHashes = m_vault->getLocatorHashes();
     m_bGotMempool = false;
@@ -456,10 +492,35 @@ void SynchedVault::updateBloomFilter()
     LOGGER(trace) << "SynchedVault::updateBloomFilter()" << std::endl;
 
     if (!m_vault) throw std::runtime_error("No vault is open.");
-    std::lock_guard<std::mutex> lock(m_vaultMutex);
+    std::lock_guard<SynchedVaultMutex> lock(m_vaultMutex);
     if (!m_vault) throw std::runtime_error("No vault is open.");
 
-    m_networkSync.setBloomFilter(m_vault->getBloomFilter(0.001, 0, 0));
+    updateFilter_unwrapped();
+}
+
+// Call with m_vaultMutex held and a vault open.
+void SynchedVault::updateFilter_unwrapped()
+{
+    // Peers that do not advertise compact filters would never answer getcfheaders
+    bool bCompactFilters = m_bUseCompactFilters;
+    if (bCompactFilters && m_bConnected && !m_networkSync.peerServesCompactFilters())
+    {
+        LOGGER(warning) << "SynchedVault - peer does not serve compact block filters, falling back to bloom filters." << std::endl;
+        bCompactFilters = false;
+    }
+
+    if (bCompactFilters)
+    {
+        std::vector<bytes_t> scripts;
+        std::vector<Coin::OutPoint> outpoints;
+        m_vault->getCompactFilterElements(scripts, outpoints);
+        m_networkSync.setFilterScripts(scripts, outpoints);
+    }
+    else
+    {
+        if (m_networkSync.usingCompactFilters()) { m_networkSync.clearFilterScripts(); }
+        m_networkSync.setBloomFilter(m_vault->getBloomFilter(0.001, 0, 0));
+    }
 }
 
 // This function recursively tries to send dependencies.
@@ -503,7 +564,7 @@ std::shared_ptr<Tx> SynchedVault::sendTx(const bytes_t& hash)
     if (!m_bConnected) throw std::runtime_error("Not connected.");
 
     if (!m_vault) throw std::runtime_error("No vault is open.");
-    std::lock_guard<std::mutex> lock(m_vaultMutex);
+    std::lock_guard<SynchedVaultMutex> lock(m_vaultMutex);
     if (!m_vault) throw std::runtime_error("No vault is open.");
 
     std::shared_ptr<Tx> tx = m_vault->getTx(hash);
@@ -517,7 +578,7 @@ std::shared_ptr<Tx> SynchedVault::sendTx(unsigned long tx_id)
     if (!m_bConnected) throw std::runtime_error("Not connected.");
 
     if (!m_vault) throw std::runtime_error("No vault is open.");
-    std::lock_guard<std::mutex> lock(m_vaultMutex);
+    std::lock_guard<SynchedVaultMutex> lock(m_vaultMutex);
     if (!m_vault) throw std::runtime_error("No vault is open.");
 
     std::shared_ptr<Tx> tx = m_vault->getTx(tx_id);
@@ -539,7 +600,7 @@ void SynchedVault::sendTx(Coin::Transaction& coin_tx)
 void SynchedVault::insertFakeMerkleBlock(unsigned int nExtraLeaves)
 {
     if (!m_vault) throw std::runtime_error("No vault is open.");
-    std::unique_lock<std::mutex> lock(m_vaultMutex);
+    std::unique_lock<SynchedVaultMutex> lock(m_vaultMutex);
     if (!m_vault) throw std::runtime_error("No vault is open.");
 
     txs_t txs = m_vault->getTxs(Tx::PROPAGATED);
@@ -580,11 +641,43 @@ void SynchedVault::clearAllSlots()
     m_notifyTxUpdated.clear();
     m_notifyTxDeleted.clear();
     m_notifyMerkleBlockInserted.clear();
+    m_notifyReorg.clear();
+    m_notifyChangeSet.clear();
     m_notifyTxInsertionError.clear();
     m_notifyMerkleBlockInsertionError.clear();
     m_notifyProtocolError.clear();
 }
 
+void SynchedVault::setNotificationExecutor(std::shared_ptr<Signals::Executor> executor)
+{
+    LOGGER(trace) << "SynchedVault::setNotificationExecutor(" << (executor ? "executor" : "null") << ")" << std::endl;
+
+    m_notifyVaultOpened.setExecutor(executor);
+    m_notifyVaultClosed.setExecutor(executor);
+    m_notifyVaultError.setExecutor(executor);
+    m_notifyKeychainUnlocked.setExecutor(executor);
+    m_notifyKeychainLocked.setExecutor(executor);
+
+    m_notifyStatusChanged.setExecutor(executor);
+    m_notifyBestHeaderChanged.setExecutor(executor, Signals::COALESCED);
+    m_notifySyncHeaderChanged.setExecutor(executor, Signals::COALESCED);
+    m_notifyConnectionError.setExecutor(executor);
+    m_notifyBlockTreeError.setExecutor(executor);
+
+    m_notifyPeerConnected.setExecutor(executor);
+    m_notifyPeerDisconnected.setExecutor(executor);
+    m_notifyTxInserted.setExecutor(executor);
+    m_notifyTxUpdated.setExecutor(executor);
+    m_notifyTxDeleted.setExecutor(executor);
+    m_notifyMerkleBlockInserted.setExecutor(executor);
+    m_notifyReorg.setExecutor(executor);
+    m_notifyChangeSet.setExecutor(executor);
+    m_notifyTxInsertionError.setExecutor(executor);
+    m_notifyMerkleBlockInsertionError.setExecutor(executor);
+    m_notifyTxConfirmationError.setExecutor(executor);
+    m_notifyProtocolError.setExecutor(executor);
+}
+
 void SynchedVault::updateStatus(status_t newStatus)
 {
     if (m_status != newStatus)
@@ -17,11 +17,26 @@
 
 #include <CoinQ/CoinQ_netsync.h>
 
+#include <chrono>
 #include <mutex>
 
 namespace CoinDB
 {
 
+// Records how long callers waited for the synched vault mutex and how long
+// they held it, including locks held through VaultLock.
+class SynchedVaultMutex
+{
+public:
+    void lock();
+    bool try_lock();
+    void unlock();
+
+private:
+    std::mutex m_mutex;
+    std::chrono::steady_clock::time_point m_acquired;
+};
+
 class SynchedVault
 {
 public:
@@ -57,9 +72,16 @@ public:
     void suspendBlockUpdates();
     void syncBlocks();
 
+    // Records peer traffic for replaying later. Set while stopped.
+    void setCaptureFile(const std::string& captureFile) { m_networkSync.setCaptureFile(captureFile); }
+
     void setFilterParams(double falsePositiveRate, uint32_t nTweak, uint8_t nFlags);
     void updateBloomFilter();
 
+    // Sync with BIP157/158 compact block filters instead of bloom filters. Takes effect on the next syncBlocks().
+    void useCompactFilters(bool bUseCompactFilters = true) { m_bUseCompactFilters = bUseCompactFilters; }
+    bool usingCompactFilters() const { return m_bUseCompactFilters; }
+
     status_t getStatus() const { return m_status; }
     uint32_t getBestHeight() const { return m_bestHeight; }
     const bytes_t& getBestHash() const { return m_bestHash; }
@@ -101,6 +123,8 @@ public:
     Signals::Connection subscribeTxUpdated(TxSignal::Slot slot) { return m_notifyTxUpdated.connect(slot); }
     Signals::Connection subscribeTxDeleted(TxSignal::Slot slot) { return m_notifyTxDeleted.connect(slot); }
     Signals::Connection subscribeMerkleBlockInserted(MerkleBlockSignal::Slot slot) { return m_notifyMerkleBlockInserted.connect(slot); }
+    Signals::Connection subscribeReorg(ReorgSignal::Slot slot) { return m_notifyReorg.connect(slot); }
+    Signals::Connection subscribeChangeSet(ChangeSetSignal::Slot slot) { return m_notifyChangeSet.connect(slot); }
     Signals::Connection subscribeTxInsertionError(TxErrorSignal::Slot slot) { return m_notifyTxInsertionError.connect(slot); }
     Signals::Connection subscribeMerkleBlockInsertionError(MerkleBlockErrorSignal::Slot slot) { return m_notifyMerkleBlockInsertionError.connect(slot); }
     Signals::Connection subscribeTxConfirmationError(TxConfirmationErrorSignal::Slot slot) { return m_notifyTxConfirmationError.connect(slot); }
@@ -108,10 +132,14 @@ public:
 
     void clearAllSlots();
 
+    // Moves delivery of the notifications above onto the executor's thread. Header changes
+    // are coalesced so only the latest is delivered; the rest are delivered in full.
+    void setNotificationExecutor(std::shared_ptr<Signals::Executor> executor);
+
 private:
     friend class VaultLock;
 
-    mutable std::mutex          m_vaultMutex;
+    mutable SynchedVaultMutex   m_vaultMutex;
     Vault*                      m_vault;
 
     status_t                    m_status;
@@ -131,6 +159,8 @@ private:
     double                      m_filterFalsePositiveRate;
     uint32_t                    m_filterTweak;
     uint8_t                     m_filterFlags;
+    bool                        m_bUseCompactFilters;
+    void                        updateFilter_unwrapped();
 
     CoinQ::Network::NetworkSync m_networkSync;
     std::string                 m_blockTreeFile;
@@ -163,6 +193,8 @@ private:
     TxSignal                    m_notifyTxUpdated;
     TxSignal                    m_notifyTxDeleted;
     MerkleBlockSignal           m_notifyMerkleBlockInserted;
+    ReorgSignal                 m_notifyReorg;
+    ChangeSetSignal             m_notifyChangeSet;
     TxErrorSignal               m_notifyTxInsertionError;
     MerkleBlockErrorSignal      m_notifyMerkleBlockInsertionError;
     TxConfirmationErrorSignal   m_notifyTxConfirmationError;
@@ -175,7 +207,7 @@ public:
     explicit VaultLock(const SynchedVault& synchedVault) : m_lock(synchedVault.m_vaultMutex) { }
 
 private:
-    std::lock_guard<std::mutex> m_lock;
+    std::lock_guard<SynchedVaultMutex> m_lock;
 };
 
 }
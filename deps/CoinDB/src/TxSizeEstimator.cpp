@@ -0,0 +1,136 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// TxSizeEstimator.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "TxSizeEstimator.h"
+
+using namespace CoinDB;
+
+TxSizeEstimator::script_type_t TxSizeEstimator::getScriptType(bool use_witness, bool use_witness_p2sh)
+{
+    if (!use_witness) return P2SH;
+    return use_witness_p2sh ? P2SH_P2WSH : P2WSH;
+}
+
+void TxSizeEstimator::addInput(script_type_t type, uint32_t minsigs, uint32_t pubkeys, bool compressed_keys, std::size_t count)
+{
+    input_count_ += count;
+    inputs_base_size_ += count * txInBaseSize(type, minsigs, pubkeys, compressed_keys);
+    if (type != P2SH)
+    {
+        witness_input_count_ += count;
+        inputs_witness_size_ += count * txInWitnessSize(type, minsigs, pubkeys, compressed_keys);
+    }
+}
+
+void TxSizeEstimator::addOutput(std::size_t script_size, std::size_t count)
+{
+    output_count_ += count;
+    outputs_size_ += count * txOutSize(script_size);
+}
+
+uint32_t TxSizeEstimator::base_size() const
+{
+    // version, txin count, txins, txout count, txouts, locktime
+    return 4 + varIntSize(input_count_) + inputs_base_size_ + varIntSize(output_count_) + outputs_size_ + 4;
+}
+
+uint32_t TxSizeEstimator::total_size() const
+{
+    if (witness_input_count_ == 0) return base_size();
+
+    // marker and flag, plus an empty stack for each input without witness data
+    return base_size() + 2 + inputs_witness_size_ + (input_count_ - witness_input_count_);
+}
+
+uint32_t TxSizeEstimator::weight() const
+{
+    return base_size() * (WITNESS_SCALE_FACTOR - 1) + total_size();
+}
+
+uint32_t TxSizeEstimator::vsize() const
+{
+    return (weight() + WITNESS_SCALE_FACTOR - 1) / WITNESS_SCALE_FACTOR;
+}
+
+uint32_t TxSizeEstimator::varIntSize(uint64_t n)
+{
+    if (n < 0xfd)           return 1;
+    if (n <= 0xffff)        return 3;
+    if (n <= 0xffffffff)    return 5;
+    return 9;
+}
+
+uint32_t TxSizeEstimator::pushSize(uint32_t data_size)
+{
+    // Must agree with CoinQ::Script::opPushData()
+    if (data_size < 0x4c)   return 1 + data_size;
+    if (data_size <= 0xff)  return 2 + data_size;
+    if (data_size <= 0xffff) return 3 + data_size;
+    return 5 + data_size;
+}
+
+uint32_t TxSizeEstimator::redeemScriptSize(uint32_t pubkeys, bool compressed_keys)
+{
+    // OP_m <pubkey 1> ... <pubkey n> OP_n OP_CHECKMULTISIG
+    uint32_t pubkey_size = compressed_keys ? COMPRESSED_PUBKEY_SIZE : UNCOMPRESSED_PUBKEY_SIZE;
+    return 1 + pubkeys * pushSize(pubkey_size) + 1 + 1;
+}
+
+uint32_t TxSizeEstimator::txOutScriptSize(script_type_t type)
+{
+    switch (type)
+    {
+    case P2WSH:
+        // OP_0 <32-byte script hash>
+        return 34;
+    default:
+        // OP_HASH160 <20-byte script hash> OP_EQUAL
+        return 23;
+    }
+}
+
+uint32_t TxSizeEstimator::txInBaseSize(script_type_t type, uint32_t minsigs, uint32_t pubkeys, bool compressed_keys)
+{
+    uint32_t scriptsig_size;
+    switch (type)
+    {
+    case P2SH:
+        // OP_0 <sig 1> ... <sig m> <redeemscript>
+        scriptsig_size = 1 + minsigs * pushSize(MAX_SIGNATURE_SIZE) + pushSize(redeemScriptSize(pubkeys, compressed_keys));
+        break;
+
+    case P2SH_P2WSH:
+        // <OP_0 <32-byte script hash>>
+        scriptsig_size = pushSize(34);
+        break;
+
+    default:
+        scriptsig_size = 0;
+    }
+
+    // outpoint, scriptsig, sequence
+    return 32 + 4 + varIntSize(scriptsig_size) + scriptsig_size + 4;
+}
+
+uint32_t TxSizeEstimator::txInWitnessSize(script_type_t type, uint32_t minsigs, uint32_t pubkeys, bool compressed_keys)
+{
+    if (type == P2SH) return 0;
+
+    // <> <sig 1> ... <sig m> <witnessscript>
+    uint32_t witnessscript_size = redeemScriptSize(pubkeys, compressed_keys);
+    return varIntSize(minsigs + 2) + 1 + minsigs * (varIntSize(MAX_SIGNATURE_SIZE) + MAX_SIGNATURE_SIZE) + varIntSize(witnessscript_size) + witnessscript_size;
+}
+
+uint64_t TxSizeEstimator::dustThreshold(script_type_t type, uint32_t minsigs, uint32_t pubkeys, bool compressed_keys, uint64_t dust_relay_fee_rate)
+{
+    uint32_t spend_weight = txInBaseSize(type, minsigs, pubkeys, compressed_keys) * WITNESS_SCALE_FACTOR + txInWitnessSize(type, minsigs, pubkeys, compressed_keys);
+    uint32_t spend_vsize = (spend_weight + WITNESS_SCALE_FACTOR - 1) / WITNESS_SCALE_FACTOR;
+    return dust_relay_fee_rate * (txOutSize(txOutScriptSize(type)) + spend_vsize);
+}
@@ -0,0 +1,87 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// TxSizeEstimator.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include <CoinCore/typedefs.h>
+
+#include <cstdint>
+#include <cstddef>
+
+namespace CoinDB
+{
+
+// Computes the worst-case serialized size and weight of a fully signed
+// transaction before any signatures exist. Inputs are described by the
+// parameters of the m-of-n multisig script that spends them.
+class TxSizeEstimator
+{
+public:
+    enum script_type_t
+    {
+        P2SH,       // legacy pay-to-script-hash
+        P2WSH,      // native segwit
+        P2SH_P2WSH  // segwit nested in pay-to-script-hash
+    };
+
+    static const uint32_t WITNESS_SCALE_FACTOR  = 4;
+    static const uint32_t MAX_STANDARD_TX_WEIGHT = 400000;
+
+    // DER signature with high R and high S plus one sighash byte.
+    static const uint32_t MAX_SIGNATURE_SIZE    = 73;
+    static const uint32_t COMPRESSED_PUBKEY_SIZE = 33;
+    static const uint32_t UNCOMPRESSED_PUBKEY_SIZE = 65;
+
+    static script_type_t getScriptType(bool use_witness, bool use_witness_p2sh);
+
+    TxSizeEstimator() : input_count_(0), witness_input_count_(0), output_count_(0), inputs_base_size_(0), inputs_witness_size_(0), outputs_size_(0) { }
+
+    void addInput(script_type_t type, uint32_t minsigs, uint32_t pubkeys, bool compressed_keys, std::size_t count = 1);
+    void addOutput(std::size_t script_size, std::size_t count = 1);
+    void addOutput(const bytes_t& script) { addOutput(script.size()); }
+
+    std::size_t input_count() const { return input_count_; }
+    std::size_t output_count() const { return output_count_; }
+
+    // Serialized size without witness data
+    uint32_t base_size() const;
+
+    // Serialized size including marker, flag and witness data
+    uint32_t total_size() const;
+
+    uint32_t weight() const;
+    uint32_t vsize() const;
+
+    // fee_rate is in satoshis per virtual byte
+    uint64_t fee(uint64_t fee_rate) const { return fee_rate * vsize(); }
+
+    // Per-element sizes
+    static uint32_t varIntSize(uint64_t n);
+    static uint32_t pushSize(uint32_t data_size);
+    static uint32_t redeemScriptSize(uint32_t pubkeys, bool compressed_keys);
+    static uint32_t txOutScriptSize(script_type_t type);
+    static uint32_t txInBaseSize(script_type_t type, uint32_t minsigs, uint32_t pubkeys, bool compressed_keys);
+    static uint32_t txInWitnessSize(script_type_t type, uint32_t minsigs, uint32_t pubkeys, bool compressed_keys);
+    static uint32_t txOutSize(std::size_t script_size) { return 8 + varIntSize(script_size) + script_size; }
+
+    // Smallest output value worth creating, using the standard relay rule of
+    // three times the cost of creating and later spending the output.
+    static uint64_t dustThreshold(script_type_t type, uint32_t minsigs, uint32_t pubkeys, bool compressed_keys, uint64_t dust_relay_fee_rate = 3);
+
+private:
+    std::size_t input_count_;
+    std::size_t witness_input_count_;
+    std::size_t output_count_;
+    uint32_t inputs_base_size_;
+    uint32_t inputs_witness_size_;
+    uint32_t outputs_size_;
+};
+
+}
@@ -13,6 +13,7 @@
 
 #include "Vault.h"
 #include "Database.h"
+#include "SigningKeyCache.h"
 
 #include <CoinQ/CoinQ_script.h>
 #include <CoinQ/CoinQ_blocks.h>
@@ -35,15 +36,72 @@
 #include <CoinCore/BigInt.h>
 
 #include <logger/logger.h>
+#include <logger/metrics.h>
 
 #include <stdutils/stringutils.h>
 
 #include <sstream>
 #include <fstream>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <typeinfo>
 
 using namespace CoinDB;
 
+namespace
+{
+
+// Vault mutex locks that record how long callers waited for the lock and how
+// long they held it. Each public call runs one database transaction under the
+// lock, so hold times are transaction times.
+template<bool exclusive>
+class TimedVaultLock
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    explicit TimedVaultLock(VaultMutex& mutex) : mutex_(mutex)
+    {
+        clock::time_point start = clock::now();
+        if (exclusive)  { mutex_.lock(); }
+        else            { mutex_.lock_shared(); }
+        acquired_ = clock::now();
+        waitHistogram().record(std::chrono::duration_cast<std::chrono::microseconds>(acquired_ - start).count());
+    }
+
+    ~TimedVaultLock()
+    {
+        holdHistogram().record(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - acquired_).count());
+        if (exclusive)  { mutex_.unlock(); }
+        else            { mutex_.unlock_shared(); }
+    }
+
+private:
+    static metrics::histogram& waitHistogram()
+    {
+        static metrics::histogram& h = metrics::get_histogram(exclusive ? "vault.lock.write_wait" : "vault.lock.read_wait");
+        return h;
+    }
+
+    static metrics::histogram& holdHistogram()
+    {
+        static metrics::histogram& h = metrics::get_histogram(exclusive ? "vault.db.write_transaction" : "vault.db.read_transaction");
+        return h;
+    }
+
+    VaultMutex& mutex_;
+    clock::time_point acquired_;
+};
+
+typedef TimedVaultLock<true> VaultWriteLock;
+typedef TimedVaultLock<false> VaultReadLock;
+
+}
+
 /*
  * data migration
 */
@@ -69,6 +127,7 @@ static const migration_entry<14> migrate_compressed_keys_entry(&migrate_compress
  * class Vault implementation
 */
 Vault::Vault(int argc, char** argv, bool create, uint32_t version, const std::string& network, bool migrate)
+    : bPendingConfirmationsLoaded(false), pendingConfirmationsTx(nullptr), bBackgroundPoolRefill(false), bStopPoolRefill(false), metadataGeneration(0)
 {
     LOGGER(trace) << "Vault::Vault(..., " << (create ? "true" : "false") << ", " << version << ", " << network << ", " << (migrate ? "true" : "false") << ")" << std::endl;
 
@@ -78,6 +137,7 @@ Vault::Vault(int argc, char** argv, bool create, uint32_t version, const std::st
 }
 
 Vault::Vault(const std::string& dbname, bool create, uint32_t version, const std::string& network, bool migrate)
+    : bPendingConfirmationsLoaded(false), pendingConfirmationsTx(nullptr), bBackgroundPoolRefill(false), bStopPoolRefill(false), metadataGeneration(0)
 {
     LOGGER(trace) << "Vault::Vault(" << dbname << ", " << (create ? "true" : "false") << ", " << version << ", " << network << ", " << (migrate ? "true" : "false") << ")" << std::endl;
 
@@ -87,6 +147,7 @@ Vault::Vault(const std::string& dbname, bool create, uint32_t version, const std
 }
 
 Vault::Vault(const std::string& dbuser, const std::string& dbpasswd, const std::string& dbname, bool create, uint32_t version, const std::string& network, bool migrate)
+    : bPendingConfirmationsLoaded(false), pendingConfirmationsTx(nullptr), bBackgroundPoolRefill(false), bStopPoolRefill(false), metadataGeneration(0)
 {
     LOGGER(trace) << "Vault::Vault(" << dbuser << ", ..., " << dbname << ", " << (create ? "true" : "false") << ", " << version << ", " << network << ", " << (migrate ? "true" : "false") << ")" << std::endl;
 
@@ -153,11 +214,15 @@ void Vault::open(int argc, char** argv, bool create, uint32_t version, const std
 
     if (argc >= 2) name_ = argv[1];
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
+    bPendingConfirmationsLoaded = false;
+    mapPendingConfirmations.clear();
 
     try
     {
-        db_ = open_database(argc, argv, create);
+        std::shared_ptr<odb::core::database> db(open_database(argc, argv, create));
+        boost::lock_guard<boost::shared_mutex> openLock(openMutex);
+        db_ = db;
     }
     catch (const std::exception& e)
     {
@@ -220,6 +285,16 @@ void Vault::open(int argc, char** argv, bool create, uint32_t version, const std
                     db_->update(account);
                 }
             }
+
+            if (v < 23 && cv >= 23)
+            {
+                LOGGER(info) << "Building account ledgers..." << std::endl;
+                odb::core::session s;
+                odb::result<Account> r(db_->query<Account>());
+                std::vector<std::shared_ptr<Account>> accounts;
+                for (auto it = r.begin(); it != r.end(); ++it) { accounts.push_back(it.load()); }
+                for (auto& account: accounts) { rebuildLedger_unwrapped(account); }
+            }
                 
             t.commit();
         }
@@ -232,11 +307,15 @@ void Vault::open(const std::string& dbuser, const std::string& dbpasswd, const s
 
     name_ = dbname;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
+    bPendingConfirmationsLoaded = false;
+    mapPendingConfirmations.clear();
 
     try
     {
-        db_ = openDatabase(dbuser, dbpasswd, dbname, create);
+        std::shared_ptr<odb::core::database> db(openDatabase(dbuser, dbpasswd, dbname, create));
+        boost::lock_guard<boost::shared_mutex> openLock(openMutex);
+        db_ = db;
     }
     catch (const std::exception& e)
     {
@@ -300,6 +379,16 @@ void Vault::open(const std::string& dbuser, const std::string& dbpasswd, const s
                 }
             }
 
+            if (v < 23 && cv >= 23)
+            {
+                LOGGER(info) << "Building account ledgers..." << std::endl;
+                odb::core::session s;
+                odb::result<Account> r(db_->query<Account>());
+                std::vector<std::shared_ptr<Account>> accounts;
+                for (auto it = r.begin(); it != r.end(); ++it) { accounts.push_back(it.load()); }
+                for (auto& account: accounts) { rebuildLedger_unwrapped(account); }
+            }
+
             t.commit();
         }
 
@@ -311,8 +400,13 @@ void Vault::close()
     LOGGER(trace) << "Vault::close()" << std::endl;
 
     if (!db_) return;
-    boost::lock_guard<boost::mutex> lock(mutex);
+    stopPoolRefillThread();
+    VaultWriteLock lock(mutex);
+    boost::lock_guard<boost::shared_mutex> openLock(openMutex);
     db_.reset();
+    bPendingConfirmationsLoaded = false;
+    mapPendingConfirmations.clear();
+    invalidateMetadataCache();
 }
 
 uint32_t Vault::getSchemaVersion() const
@@ -320,7 +414,7 @@ uint32_t Vault::getSchemaVersion() const
     LOGGER(trace) << "Vault::getSchemaVersion()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getSchemaVersion_unwrapped();
@@ -336,7 +430,7 @@ void Vault::setSchemaVersion(uint32_t version)
 {
     LOGGER(trace) << "Vault::setSchemaVersion(" << version << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::transaction t(db_->begin());
     setSchemaVersion_unwrapped(version);
     t.commit();
@@ -363,7 +457,7 @@ std::string Vault::getNetwork() const
     LOGGER(trace) << "Vault::getNetwork()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getNetwork_unwrapped();
@@ -379,7 +473,7 @@ void Vault::setNetwork(const std::string& network)
 {
     LOGGER(trace) << "Vault::setNetwork(" << network << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::transaction t(db_->begin());
     setNetwork_unwrapped(network);
     t.commit();
@@ -409,7 +503,7 @@ uint32_t Vault::getHorizonTimestamp() const
     LOGGER(trace) << "Vault::getHorizonTimestamp()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getHorizonTimestamp_unwrapped();
@@ -420,7 +514,7 @@ uint32_t Vault::getMaxFirstBlockTimestamp() const
     LOGGER(trace) << "Vault::getMaxFirstBlockTimestamp()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getMaxFirstBlockTimestamp_unwrapped();
@@ -445,7 +539,7 @@ uint32_t Vault::getHorizonHeight() const
     LOGGER(trace) << "Vault::getHorizonHeight()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getHorizonHeight_unwrapped();
@@ -462,7 +556,7 @@ std::vector<bytes_t> Vault::getLocatorHashes() const
     LOGGER(trace) << "Vault::getLocatorHashes()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getLocatorHashes_unwrapped();
@@ -497,8 +591,11 @@ Coin::BloomFilter Vault::getBloomFilter(double falsePositiveRate, uint32_t nTwea
 {
     LOGGER(trace) << "Vault::getBloomFilter(" << falsePositiveRate << ", " << nTweak << ", " << nFlags << ")" << std::endl;
 
+    static metrics::histogram& elapsed = metrics::get_histogram("vault.bloom_filter");
+    metrics::scoped_timer timer(elapsed);
+
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -568,12 +665,46 @@ Coin::BloomFilter Vault::getBloomFilter_unwrapped(double falsePositiveRate, uint
     return filter;
 }
 
+void Vault::getCompactFilterElements(std::vector<bytes_t>& scripts, std::vector<Coin::OutPoint>& outpoints) const
+{
+    LOGGER(trace) << "Vault::getCompactFilterElements()" << std::endl;
+
+#if defined(LOCK_ALL_CALLS)
+    VaultReadLock lock(mutex);
+#endif
+    odb::core::session s;
+    odb::core::transaction t(db_->begin());
+    getCompactFilterElements_unwrapped(scripts, outpoints);
+}
+
+void Vault::getCompactFilterElements_unwrapped(std::vector<bytes_t>& scripts, std::vector<Coin::OutPoint>& outpoints) const
+{
+    scripts.clear();
+    outpoints.clear();
+
+    // Compact filters commit to whole output scripts, so unlike the bloom filter we match txoutscripts rather than payees.
+    {
+        odb::result<SigningScript> r(db_->query<SigningScript>());
+        for (auto& script: r) { scripts.push_back(script.txoutscript()); }
+    }
+
+    {
+        typedef odb::query<TxOut> query_t;
+        odb::result<TxOut> r(db_->query<TxOut>(query_t::sending_account != 0 && query_t::status == TxOut::UNSPENT));
+        for (auto& txout: r)
+        {
+            std::shared_ptr<Tx> tx = txout.tx();
+            if (tx) { outpoints.push_back(Coin::OutPoint(uchar_vector(tx->hash()).getReverse(), txout.txindex())); } // outpoints use wire order
+        }
+    }
+}
+
 hashvector_t Vault::getIncompleteBlockHashes() const
 {
     LOGGER(trace) << "Vault::getIncompleteBlockHashes()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -588,13 +719,35 @@ hashvector_t Vault::getIncompleteBlockHashes_unwrapped() const
     return hashes;
 }
 
-void Vault::exportVault(const std::string& filepath, bool exportprivkeys) const
+void Vault::exportVault(const std::string& filepath, bool exportprivkeys, archive_format_t format) const
 {
-    LOGGER(trace) << "Vault::exportVault(" << filepath << ", " << (exportprivkeys ? "true" : "false") << std::endl;
+    LOGGER(trace) << "Vault::exportVault(" << filepath << ", " << (exportprivkeys ? "true" : "false") << ", " << format << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
+    if (format != TEXT_ARCHIVE)
+    {
+        std::ofstream ofs(filepath, std::ios::binary);
+        BinaryArchiveWriter writer(ofs, format == COMPRESSED_BINARY_ARCHIVE);
+
+        odb::core::transaction t(db_->begin());
+        {
+            odb::core::session s;
+            odb::result<Account> account_r(db_->query<Account>());
+            for (auto& account: account_r)
+            {
+                exportAccount_unwrapped(account, writer, exportprivkeys);
+            }
+        }
+
+        // Merkle blocks and transactions open their own sessions per batch
+        exportMerkleBlocks_unwrapped(writer);
+        exportTxs_unwrapped(writer, 0);
+        writer.finish();
+        return;
+    }
+
     std::ofstream ofs(filepath);
     boost::archive::text_oarchive oa(ofs);
 
@@ -626,8 +779,24 @@ void Vault::importVault(const std::string& filepath, bool importprivkeys)
 {
     LOGGER(trace) << "Vault::importVault(" << filepath << ", " << (importprivkeys ? "true" : "false") << std::endl;
 
+    if (BinaryArchive::isBinaryArchive(filepath))
+    {
+        std::ifstream ifs(filepath, std::ios::binary);
+        BinaryArchiveReader reader(ifs);
+
+        {
+            VaultWriteLock lock(mutex);
+            unsigned int privkeysimported = importprivkeys;
+            unsigned int txcount;
+            importBinaryArchive(reader, privkeysimported, txcount);
+        }
+
+        flushSignals();
+        return;
+    }
+
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         std::ifstream ifs(filepath);
         boost::archive::text_iarchive ia(ifs);
 
@@ -657,7 +826,79 @@ void Vault::importVault(const std::string& filepath, bool importprivkeys)
         t.commit();
     }
 
-    signalQueue.flush();
+    flushSignals();
+}
+
+std::shared_ptr<Account> Vault::importBinaryArchive(BinaryArchiveReader& reader, unsigned int& privkeysimported, unsigned int& txcount)
+{
+    bool importprivkeys = (privkeysimported != 0);
+    unsigned int privkeys = 0;
+    unsigned int txs = 0;
+
+    std::shared_ptr<Account> account;
+    BinaryArchive::record_type_t type;
+    std::string payload;
+    try
+    {
+        // A bad record anywhere rolls back the whole archive. Records are inserted in
+        // batches of ARCHIVE_BATCH_SIZE per session so the object cache stays bounded.
+        odb::core::transaction t(db_->begin());
+        bool more = true;
+        while (more)
+        {
+            odb::core::session s;
+            for (uint32_t i = 0; i < ARCHIVE_BATCH_SIZE; i++)
+            {
+                if (!reader.readRecord(type, payload))
+                {
+                    more = false;
+                    break;
+                }
+
+                switch (type)
+                {
+                case BinaryArchive::ACCOUNT:
+                {
+                    std::shared_ptr<Account> imported(new Account());
+                    BinaryArchiveReader::read(payload, *imported);
+                    unsigned int n = importprivkeys;
+                    account = importAccount_unwrapped(imported, n);
+                    privkeys += n;
+                    break;
+                }
+                case BinaryArchive::MERKLEBLOCK:
+                {
+                    std::shared_ptr<MerkleBlock> merkleblock(new MerkleBlock());
+                    BinaryArchiveReader::read(payload, *merkleblock);
+                    insertMerkleBlock_unwrapped(merkleblock);
+                    break;
+                }
+                case BinaryArchive::TX:
+                {
+                    std::shared_ptr<Tx> tx(new Tx());
+                    BinaryArchiveReader::read(payload, *tx);
+                    insertTx_unwrapped(tx);
+                    txs++;
+                    break;
+                }
+                default:
+                    LOGGER(debug) << "Vault::importBinaryArchive - skipping unknown record type " << (int)type << "." << std::endl;
+                }
+            }
+        }
+        t.commit();
+    }
+    catch (...)
+    {
+        clearSignals();
+        throw;
+    }
+
+    privkeysimported = privkeys;
+    txcount = txs;
+
+    LOGGER(debug) << "Vault::importBinaryArchive - imported " << reader.record_count() << " record(s)." << std::endl;
+    return account;
 }
 
 
@@ -668,7 +909,7 @@ std::shared_ptr<Contact> Vault::newContact(const std::string& username)
 {
     LOGGER(trace) << "Vault::newContact(" << username << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::transaction t(db_->begin());
     std::shared_ptr<Contact> contact = newContact_unwrapped(username);
     t.commit();
@@ -690,7 +931,7 @@ std::shared_ptr<Contact> Vault::getContact(const std::string& username) const
     LOGGER(trace) << "Vault::getContact(" << username << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getContact_unwrapped(username);
@@ -712,7 +953,7 @@ ContactVector Vault::getAllContacts() const
     LOGGER(trace) << "Vault::getAllContacts()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getAllContacts_unwrapped();
@@ -733,7 +974,7 @@ bool Vault::contactExists(const std::string& username) const
     LOGGER(trace) << "Vault::contactExists(" << username << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return contactExists_unwrapped(username);
@@ -751,7 +992,7 @@ std::shared_ptr<Contact> Vault::renameContact(const std::string& old_username, c
 {
     LOGGER(trace) << "Vault::renameContact(" << old_username << ", " << new_username << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::transaction t(db_->begin());
     std::shared_ptr<Contact> contact = renameContact_unwrapped(old_username, new_username);
     t.commit();
@@ -782,7 +1023,7 @@ void Vault::exportKeychain(const std::string& keychain_name, const std::string&
     LOGGER(trace) << "Vault::exportKeychain(" << keychain_name << ", " << filepath << ", " << (exportprivkeys ? "true" : "false") << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     std::shared_ptr<Keychain> keychain = getKeychain_unwrapped(keychain_name);
@@ -802,11 +1043,12 @@ std::shared_ptr<Keychain> Vault::importKeychain(const std::string& filepath, boo
 {
     LOGGER(trace) << "Vault::importKeychain(" << filepath << ", " << (importprivkeys ? "true" : "false") << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
     std::shared_ptr<Keychain> keychain = importKeychain_unwrapped(filepath, importprivkeys);
     t.commit();
+    invalidateMetadataCache();
     return keychain;
 }
 
@@ -863,7 +1105,7 @@ bool Vault::keychainExists(const std::string& keychain_name) const
     LOGGER(trace) << "Vault::keychainExists(" << keychain_name << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return keychainExists_unwrapped(keychain_name);
@@ -880,7 +1122,7 @@ bool Vault::keychainExists(const bytes_t& keychain_hash) const
     LOGGER(trace) << "Vault::keychainExists(@hash = " << uchar_vector(keychain_hash).getHex() << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return keychainExists_unwrapped(keychain_hash);
@@ -922,7 +1164,7 @@ bool Vault::isKeychainPrivate(const std::string& keychain_name) const
     LOGGER(trace) << "Vault::isKeychainPrivate(" << keychain_name << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return isKeychainPrivate_unwrapped(keychain_name);
@@ -938,7 +1180,7 @@ std::shared_ptr<Keychain> Vault::newKeychain(const std::string& keychain_name, c
 {
     LOGGER(trace) << "Vault::newKeychain(" << keychain_name << ", ...)" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session session;
     odb::core::transaction t(db_->begin());
     {
@@ -953,6 +1195,7 @@ std::shared_ptr<Keychain> Vault::newKeychain(const std::string& keychain_name, c
     }
     persistKeychain_unwrapped(keychain);
     t.commit();
+    invalidateMetadataCache();
 
     return keychain;
 }
@@ -962,7 +1205,7 @@ void Vault::renameKeychain(const std::string& old_name, const std::string& new_n
     LOGGER(trace) << "Vault::renameKeychain(" << old_name << ", " << new_name << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
 #endif
     odb::core::session session;
     odb::core::transaction t(db_->begin());
@@ -980,6 +1223,7 @@ void Vault::renameKeychain(const std::string& old_name, const std::string& new_n
 
     db_->update(keychain);
     t.commit();
+    invalidateMetadataCache();
 }
 
 void Vault::persistKeychain_unwrapped(std::shared_ptr<Keychain> keychain)
@@ -1003,7 +1247,7 @@ std::vector<KeychainView> Vault::getRootKeychainViews(const std::string& account
     LOGGER(trace) << "Vault::getRootKeychainViews(" << account_name << ", " << (get_hidden ? "true" : "false") << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getRootKeychainViews_unwrapped(account_name, get_hidden);
@@ -1036,7 +1280,7 @@ secure_bytes_t Vault::exportBIP32(const std::string& keychain_name, bool export_
     LOGGER(trace) << "Vault::exportBIP32(" << keychain_name << ", " << (export_private ? "true" : "false") << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     std::shared_ptr<Keychain> keychain = getKeychain_unwrapped(keychain_name);
@@ -1054,7 +1298,7 @@ std::shared_ptr<Keychain> Vault::importBIP32(const std::string& keychain_name, c
 {
     LOGGER(trace) << "Vault::importKeychainExtendedKey(" << keychain_name << ", ...)" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session session;
     odb::core::transaction t(db_->begin());
     odb::result<Keychain> r(db_->query<Keychain>(odb::query<Keychain>::name == keychain_name));
@@ -1065,6 +1309,7 @@ std::shared_ptr<Keychain> Vault::importBIP32(const std::string& keychain_name, c
     keychain->importBIP32(extkey, lock_key);
     persistKeychain_unwrapped(keychain);
     t.commit();
+    invalidateMetadataCache();
 
     return keychain;
 }
@@ -1074,7 +1319,7 @@ secure_bytes_t Vault::exportBIP39(const std::string& keychain_name) const
     LOGGER(trace) << "Vault::exportBIP39(" << keychain_name << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     std::shared_ptr<Keychain> keychain = getKeychain_unwrapped(keychain_name);
@@ -1086,7 +1331,7 @@ void Vault::encryptKeychain(const std::string& keychain_name, const secure_bytes
 {
     LOGGER(trace) << "Vault::encryptKeychain(" << keychain_name << ", ...)" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
 
@@ -1094,14 +1339,15 @@ void Vault::encryptKeychain(const std::string& keychain_name, const secure_bytes
     unlockKeychain_unwrapped(keychain);
     keychain->encrypt(lock_key);
     updateKeychain_unwrapped(keychain);
-    t.commit(); 
+    t.commit();
+    invalidateMetadataCache();
 }
 
 void Vault::decryptKeychain(const std::string& keychain_name)
 {
     LOGGER(trace) << "Vault::unencryptKeychain(" << keychain_name << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
 
@@ -1109,14 +1355,15 @@ void Vault::decryptKeychain(const std::string& keychain_name)
     unlockKeychain_unwrapped(keychain);
     keychain->decrypt();
     updateKeychain_unwrapped(keychain);
-    t.commit(); 
+    t.commit();
+    invalidateMetadataCache();
 }
 
 void Vault::refillAccountPool(const std::string& account_name)
 {
     LOGGER(trace) << "Vault::refillAccountPool(" << account_name << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
     std::shared_ptr<Account> account = getAccount_unwrapped(account_name);
@@ -1134,7 +1381,7 @@ std::shared_ptr<Keychain> Vault::getKeychain(const std::string& keychain_name) c
     LOGGER(trace) << "Vault::getKeychain(" << keychain_name << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getKeychain_unwrapped(keychain_name);
@@ -1154,7 +1401,7 @@ std::vector<std::shared_ptr<Keychain>> Vault::getAllKeychains(bool root_only, bo
     LOGGER(trace) << "Vault::getAllKeychains()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     odb::query<Keychain> query(1 == 1);
@@ -1173,7 +1420,7 @@ void Vault::lockAllKeychains()
 {
     LOGGER(trace) << "Vault::lockAllKeychains()" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     mapPrivateKeyUnlock.clear();
     for (auto& item: mapPrivateKeyUnlock)
     {
@@ -1185,7 +1432,7 @@ void Vault::lockKeychain(const std::string& keychain_name)
 {
     LOGGER(trace) << "Vault::lockKeychain(" << keychain_name << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     mapPrivateKeyUnlock.erase(keychain_name);
     notifyKeychainLocked(keychain_name);
 }
@@ -1194,7 +1441,7 @@ void Vault::unlockKeychain(const std::string& keychain_name, const secure_bytes_
 {
     LOGGER(trace) << "Vault::unlockKeychain(" << keychain_name << ", ?)" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
 
@@ -1279,7 +1526,7 @@ bool Vault::isKeychainEncrypted(const std::string& keychain_name) const
 {
     LOGGER(trace) << "Vault::isKeychainEncrypted(" << keychain_name << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
 
@@ -1290,15 +1537,29 @@ bool Vault::isKeychainEncrypted(const std::string& keychain_name) const
 ////////////////////////
 // ACCOUNT OPERATIONS //
 ////////////////////////    
-void Vault::exportAccount(const std::string& account_name, const std::string& filepath, bool exportprivkeys) const
+void Vault::exportAccount(const std::string& account_name, const std::string& filepath, bool exportprivkeys, archive_format_t format) const
 {
-    LOGGER(trace) << "Vault::exportAccount(" << account_name << ", " << filepath << ", " << (exportprivkeys ? "true" : "false") << ", ?)" << std::endl;
+    LOGGER(trace) << "Vault::exportAccount(" << account_name << ", " << filepath << ", " << (exportprivkeys ? "true" : "false") << ", " << format << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
 
     // TODO: disallow operation if file is already open
+    if (format != TEXT_ARCHIVE)
+    {
+        std::ofstream ofs(filepath, std::ios::binary);
+        BinaryArchiveWriter writer(ofs, format == COMPRESSED_BINARY_ARCHIVE);
+
+        odb::core::session s;
+        odb::core::transaction t(db_->begin());
+        std::shared_ptr<Account> account = getAccount_unwrapped(account_name);
+
+        exportAccount_unwrapped(*account, writer, exportprivkeys);
+        writer.finish();
+        return;
+    }
+
     std::ofstream ofs(filepath);
     boost::archive::text_oarchive oa(ofs);
 
@@ -1317,23 +1578,48 @@ void Vault::exportAccount_unwrapped(Account& account, boost::archive::text_oarch
     oa << account;
 }
 
+void Vault::exportAccount_unwrapped(Account& account, BinaryArchiveWriter& writer, bool exportprivkeys) const
+{
+    if (!exportprivkeys)
+        for (auto& keychain: account.keychains()) { keychain->clearPrivateKey(); }
+
+    writer.write(BinaryArchive::ACCOUNT, account);
+}
+
 std::shared_ptr<Account> Vault::importAccount(const std::string& filepath, unsigned int& privkeysimported)
 {
     LOGGER(trace) << "Vault::importAccount(" << filepath << ", " << privkeysimported << ")" << std::endl;
 
+    if (BinaryArchive::isBinaryArchive(filepath))
+    {
+        std::ifstream ifs(filepath, std::ios::binary);
+        BinaryArchiveReader reader(ifs);
+
+        std::shared_ptr<Account> account;
+        {
+            VaultWriteLock lock(mutex);
+            unsigned int txcount;
+            account = importBinaryArchive(reader, privkeysimported, txcount);
+        }
+
+        flushSignals();
+        if (!account) throw std::runtime_error("Vault::importAccount() - archive does not contain an account.");
+        return account;
+    }
+
     std::ifstream ifs(filepath);
     boost::archive::text_iarchive ia(ifs);
 
     std::shared_ptr<Account> account;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         account = importAccount_unwrapped(ia, privkeysimported);
         t.commit();
     }
 
-    signalQueue.flush();
+    flushSignals();
     return account; 
 }
 
@@ -1341,7 +1627,11 @@ std::shared_ptr<Account> Vault::importAccount_unwrapped(boost::archive::text_iar
 {
     std::shared_ptr<Account> account(new Account());
     ia >> *account;
+    return importAccount_unwrapped(account, privkeysimported);
+}
 
+std::shared_ptr<Account> Vault::importAccount_unwrapped(std::shared_ptr<Account> account, unsigned int& privkeysimported)
+{
     odb::result<Account> r(db_->query<Account>(odb::query<Account>::hash == account->hash()));
     if (!r.empty()) throw AccountAlreadyExistsException(r.begin().load()->name());
 
@@ -1446,7 +1736,7 @@ bool Vault::accountExists(const std::string& account_name) const
     LOGGER(trace) << "Vault::accountExists(" << account_name << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return accountExists_unwrapped(account_name);
@@ -1488,7 +1778,7 @@ void Vault::newAccount(const std::string& account_name, unsigned int minsigs, co
 {
     LOGGER(trace) << "Vault::newAccount(" << account_name << ", " << minsigs << " of [" << stdutils::delimited_list(keychain_names, ", ") << "], " << unused_pool_size << ", " << time_created << (use_witness ? "true" : "false") << ", " << (use_witness_p2sh ? "true" : "false") << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
     odb::result<Account> r(db_->query<Account>(odb::query<Account>::name == account_name));
@@ -1529,6 +1819,7 @@ void Vault::newAccount(const std::string& account_name, unsigned int minsigs, co
     db_->update(defaultAccountBin);
     db_->update(account);
     t.commit();
+    invalidateMetadataCache();
 }
 
 void Vault::newAccount(bool use_witness, bool use_witness_p2sh, const std::string& account_name, unsigned int minsigs, const std::vector<std::string>& keychain_names, uint32_t unused_pool_size, uint32_t time_created, bool compressed_keys)
@@ -1541,7 +1832,7 @@ void Vault::renameAccount(const std::string& old_name, const std::string& new_na
     LOGGER(trace) << "Vault::renameAccount(" << old_name << ", " << new_name << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
 #endif
     odb::core::session session;
     odb::core::transaction t(db_->begin());
@@ -1559,6 +1850,7 @@ void Vault::renameAccount(const std::string& old_name, const std::string& new_na
 
     db_->update(account);
     t.commit();
+    invalidateMetadataCache();
 }
 
 std::shared_ptr<Account> Vault::getAccount(const std::string& account_name) const
@@ -1566,7 +1858,7 @@ std::shared_ptr<Account> Vault::getAccount(const std::string& account_name) cons
     LOGGER(trace) << "Vault::getAccount(" << account_name << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getAccount_unwrapped(account_name);
@@ -1586,7 +1878,7 @@ std::vector<TxOutView> Vault::getUnspentTxOutViews(const std::string& account_na
     LOGGER(trace) << "Vault::getUnspentTxOutViews(" << account_name << ", " << min_confirmations << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -1617,7 +1909,7 @@ AccountInfo Vault::getAccountInfo(const std::string& account_name) const
     LOGGER(trace) << "Vault::getAccountInfo(" << account_name << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -1630,10 +1922,15 @@ std::vector<AccountInfo> Vault::getAllAccountInfo() const
     LOGGER(trace) << "Vault::getAllAccountInfo()" << std::endl;
  
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
+    return getAllAccountInfo_unwrapped();
+}
+
+std::vector<AccountInfo> Vault::getAllAccountInfo_unwrapped() const
+{
     odb::result<Account> r(db_->query<Account>());
     std::vector<AccountInfo> accountInfoVector;
     for (auto& account: r) { accountInfoVector.push_back(account.accountInfo()); }
@@ -1644,12 +1941,16 @@ uint64_t Vault::getAccountBalance(const std::string& account_name, unsigned int
 {
     LOGGER(trace) << "Vault::getAccountBalance(" << account_name << ", " << min_confirmations << ")" << std::endl;
 
-    std::vector<Tx::status_t> tx_statuses = Tx::getStatusFlags(tx_flags);
-
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
+    return getAccountBalance_unwrapped(account_name, min_confirmations, tx_flags);
+}
+
+uint64_t Vault::getAccountBalance_unwrapped(const std::string& account_name, unsigned int min_confirmations, int tx_flags) const
+{
+    std::vector<Tx::status_t> tx_statuses = Tx::getStatusFlags(tx_flags);
     typedef odb::query<BalanceView> query_t;
     query_t query(query_t::Account::name == account_name && query_t::TxOut::status == TxOut::UNSPENT && query_t::Tx::status.in_range(tx_statuses.begin(), tx_statuses.end()));
     if (min_confirmations > 0)
@@ -1669,7 +1970,7 @@ std::shared_ptr<AccountBin> Vault::addAccountBin(const std::string& account_name
     if (bin_name.empty() || bin_name[0] == '@') throw std::runtime_error("Invalid account bin name.");
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -1700,6 +2001,7 @@ std::shared_ptr<AccountBin> Vault::addAccountBin(const std::string& account_name
     db_->update(bin);
     db_->update(account);
     t.commit();
+    invalidateMetadataCache();
 
     return bin;
 }
@@ -1708,7 +2010,7 @@ std::shared_ptr<SigningScript> Vault::issueSigningScript(const std::string& acco
 {
     LOGGER(trace) << "Vault::issueSigningScript(" << account_name << ", " << bin_name << ", " << label << ", " << index << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
     if (!accountExists_unwrapped(account_name)) throw AccountNotFoundException(account_name);
@@ -1734,6 +2036,7 @@ std::shared_ptr<SigningScript> Vault::issueSigningScript(const std::string& acco
         db_->update(script);
     }
     t.commit();
+    invalidateMetadataCache();
     return script;
 }
 
@@ -1771,12 +2074,15 @@ std::shared_ptr<SigningScript> Vault::issueAccountBinSigningScript_unwrapped(std
 
 void Vault::refillAccountBinPool_unwrapped(std::shared_ptr<AccountBin> bin, uint32_t index)
 {
-    // get largest signing script index that is not unused
+    // get largest signing script index that is not unused and the number of unused scripts
     typedef odb::query<ScriptCountView> count_query_t;
     odb::result<ScriptCountView> count_result(db_->query<ScriptCountView>(count_query_t::AccountBin::id == bin->id() && count_query_t::SigningScript::status != SigningScript::UNUSED));
     uint32_t max_index = count_result.empty() ? 0 : count_result.begin()->max_index;
     uint32_t max_unused_index = (index > max_index) ? index : max_index;
 
+    count_result = db_->query<ScriptCountView>(count_query_t::AccountBin::id == bin->id() && count_query_t::SigningScript::status == SigningScript::UNUSED);
+    uint32_t unused_count = count_result.empty() ? 0 : count_result.begin()->count;
+
     if (max_unused_index > 0)
     {
         // update any unused signing scripts with smaller index to issued status
@@ -1788,35 +2094,167 @@ void Vault::refillAccountBinPool_unwrapped(std::shared_ptr<AccountBin> bin, uint
             std::shared_ptr<SigningScript> script(db_->load<SigningScript>(script_view.id));
             script->status(SigningScript::ISSUED);
             db_->update(script);
+            unused_count--;
         }
     }
 
     // create any additional scripts to have all up to specified index issued
-    if (index > max_index)
+    if (index > bin->script_count())
     {
-        count_result = db_->query<ScriptCountView>();
-        uint32_t count = count_result.empty() ? 0 : count_result.begin().load()->count;
-        for (uint32_t i = count + 1; i < index; i++)
+        SigningScriptVector scripts = bin->newSigningScripts(index - bin->script_count());
+        for (auto& script: scripts) { script->status(SigningScript::ISSUED); }
+        persistSigningScripts_unwrapped(scripts);
+    }
+
+    // refill remaining pool. callers only wait on derivation if background refill is off or the pool is empty.
+    uint32_t unused_pool_size = bin->unused_pool_size();
+    if (unused_count < unused_pool_size)
+    {
+        if (bBackgroundPoolRefill && unused_count > 0)
         {
-            std::shared_ptr<SigningScript> script = bin->newSigningScript();
-            script->status(SigningScript::ISSUED);
-            for (auto& key: script->keys()) { db_->persist(key); }
-            db_->persist(script); 
+            scheduleAccountBinPoolRefill(bin->id());
+        }
+        else
+        {
+            persistSigningScripts_unwrapped(bin->newSigningScripts(unused_pool_size - unused_count));
         }
     }
+    db_->update(bin);
+}
 
-    // refill remaining pool
-    count_result = db_->query<ScriptCountView>(count_query_t::AccountBin::id == bin->id() && count_query_t::SigningScript::status == SigningScript::UNUSED);
-    uint32_t count = count_result.empty() ? 0 : count_result.begin().load()->count;
-
-    uint32_t unused_pool_size = bin->account() ? bin->account()->unused_pool_size() : DEFAULT_UNUSED_POOL_SIZE;
-    for (uint32_t i = count; i < unused_pool_size; i++)
+void Vault::persistSigningScripts_unwrapped(const SigningScriptVector& scripts)
+{
+    // ODB keeps one prepared insert statement per class on the connection, so these are not reparsed
+    for (auto& script: scripts)
     {
-        std::shared_ptr<SigningScript> script = bin->newSigningScript();
         for (auto& key: script->keys()) { db_->persist(key); }
-        db_->persist(script); 
-    } 
-    db_->update(bin);
+        db_->persist(script);
+    }
+}
+
+uint32_t Vault::getAccountBinPoolShortfall_unwrapped(std::shared_ptr<AccountBin> bin) const
+{
+    typedef odb::query<ScriptCountView> count_query_t;
+    odb::result<ScriptCountView> count_result(db_->query<ScriptCountView>(count_query_t::AccountBin::id == bin->id() && count_query_t::SigningScript::status == SigningScript::UNUSED));
+    uint32_t unused_count = count_result.empty() ? 0 : count_result.begin()->count;
+    uint32_t unused_pool_size = bin->unused_pool_size();
+    return (unused_count < unused_pool_size) ? unused_pool_size - unused_count : 0;
+}
+
+void Vault::setBackgroundPoolRefill(bool enabled)
+{
+    LOGGER(trace) << "Vault::setBackgroundPoolRefill(" << (enabled ? "true" : "false") << ")" << std::endl;
+
+    if (!enabled) { stopPoolRefillThread(); }
+
+    {
+        VaultWriteLock lock(mutex);
+        bBackgroundPoolRefill = enabled;
+    }
+
+    if (enabled)
+    {
+        boost::lock_guard<boost::mutex> lock(poolRefillMutex);
+        if (!poolRefillThread.joinable())
+        {
+            bStopPoolRefill = false;
+            poolRefillThread = boost::thread(&Vault::poolRefillLoop, this);
+        }
+    }
+}
+
+void Vault::scheduleAccountBinPoolRefill(unsigned long bin_id)
+{
+    boost::lock_guard<boost::mutex> lock(poolRefillMutex);
+    poolRefillBinIds.insert(bin_id);
+    poolRefillCondition.notify_one();
+}
+
+void Vault::stopPoolRefillThread()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(poolRefillMutex);
+        if (!poolRefillThread.joinable()) return;
+        bStopPoolRefill = true;
+        poolRefillCondition.notify_one();
+    }
+
+    poolRefillThread.join();
+
+    boost::lock_guard<boost::mutex> lock(poolRefillMutex);
+    poolRefillBinIds.clear();
+}
+
+void Vault::poolRefillLoop()
+{
+    while (true)
+    {
+        unsigned long bin_id;
+        {
+            boost::unique_lock<boost::mutex> lock(poolRefillMutex);
+            while (!bStopPoolRefill && poolRefillBinIds.empty()) { poolRefillCondition.wait(lock); }
+            if (bStopPoolRefill) return;
+            bin_id = *poolRefillBinIds.begin();
+            poolRefillBinIds.erase(poolRefillBinIds.begin());
+        }
+
+        try
+        {
+            refillAccountBinPoolInBackground(bin_id);
+        }
+        catch (const std::exception& e)
+        {
+            LOGGER(error) << "Vault::poolRefillLoop - failed to refill account bin " << bin_id << ": " << e.what() << std::endl;
+        }
+    }
+}
+
+void Vault::refillAccountBinPoolInBackground(unsigned long bin_id)
+{
+    LOGGER(trace) << "Vault::refillAccountBinPoolInBackground(" << bin_id << ")" << std::endl;
+
+    // Read what needs deriving, then derive without holding any lock. The bin only holds
+    // its account weakly and the session owns it, so copy what derivation needs first.
+    std::shared_ptr<AccountBin> bin;
+    std::vector<std::shared_ptr<Keychain>> keychains;
+    bool compressed_keys;
+    uint32_t first_index;
+    uint32_t count;
+    {
+        VaultReadLock lock(mutex);
+        odb::core::session s;
+        odb::core::transaction t(db_->begin());
+        bin = db_->find<AccountBin>(bin_id);
+        if (!bin) return;
+        std::shared_ptr<Account> account = bin->account();
+        if (!account) throw std::runtime_error("Vault::refillAccountBinPoolInBackground - account bin has no account.");
+        first_index = bin->script_count();
+        count = getAccountBinPoolShortfall_unwrapped(bin);
+        keychains.assign(bin->keychains().begin(), bin->keychains().end());
+        compressed_keys = account->compressed_keys();
+    }
+    if (count == 0) return;
+
+    std::vector<KeyVector> keys = AccountBin::deriveSigningKeys(keychains, compressed_keys, first_index, count);
+
+    {
+        VaultWriteLock lock(mutex);
+        odb::core::session s;
+        odb::core::transaction t(db_->begin());
+        bin = db_->find<AccountBin>(bin_id);
+        if (!bin) return;
+
+        // A synchronous refill got there first. The keys are stale.
+        if (bin->script_count() != first_index) return;
+
+        count = getAccountBinPoolShortfall_unwrapped(bin);
+        if (count < keys.size()) { keys.resize(count); }
+        persistSigningScripts_unwrapped(bin->newSigningScripts(keys));
+        db_->update(bin);
+        t.commit();
+    }
+
+    LOGGER(debug) << "Vault::refillAccountBinPoolInBackground - added " << keys.size() << " script(s) to account bin " << bin_id << "." << std::endl;
 }
 
 std::vector<SigningScriptView> Vault::getSigningScriptViews(const std::string& account_name, const std::string& bin_name, int flags) const
@@ -1832,7 +2270,7 @@ std::vector<SigningScriptView> Vault::getSigningScriptViews(const std::string& a
     query += "ORDER BY" + query_t::Account::name + "ASC," + query_t::AccountBin::name + "ASC," + query_t::SigningScript::status + "DESC," + query_t::SigningScript::index + "ASC";
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -1843,10 +2281,8 @@ std::vector<SigningScriptView> Vault::getSigningScriptViews(const std::string& a
     return views;
 }
 
-std::vector<TxOutView> Vault::getTxOutViews(const std::string& account_name, const std::string& bin_name, int role_flags, int txout_status_flags, int tx_status_flags, bool hide_change) const
+static odb::query<TxOutView> getTxOutViewFilterQuery(const std::string& account_name, const std::string& bin_name, int role_flags, int txout_status_flags, int tx_status_flags, bool hide_change)
 {
-    LOGGER(trace) << "Vault::getTxOutViews(" << account_name << ", " << bin_name << ", " << TxOut::getRoleString(role_flags) << ", " << TxOut::getStatusString(txout_status_flags) << ", " << ", " << Tx::getStatusString(tx_status_flags) << ")" << std::endl;
-
     typedef odb::query<TxOutView> query_t;
     query_t query(query_t::receiving_account::id != 0 || query_t::sending_account::id != 0);
     if (!account_name.empty())
@@ -1868,12 +2304,26 @@ std::vector<TxOutView> Vault::getTxOutViews(const std::string& account_name, con
         query = (query && query_t::Tx::status.in_range(tx_statuses.begin(), tx_statuses.end()));
     }
 
-    query += "ORDER BY" + query_t::BlockHeader::height + "DESC," + query_t::Tx::timestamp + "DESC," + query_t::Tx::id + "DESC";
+    return query;
+}
+
+std::vector<TxOutView> Vault::getTxOutViews(const std::string& account_name, const std::string& bin_name, int role_flags, int txout_status_flags, int tx_status_flags, bool hide_change) const
+{
+    LOGGER(trace) << "Vault::getTxOutViews(" << account_name << ", " << bin_name << ", " << TxOut::getRoleString(role_flags) << ", " << TxOut::getStatusString(txout_status_flags) << ", " << ", " << Tx::getStatusString(tx_status_flags) << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
+    return getTxOutViews_unwrapped(account_name, bin_name, role_flags, txout_status_flags, tx_status_flags, hide_change);
+}
+
+std::vector<TxOutView> Vault::getTxOutViews_unwrapped(const std::string& account_name, const std::string& bin_name, int role_flags, int txout_status_flags, int tx_status_flags, bool hide_change) const
+{
+    typedef odb::query<TxOutView> query_t;
+    query_t query(getTxOutViewFilterQuery(account_name, bin_name, role_flags, txout_status_flags, tx_status_flags, hide_change));
+    query += "ORDER BY" + query_t::BlockHeader::height + "DESC," + query_t::Tx::timestamp + "DESC," + query_t::Tx::id + "DESC";
+
     std::vector<TxOutView> views;
     odb::result<TxOutView> r(db_->query<TxOutView>(query));
     for (auto& view: r)
@@ -1886,41 +2336,139 @@ std::vector<TxOutView> Vault::getTxOutViews(const std::string& account_name, con
 }
 
 
-////////////////////////////
-// ACCOUNT BIN OPERATIONS //
-////////////////////////////    
-std::shared_ptr<AccountBin> Vault::getAccountBin(const std::string& account_name, const std::string& bin_name) const
+std::vector<TxOutView> Vault::getTxOutViewsPage(const HistoryFilter& filter, HistoryCursor& cursor, unsigned int count) const
 {
-    LOGGER(trace) << "Vault::getAccountBin(" << account_name << ", " << bin_name << ")" << std::endl;
+    LOGGER(trace) << "Vault::getTxOutViewsPage(" << filter.account_name << ", " << filter.bin_name << ", " << TxOut::getRoleString(filter.role_flags) << ", " << TxOut::getStatusString(filter.txout_status_flags) << ", " << Tx::getStatusString(filter.tx_status_flags) << ", " << cursor.token() << ", " << count << ")" << std::endl;
+
+    if (cursor.isEnd() || count == 0) return std::vector<TxOutView>();
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
-    odb::core::session s;
     odb::core::transaction t(db_->begin());
-    std::shared_ptr<AccountBin> bin = getAccountBin_unwrapped(account_name, bin_name);
-    return bin; 
+    return getTxOutViewsPage_unwrapped(filter, cursor, count);
 }
 
-std::shared_ptr<AccountBin> Vault::getAccountBin_unwrapped(const std::string& account_name, const std::string& bin_name) const
+std::vector<TxOutView> Vault::getTxOutViewsPage_unwrapped(const HistoryFilter& filter, HistoryCursor& cursor, unsigned int count) const
 {
-    typedef odb::query<AccountBin> query_t;
-    query_t query(query_t::name == bin_name);
-    if (account_name.empty())   { query = query && query_t::account.is_null();              }
-    else                        { query = query && query_t::account->name == account_name;  }
-    odb::result<AccountBin> r(db_->query<AccountBin>(query));
-    if (r.empty()) throw AccountBinNotFoundException(account_name, bin_name);
-    return r.begin().load();
-}
+    std::vector<TxOutView> views;
+    if (cursor.isEnd() || count == 0) return views;
+
+    typedef odb::query<TxOutView> query_t;
+    query_t query(getTxOutViewFilterQuery(filter.account_name, filter.bin_name, filter.role_flags, filter.txout_status_flags, filter.tx_status_flags, filter.hide_change));
+    if (filter.min_timestamp)                   query = (query && query_t::Tx::timestamp >= filter.min_timestamp);
+    if (filter.max_timestamp)                   query = (query && query_t::Tx::timestamp <= filter.max_timestamp);
+    if (!cursor.isStart())
+    {
+        query = (query && (query_t::Tx::timestamp < cursor.timestamp() ||
+            (query_t::Tx::timestamp == cursor.timestamp() && (query_t::Tx::id < cursor.tx_id() ||
+            (query_t::Tx::id == cursor.tx_id() && query_t::TxOut::id < cursor.txout_id())))));
+    }
+
+    // Fetch one extra row to find out whether this is the last page
+    std::stringstream limit;
+    limit << "LIMIT " << (count + 1);
+    query += "ORDER BY" + query_t::Tx::timestamp + "DESC," + query_t::Tx::id + "DESC," + query_t::TxOut::id + "DESC " + limit.str().c_str();
+
+    odb::result<TxOutView> r(db_->query<TxOutView>(query));
+    unsigned int rows = 0;
+    for (auto& view: r)
+    {
+        if (rows++ == count) return views;
+
+        cursor.advance(view.tx_timestamp, view.tx_id, view.id);
+        view.updateRole(filter.role_flags);
+        std::vector<TxOutView> split_views = view.getSplitRoles(TxOut::ROLE_RECEIVER, filter.account_name);
+        for (auto& split_view: split_views) { views.push_back(split_view); }
+    }
+
+    cursor.setEnd();
+    return views;
+}
+
+std::vector<TxOutView> Vault::getTxOutViewsForTxs(const std::string& account_name, const std::set<unsigned long>& tx_ids, int role_flags, int txout_status_flags, bool hide_change) const
+{
+    LOGGER(trace) << "Vault::getTxOutViewsForTxs(" << account_name << ", " << tx_ids.size() << " txs, " << TxOut::getRoleString(role_flags) << ", " << TxOut::getStatusString(txout_status_flags) << ")" << std::endl;
+
+    if (tx_ids.empty()) return std::vector<TxOutView>();
+
+#if defined(LOCK_ALL_CALLS)
+    VaultReadLock lock(mutex);
+#endif
+    odb::core::transaction t(db_->begin());
+    return getTxOutViewsForTxs_unwrapped(account_name, tx_ids, role_flags, txout_status_flags, hide_change);
+}
+
+std::vector<TxOutView> Vault::getTxOutViewsForTxs_unwrapped(const std::string& account_name, const std::set<unsigned long>& tx_ids, int role_flags, int txout_status_flags, bool hide_change) const
+{
+    std::vector<TxOutView> views;
+    if (tx_ids.empty()) return views;
+
+    typedef odb::query<TxOutView> query_t;
+    query_t filter_query(getTxOutViewFilterQuery(account_name, "", role_flags, txout_status_flags, Tx::ALL, hide_change));
+
+    // Keep the IN lists well below the sqlite host parameter limit
+    const std::size_t BATCH_SIZE = 500;
+    std::vector<unsigned long> ids(tx_ids.begin(), tx_ids.end());
+    for (std::size_t i = 0; i < ids.size(); i += BATCH_SIZE)
+    {
+        auto end = ids.begin() + std::min(i + BATCH_SIZE, ids.size());
+        query_t query(filter_query && query_t::Tx::id.in_range(ids.begin() + i, end));
+        query += "ORDER BY" + query_t::Tx::id + "DESC," + query_t::TxOut::id + "ASC";
+
+        odb::result<TxOutView> r(db_->query<TxOutView>(query));
+        for (auto& view: r)
+        {
+            view.updateRole(role_flags);
+            std::vector<TxOutView> split_views = view.getSplitRoles(TxOut::ROLE_RECEIVER, account_name);
+            for (auto& split_view: split_views) { views.push_back(split_view); }
+        }
+    }
+    return views;
+}
+
+
+
+////////////////////////////
+// ACCOUNT BIN OPERATIONS //
+////////////////////////////    
+std::shared_ptr<AccountBin> Vault::getAccountBin(const std::string& account_name, const std::string& bin_name) const
+{
+    LOGGER(trace) << "Vault::getAccountBin(" << account_name << ", " << bin_name << ")" << std::endl;
+
+#if defined(LOCK_ALL_CALLS)
+    VaultReadLock lock(mutex);
+#endif
+    odb::core::session s;
+    odb::core::transaction t(db_->begin());
+    std::shared_ptr<AccountBin> bin = getAccountBin_unwrapped(account_name, bin_name);
+    return bin; 
+}
+
+std::shared_ptr<AccountBin> Vault::getAccountBin_unwrapped(const std::string& account_name, const std::string& bin_name) const
+{
+    typedef odb::query<AccountBin> query_t;
+    query_t query(query_t::name == bin_name);
+    if (account_name.empty())   { query = query && query_t::account.is_null();              }
+    else                        { query = query && query_t::account->name == account_name;  }
+    odb::result<AccountBin> r(db_->query<AccountBin>(query));
+    if (r.empty()) throw AccountBinNotFoundException(account_name, bin_name);
+    return r.begin().load();
+}
 
 std::vector<AccountBinView> Vault::getAllAccountBinViews() const
 {
     LOGGER(trace) << "Vault::getAllAccountBinViews()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
+    return getAllAccountBinViews_unwrapped();
+}
+
+std::vector<AccountBinView> Vault::getAllAccountBinViews_unwrapped() const
+{
     odb::result<AccountBinView> r(db_->query<AccountBinView>());
     std::vector<AccountBinView> views;
     for (auto& view: r) { views.push_back(view); }
@@ -1932,7 +2480,7 @@ void Vault::exportAccountBin(const std::string& account_name, const std::string&
     LOGGER(trace) << "Vault::exportAccountBin(" << account_name << ", " << bin_name << ", " << filepath << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -1952,11 +2500,12 @@ std::shared_ptr<AccountBin> Vault::importAccountBin(const std::string& filepath)
 {
     LOGGER(trace) << "Vault::importAccountBin(" << filepath << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
     std::shared_ptr<AccountBin> bin = importAccountBin_unwrapped(filepath);
     t.commit();
+    invalidateMetadataCache();
     return bin;
 }
 
@@ -2054,7 +2603,7 @@ std::shared_ptr<Tx> Vault::getTx(const bytes_t& hash) const
     LOGGER(trace) << "Vault::getTx(" << uchar_vector(hash).getHex() << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -2075,7 +2624,7 @@ std::shared_ptr<Tx> Vault::getTx(unsigned long tx_id) const
     LOGGER(trace) << "Vault::getTx(" << tx_id << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -2096,7 +2645,7 @@ txs_t Vault::getTxs(int tx_status_flags, unsigned long start, int count, uint32_
     LOGGER(trace) << "Vault::getTxs(" << Tx::getStatusString(tx_status_flags) << ", " << start << ", " << count << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -2138,7 +2687,7 @@ std::vector<std::string> Vault::getSerializedUnsignedTxs(const std::string& acco
     LOGGER(trace) << "Vault::getSerializedUnsignedTxs(" << account_name << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -2166,7 +2715,7 @@ uint32_t Vault::getTxConfirmations(const bytes_t& hash) const
     LOGGER(trace) << "Vault::getTxConfirmations(" << uchar_vector(hash).getHex() << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -2179,7 +2728,7 @@ uint32_t Vault::getTxConfirmations(unsigned long tx_id) const
     LOGGER(trace) << "Vault::getTxConfirmations(" << tx_id << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -2192,7 +2741,7 @@ uint32_t Vault::getTxConfirmations(std::shared_ptr<Tx> tx) const
     LOGGER(trace) << "Vault::getTxConfirmations(tx: " << uchar_vector(tx->hash()).getHex() << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -2209,6 +2758,15 @@ std::vector<TxView> Vault::getTxViews(int tx_status_flags, unsigned long start,
 {
     LOGGER(trace) << "Vault::getTxViews(" << Tx::getStatusString(tx_status_flags) << ", " << start << ", " << count << ")" << std::endl;
 
+#if defined(LOCK_ALL_CALLS)
+    VaultReadLock lock(mutex);
+#endif
+    odb::core::transaction t(db_->begin());
+    return getTxViews_unwrapped(tx_status_flags, start, count, minheight);
+}
+
+std::vector<TxView> Vault::getTxViews_unwrapped(int tx_status_flags, unsigned long start, int count, uint32_t minheight) const
+{
     typedef odb::query<TxView> query_t;
     query_t query (1 == 1);
     if (tx_status_flags != Tx::ALL)
@@ -2231,29 +2789,71 @@ std::vector<TxView> Vault::getTxViews(int tx_status_flags, unsigned long start,
         query = query + ss.str().c_str();
     }
 
-#if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
-#endif
-    odb::core::transaction t(db_->begin());
     std::vector<TxView> views;
     odb::result<TxView> r(db_->query<TxView>(query));
     for (auto& view: r) { views.push_back(view); }
     return views; 
 }
 
+std::vector<TxView> Vault::getTxViewsPage(const HistoryFilter& filter, HistoryCursor& cursor, unsigned int count) const
+{
+    LOGGER(trace) << "Vault::getTxViewsPage(" << Tx::getStatusString(filter.tx_status_flags) << ", " << cursor.token() << ", " << count << ")" << std::endl;
+
+    std::vector<TxView> views;
+    if (cursor.isEnd() || count == 0) return views;
+
+    typedef odb::query<TxView> query_t;
+    query_t query (1 == 1);
+    if (filter.tx_status_flags != Tx::ALL)
+    {
+        std::vector<Tx::status_t> tx_statuses = Tx::getStatusFlags(filter.tx_status_flags);
+        query = query && query_t::Tx::status.in_range(tx_statuses.begin(), tx_statuses.end());
+    }
+    if (filter.min_timestamp)   query = (query && query_t::Tx::timestamp >= filter.min_timestamp);
+    if (filter.max_timestamp)   query = (query && query_t::Tx::timestamp <= filter.max_timestamp);
+    if (!cursor.isStart())
+    {
+        query = (query && (query_t::Tx::timestamp < cursor.timestamp() ||
+            (query_t::Tx::timestamp == cursor.timestamp() && query_t::Tx::id < cursor.tx_id())));
+    }
+
+    std::stringstream limit;
+    limit << "LIMIT " << (count + 1);
+    query += "ORDER BY" + query_t::Tx::timestamp + "DESC," + query_t::Tx::id + "DESC " + limit.str().c_str();
+
+#if defined(LOCK_ALL_CALLS)
+    VaultReadLock lock(mutex);
+#endif
+    odb::core::transaction t(db_->begin());
+    odb::result<TxView> r(db_->query<TxView>(query));
+    for (auto& view: r)
+    {
+        if (views.size() == count) return views;
+
+        cursor.advance(view.timestamp, view.id);
+        views.push_back(view);
+    }
+
+    cursor.setEnd();
+    return views;
+}
+
 std::shared_ptr<Tx> Vault::insertTx(std::shared_ptr<Tx> tx, bool replace_labels)
 {
     LOGGER(trace) << "Vault::insertTx(...) - hash: " << uchar_vector(tx->hash()).getHex() << ", unsigned hash: " << uchar_vector(tx->unsigned_hash()).getHex() << ", replace_labels: " << (replace_labels ? "true" : "false") << std::endl;
 
+    static metrics::histogram& elapsed = metrics::get_histogram("vault.insert_tx");
+    metrics::scoped_timer timer(elapsed);
+
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         tx = insertTx_unwrapped(tx, replace_labels);
         if (tx) t.commit();
     }
 
-    signalQueue.flush();
+    flushSignals();
     return tx;
 }
 
@@ -2412,7 +3012,7 @@ std::shared_ptr<Tx> Vault::insertTx_unwrapped(std::shared_ptr<Tx> tx, bool repla
             if (!updated) return nullptr;
 
             updateConfirmations_unwrapped(stored_tx);
-            signalQueue.push(notifyTxUpdated.bind(stored_tx));
+            queueTxUpdated(stored_tx);
             return stored_tx;
         }
 
@@ -2573,7 +3173,7 @@ LOGGER(trace) << "txoutscript!!! " << uchar_vector(txoutscript).getHex() << std:
                 {
                     conflicting_tx->conflicting(true);
                     db_->update(conflicting_tx);
-                    signalQueue.push(notifyTxUpdated.bind(conflicting_tx));
+                    queueTxUpdated(conflicting_tx);
                     //notifyTxUpdated(conflicting_tx);
                 }
             }
@@ -2594,10 +3194,11 @@ LOGGER(trace) << "txoutscript!!! " << uchar_vector(txoutscript).getHex() << std:
             // Update other affected objects
             for (auto& txin:        updated_txins)  { db_->update(txin);        }
             for (auto& txout:       updated_txouts) { db_->update(txout);       }
-            for (auto& tx:          updated_txs)    { db_->update(tx);          }
+            for (auto& tx:          updated_txs)    { db_->update(tx); updateLedger_unwrapped(tx); } // fees may now be known
 
             if (tx->status() >= Tx::SENT) updateConfirmations_unwrapped(tx);
-            signalQueue.push(notifyTxInserted.bind(tx));
+            updateLedger_unwrapped(tx);
+            queueTxInserted(tx);
             //notifyTxInserted(tx);
             return tx;
         }
@@ -2607,7 +3208,7 @@ LOGGER(trace) << "txoutscript!!! " << uchar_vector(txoutscript).getHex() << std:
     }
     catch (...)
     {
-        signalQueue.clear();
+        clearSignals();
         throw;
     }
 }
@@ -2623,14 +3224,14 @@ std::shared_ptr<Tx> Vault::insertNewTx(const Coin::Transaction& cointx, std::sha
 
     std::shared_ptr<Tx> tx;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         tx = insertNewTx_unwrapped(cointx, blockheader, verifysigs, isCoinbase);
         t.commit();
     }
 
-    signalQueue.flush();
+    flushSignals();
     return tx;
 }
 
@@ -2679,7 +3280,8 @@ std::shared_ptr<Tx> Vault::insertNewTx_unwrapped(const Coin::Transaction& cointx
                 stored_tx->updateStatus(tx->status());
                 stored_tx->blockheader(blockheader);
                 db_->update(stored_tx);
-                signalQueue.push(notifyTxUpdated.bind(stored_tx));
+                updateLedger_unwrapped(stored_tx);
+                queueTxUpdated(stored_tx);
                 return stored_tx; 
             }
             return nullptr;
@@ -2781,9 +3383,10 @@ std::shared_ptr<Tx> Vault::insertNewTx_unwrapped(const Coin::Transaction& cointx
 
             for (auto& txin:    updated_txins)          { db_->update(txin);                    }
             for (auto& txout:   updated_txouts)         { db_->update(txout);                   }
-            for (auto& tx:      updated_txs)            { tx->updateTotals(); db_->update(tx);  }
+            for (auto& tx:      updated_txs)            { tx->updateTotals(); db_->update(tx); updateLedger_unwrapped(tx); }
 
-            signalQueue.push(notifyTxInserted.bind(tx));
+            updateLedger_unwrapped(tx);
+            queueTxInserted(tx);
             return tx;
         }
 
@@ -2791,7 +3394,7 @@ std::shared_ptr<Tx> Vault::insertNewTx_unwrapped(const Coin::Transaction& cointx
     }
     catch (...)
     {
-        signalQueue.clear();
+        clearSignals();
         throw;
     }
 }
@@ -2802,14 +3405,14 @@ std::shared_ptr<Tx> Vault::insertMerkleTx(const ChainMerkleBlock& chainmerkleblo
 
     std::shared_ptr<Tx> tx;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         tx = insertMerkleTx_unwrapped(chainmerkleblock, cointx, txindex, txcount, verifysigs, isCoinbase);
         t.commit();
     }
 
-    signalQueue.flush();
+    flushSignals();
     return tx;
 }
 
@@ -2845,32 +3448,8 @@ std::shared_ptr<Tx> Vault::insertMerkleTx_unwrapped(const ChainMerkleBlock& chai
                         throw MerkleTxInvalidHeightException(blockhash, chainmerkleblock.height, txhash, txindex, txcount);
                 }
 
-                {
-                    // Unconfirm any transactions with equal or larger height
-                    odb::result<Tx> r(db_->query<Tx>(odb::query<Tx>::blockheader->height >= (unsigned int)chainmerkleblock.height));
-                    for (odb::result<Tx>::iterator it = r.begin(); it != r.end(); ++it)
-                    {
-                        std::shared_ptr<Tx> tx(it.load());
-                        tx->blockheader(nullptr);
-                        db_->update(tx);
-                        signalQueue.push(notifyTxUpdated.bind(tx));
-                    }
-                }
-
-                {
-                    // Delete any merkleblocks with equal or larger height
-                    odb::result<MerkleBlock> r(db_->query<MerkleBlock>(odb::query<MerkleBlock>::blockheader->height >= (unsigned int)chainmerkleblock.height));
-                    for (auto& merkleblock: r) { db_->erase(merkleblock); }
-                }
-
-                {
-                    // Delete any blockheaders with equal or larger height
-                    odb::result<BlockHeader> r(db_->query<BlockHeader>(odb::query<BlockHeader>::height >= (unsigned int)chainmerkleblock.height));
-                    for (auto& blockheader: r) { db_->erase(blockheader); }
-                }
-
-                // TODO: test and use the following instead of the above three code blocks
-                //deleteMerkleBlock_unwrapped((uint32_t)chainmerkleblock.height);
+                // Unconfirm any transactions and delete any blocks with equal or larger height
+                deleteMerkleBlock_unwrapped((uint32_t)chainmerkleblock.height);
 
                 // Instantiate the new merkle block and store
                 merkleblock = std::make_shared<MerkleBlock>(chainmerkleblock);
@@ -2890,7 +3469,8 @@ std::shared_ptr<Tx> Vault::insertMerkleTx_unwrapped(const ChainMerkleBlock& chai
                 tx->status(Tx::CONFIRMED);
                 tx->conflicting(false);
                 db_->update(tx);
-                signalQueue.push(notifyTxUpdated.bind(tx));
+                updateLedger_unwrapped(tx);
+                queueTxUpdated(tx);
             }
             else
             {
@@ -2927,7 +3507,8 @@ std::shared_ptr<Tx> Vault::insertMerkleTx_unwrapped(const ChainMerkleBlock& chai
                     tx->status(Tx::CONFIRMED);
                     tx->conflicting(false);
                     db_->update(tx);
-                    signalQueue.push(notifyTxUpdated.bind(tx));
+                    updateLedger_unwrapped(tx);
+                    queueTxUpdated(tx);
                 }
             } 
         }
@@ -2950,14 +3531,14 @@ std::shared_ptr<Tx> Vault::insertMerkleTx_unwrapped(const ChainMerkleBlock& chai
         {
             merkleblock->txsinserted(true);
             db_->update(merkleblock);
-            signalQueue.push(notifyMerkleBlockInserted.bind(merkleblock));
+            queueMerkleBlockInserted(merkleblock);
         }
 
         return tx;
     }
     catch (...)
     {
-        signalQueue.clear();
+        clearSignals();
         throw;
     }
 }
@@ -2966,16 +3547,19 @@ std::shared_ptr<Tx> Vault::confirmMerkleTx(const ChainMerkleBlock& chainmerklebl
 {
     LOGGER(trace) << "Vault::confirmMerkleTx(" << chainmerkleblock.hash().getHex() << ", " << uchar_vector(txhash).getHex() << ", " << txindex << ", " << txcount << ")" << std::endl;
 
+    static metrics::histogram& elapsed = metrics::get_histogram("vault.confirm_tx");
+    metrics::scoped_timer timer(elapsed);
+
     std::shared_ptr<Tx> tx;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         tx = confirmMerkleTx_unwrapped(chainmerkleblock, txhash, txindex, txcount);
         t.commit();
     }
 
-    signalQueue.flush();
+    flushSignals();
     return tx;
 }
 
@@ -3010,33 +3594,8 @@ std::shared_ptr<Tx> Vault::confirmMerkleTx_unwrapped(const ChainMerkleBlock& cha
                         throw MerkleTxInvalidHeightException(blockhash, chainmerkleblock.height, txhash, txindex, txcount);
                 }
 
-                {
-                    // Unconfirm any transactions with equal or larger height
-                    odb::result<Tx> r(db_->query<Tx>(odb::query<Tx>::blockheader->height >= (unsigned int)chainmerkleblock.height));
-                    for (odb::result<Tx>::iterator it = r.begin(); it != r.end(); ++it)
-                    {
-                        std::shared_ptr<Tx> tx(it.load());
-                        tx->status(Tx::PROPAGATED);
-                        db_->update(tx);
-                        signalQueue.push(notifyTxUpdated.bind(tx));
-                    }
-                }
-
-
-                {
-                    // Delete any merkleblocks with equal or larger height
-                    odb::result<MerkleBlock> r(db_->query<MerkleBlock>(odb::query<MerkleBlock>::blockheader->height >= (unsigned int)chainmerkleblock.height));
-                    for (auto& merkleblock: r) { db_->erase(merkleblock); }
-                }
-
-                {
-                    // Delete any blockheaders with equal or larger height
-                    odb::result<BlockHeader> r(db_->query<BlockHeader>(odb::query<BlockHeader>::height >= (unsigned int)chainmerkleblock.height));
-                    for (auto& blockheader: r) { db_->erase(blockheader); }
-                }
-
-                // TODO: test and use the following instead of the above three code blocks
-                //deleteMerkleBlock_unwrapped((uint32_t)chainmerkleblock.height);
+                // Unconfirm any transactions and delete any blocks with equal or larger height
+                deleteMerkleBlock_unwrapped((uint32_t)chainmerkleblock.height);
 
                 // Instantiate the new merkle block and store
                 merkleblock = std::make_shared<MerkleBlock>(chainmerkleblock);
@@ -3054,21 +3613,22 @@ std::shared_ptr<Tx> Vault::confirmMerkleTx_unwrapped(const ChainMerkleBlock& cha
             tx->status(Tx::CONFIRMED);
             tx->conflicting(false);
             db_->update(tx);
-            signalQueue.push(notifyTxUpdated.bind(tx));
+            updateLedger_unwrapped(tx);
+            queueTxUpdated(tx);
         }
 
         if (txindex + 1 == txcount)
         {
             merkleblock->txsinserted(true);
             db_->update(merkleblock);
-            signalQueue.push(notifyMerkleBlockInserted.bind(merkleblock));
+            queueMerkleBlockInserted(merkleblock);
         }
 
         return tx;
     }
     catch (...)
     {
-        signalQueue.clear();
+        clearSignals();
         throw;
     }
 }
@@ -3079,7 +3639,7 @@ std::shared_ptr<Tx> Vault::createTx(const std::string& account_name, uint32_t tx
 
     std::shared_ptr<Tx> tx;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         tx = createTx_unwrapped(account_name, tx_version, tx_locktime, txouts, fee, maxchangeouts);
@@ -3090,7 +3650,7 @@ std::shared_ptr<Tx> Vault::createTx(const std::string& account_name, uint32_t tx
         }
     }
 
-    signalQueue.flush();
+    flushSignals();
     return tx;
 }
 
@@ -3163,7 +3723,7 @@ std::shared_ptr<Tx> Vault::createTx(const std::string& username, const std::stri
 
     std::shared_ptr<Tx> tx;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         tx = createTx_unwrapped(username, account_name, tx_version, tx_locktime, txouts, fee, maxchangeouts);
@@ -3174,7 +3734,7 @@ std::shared_ptr<Tx> Vault::createTx(const std::string& username, const std::stri
         }
     }
 
-    signalQueue.flush();
+    flushSignals();
     return tx;
 }
 
@@ -3211,7 +3771,7 @@ std::shared_ptr<Tx> Vault::createTx(const std::string& account_name, uint32_t tx
 
     std::shared_ptr<Tx> tx;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         tx = createTx_unwrapped(account_name, tx_version, tx_locktime, coin_ids, txouts, fee, min_confirmations);
@@ -3222,7 +3782,7 @@ std::shared_ptr<Tx> Vault::createTx(const std::string& account_name, uint32_t tx
         }
     }
 
-    signalQueue.flush();
+    flushSignals();
     return tx;
 }
 
@@ -3231,104 +3791,8 @@ std::shared_ptr<Tx> Vault::createTx_unwrapped(const std::string& account_name, u
     std::shared_ptr<Account> account = getAccount_unwrapped(account_name);
 
     // TODO: Better fee calculation heuristics
-    uint64_t input_total = 0;
-    uint64_t desired_total = fee;
-    for (auto& txout: txouts)
-    {
-        desired_total += txout->value();
-        if (txout->value() == 0) throw TxInvalidOutputsException();
-    }
-
-    typedef odb::query<TxOutView> query_t;
-    query_t base_query(query_t::Tx::status > Tx::UNSIGNED && query_t::TxOut::status == TxOut::UNSPENT && query_t::receiving_account::id == account->id());
-
-    if (min_confirmations > 0)
-    {
-        uint32_t best_height = getBestHeight_unwrapped();
-        if (min_confirmations > best_height) throw AccountInsufficientFundsException(account_name, desired_total, 0);
-        base_query = (base_query && query_t::BlockHeader::height <= best_height + 1 - min_confirmations);
-    }
-
-    txins_t txins;
-    if (!coin_ids.empty())
-    {
-        odb::result<TxOutView> utxoview_r(db_->query<TxOutView>(base_query && query_t::TxOut::id.in_range(coin_ids.begin(), coin_ids.end())));
-        for (auto& utxoview: utxoview_r)
-        {
-            std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0xffffffff));
-            if (account->use_witness())
-            {
-                using namespace CoinQ::Script;
-                scriptstack_t stack;
-                for (std::size_t k = 0; k <= account->keychains().size(); k++) { stack.push_back(bytes_t()); }
-                stack.push_back(utxoview.signingscript_redeemscript); 
-                txin->scriptwitnessstack(stack);
-            }
-            txins.push_back(txin);
-            input_total += utxoview.value;
-        }
-        if (txins.size() < coin_ids.size()) throw TxInvalidInputsException();
-    }
-
-    // If the supplied inputs are insufficient, automatically add more
-    // TODO; Better coin selection heuristics
-    if (input_total < desired_total)
-    {
-        query_t query(base_query);
-        if (!coin_ids.empty()) { query = (query && !query_t::TxOut::id.in_range(coin_ids.begin(), coin_ids.end())); }
-        odb::result<TxOutView> utxoview_r(db_->query<TxOutView>(query));
-        std::vector<TxOutView> utxoviews;
-        for (auto& utxoview: utxoview_r) { utxoviews.push_back(utxoview); }
-        std::random_shuffle(utxoviews.begin(), utxoviews.end(), [](int i) { return std::rand() % i; });
-
-        for (auto& utxoview: utxoviews)
-        {
-            std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0xffffffff));
-            if (account->use_witness())
-            {
-                using namespace CoinQ::Script;
-                scriptstack_t stack;
-                for (std::size_t k = 0; k <= account->keychains().size(); k++) { stack.push_back(bytes_t()); }
-                stack.push_back(utxoview.signingscript_redeemscript); 
-                txin->scriptwitnessstack(stack);
-            }
-            txins.push_back(txin);
-            input_total += utxoview.value;
-            if (input_total >= desired_total) break;
-        }
-        if (input_total < desired_total) throw AccountInsufficientFundsException(account_name, desired_total, input_total);
-    }
- 
-    // Use supplied outputs first
-    std::shared_ptr<AccountBin> change_bin;
-    for (auto& txout: txouts)
-    {
-        if (txout->script().empty())
-        {
-            if (!change_bin) { change_bin = getAccountBin_unwrapped(account_name, CHANGE_BIN_NAME); }
-            std::shared_ptr<SigningScript> changescript = issueAccountBinSigningScript_unwrapped(change_bin);
-            txout->signingscript(changescript);
-        }
-    }
-
-    // If supplied change amounts are insufficient, add another change output
-    uint64_t change = input_total - desired_total;
-    if (change > 0)
-    {
-        if (!change_bin) { change_bin = getAccountBin_unwrapped(account_name, CHANGE_BIN_NAME); }
-        std::shared_ptr<SigningScript> changescript = issueAccountBinSigningScript_unwrapped(change_bin);
-
-        std::shared_ptr<TxOut> txout(new TxOut(change, changescript));
-        txouts.push_back(txout);
-    }
-    // TODO: Better rng seeding
-    std::srand(std::time(0));
-    std::random_shuffle(txins.begin(), txins.end(), [](int i) { return std::rand() % i; });
-    std::random_shuffle(txouts.begin(), txouts.end(), [](int i) { return std::rand() % i; });
-
-    std::shared_ptr<Tx> tx(new Tx());
-    tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
-    return tx;
+    // The fee does not depend on size, so any change at all gets an output.
+    return buildTx_unwrapped(account, tx_version, tx_locktime, coin_ids, txouts, [fee](std::size_t, bool) { return fee; }, 1, min_confirmations);
 }
 
 std::shared_ptr<Tx> Vault::createTx(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee, uint32_t min_confirmations, bool insert)
@@ -3337,7 +3801,7 @@ std::shared_ptr<Tx> Vault::createTx(const std::string& username, const std::stri
 
     std::shared_ptr<Tx> tx;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         tx = createTx_unwrapped(username, account_name, tx_version, tx_locktime, coin_ids, txouts, fee, min_confirmations);
@@ -3348,7 +3812,7 @@ std::shared_ptr<Tx> Vault::createTx(const std::string& username, const std::stri
         }
     }
 
-    signalQueue.flush();
+    flushSignals();
     return tx;
 }
 
@@ -3369,13 +3833,27 @@ std::shared_ptr<Tx> Vault::createTx_unwrapped(const std::string& username, const
     return tx;
 }
 
+static std::shared_ptr<TxIn> newAccountTxIn(std::shared_ptr<Account> account, const TxOutView& utxoview)
+{
+    std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0xffffffff));
+    if (account->use_witness())
+    {
+        using namespace CoinQ::Script;
+        scriptstack_t stack;
+        for (std::size_t k = 0; k <= account->keychains().size(); k++) { stack.push_back(bytes_t()); }
+        stack.push_back(utxoview.signingscript_redeemscript); 
+        txin->scriptwitnessstack(stack);
+    }
+    return txin;
+}
+
 txs_t Vault::consolidateTxOuts(const std::string& account_name, uint32_t max_tx_size, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations, bool insert)
 {
     LOGGER(trace) << "Vault::consolidateTxOuts(" << account_name << ", " << max_tx_size << ", " << tx_version << ", " << tx_locktime << ", " << coin_ids.size() << " txin(s), " << uchar_vector(txoutscript).getHex() << ", " << min_fee << ", " << min_confirmations << ", " << (insert ? "insert" : "no insert") << ")" << std::endl;
 
     txs_t txs;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         txs = consolidateTxOuts_unwrapped(account_name, max_tx_size, tx_version, tx_locktime, coin_ids, txoutscript, min_fee, min_confirmations);
@@ -3391,7 +3869,7 @@ txs_t Vault::consolidateTxOuts(const std::string& account_name, uint32_t max_tx_
         }
     }
 
-    signalQueue.flush();
+    flushSignals();
     return txs;
 }
 
@@ -3403,7 +3881,7 @@ txs_t Vault::consolidateTxOuts(const std::string& username, const std::string& a
 
     txs_t txs;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         txs = consolidateTxOuts_unwrapped(account_name, max_tx_size, tx_version, tx_locktime, coin_ids, txoutscript, min_fee, min_confirmations);
@@ -3420,7 +3898,7 @@ txs_t Vault::consolidateTxOuts(const std::string& username, const std::string& a
         if (bInserted) t.commit();
     }
 
-    signalQueue.flush();
+    flushSignals();
     return txs;
 }
 
@@ -3459,89 +3937,407 @@ txs_t Vault::consolidateTxOuts_unwrapped(const std::string& account_name, uint32
     txins_t txins;
     uint64_t input_total = 0;
 
-    std::shared_ptr<Tx> test_tx = std::make_shared<Tx>();
+    // Sizes are measured for the fully signed transaction, not the unsigned placeholder.
+    TxSizeEstimator::script_type_t script_type = TxSizeEstimator::getScriptType(account->use_witness(), account->use_witness_p2sh());
+    TxSizeEstimator empty_estimator;
+    empty_estimator.addOutput(txoutscript);
+    TxSizeEstimator estimator(empty_estimator);
+
     txs_t txs;
-    std::shared_ptr<TxOut> txout = std::make_shared<TxOut>(0, txoutscript);
-    txouts_t txouts;
-    txouts.push_back(txout);
     for (auto& utxoview: utxoviews)
     {
-        std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0xffffffff));
-        if (account->use_witness())
-        {
-            using namespace CoinQ::Script;
-            scriptstack_t stack;
-            for (std::size_t k = 0; k <= account->keychains().size(); k++) { stack.push_back(bytes_t()); }
-            stack.push_back(utxoview.signingscript_redeemscript); 
-            txin->scriptwitnessstack(stack);
-        }
+        std::shared_ptr<TxIn> txin = newAccountTxIn(account, utxoview);
         txins.push_back(txin);
-        test_tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
-        if (test_tx->raw().size() > max_tx_size)
+        estimator.addInput(script_type, account->minsigs(), account->keychains().size(), account->compressed_keys());
+        if (estimator.total_size() > max_tx_size)
         {
             txins.pop_back();
-            if (txins.empty()) throw std::runtime_error("Vault::consolidateTxOuts_unwrapped() - txins empty.");
+            if (txins.empty()) throw std::runtime_error("Vault::consolidateTxOuts_unwrapped() - maximum transaction size is too small.");
             if (input_total <= min_fee) throw std::runtime_error("Vault::consolidateTxOuts_unwrapped() - input total is not greater than fee.");
             txouts_t txouts;
             std::shared_ptr<TxOut> txout = std::make_shared<TxOut>(input_total - min_fee, txoutscript);
             txouts.push_back(txout);
             std::shared_ptr<Tx> tx = std::make_shared<Tx>();
             tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
-            if (tx->raw().size() > max_tx_size) throw std::runtime_error("Vault::consolidateTxOuts_unwrapped() - maximum transaction size is too small.");
 
             txs.push_back(tx);
             input_total = 0;
             txins.clear();
             txins.push_back(txin);
+            estimator = empty_estimator;
+            estimator.addInput(script_type, account->minsigs(), account->keychains().size(), account->compressed_keys());
+            if (estimator.total_size() > max_tx_size) throw std::runtime_error("Vault::consolidateTxOuts_unwrapped() - maximum transaction size is too small.");
         }
             
         input_total += utxoview.value;
     }
     
-    if (!txins.empty() && input_total >= min_fee)
+    if (!txins.empty() && input_total > min_fee)
     {
         txouts_t txouts;
         std::shared_ptr<TxOut> txout = std::make_shared<TxOut>(input_total - min_fee, txoutscript);
         txouts.push_back(txout);
         std::shared_ptr<Tx> tx = std::make_shared<Tx>();
         tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
-        if (tx->raw().size() < max_tx_size) { txs.push_back(tx); }
+        txs.push_back(tx);
     }
     
     return txs;
 }
 
-void Vault::updateTx_unwrapped(std::shared_ptr<Tx> tx)
-{
-    for (auto& txin: tx->txins()) { db_->update(txin); }
-    for (auto& txout: tx->txouts()) { db_->update(txout); }
-    db_->update(tx); 
-}
-
-void Vault::deleteTx(const bytes_t& tx_hash)
+std::vector<TxOutView> Vault::getSpendableTxOutViews_unwrapped(std::shared_ptr<Account> account, const ids_t& coin_ids, uint32_t min_confirmations) const
 {
-    LOGGER(trace) << "Vault::deleteTx(" << uchar_vector(tx_hash).getHex() << ")" << std::endl;
+    typedef odb::query<TxOutView> query_t;
+    query_t query(query_t::Tx::status > Tx::UNSIGNED && query_t::TxOut::status == TxOut::UNSPENT && query_t::receiving_account::id == account->id());
 
-    boost::lock_guard<boost::mutex> lock(mutex);
-    odb::core::session s;
-    odb::core::transaction t(db_->begin());
-    odb::result<Tx> r(db_->query<Tx>(odb::query<Tx>::hash == tx_hash || odb::query<Tx>::unsigned_hash == tx_hash));
-    if (r.empty()) throw TxNotFoundException(tx_hash);
+    if (min_confirmations > 0)
+    {
+        uint32_t best_height = getBestHeight_unwrapped();
+        if (min_confirmations > best_height) throw AccountInsufficientFundsException(account->name(), 0, 0);
+        query = (query && query_t::BlockHeader::height <= best_height + 1 - min_confirmations);
+    }
 
-    std::shared_ptr<Tx> tx(r.begin().load());
-    deleteTx_unwrapped(tx);
-    t.commit();
+    if (!coin_ids.empty()) { query = (query && query_t::TxOut::id.in_range(coin_ids.begin(), coin_ids.end())); }
 
-    signalQueue.flush();
+    std::vector<TxOutView> utxoviews;
+    odb::result<TxOutView> utxoview_r(db_->query<TxOutView>(query));
+    for (auto& utxoview: utxoview_r) { utxoviews.push_back(utxoview); }
+    if (utxoviews.size() < coin_ids.size()) throw TxInvalidInputsException();
+    return utxoviews;
 }
 
-void Vault::deleteTx(unsigned long tx_id)
+std::shared_ptr<Tx> Vault::createTxWithFeeRate(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee_rate, uint32_t min_confirmations, bool insert)
 {
-    LOGGER(trace) << "Vault::deleteTx(" << tx_id << ")" << std::endl;
+    LOGGER(trace) << "Vault::createTxWithFeeRate(" << account_name << ", " << tx_version << ", " << tx_locktime << ", " << coin_ids.size() << " txin(s), " << txouts.size() << " txout(s), " << fee_rate << ", " << min_confirmations << ", " << (insert ? "insert" : "no insert") << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
-    odb::core::session s;
-    odb::core::transaction t(db_->begin());
+    std::shared_ptr<Tx> tx;
+    {
+        VaultWriteLock lock(mutex);
+        odb::core::session s;
+        odb::core::transaction t(db_->begin());
+        tx = createTxWithFeeRate_unwrapped(account_name, tx_version, tx_locktime, coin_ids, txouts, fee_rate, min_confirmations);
+        if (insert)
+        {
+            tx = insertTx_unwrapped(tx);
+            if (tx) t.commit();
+        }
+    }
+
+    flushSignals();
+    return tx;
+}
+
+std::shared_ptr<Tx> Vault::createTxWithFeeRate(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee_rate, uint32_t min_confirmations, bool insert)
+{
+    LOGGER(trace) << "Vault::createTxWithFeeRate(" << username << ", " << account_name << ", " << tx_version << ", " << tx_locktime << ", " << coin_ids.size() << " txin(s), " << txouts.size() << " txout(s), " << fee_rate << ", " << min_confirmations << ", " << (insert ? "insert" : "no insert") << ")" << std::endl;
+
+    std::shared_ptr<Tx> tx;
+    {
+        VaultWriteLock lock(mutex);
+        odb::core::session s;
+        odb::core::transaction t(db_->begin());
+        tx = createTxWithFeeRate_unwrapped(username, account_name, tx_version, tx_locktime, coin_ids, txouts, fee_rate, min_confirmations);
+        if (insert)
+        {
+            tx = insertTx_unwrapped(tx);
+            if (tx) t.commit();
+        }
+    }
+
+    flushSignals();
+    return tx;
+}
+
+std::shared_ptr<Tx> Vault::createTxWithFeeRate_unwrapped(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee_rate, uint32_t min_confirmations)
+{
+    std::shared_ptr<Account> account = getAccount_unwrapped(account_name);
+
+    TxSizeEstimator::script_type_t script_type = TxSizeEstimator::getScriptType(account->use_witness(), account->use_witness_p2sh());
+    uint32_t minsigs = account->minsigs();
+    uint32_t pubkeys = account->keychains().size();
+    bool compressed_keys = account->compressed_keys();
+
+    TxSizeEstimator estimator;
+    for (auto& txout: txouts)
+    {
+        // Empty scripts become change outputs for this account
+        if (txout->script().empty())    { estimator.addOutput(TxSizeEstimator::txOutScriptSize(script_type)); }
+        else                            { estimator.addOutput(txout->script()); }
+    }
+
+    auto fee = [&](std::size_t txin_count, bool with_change)
+    {
+        TxSizeEstimator tx_estimator(estimator);
+        if (txin_count > 0) { tx_estimator.addInput(script_type, minsigs, pubkeys, compressed_keys, txin_count); }
+        if (with_change)    { tx_estimator.addOutput(TxSizeEstimator::txOutScriptSize(script_type)); }
+        return tx_estimator.fee(fee_rate);
+    };
+
+    // Change that costs more to spend than it is worth goes to the fee instead
+    uint64_t min_change = TxSizeEstimator::dustThreshold(script_type, minsigs, pubkeys, compressed_keys);
+    return buildTx_unwrapped(account, tx_version, tx_locktime, coin_ids, txouts, fee, min_change, min_confirmations);
+}
+
+std::shared_ptr<Tx> Vault::buildTx_unwrapped(std::shared_ptr<Account> account, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, tx_fee_function_t fee, uint64_t min_change, uint32_t min_confirmations)
+{
+    uint64_t output_total = 0;
+    for (auto& txout: txouts)
+    {
+        if (txout->value() == 0) throw TxInvalidOutputsException();
+        output_total += txout->value();
+    }
+
+    txins_t txins;
+    uint64_t input_total = 0;
+    if (!coin_ids.empty())
+    {
+        std::vector<TxOutView> utxoviews = getSpendableTxOutViews_unwrapped(account, coin_ids, min_confirmations);
+        for (auto& utxoview: utxoviews)
+        {
+            txins.push_back(newAccountTxIn(account, utxoview));
+            input_total += utxoview.value;
+        }
+    }
+
+    // If the supplied inputs are insufficient, automatically add more. Each added
+    // input can raise the fee, so the target is recomputed as we go.
+    // TODO; Better coin selection heuristics
+    if (input_total < output_total + fee(txins.size(), false))
+    {
+        std::vector<TxOutView> utxoviews = getSpendableTxOutViews_unwrapped(account, ids_t(), min_confirmations);
+        std::set<unsigned long> selected(coin_ids.begin(), coin_ids.end());
+
+        // TODO: Better rng seeding
+        std::srand(std::time(0));
+        std::random_shuffle(utxoviews.begin(), utxoviews.end(), [](int i) { return std::rand() % i; });
+
+        for (auto& utxoview: utxoviews)
+        {
+            if (selected.count(utxoview.id)) continue;
+            txins.push_back(newAccountTxIn(account, utxoview));
+            input_total += utxoview.value;
+            if (input_total >= output_total + fee(txins.size(), false)) break;
+        }
+        if (input_total < output_total + fee(txins.size(), false)) throw AccountInsufficientFundsException(account->name(), output_total + fee(txins.size(), false), input_total);
+    }
+
+    // Use supplied outputs first
+    std::shared_ptr<AccountBin> change_bin;
+    for (auto& txout: txouts)
+    {
+        if (txout->script().empty())
+        {
+            if (!change_bin) { change_bin = getAccountBin_unwrapped(account->name(), CHANGE_BIN_NAME); }
+            std::shared_ptr<SigningScript> changescript = issueAccountBinSigningScript_unwrapped(change_bin);
+            txout->signingscript(changescript);
+        }
+    }
+
+    // If supplied change amounts are insufficient, add another change output
+    uint64_t change_fee = fee(txins.size(), true);
+    uint64_t change = 0;
+    if (input_total > output_total + change_fee && input_total - output_total - change_fee >= min_change)
+    {
+        if (!change_bin) { change_bin = getAccountBin_unwrapped(account->name(), CHANGE_BIN_NAME); }
+        std::shared_ptr<SigningScript> changescript = issueAccountBinSigningScript_unwrapped(change_bin);
+
+        change = input_total - output_total - change_fee;
+        std::shared_ptr<TxOut> txout(new TxOut(change, changescript));
+        txouts.push_back(txout);
+    }
+
+    LOGGER(debug) << "Vault::buildTx_unwrapped() - " << txins.size() << " txin(s), " << txouts.size() << " txout(s), fee: " << (input_total - output_total - change) << std::endl;
+
+    // TODO: Better rng seeding
+    std::srand(std::time(0));
+    std::random_shuffle(txins.begin(), txins.end(), [](int i) { return std::rand() % i; });
+    std::random_shuffle(txouts.begin(), txouts.end(), [](int i) { return std::rand() % i; });
+
+    std::shared_ptr<Tx> tx(new Tx());
+    tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
+    return tx;
+}
+
+std::shared_ptr<Tx> Vault::createTxWithFeeRate_unwrapped(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee_rate, uint32_t min_confirmations)
+{
+    std::shared_ptr<User> user = getUser_unwrapped(username);
+
+    if (user->isTxOutScriptWhitelistEnabled())
+    {
+        for (auto& txout: txouts)
+        {
+            if (!txout->script().empty() && !user->txoutscript_whitelist().count(txout->script())) throw TxOutputScriptNotInUserWhitelistException(username, txout->script());        
+        }
+    }
+
+    std::shared_ptr<Tx> tx;
+    try
+    {
+        tx = createTxWithFeeRate_unwrapped(account_name, tx_version, tx_locktime, coin_ids, txouts, fee_rate, min_confirmations);
+    }
+    catch (AccountInsufficientFundsException& e)
+    {
+        e.username(username);
+        throw e;
+    }
+
+    tx->user(user);
+    return tx;
+}
+
+txs_t Vault::consolidateTxOutsWithFeeRate(const std::string& account_name, uint32_t max_tx_weight, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t fee_rate, uint32_t min_confirmations, bool insert)
+{
+    LOGGER(trace) << "Vault::consolidateTxOutsWithFeeRate(" << account_name << ", " << max_tx_weight << ", " << tx_version << ", " << tx_locktime << ", " << coin_ids.size() << " txin(s), " << uchar_vector(txoutscript).getHex() << ", " << fee_rate << ", " << min_confirmations << ", " << (insert ? "insert" : "no insert") << ")" << std::endl;
+
+    txs_t txs;
+    {
+        VaultWriteLock lock(mutex);
+        odb::core::session s;
+        odb::core::transaction t(db_->begin());
+        txs = consolidateTxOutsWithFeeRate_unwrapped(account_name, max_tx_weight, tx_version, tx_locktime, coin_ids, txoutscript, fee_rate, min_confirmations);
+        if (insert)
+        {
+            bool bInserted = false;
+            for (auto& tx: txs)
+            {
+                tx = insertTx_unwrapped(tx);
+                if (tx) { bInserted = true; }
+            }
+            if (bInserted) t.commit();
+        }
+    }
+
+    flushSignals();
+    return txs;
+}
+
+txs_t Vault::consolidateTxOutsWithFeeRate(const std::string& username, const std::string& account_name, uint32_t max_tx_weight, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t fee_rate, uint32_t min_confirmations, bool insert)
+{
+    LOGGER(trace) << "Vault::consolidateTxOutsWithFeeRate(" << username << ", " << account_name << ", " << max_tx_weight << ", " << tx_version << ", " << tx_locktime << ", " << coin_ids.size() << " txin(s), " << uchar_vector(txoutscript).getHex() << ", " << fee_rate << ", " << min_confirmations << ", " << (insert ? "insert" : "no insert") << ")" << std::endl;
+
+    txs_t txs;
+    {
+        VaultWriteLock lock(mutex);
+        odb::core::session s;
+        odb::core::transaction t(db_->begin());
+        std::shared_ptr<User> user = getUser_unwrapped(username);
+        txs = consolidateTxOutsWithFeeRate_unwrapped(account_name, max_tx_weight, tx_version, tx_locktime, coin_ids, txoutscript, fee_rate, min_confirmations);
+        bool bInserted = false;
+        for (auto& tx: txs)
+        {
+            tx->user(user); 
+            if (insert)
+            {
+                tx = insertTx_unwrapped(tx);
+                if (tx) { bInserted = true; }
+            }
+        }
+        if (bInserted) t.commit();
+    }
+
+    flushSignals();
+    return txs;
+}
+
+txs_t Vault::consolidateTxOutsWithFeeRate_unwrapped(const std::string& account_name, uint32_t max_tx_weight, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t fee_rate, uint32_t min_confirmations)
+{
+    std::shared_ptr<Account> account = getAccount_unwrapped(account_name);
+
+    TxSizeEstimator::script_type_t script_type = TxSizeEstimator::getScriptType(account->use_witness(), account->use_witness_p2sh());
+    uint32_t minsigs = account->minsigs();
+    uint32_t pubkeys = account->keychains().size();
+    bool compressed_keys = account->compressed_keys();
+
+    TxSizeEstimator empty_estimator;
+    empty_estimator.addOutput(txoutscript);
+    TxSizeEstimator one_input_estimator(empty_estimator);
+    one_input_estimator.addInput(script_type, minsigs, pubkeys, compressed_keys);
+    if (one_input_estimator.weight() > max_tx_weight) throw std::runtime_error("Vault::consolidateTxOutsWithFeeRate_unwrapped() - maximum transaction weight is too small.");
+
+    std::vector<TxOutView> utxoviews = getSpendableTxOutViews_unwrapped(account, coin_ids, min_confirmations);
+
+    // TODO: Better rng seeding
+    std::srand(std::time(0));
+    std::random_shuffle(utxoviews.begin(), utxoviews.end(), [](int i) { return std::rand() % i; });
+
+    txs_t txs;
+    txins_t txins;
+    uint64_t input_total = 0;
+    TxSizeEstimator estimator(empty_estimator);
+
+    // Batches that cannot pay for their own fee are left unspent.
+    auto flush_txins = [&]()
+    {
+        uint64_t fee = estimator.fee(fee_rate);
+        if (input_total > fee)
+        {
+            txouts_t txouts;
+            txouts.push_back(std::make_shared<TxOut>(input_total - fee, txoutscript));
+            std::shared_ptr<Tx> tx = std::make_shared<Tx>();
+            tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
+            txs.push_back(tx);
+        }
+        else
+        {
+            LOGGER(debug) << "Vault::consolidateTxOutsWithFeeRate_unwrapped() - skipping " << txins.size() << " txin(s) totaling " << input_total << " which do not cover fee " << fee << "." << std::endl;
+        }
+
+        txins.clear();
+        input_total = 0;
+        estimator = empty_estimator;
+    };
+
+    for (auto& utxoview: utxoviews)
+    {
+        TxSizeEstimator next_estimator(estimator);
+        next_estimator.addInput(script_type, minsigs, pubkeys, compressed_keys);
+        if (next_estimator.weight() > max_tx_weight)
+        {
+            flush_txins();
+            next_estimator = one_input_estimator;
+        }
+
+        txins.push_back(newAccountTxIn(account, utxoview));
+        input_total += utxoview.value;
+        estimator = next_estimator;
+    }
+
+    if (!txins.empty()) { flush_txins(); }
+
+    return txs;
+}
+
+void Vault::updateTx_unwrapped(std::shared_ptr<Tx> tx)
+{
+    for (auto& txin: tx->txins()) { db_->update(txin); }
+    for (auto& txout: tx->txouts()) { db_->update(txout); }
+    db_->update(tx); 
+}
+
+void Vault::deleteTx(const bytes_t& tx_hash)
+{
+    LOGGER(trace) << "Vault::deleteTx(" << uchar_vector(tx_hash).getHex() << ")" << std::endl;
+
+    VaultWriteLock lock(mutex);
+    odb::core::session s;
+    odb::core::transaction t(db_->begin());
+    odb::result<Tx> r(db_->query<Tx>(odb::query<Tx>::hash == tx_hash || odb::query<Tx>::unsigned_hash == tx_hash));
+    if (r.empty()) throw TxNotFoundException(tx_hash);
+
+    std::shared_ptr<Tx> tx(r.begin().load());
+    deleteTx_unwrapped(tx);
+    t.commit();
+
+    flushSignals();
+}
+
+void Vault::deleteTx(unsigned long tx_id)
+{
+    LOGGER(trace) << "Vault::deleteTx(" << tx_id << ")" << std::endl;
+
+    VaultWriteLock lock(mutex);
+    odb::core::session s;
+    odb::core::transaction t(db_->begin());
     odb::result<Tx> r(db_->query<Tx>(odb::query<Tx>::id == tx_id));
     if (r.empty()) throw TxNotFoundException();
 
@@ -3549,7 +4345,7 @@ void Vault::deleteTx(unsigned long tx_id)
     deleteTx_unwrapped(tx);
     t.commit();
 
-    signalQueue.flush();
+    flushSignals();
 }
 
 void Vault::deleteTx_unwrapped(std::shared_ptr<Tx> tx)
@@ -3581,12 +4377,18 @@ void Vault::deleteTx_unwrapped(std::shared_ptr<Tx> tx)
         }
 
         // delete tx
+        if (tx->blockheader() && bPendingConfirmationsLoaded)
+        {
+            pendingConfirmationsChanging_unwrapped();
+            mapPendingConfirmations[tx->hash()] = tx->blockheader()->id();
+        }
         db_->erase(tx);
-        signalQueue.push(notifyTxDeleted.bind(tx));
+        eraseLedgerEntries_unwrapped(tx->id());
+        queueTxDeleted(tx);
     }
     catch (...)
     {
-        signalQueue.clear();
+        clearSignals();
         throw;
     }
 }
@@ -3596,7 +4398,7 @@ SigningRequest Vault::getSigningRequest(const bytes_t& hash, bool include_raw_tx
     LOGGER(trace) << "Vault::getSigningRequest(" << uchar_vector(hash).getHex() << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -3612,7 +4414,7 @@ SigningRequest Vault::getSigningRequest(unsigned long tx_id, bool include_raw_tx
     LOGGER(trace) << "Vault::getSigningRequest(" << tx_id << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -3645,7 +4447,7 @@ SignatureInfo Vault::getSignatureInfo(const bytes_t& hash) const
     LOGGER(trace) << "Vault::getSignatureInfo(" << uchar_vector(hash).getHex() << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -3661,7 +4463,7 @@ SignatureInfo Vault::getSignatureInfo(unsigned long tx_id) const
     LOGGER(trace) << "Vault::getSignatureInfo(" << tx_id << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -3724,7 +4526,7 @@ std::shared_ptr<Tx> Vault::signTx(const bytes_t& hash, std::vector<std::string>&
 {
     LOGGER(trace) << "Vault::signTx(" << uchar_vector(hash).getHex() << ", [" << stdutils::delimited_list(keychain_names, ", ") << "], " << (update ? "update" : "no update") << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
 
@@ -3753,7 +4555,7 @@ std::shared_ptr<Tx> Vault::signTx(unsigned long tx_id, std::vector<std::string>&
 {
     LOGGER(trace) << "Vault::signTx(" << tx_id << ", [" << stdutils::delimited_list(keychain_names, ", ") << "], " << (update ? "update" : "no update") << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
 
@@ -3770,12 +4572,102 @@ std::shared_ptr<Tx> Vault::signTx(unsigned long tx_id, std::vector<std::string>&
     return tx;
 }
 
+txs_t Vault::signTxs(const ids_t& tx_ids, std::vector<std::string>& keychain_names, bool update)
+{
+    LOGGER(trace) << "Vault::signTxs([" << tx_ids.size() << " txs], [" << stdutils::delimited_list(keychain_names, ", ") << "], " << (update ? "update" : "no update") << ")" << std::endl;
+
+    VaultWriteLock lock(mutex);
+    odb::core::session s;
+    odb::core::transaction t(db_->begin());
+
+    std::set<unsigned long> ids(tx_ids.begin(), tx_ids.end());
+
+    txs_t txs;
+    if (!ids.empty())
+    {
+        odb::result<Tx> tx_r(db_->query<Tx>(odb::query<Tx>::id.in_range(ids.begin(), ids.end())));
+
+        std::size_t found = 0;
+        for (auto it = tx_r.begin(); it != tx_r.end(); ++it)
+        {
+            found++;
+            std::shared_ptr<Tx> tx(it.load());
+            if (tx->status() == Tx::UNSIGNED) { txs.push_back(tx); }
+        }
+        if (found != ids.size()) throw TxNotFoundException();
+    }
+
+    signTxs_unwrapped(txs, keychain_names);
+    if (!txs.empty() && update)
+    {
+        for (auto& tx: txs) { updateTx_unwrapped(tx); }
+        t.commit();
+    }
+    return txs;
+}
+
+txs_t Vault::signTxs(const std::string& account_name, std::vector<std::string>& keychain_names, bool update)
+{
+    LOGGER(trace) << "Vault::signTxs(" << account_name << ", [" << stdutils::delimited_list(keychain_names, ", ") << "], " << (update ? "update" : "no update") << ")" << std::endl;
+
+    VaultWriteLock lock(mutex);
+    odb::core::session s;
+    odb::core::transaction t(db_->begin());
+
+    std::shared_ptr<Account> account = getAccount_unwrapped(account_name);
+
+    odb::result<TxOutView> view_r(db_->query<TxOutView>(odb::query<TxOutView>::sending_account::id == account->id() && odb::query<TxOutView>::Tx::status == Tx::UNSIGNED));
+
+    std::set<unsigned long> txIds;
+    for (auto& view: view_r) { txIds.insert(view.tx_id); }
+
+    txs_t txs;
+    if (!txIds.empty())
+    {
+        odb::result<Tx> tx_r(db_->query<Tx>(odb::query<Tx>::id.in_range(txIds.begin(), txIds.end())));
+        for (auto it = tx_r.begin(); it != tx_r.end(); ++it) { txs.push_back(std::shared_ptr<Tx>(it.load())); }
+    }
+
+    signTxs_unwrapped(txs, keychain_names);
+    if (!txs.empty() && update)
+    {
+        for (auto& tx: txs) { updateTx_unwrapped(tx); }
+        t.commit();
+    }
+    return txs;
+}
+
 unsigned int Vault::signTx_unwrapped(std::shared_ptr<Tx> tx, std::vector<std::string>& keychain_names)
+{
+    txs_t txs(1, tx);
+    return signTxs_unwrapped(txs, keychain_names);
+}
+
+unsigned int Vault::signTxs_unwrapped(txs_t& txs, std::vector<std::string>& keychain_names)
 {
     using namespace CoinQ::Script;
     using namespace CoinCrypto;
 
-    Coin::Transaction coin_tx = tx->toCoinCore();
+    static metrics::histogram& signHistogram = metrics::get_histogram("vault.sign_txs");
+    static metrics::counter& signatureCounter = metrics::get_counter("vault.signatures");
+    metrics::scoped_timer timer(signHistogram);
+
+    struct InputState
+    {
+        std::shared_ptr<TxIn> txin;
+        std::unique_ptr<SignableTxIn> signableTxIn;
+        std::size_t tx;
+    };
+
+    struct SigningJob
+    {
+        std::size_t input;
+        std::size_t keySlot;
+        bytes_t pubkey;
+        bytes_t signingHash;
+        std::shared_ptr<Keychain> keychain;
+        bytes_t signature;
+    };
 
     // No point in trying nonprivate keys
     odb::query<Key> privkey_query(odb::query<Key>::is_private != 0);
@@ -3784,66 +4676,167 @@ unsigned int Vault::signTx_unwrapped(std::shared_ptr<Tx> tx, std::vector<std::st
     if (!keychain_names.empty())
         privkey_query = privkey_query && odb::query<Key>::root_keychain->name.in_range(keychain_names.begin(), keychain_names.end());
 
-    KeychainSet keychains_signed;
+    // Everything touching the database happens here, on this thread: find the keys for each
+    // missing signature, derive each private key once and compute the hashes to sign.
+    std::vector<Coin::Transaction> coin_txs;
+    std::vector<InputState> inputs;
+    std::vector<SigningJob> jobs;
+    std::map<unsigned long, bool> keychainsUnlocked;
+    SigningKeyCache keyCache;
 
-    unsigned int sigsadded = 0;
-    for (auto& txin: tx->txins())
+    for (std::size_t i = 0; i < txs.size(); i++) { coin_txs.push_back(txs[i]->toCoinCore()); }
+
+    for (std::size_t i = 0; i < txs.size(); i++)
     {
-        uint64_t outpointvalue = txin->outpoint() ? txin->outpoint()->value() : 0;
-        SignableTxIn signableTxIn(coin_tx, txin->txindex(), outpointvalue);
+        const Coin::Transaction& coin_tx = coin_txs[i];
+        for (auto& txin: txs[i]->txins())
+        {
+            uint64_t outpointvalue = txin->outpoint() ? txin->outpoint()->value() : 0;
+            std::unique_ptr<SignableTxIn> signableTxIn(new SignableTxIn(coin_tx, txin->txindex(), outpointvalue));
 
-        unsigned int sigsneeded = signableTxIn.sigsneeded();
-        if (sigsneeded == 0) continue;
+            unsigned int sigsneeded = signableTxIn->sigsneeded();
+            if (sigsneeded == 0) continue;
 
-        std::vector<bytes_t> pubkeys = signableTxIn.missingsigs();
-        if (pubkeys.empty()) continue;
+            std::vector<bytes_t> pubkeys = signableTxIn->missingsigs();
+            if (pubkeys.empty()) continue;
 
-        odb::result<Key> key_r(db_->query<Key>(privkey_query && odb::query<Key>::pubkey.in_range(pubkeys.begin(), pubkeys.end())));
-        if (key_r.empty()) continue;
+            odb::result<Key> key_r(db_->query<Key>(privkey_query && odb::query<Key>::pubkey.in_range(pubkeys.begin(), pubkeys.end())));
+            if (key_r.empty()) continue;
 
-        // Compute hash to sign
-        bytes_t signingHash = coin_tx.getSigHash(SIGHASH_ALL, txin->txindex(), signableTxIn.redeemscript(), outpointvalue);
-        LOGGER(debug) << "Vault::signTx_unwrapped - computed signing hash " << uchar_vector(signingHash).getHex() << " for input " << txin->txindex() << std::endl;
+            // Compute hash to sign
+            bytes_t signingHash = coin_tx.getSigHash(SIGHASH_ALL, txin->txindex(), signableTxIn->redeemscript(), outpointvalue);
+            LOGGER(debug) << "Vault::signTxs_unwrapped - computed signing hash " << uchar_vector(signingHash).getHex() << " for input " << txin->txindex() << std::endl;
 
-        for (auto& key: key_r)
-        {
-            if (!tryUnlockKeychain_unwrapped(key.root_keychain()))
+            std::size_t input = inputs.size();
+            for (auto& key: key_r)
             {
-                LOGGER(debug) << "Vault::signTx_unwrapped - private key locked for keychain " << key.root_keychain()->name() << std::endl;
-                continue;
+                std::shared_ptr<Keychain> keychain = key.root_keychain();
+                auto unlocked = keychainsUnlocked.find(keychain->id());
+                if (unlocked == keychainsUnlocked.end())
+                {
+                    unlocked = keychainsUnlocked.insert(std::make_pair(keychain->id(), tryUnlockKeychain_unwrapped(keychain))).first;
+                }
+                if (!unlocked->second)
+                {
+                    LOGGER(debug) << "Vault::signTxs_unwrapped - private key locked for keychain " << keychain->name() << std::endl;
+                    continue;
+                }
+
+                LOGGER(debug) << "Vault::signTxs_unwrapped - SIGNING INPUT " << txin->txindex() << " WITH KEYCHAIN " << keychain->name() << std::endl;
+                long slot = keyCache.find(key.pubkey());
+                if (slot < 0)
+                {
+                    secure_bytes_t privkey = key.try_privkey();
+                    slot = keyCache.insert(key.pubkey(), privkey);
+                }
+
+                SigningJob job;
+                job.input = input;
+                job.keySlot = slot;
+                job.pubkey = key.pubkey();
+                job.signingHash = signingHash;
+                job.keychain = keychain;
+                jobs.push_back(job);
+
+                sigsneeded--;
+                if (sigsneeded == 0) break;
             }
 
-            LOGGER(debug) << "Vault::signTx_unwrapped - SIGNING INPUT " << txin->txindex() << " WITH KEYCHAIN " << key.root_keychain()->name() << std::endl;        
-            secure_bytes_t privkey = key.try_privkey();
+            InputState state;
+            state.txin = txin;
+            state.signableTxIn = std::move(signableTxIn);
+            state.tx = i;
+            inputs.push_back(std::move(state));
+        }
+    }
 
-            // TODO: Better exception handling with secp256kl_key class
-            secp256k1_key signingKey;
-            signingKey.setPrivKey(privkey);
+    // ECDSA is the expensive part and touches nothing shared, so spread it across cores.
+    // Each worker builds its own key objects from the cached private keys. Nonces are
+    // derived per RFC 6979 rather than drawn from OpenSSL's shared random generator,
+    // so signatures are the same whichever thread makes them.
+    std::atomic<std::size_t> nextJob(0);
+    std::exception_ptr error;
+    std::mutex errorMutex;
 
-            // Try checking both compressed and uncompressed pubkeys
-            if (signingKey.getPubKey() != key.pubkey() && signingKey.getPubKey(false) != key.pubkey()) throw KeychainInvalidPrivateKeyException(key.root_keychain()->name(), key.pubkey());
+    auto sign = [&]()
+    {
+        std::map<std::size_t, std::shared_ptr<secp256k1_key>> signingKeys;
+        std::size_t j;
+        while ((j = nextJob.fetch_add(1)) < jobs.size())
+        {
+            SigningJob& job = jobs[j];
+            try
+            {
+                std::shared_ptr<secp256k1_key>& signingKey = signingKeys[job.keySlot];
+                if (!signingKey)
+                {
+                    bytes_t privkey = keyCache.get(job.keySlot);
+                    signingKey = std::make_shared<secp256k1_key>();
+                    signingKey->setPrivKey(privkey);
+                    SigningKeyCache::wipe(&privkey[0], privkey.size());
+                }
+
+                // Try checking both compressed and uncompressed pubkeys
+                if (signingKey->getPubKey() != job.pubkey && signingKey->getPubKey(false) != job.pubkey) throw KeychainInvalidPrivateKeyException(job.keychain->name(), job.pubkey);
 
-            bytes_t signature = secp256k1_sign(signingKey, signingHash);
-            signature.push_back(SIGHASH_ALL);
-            signableTxIn.addsig(key.pubkey(), signature);
-            LOGGER(debug) << "Vault::signTx_unwrapped - PUBLIC KEY: " << uchar_vector(key.pubkey()).getHex() << " SIGNATURE: " << uchar_vector(signature).getHex() << std::endl;
-            keychains_signed.insert(key.root_keychain());
-            sigsadded++;
-            sigsneeded--;
-            if (sigsneeded == 0) break;
+                job.signature = secp256k1_sign_rfc6979(*signingKey, job.signingHash);
+                job.signature.push_back(SIGHASH_ALL);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) { error = std::current_exception(); }
+                nextJob = jobs.size();
+            }
         }
+    };
 
-        txin->script(signableTxIn.txinscript());
+    // Below a few signatures per thread, starting threads costs more than it saves.
+    const std::size_t MIN_JOBS_PER_THREAD = 4;
+    std::size_t threadCount = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u), jobs.size() / MIN_JOBS_PER_THREAD);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < threadCount; i++) { threads.push_back(std::thread(sign)); }
+    sign();
+    for (auto& thread: threads) { thread.join(); }
+
+    keyCache.clear();
+    if (error) std::rethrow_exception(error);
+
+    // Apply the signatures in the order the keys were found.
+    KeychainSet keychains_signed;
+    std::vector<unsigned int> txSigsAdded(txs.size(), 0);
+    unsigned int sigsadded = 0;
+    for (auto& job: jobs)
+    {
+        InputState& state = inputs[job.input];
+        state.signableTxIn->addsig(job.pubkey, job.signature);
+        LOGGER(debug) << "Vault::signTxs_unwrapped - PUBLIC KEY: " << uchar_vector(job.pubkey).getHex() << " SIGNATURE: " << uchar_vector(job.signature).getHex() << std::endl;
+        keychains_signed.insert(job.keychain);
+        txSigsAdded[state.tx]++;
+        sigsadded++;
+    }
+
+    for (auto& state: inputs)
+    {
+        state.txin->script(state.signableTxIn->txinscript());
         std::vector<bytes_t> stack;
-        for (auto& item: signableTxIn.scriptwitness().stack) { stack.push_back(item); }
-        txin->scriptwitnessstack(stack);
+        for (auto& item: state.signableTxIn->scriptwitness().stack) { stack.push_back(item); }
+        state.txin->scriptwitnessstack(stack);
     }
 
-    keychain_names.clear();
-    if (!sigsadded) return 0;
+    txs_t signedTxs;
+    for (std::size_t i = 0; i < txs.size(); i++)
+    {
+        if (!txSigsAdded[i]) continue;
+        txs[i]->updateStatus(Tx::NO_STATUS, true);
+        signedTxs.push_back(txs[i]);
+    }
+    txs.swap(signedTxs);
 
+    keychain_names.clear();
     for (auto& keychain: keychains_signed) { keychain_names.push_back(keychain->name()); }
-    tx->updateStatus(Tx::NO_STATUS, true);
+
+    signatureCounter.add(sigsadded);
     return sigsadded;
 }
 
@@ -3852,7 +4845,7 @@ std::shared_ptr<TxOut> Vault::getTxOut(const bytes_t& outhash, uint32_t outindex
     LOGGER(trace) << "Vault::getTxOut(" << uchar_vector(outhash).getHex() << ", " << outindex << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -3871,7 +4864,7 @@ std::shared_ptr<TxOut> Vault::setSendingLabel(const bytes_t& outhash, uint32_t o
 {
     LOGGER(trace) << "Vault::setSendingLabel(" << uchar_vector(outhash).getHex() << ", " << outindex << ", " << label << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
     std::shared_ptr<TxOut> txout = setSendingLabel_unwrapped(outhash, outindex, label);
@@ -3891,7 +4884,7 @@ std::shared_ptr<TxOut> Vault::setReceivingLabel(const bytes_t& outhash, uint32_t
 {
     LOGGER(trace) << "Vault::setReceivingLabel(" << uchar_vector(outhash).getHex() << ", " << outindex << ", " << label << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::session s;
     odb::core::transaction t(db_->begin());
     std::shared_ptr<TxOut> txout = setReceivingLabel_unwrapped(outhash, outindex, label);
@@ -3913,7 +4906,7 @@ std::shared_ptr<Tx> Vault::exportTx(const bytes_t& hash, const std::string& file
     LOGGER(trace) << "Vault::exportTx(" << uchar_vector(hash).getHex() << ", " << filepath << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
 
     std::shared_ptr<Tx> tx;
@@ -3931,7 +4924,7 @@ std::shared_ptr<Tx> Vault::exportTx(unsigned long tx_id, const std::string& file
     LOGGER(trace) << "Vault::exportTx(" << tx_id << ", " << filepath << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
 
     std::shared_ptr<Tx> tx;
@@ -3959,7 +4952,7 @@ std::string Vault::exportTx(const bytes_t& hash) const
     LOGGER(trace) << "Vault::exportTx(" << uchar_vector(hash).getHex() << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
 
     std::shared_ptr<Tx> tx;
@@ -3976,7 +4969,7 @@ std::string Vault::exportTx(unsigned long tx_id) const
     LOGGER(trace) << "Vault::exportTx(" << tx_id << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
 
     std::shared_ptr<Tx> tx;
@@ -4007,7 +5000,7 @@ std::shared_ptr<Tx> Vault::importTx(const std::string& filepath)
 
     std::shared_ptr<Tx> tx(new Tx());
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         ia >> *tx;
@@ -4015,7 +5008,7 @@ std::shared_ptr<Tx> Vault::importTx(const std::string& filepath)
         if (tx) { t.commit(); }
     }
 
-    signalQueue.flush();
+    flushSignals();
     return tx;
 }
 
@@ -4029,7 +5022,7 @@ std::shared_ptr<Tx> Vault::importTxFromString(const std::string& txstr)
 
     std::shared_ptr<Tx> tx(new Tx());
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         ia >> *tx;
@@ -4037,19 +5030,30 @@ std::shared_ptr<Tx> Vault::importTxFromString(const std::string& txstr)
         if (tx) { t.commit(); }
     }
 
-    signalQueue.flush();
+    flushSignals();
     return tx;
 }
 
-unsigned int Vault::exportTxs(const std::string& filepath, uint32_t minheight) const
+unsigned int Vault::exportTxs(const std::string& filepath, uint32_t minheight, archive_format_t format) const
 {
-    LOGGER(trace) << "Vault::exportTxs(" << filepath << ", " << minheight << ")" << std::endl;
+    LOGGER(trace) << "Vault::exportTxs(" << filepath << ", " << minheight << ", " << format << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
 
     //TODO: disable opetation if file is already open
+    if (format != TEXT_ARCHIVE)
+    {
+        std::ofstream ofs(filepath, std::ios::binary);
+        BinaryArchiveWriter writer(ofs, format == COMPRESSED_BINARY_ARCHIVE);
+
+        odb::core::transaction t(db_->begin());
+        unsigned int n = exportTxs_unwrapped(writer, minheight);
+        writer.finish();
+        return n;
+    }
+
     std::ofstream ofs(filepath);
     boost::archive::text_oarchive oa(ofs);
 
@@ -4079,22 +5083,68 @@ unsigned int Vault::exportTxs_unwrapped(boost::archive::text_oarchive& oa, uint3
     return n;
 }
 
+unsigned int Vault::exportTxs_unwrapped(BinaryArchiveWriter& writer, uint32_t minheight) const
+{
+    typedef odb::query<Tx> tx_query_t;
+    unsigned int n = 0;
+
+    // Stream straight from the cursor. Loaded objects only live for one batch.
+    auto writeTxs = [&](const tx_query_t& query)
+    {
+        odb::result<Tx> r(db_->query<Tx>(query));
+        auto it(r.begin());
+        while (it != r.end())
+        {
+            odb::core::session s;
+            for (uint32_t i = 0; i < ARCHIVE_BATCH_SIZE && it != r.end(); i++, ++it)
+            {
+                writer.write(BinaryArchive::TX, *it.load());
+                n++;
+            }
+        }
+    };
+
+    // First the confirmed transactions
+    writeTxs((tx_query_t::blockheader.is_not_null() && tx_query_t::blockheader->height >= minheight) + "ORDER BY" + tx_query_t::blockheader + "ASC, " + tx_query_t::timestamp + "ASC");
+
+    // Then the unconfirmed
+    writeTxs(tx_query_t::blockheader.is_null() + "ORDER BY" + tx_query_t::timestamp + "ASC");
+
+    return n;
+}
+
 unsigned int Vault::importTxs(const std::string& filepath)
 {
     LOGGER(trace) << "Vault::importTxs(" << filepath << ")" << std::endl;
 
+    if (BinaryArchive::isBinaryArchive(filepath))
+    {
+        std::ifstream ifs(filepath, std::ios::binary);
+        BinaryArchiveReader reader(ifs);
+
+        unsigned int txcount;
+        {
+            VaultWriteLock lock(mutex);
+            unsigned int privkeysimported = 0;
+            importBinaryArchive(reader, privkeysimported, txcount);
+        }
+
+        flushSignals();
+        return txcount;
+    }
+
     std::ifstream ifs(filepath);
     boost::archive::text_iarchive ia(ifs);
 
     uint32_t n;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::transaction t(db_->begin());
         n = importTxs_unwrapped(ia);
         t.commit();
     }
 
-    signalQueue.flush();
+    flushSignals();
     return n;
 }
 
@@ -4120,7 +5170,7 @@ std::shared_ptr<SigningScript> Vault::getSigningScript(const bytes_t& script) co
     LOGGER(trace) << "Vault::getSigningScript(" << uchar_vector(script).getHex() << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
@@ -4144,7 +5194,7 @@ uint32_t Vault::getBestHeight() const
     LOGGER(trace) << "Vault::getBestHeight()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getBestHeight_unwrapped();
@@ -4162,7 +5212,7 @@ std::shared_ptr<BlockHeader> Vault::getBlockHeader(const bytes_t& hash) const
     LOGGER(trace) << "Vault::getBlockHeader(" << uchar_vector(hash).getHex() << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getBlockHeader_unwrapped(hash);
@@ -4173,7 +5223,7 @@ std::shared_ptr<BlockHeader> Vault::getBlockHeader(uint32_t height) const
     LOGGER(trace) << "Vault::getBlockHeader(" << height << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getBlockHeader_unwrapped(height);
@@ -4198,33 +5248,80 @@ std::shared_ptr<BlockHeader> Vault::getBestBlockHeader() const
     LOGGER(trace) << "Vault::getBestBlockHeader()" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getBestBlockHeader_unwrapped();
 }
 
-std::shared_ptr<BlockHeader> Vault::getBestBlockHeader_unwrapped() const
-{
-    odb::result<BlockHeader> r(db_->query<BlockHeader>("ORDER BY" + odb::query<BlockHeader>::height + "DESC LIMIT 1"));
-    if (r.empty()) return nullptr;
-    return r.begin().load();
+std::shared_ptr<BlockHeader> Vault::getBestBlockHeader_unwrapped() const
+{
+    odb::result<BlockHeader> r(db_->query<BlockHeader>("ORDER BY" + odb::query<BlockHeader>::height + "DESC LIMIT 1"));
+    if (r.empty()) return nullptr;
+    return r.begin().load();
+}
+
+std::shared_ptr<MerkleBlock> Vault::insertMerkleBlock(std::shared_ptr<MerkleBlock> merkleblock)
+{
+    LOGGER(trace) << "Vault::insertMerkleBlock(" << uchar_vector(merkleblock->blockheader()->hash()).getHex() << ")" << std::endl;
+
+    static metrics::histogram& elapsed = metrics::get_histogram("vault.insert_merkleblock");
+    metrics::scoped_timer timer(elapsed);
+
+    {
+        VaultWriteLock lock(mutex);
+        odb::core::session s;
+        odb::core::transaction t(db_->begin());
+        merkleblock = insertMerkleBlock_unwrapped(merkleblock);
+        t.commit();
+    }
+
+    flushSignals();
+    return merkleblock;
+}
+
+unsigned int Vault::insertMerkleBlocks(const std::vector<chain_merkle_block_txs_t>& blocks)
+{
+    LOGGER(trace) << "Vault::insertMerkleBlocks(" << blocks.size() << " block(s))" << std::endl;
+
+    static metrics::histogram& elapsed = metrics::get_histogram("vault.insert_merkleblocks");
+    metrics::scoped_timer timer(elapsed);
+
+    unsigned int txcount = 0;
+    for (std::size_t i = 0; i < blocks.size(); i += ARCHIVE_BATCH_SIZE)
+    {
+        {
+            VaultWriteLock lock(mutex);
+            odb::core::session s;
+            odb::core::transaction t(db_->begin());
+            auto end = blocks.begin() + std::min<std::size_t>(i + ARCHIVE_BATCH_SIZE, blocks.size());
+            for (auto it = blocks.begin() + i; it != end; ++it) { txcount += insertMerkleBlock_unwrapped(it->first, it->second); }
+            t.commit();
+        }
+
+        flushSignals();
+    }
+
+    return txcount;
 }
 
-std::shared_ptr<MerkleBlock> Vault::insertMerkleBlock(std::shared_ptr<MerkleBlock> merkleblock)
+unsigned int Vault::insertMerkleBlock_unwrapped(const ChainMerkleBlock& chainmerkleblock, const std::vector<Coin::Transaction>& cointxs)
 {
-    LOGGER(trace) << "Vault::insertMerkleBlock(" << uchar_vector(merkleblock->blockheader()->hash()).getHex() << ")" << std::endl;
-
+    // Same as SynchedVault does with NetworkSync's merkle block and merkle tx notifications.
+    if (cointxs.empty())
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
-        odb::core::session s;
-        odb::core::transaction t(db_->begin());
-        merkleblock = insertMerkleBlock_unwrapped(merkleblock);
-        t.commit();
+        std::shared_ptr<MerkleBlock> merkleblock(new MerkleBlock(chainmerkleblock));
+        merkleblock->txsinserted(true);
+        insertMerkleBlock_unwrapped(merkleblock);
+        return 0;
     }
 
-    signalQueue.flush();
-    return merkleblock;
+    unsigned int txcount = 0;
+    for (unsigned int i = 0; i < cointxs.size(); i++)
+    {
+        if (insertMerkleTx_unwrapped(chainmerkleblock, cointxs[i], i, cointxs.size())) { txcount++; }
+    }
+    return txcount;
 }
 
 std::shared_ptr<MerkleBlock> Vault::insertMerkleBlock_unwrapped(std::shared_ptr<MerkleBlock> merkleblock)
@@ -4260,7 +5357,8 @@ std::shared_ptr<MerkleBlock> Vault::insertMerkleBlock_unwrapped(std::shared_ptr<
             LOGGER(debug) << "Vault::insertMerkleBlock_unwrapped - inserting horizon merkle block. hash: " << new_blockheader_hash << ", height: " << new_blockheader->height() << std::endl;
             db_->persist(new_blockheader);
             db_->persist(merkleblock);
-            signalQueue.push(notifyMerkleBlockInserted.bind(merkleblock));
+            addPendingConfirmations_unwrapped(new_blockheader, merkleblock->hashes());
+            queueMerkleBlockInserted(merkleblock);
             //notifyMerkleBlockInserted(merkleblock);
             return merkleblock;
         }
@@ -4299,11 +5397,13 @@ std::shared_ptr<MerkleBlock> Vault::insertMerkleBlock_unwrapped(std::shared_ptr<
         LOGGER(debug) << "Vault::insertMerkleBlock_unwrapped - inserting merkle block. hash: " << new_blockheader_hash << ", height: " << new_blockheader->height() << std::endl;
         db_->persist(new_blockheader);
         db_->persist(merkleblock);
-        signalQueue.push(notifyMerkleBlockInserted.bind(merkleblock));
+        queueMerkleBlockInserted(merkleblock);
 
-        // Confirm transactions
+        // Confirm transactions we already have. Hashes we don't have yet are remembered
+        // so the transactions get confirmed directly when they arrive.
         bool confirmations_updated = false;
         const auto& hashes = merkleblock->hashes();
+        std::set<bytes_t> pending_hashes(hashes.begin(), hashes.end());
         odb::result<Tx> tx_r(db_->query<Tx>(odb::query<Tx>::hash.in_range(hashes.begin(), hashes.end())));
         for (auto& tx: tx_r)
         {
@@ -4316,7 +5416,10 @@ std::shared_ptr<MerkleBlock> Vault::insertMerkleBlock_unwrapped(std::shared_ptr<
             tx.blockheader(new_blockheader);
             db_->update(tx);
             confirmations_updated = true;
-            signalQueue.push(notifyTxUpdated.bind(std::make_shared<Tx>(tx)));
+            pending_hashes.erase(tx.hash());
+            std::shared_ptr<Tx> confirmed_tx(std::make_shared<Tx>(tx));
+            updateLedger_unwrapped(confirmed_tx);
+            queueTxUpdated(confirmed_tx);
         }
 
         if (confirmations_updated)
@@ -4324,11 +5427,13 @@ std::shared_ptr<MerkleBlock> Vault::insertMerkleBlock_unwrapped(std::shared_ptr<
             db_->update(merkleblock);
         }
 
+        addPendingConfirmations_unwrapped(new_blockheader, std::vector<bytes_t>(pending_hashes.begin(), pending_hashes.end()));
+
         return merkleblock;     
     }
     catch (...)
     {
-        signalQueue.clear();
+        clearSignals();
         throw;
     }
 }
@@ -4344,83 +5449,147 @@ unsigned int Vault::deleteMerkleBlock(uint32_t height)
 
     unsigned int count;
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         count = deleteMerkleBlock_unwrapped(height);
         t.commit();
     }
 
-    signalQueue.flush();
+    flushSignals();
     return count;
 }
 
+// update_query() bypasses the session, so objects it already holds have to be refreshed.
+template <typename T>
+static void reloadCachedObject(odb::database& db, unsigned long id)
+{
+    if (!odb::session::has_current()) return;
+    std::shared_ptr<T> object(odb::session::current().cache_find<T>(db, id));
+    if (object) { db.reload(object); }
+}
+
+template <typename T>
+static void eraseCachedObject(odb::database& db, unsigned long id)
+{
+    if (odb::session::has_current()) { odb::session::current().cache_erase<T>(db, id); }
+}
+
+// Drops an account's ledger entries from the session after update_query() changed their balances.
+static void eraseCachedLedgerEntries(odb::database& db, unsigned long account_id)
+{
+    if (!odb::session::has_current()) return;
+
+    odb::session::database_map& databases = odb::session::current().map();
+    auto db_it = databases.find(&db);
+    if (db_it == databases.end()) return;
+
+    auto type_it = db_it->second.find(&typeid(LedgerEntry));
+    if (type_it == db_it->second.end()) return;
+
+    odb::session::object_map<LedgerEntry>& entries = static_cast<odb::session::object_map<LedgerEntry>&>(*type_it->second);
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        if (it->second->account_id() == account_id) { it = entries.erase(it); }
+        else                                        { ++it; }
+    }
+}
+
 unsigned int Vault::deleteMerkleBlock_unwrapped(uint32_t height)
 {
     try
     {
-
-    /*
-        unsigned int count = 0;
-
-        typedef odb::query<ConfirmedTxView> query_t;
-        odb::result<ConfirmedTxView> r(db_->query<ConfirmedTxView>((query_t::BlockHeader::height >= height) + "ORDER BY" + query_t::BlockHeader::height));
-        for (auto& view: r)
+        std::vector<unsigned long> blockheader_ids;
+        std::vector<unsigned long> merkleblock_ids;
         {
-            std::shared_ptr<Tx> tx(db_->find<Tx>(view.tx_id));
-            if (tx)
+            odb::result<BlockIdView> r(db_->query<BlockIdView>(odb::query<BlockIdView>::BlockHeader::height >= height));
+            for (auto& view: r)
             {
-                tx->blockheader(nullptr);
-                db_->update(tx);
-                signalQueue.push(notifyTxUpdated.bind(tx));
+                blockheader_ids.push_back(view.blockheader_id);
+                if (!view.merkleblock_id.null()) { merkleblock_ids.push_back(*view.merkleblock_id); }
             }
+        }
+        if (blockheader_ids.empty()) return 0;
 
-            std::shared_ptr<MerkleBlock> merkleblock(db_->find<MerkleBlock>(view.merkleblock_id));
-            if (merkleblock) { db_->erase(merkleblock); }
+        LOGGER(debug) << "Vault::deleteMerkleBlock_unwrapped - deleting " << blockheader_ids.size() << " block(s) from height " << height << "." << std::endl;
 
-            std::shared_ptr<BlockHeader> blockheader(db_->find<BlockHeader>(view.blockheader_id));
-            if (blockheader)
+        // Ledger entries sort by confirmation height, so the ones at or above the height belong to exactly these txs
+        std::vector<unsigned long> ledger_entry_ids;
+        std::set<std::string> account_names;
+        {
+            typedef odb::query<LedgerEntryView> query_t;
+            odb::result<LedgerEntryView> r(db_->query<LedgerEntryView>(query_t::LedgerEntry::sort_height >= height && query_t::LedgerEntry::sort_height != LedgerEntry::UNCONFIRMED_HEIGHT));
+            for (auto& view: r)
             {
-                db_->erase(blockheader);
-                count++;
+                ledger_entry_ids.push_back(view.id);
+                account_names.insert(view.account_name);
             }
         }
 
-        return count;
-    */
-
-        typedef odb::query<BlockHeader> query_t;
-        odb::result<BlockHeader> r(db_->query<BlockHeader>((query_t::height >= height) + "ORDER BY" + query_t::height + "DESC"));
-        unsigned int count = 0;
-        for (auto& blockheader: r)
+        std::vector<unsigned long> tx_ids;
+        std::vector<bytes_t> tx_hashes;
         {
-            LOGGER(debug) << "Vault::deleteMerkleBlock_unwrapped - deleting block. hash: " << uchar_vector(blockheader.hash()).getHex() << ", height: " << blockheader.height() << std::endl;
-
-            // Remove tx confirmations
-            odb::result<Tx> tx_r(db_->query<Tx>(odb::query<Tx>::blockheader == blockheader.id()));
-            for (auto& tx: tx_r)
+            odb::result<TxView> r(db_->query<TxView>(odb::query<TxView>::BlockHeader::height >= height));
+            for (auto& view: r)
             {
-    //            LOGGER(debug) << "Vault::deleteMerkleBlock_unwrapped - unconfirming transaction. hash: " << uchar_vector(tx.hash()).getHex() << std::endl;
-                tx.blockheader(nullptr);
-                db_->update(tx);
-                signalQueue.push(notifyTxUpdated.bind(std::make_shared<Tx>(tx)));
-                //notifyTxUpdated(std::make_shared<Tx>(tx));
+                tx_ids.push_back(view.id);
+                tx_hashes.push_back(view.hash);
             }
+        }
 
-            // Delete merkle block
-            db_->erase_query<MerkleBlock>(odb::query<MerkleBlock>::blockheader == blockheader.id());
+        // Unconfirm the txs and drop the merkle blocks with one statement each per batch of blocks,
+        // which stays within statement parameter limits. Reorgs are rarely deeper than one batch.
+        const std::size_t BATCH_SIZE = 500;
+        for (std::size_t i = 0; i < blockheader_ids.size(); i += BATCH_SIZE)
+        {
+            auto begin = blockheader_ids.begin() + i;
+            auto end = blockheader_ids.begin() + std::min(i + BATCH_SIZE, blockheader_ids.size());
+
+            // Same as Tx::blockheader(nullptr)
+            typedef odb::query<Tx> query_t;
+            query_t query(std::string(query_t::blockheader.column()) + "= NULL," + std::string(query_t::status.column()) + "= CASE WHEN" +
+                (query_t::status == Tx::CONFIRMED) + "THEN" + query_t::_val(Tx::PROPAGATED) + "ELSE" + query_t::status + "END");
+            query += "WHERE" + query_t::blockheader.in_range(begin, end);
+            update_query<Tx>(query);
+
+            // Hashes go with their merkle block
+            db_->erase_query<MerkleBlock>(odb::query<MerkleBlock>::blockheader.in_range(begin, end));
+        }
+        for (auto tx_id: tx_ids) { reloadCachedObject<Tx>(*db_, tx_id); }
 
-            // Delete block header
-            db_->erase(blockheader);
+        if (!ledger_entry_ids.empty())
+        {
+            typedef odb::query<LedgerEntry> query_t;
+            uint32_t unconfirmed_height = LedgerEntry::UNCONFIRMED_HEIGHT;
+            query_t query(std::string(query_t::sort_height.column()) + "=" + query_t::_val(unconfirmed_height));
+            query += "WHERE" + (query_t::sort_height >= height && query_t::sort_height != unconfirmed_height);
+            update_query<LedgerEntry>(query);
+            for (auto ledger_entry_id: ledger_entry_ids) { reloadCachedObject<LedgerEntry>(*db_, ledger_entry_id); }
+        }
 
-            count++;
+        // Forget transactions we were waiting on from these blocks
+        if (bPendingConfirmationsLoaded)
+        {
+            pendingConfirmationsChanging_unwrapped();
+            std::set<unsigned long> deleted_ids(blockheader_ids.begin(), blockheader_ids.end());
+            for (auto it = mapPendingConfirmations.begin(); it != mapPendingConfirmations.end();)
+            {
+                if (deleted_ids.count(it->second))  { it = mapPendingConfirmations.erase(it); }
+                else                                { ++it; }
+            }
         }
 
-        return count;
+        db_->erase_query<BlockHeader>(odb::query<BlockHeader>::height >= height);
+        for (auto merkleblock_id: merkleblock_ids) { eraseCachedObject<MerkleBlock>(*db_, merkleblock_id); }
+        for (auto blockheader_id: blockheader_ids) { eraseCachedObject<BlockHeader>(*db_, blockheader_id); }
+
+        repairLedger_unwrapped(height);
+        queueReorg(height, tx_ids, tx_hashes, account_names);
+        return blockheader_ids.size();
     }
     catch (...)
     {
-        signalQueue.clear();
+        clearSignals();
         throw;
     }
 }
@@ -4431,45 +5600,113 @@ unsigned int Vault::updateConfirmations_unwrapped(std::shared_ptr<Tx> tx)
 
     try
     {
-        unsigned int count = 0;
-        typedef odb::query<ConfirmedTxView> query_t;
-        query_t query(query_t::Tx::blockheader.is_null());
-        if (tx) query = (query && query_t::Tx::hash == tx->hash());
+        loadPendingConfirmations_unwrapped();
 
-        odb::result<ConfirmedTxView> r(db_->query<ConfirmedTxView>(query));
-        for (auto& view: r)
+        unsigned int count = 0;
+        if (tx)
         {
-            if (view.blockheader_id == 0) continue;
+            auto it = mapPendingConfirmations.find(tx->hash());
+            if (it == mapPendingConfirmations.end()) return 0;
 
-            std::shared_ptr<Tx> tx(db_->load<Tx>(view.tx_id));
-            std::shared_ptr<BlockHeader> blockheader(db_->load<BlockHeader>(view.blockheader_id));
-            std::shared_ptr<MerkleBlock> merkleblock(db_->load<MerkleBlock>(view.merkleblock_id));
+            unsigned long blockheader_id = it->second;
+            pendingConfirmationsChanging_unwrapped();
+            mapPendingConfirmations.erase(it);
+            if (tx->blockheader()) return 0;
 
+            std::shared_ptr<BlockHeader> blockheader(db_->load<BlockHeader>(blockheader_id));
             tx->blockheader(blockheader);
             db_->update(tx);
-            signalQueue.push(notifyTxUpdated.bind(tx));
-            count++;
-            LOGGER(debug) << "Vault::updateConfirmations_unwrapped - transaction " << uchar_vector(tx->hash()).getHex() << " confirmed in block " << uchar_vector(tx->blockheader()->hash()).getHex() << " height: " << tx->blockheader()->height() << std::endl;
+            updateLedger_unwrapped(tx);
+            queueTxUpdated(tx);
+            LOGGER(debug) << "Vault::updateConfirmations_unwrapped - transaction " << uchar_vector(tx->hash()).getHex() << " confirmed in block " << uchar_vector(blockheader->hash()).getHex() << " height: " << blockheader->height() << std::endl;
+            return 1;
+        }
+
+        // Check all pending hashes in batches to stay within statement parameter limits
+        const std::size_t BATCH_SIZE = 500;
+        std::vector<bytes_t> hashes;
+        for (auto& item: mapPendingConfirmations) { hashes.push_back(item.first); }
+        for (std::size_t i = 0; i < hashes.size(); i += BATCH_SIZE)
+        {
+            auto begin = hashes.begin() + i;
+            auto end = hashes.begin() + std::min(i + BATCH_SIZE, hashes.size());
+            odb::result<Tx> tx_r(db_->query<Tx>(odb::query<Tx>::hash.in_range(begin, end)));
+            for (auto it = tx_r.begin(); it != tx_r.end(); ++it)
+            {
+                std::shared_ptr<Tx> tx(it.load());
+                count += updateConfirmations_unwrapped(tx);
+            }
         }
 
         return count;
     }
     catch (...)
     {
-        signalQueue.clear();
+        clearSignals();
         throw;
     }
 }
 
-void Vault::exportMerkleBlocks(const std::string& filepath) const
+void Vault::loadPendingConfirmations_unwrapped()
+{
+    if (bPendingConfirmationsLoaded) return;
+
+    // The view includes uncommitted changes made earlier in this transaction
+    pendingConfirmationsChanging_unwrapped();
+    mapPendingConfirmations.clear();
+    odb::result<PendingConfirmationView> r(db_->query<PendingConfirmationView>());
+    for (auto& view: r) { mapPendingConfirmations[view.tx_hash] = view.blockheader_id; }
+    bPendingConfirmationsLoaded = true;
+
+    LOGGER(debug) << "Vault::loadPendingConfirmations_unwrapped - " << mapPendingConfirmations.size() << " pending transaction hash(es)." << std::endl;
+}
+
+void Vault::addPendingConfirmations_unwrapped(std::shared_ptr<BlockHeader> blockheader, const std::vector<bytes_t>& txhashes)
+{
+    // Before the first load the view already reflects these hashes
+    if (!bPendingConfirmationsLoaded) return;
+
+    pendingConfirmationsChanging_unwrapped();
+    for (auto& txhash: txhashes) { mapPendingConfirmations[txhash] = blockheader->id(); }
+}
+
+void Vault::pendingConfirmationsChanging_unwrapped()
+{
+    odb::transaction& t = odb::transaction::current();
+    if (pendingConfirmationsTx == &t) return;
+
+    // odb resets pendingConfirmationsTx when the transaction finishes either way
+    t.callback_register(&Vault::pendingConfirmationsTxEvent, this, odb::transaction::event_rollback, 0, &pendingConfirmationsTx);
+}
+
+void Vault::pendingConfirmationsTxEvent(unsigned short /*event*/, void* key, unsigned long long /*data*/)
+{
+    // Runs during rollback, still under the vault's write lock
+    Vault* vault = static_cast<Vault*>(key);
+    vault->bPendingConfirmationsLoaded = false;
+    vault->mapPendingConfirmations.clear();
+}
+
+void Vault::exportMerkleBlocks(const std::string& filepath, archive_format_t format) const
 {
-    LOGGER(trace) << "Vault::exportMerkleBlocks(" << filepath << ")" << std::endl;
+    LOGGER(trace) << "Vault::exportMerkleBlocks(" << filepath << ", " << format << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
 
     // TODO: Disable operation if file is already open
+    if (format != TEXT_ARCHIVE)
+    {
+        std::ofstream ofs(filepath, std::ios::binary);
+        BinaryArchiveWriter writer(ofs, format == COMPRESSED_BINARY_ARCHIVE);
+
+        odb::core::transaction t(db_->begin());
+        exportMerkleBlocks_unwrapped(writer);
+        writer.finish();
+        return;
+    }
+
     std::ofstream ofs(filepath);
     boost::archive::text_oarchive oa(ofs);
 
@@ -4489,22 +5726,53 @@ void Vault::exportMerkleBlocks_unwrapped(boost::archive::text_oarchive& oa) cons
     for (auto& merkleblock: mb_r)   { oa << merkleblock; }
 }
 
+void Vault::exportMerkleBlocks_unwrapped(BinaryArchiveWriter& writer) const
+{
+    typedef odb::query<MerkleBlock> mb_query_t;
+    odb::result<MerkleBlock> r(db_->query<MerkleBlock>("ORDER BY " + mb_query_t::blockheader->height));
+    auto it(r.begin());
+    while (it != r.end())
+    {
+        odb::core::session s;
+        for (uint32_t i = 0; i < ARCHIVE_BATCH_SIZE && it != r.end(); i++, ++it)
+        {
+            writer.write(BinaryArchive::MERKLEBLOCK, *it.load());
+        }
+    }
+}
+
 void Vault::importMerkleBlocks(const std::string& filepath)
 {
     LOGGER(trace) << "Vault::importMerkleBlocks(" << filepath << ")" << std::endl;
 
+    if (BinaryArchive::isBinaryArchive(filepath))
+    {
+        std::ifstream ifs(filepath, std::ios::binary);
+        BinaryArchiveReader reader(ifs);
+
+        {
+            VaultWriteLock lock(mutex);
+            unsigned int privkeysimported = 0;
+            unsigned int txcount;
+            importBinaryArchive(reader, privkeysimported, txcount);
+        }
+
+        flushSignals();
+        return;
+    }
+
     std::ifstream ifs(filepath);
     boost::archive::text_iarchive ia(ifs);
 
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
+        VaultWriteLock lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         importMerkleBlocks_unwrapped(ia);
         t.commit();
     }
 
-    signalQueue.flush();
+    flushSignals();
 }
 
 void Vault::importMerkleBlocks_unwrapped(boost::archive::text_iarchive& ia)
@@ -4519,6 +5787,355 @@ void Vault::importMerkleBlocks_unwrapped(boost::archive::text_iarchive& ia)
     }
 }
 
+///////////////////////
+// LEDGER OPERATIONS //
+///////////////////////
+std::vector<LedgerEntryView> Vault::getLedgerViews(const std::string& account_name, unsigned int count) const
+{
+    LOGGER(trace) << "Vault::getLedgerViews(" << account_name << ", " << count << ")" << std::endl;
+
+#if defined(LOCK_ALL_CALLS)
+    VaultReadLock lock(mutex);
+#endif
+    odb::core::transaction t(db_->begin());
+    return getLedgerViews_unwrapped(account_name, count);
+}
+
+std::vector<LedgerEntryView> Vault::getLedgerViews_unwrapped(const std::string& account_name, unsigned int count) const
+{
+    typedef odb::query<LedgerEntryView> query_t;
+    query_t query(query_t::Account::name == account_name);
+    query += "ORDER BY" + query_t::LedgerEntry::sort_height + "DESC," + query_t::LedgerEntry::tx_id + "DESC";
+    if (count > 0)
+    {
+        std::stringstream limit;
+        limit << " LIMIT " << count;
+        query += limit.str().c_str();
+    }
+
+    getAccount_unwrapped(account_name);
+
+    std::vector<LedgerEntryView> views;
+    odb::result<LedgerEntryView> r(db_->query<LedgerEntryView>(query));
+    for (auto& view: r) { views.push_back(view); }
+    return views;
+}
+
+void Vault::rebuildLedger(const std::string& account_name)
+{
+    LOGGER(trace) << "Vault::rebuildLedger(" << account_name << ")" << std::endl;
+
+    VaultWriteLock lock(mutex);
+    odb::core::session s;
+    odb::core::transaction t(db_->begin());
+    if (account_name.empty())
+    {
+        odb::result<Account> r(db_->query<Account>());
+        std::vector<std::shared_ptr<Account>> accounts;
+        for (auto it = r.begin(); it != r.end(); ++it) { accounts.push_back(it.load()); }
+        for (auto& account: accounts) { rebuildLedger_unwrapped(account); }
+    }
+    else
+    {
+        rebuildLedger_unwrapped(getAccount_unwrapped(account_name));
+    }
+    t.commit();
+}
+
+// Net effect of a tx on each account with txouts in it, as shown in the history:
+// received txouts, less sent txouts and the fee for the sending account.
+static std::map<unsigned long, int64_t> getLedgerDeltas(std::shared_ptr<Tx> tx)
+{
+    std::map<unsigned long, int64_t> deltas;
+    std::set<unsigned long> senders;
+    for (auto& txout: tx->txouts())
+    {
+        if (txout->sending_account())
+        {
+            deltas[txout->sending_account()->id()] -= (int64_t)txout->value();
+            senders.insert(txout->sending_account()->id());
+        }
+        if (txout->receiving_account())
+        {
+            deltas[txout->receiving_account()->id()] += (int64_t)txout->value();
+        }
+    }
+    for (auto id: senders) { deltas[id] -= (int64_t)tx->fee(); }
+    return deltas;
+}
+
+void Vault::updateLedger_unwrapped(std::shared_ptr<Tx> tx)
+{
+    std::map<unsigned long, int64_t> deltas = getLedgerDeltas(tx);
+    uint32_t sort_height = tx->blockheader() ? tx->blockheader()->height() : LedgerEntry::UNCONFIRMED_HEIGHT;
+
+    // Keep entries that are still correct, replace the rest
+    odb::result<LedgerEntry> r(db_->query<LedgerEntry>(odb::query<LedgerEntry>::tx_id == tx->id()));
+    ledger_entries_t entries;
+    for (auto it = r.begin(); it != r.end(); ++it) { entries.push_back(it.load()); }
+    for (auto& entry: entries)
+    {
+        auto it = deltas.find(entry->account_id());
+        if (it != deltas.end() && it->second == entry->delta() && entry->sort_height() == sort_height)
+        {
+            deltas.erase(it);
+            continue;
+        }
+        eraseLedgerEntry_unwrapped(entry);
+    }
+
+    for (auto& delta: deltas)
+    {
+        insertLedgerEntry_unwrapped(std::make_shared<LedgerEntry>(delta.first, tx->id(), sort_height, delta.second));
+    }
+}
+
+void Vault::eraseLedgerEntries_unwrapped(unsigned long tx_id)
+{
+    odb::result<LedgerEntry> r(db_->query<LedgerEntry>(odb::query<LedgerEntry>::tx_id == tx_id));
+    ledger_entries_t entries;
+    for (auto it = r.begin(); it != r.end(); ++it) { entries.push_back(it.load()); }
+    for (auto& entry: entries) { eraseLedgerEntry_unwrapped(entry); }
+}
+
+void Vault::insertLedgerEntry_unwrapped(std::shared_ptr<LedgerEntry> entry)
+{
+    typedef odb::query<LedgerEntry> query_t;
+    query_t query(query_t::account_id == entry->account_id() &&
+        (query_t::sort_height < entry->sort_height() || (query_t::sort_height == entry->sort_height() && query_t::tx_id < entry->tx_id())));
+    query += "ORDER BY" + query_t::sort_height + "DESC," + query_t::tx_id + "DESC LIMIT 1";
+
+    int64_t confirmed_balance = 0;
+    int64_t balance = 0;
+    odb::result<LedgerEntry> r(db_->query<LedgerEntry>(query));
+    if (!r.empty())
+    {
+        confirmed_balance = r.begin()->confirmed_balance();
+        balance = r.begin()->balance();
+    }
+
+    int64_t confirmed_delta = entry->confirmed() ? entry->delta() : 0;
+    entry->confirmed_balance(confirmed_balance + confirmed_delta);
+    entry->balance(balance + entry->delta());
+    db_->persist(entry);
+
+    shiftLedger_unwrapped(*entry, entry->delta(), confirmed_delta);
+}
+
+void Vault::eraseLedgerEntry_unwrapped(std::shared_ptr<LedgerEntry> entry)
+{
+    shiftLedger_unwrapped(*entry, -entry->delta(), entry->confirmed() ? -entry->delta() : 0);
+    db_->erase(entry);
+}
+
+void Vault::shiftLedger_unwrapped(const LedgerEntry& entry, int64_t delta, int64_t confirmed_delta)
+{
+    if (delta == 0 && confirmed_delta == 0) return;
+
+    // One statement however many entries follow, as for a back-dated confirmation or an import.
+    typedef odb::query<LedgerEntry> query_t;
+    query_t query(std::string(query_t::balance.column()) + "=" + query_t::balance + "+" + query_t::_val(delta) + "," +
+        std::string(query_t::confirmed_balance.column()) + "=" + query_t::confirmed_balance + "+" + query_t::_val(confirmed_delta));
+    query += "WHERE" + (query_t::account_id == entry.account_id() &&
+        (query_t::sort_height > entry.sort_height() || (query_t::sort_height == entry.sort_height() && query_t::tx_id > entry.tx_id())));
+    update_query<LedgerEntry>(query);
+    eraseCachedLedgerEntries(*db_, entry.account_id());
+}
+
+void Vault::recomputeLedger_unwrapped(unsigned long account_id, uint32_t min_sort_height)
+{
+    typedef odb::query<LedgerEntry> query_t;
+
+    int64_t confirmed_balance = 0;
+    int64_t balance = 0;
+    {
+        query_t query(query_t::account_id == account_id && query_t::sort_height < min_sort_height);
+        query += "ORDER BY" + query_t::sort_height + "DESC," + query_t::tx_id + "DESC LIMIT 1";
+        odb::result<LedgerEntry> r(db_->query<LedgerEntry>(query));
+        if (!r.empty())
+        {
+            confirmed_balance = r.begin()->confirmed_balance();
+            balance = r.begin()->balance();
+        }
+    }
+
+    query_t query(query_t::account_id == account_id && query_t::sort_height >= min_sort_height);
+    query += "ORDER BY" + query_t::sort_height + "ASC," + query_t::tx_id + "ASC";
+    odb::result<LedgerEntry> r(db_->query<LedgerEntry>(query));
+    ledger_entries_t entries;
+    for (auto it = r.begin(); it != r.end(); ++it) { entries.push_back(it.load()); }
+    for (auto& entry: entries)
+    {
+        if (entry->confirmed()) { confirmed_balance += entry->delta(); }
+        balance += entry->delta();
+        if (entry->confirmed_balance() == confirmed_balance && entry->balance() == balance) continue;
+
+        entry->confirmed_balance(confirmed_balance);
+        entry->balance(balance);
+        db_->update(entry);
+    }
+}
+
+void Vault::repairLedger_unwrapped(uint32_t min_height)
+{
+    odb::result<Account> r(db_->query<Account>());
+    std::vector<unsigned long> account_ids;
+    for (auto& account: r) { account_ids.push_back(account.id()); }
+    for (auto account_id: account_ids) { recomputeLedger_unwrapped(account_id, min_height); }
+}
+
+void Vault::rebuildLedger_unwrapped(std::shared_ptr<Account> account)
+{
+    LOGGER(debug) << "Vault::rebuildLedger_unwrapped(" << account->name() << ")" << std::endl;
+
+    db_->erase_query<LedgerEntry>(odb::query<LedgerEntry>::account_id == account->id());
+
+    // Sum the deltas per tx the same way getLedgerDeltas() does
+    typedef odb::query<TxOutView> query_t;
+    query_t query(query_t::sending_account::id == account->id() || query_t::receiving_account::id == account->id());
+    odb::result<TxOutView> r(db_->query<TxOutView>(query));
+
+    typedef std::pair<uint32_t, unsigned long> position_t;
+    std::map<position_t, int64_t> deltas;
+    std::set<unsigned long> sent_tx_ids;
+    for (auto& view: r)
+    {
+        position_t position(view.height ? view.height : LedgerEntry::UNCONFIRMED_HEIGHT, view.tx_id);
+        int64_t& delta = deltas[position];
+        if (view.sending_account_id == account->id())
+        {
+            delta -= (int64_t)view.value;
+            if (sent_tx_ids.insert(view.tx_id).second) { delta -= (int64_t)view.tx_fee(); }
+        }
+        if (view.receiving_account_id == account->id()) { delta += (int64_t)view.value; }
+    }
+
+    int64_t confirmed_balance = 0;
+    int64_t balance = 0;
+    for (auto& item: deltas)
+    {
+        std::shared_ptr<LedgerEntry> entry(std::make_shared<LedgerEntry>(account->id(), item.first.second, item.first.first, item.second));
+        if (entry->confirmed()) { confirmed_balance += entry->delta(); }
+        balance += entry->delta();
+        entry->confirmed_balance(confirmed_balance);
+        entry->balance(balance);
+        db_->persist(entry);
+    }
+}
+
+/////////////
+// SIGNALS //
+/////////////
+static void addChangeSetAccounts(VaultChangeSet& changes, std::shared_ptr<Tx> tx)
+{
+    for (auto& txout: tx->txouts())
+    {
+        if (txout->sending_account())   { changes.account_names.insert(txout->sending_account()->name()); }
+        if (txout->receiving_account()) { changes.account_names.insert(txout->receiving_account()->name()); }
+    }
+}
+
+void Vault::queueTxInserted(std::shared_ptr<Tx> tx)
+{
+    signalQueue.push(notifyTxInserted.bind(tx));
+
+    boost::lock_guard<boost::mutex> lock(changeSetMutex);
+    pendingChangeSet.txInserted(tx->id());
+    addChangeSetAccounts(pendingChangeSet, tx);
+}
+
+void Vault::queueTxUpdated(std::shared_ptr<Tx> tx)
+{
+    signalQueue.push(notifyTxUpdated.bind(tx));
+
+    boost::lock_guard<boost::mutex> lock(changeSetMutex);
+    pendingChangeSet.txUpdated(tx->id());
+    addChangeSetAccounts(pendingChangeSet, tx);
+}
+
+void Vault::queueTxDeleted(std::shared_ptr<Tx> tx)
+{
+    signalQueue.push(notifyTxDeleted.bind(tx));
+
+    boost::lock_guard<boost::mutex> lock(changeSetMutex);
+    pendingChangeSet.txDeleted(tx->id());
+    addChangeSetAccounts(pendingChangeSet, tx);
+}
+
+void Vault::queueMerkleBlockInserted(std::shared_ptr<MerkleBlock> merkleblock)
+{
+    signalQueue.push(notifyMerkleBlockInserted.bind(merkleblock));
+    queueChainChanged();
+}
+
+void Vault::queueChainChanged()
+{
+    boost::lock_guard<boost::mutex> lock(changeSetMutex);
+    pendingChangeSet.chain_changed = true;
+}
+
+// Ledger entries are moved by the caller, which knows the affected accounts.
+void Vault::queueReorg(uint32_t height, const std::vector<unsigned long>& tx_ids, const std::vector<bytes_t>& tx_hashes, const std::set<std::string>& account_names)
+{
+    signalQueue.push(notifyReorg.bind(height, tx_ids, tx_hashes));
+
+    boost::lock_guard<boost::mutex> lock(changeSetMutex);
+    for (auto tx_id: tx_ids) { pendingChangeSet.txUpdated(tx_id); }
+    pendingChangeSet.account_names.insert(account_names.begin(), account_names.end());
+    pendingChangeSet.chain_changed = true;
+}
+
+void Vault::flushSignals()
+{
+    // Tx writes can issue scripts, which changes account info. Invalidate before any slot can take a new snapshot.
+    invalidateMetadataCache();
+
+    static metrics::gauge& depth = metrics::get_gauge("vault.signal_queue_depth");
+    depth.set(signalQueue.size());
+    signalQueue.flush();
+
+    VaultChangeSet changes;
+    {
+        boost::lock_guard<boost::mutex> lock(changeSetMutex);
+        std::swap(changes, pendingChangeSet);
+    }
+    if (!changes.empty()) { notifyChangeSet(changes); }
+}
+
+void Vault::clearSignals()
+{
+    signalQueue.clear();
+
+    boost::lock_guard<boost::mutex> lock(changeSetMutex);
+    pendingChangeSet.clear();
+}
+
+///////////////////////
+// SNAPSHOT METADATA //
+///////////////////////
+void Vault::invalidateMetadataCache()
+{
+    metadataGeneration++;
+
+    boost::lock_guard<boost::mutex> lock(metadataCacheMutex);
+    metadataCache.reset();
+}
+
+std::shared_ptr<const VaultMetadata> Vault::getCachedMetadata(uint64_t write_sequence) const
+{
+    boost::lock_guard<boost::mutex> lock(metadataCacheMutex);
+    if (metadataCache && metadataCache->write_sequence == write_sequence) return metadataCache;
+    return nullptr;
+}
+
+void Vault::cacheMetadata(std::shared_ptr<const VaultMetadata> metadata) const
+{
+    // A snapshot taken before the last write may still finish loading after it, so never publish older data.
+    boost::lock_guard<boost::mutex> lock(metadataCacheMutex);
+    if (metadata->write_sequence != mutex.write_sequence || metadata->generation != metadataGeneration) return;
+    metadataCache = metadata;
+}
+
 /////////////////////
 // USER OPERATIONS //
 /////////////////////
@@ -4526,7 +6143,7 @@ std::shared_ptr<User> Vault::addUser(const std::string& username, bool txoutscri
 {
     LOGGER(trace) << "Vault::addUser(" << username << ", " << (txoutscript_whitelist_enabled ? "true" : "false") << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::transaction t(db_->begin());
     std::shared_ptr<User> user = addUser_unwrapped(username, txoutscript_whitelist_enabled);
     t.commit();
@@ -4550,7 +6167,7 @@ std::shared_ptr<User> Vault::getUser(const std::string& username) const
     LOGGER(trace) << "Vault::getUser(" << username << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
     return getUser_unwrapped(username);
@@ -4570,7 +6187,7 @@ const std::set<bytes_t>& Vault::getTxOutScriptWhitelist(const std::string& usern
     LOGGER(trace) << "Vault::getTxOutScriptWhitelist(" << username << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
 
@@ -4582,7 +6199,7 @@ std::shared_ptr<User> Vault::setTxOutScriptWhitelist(const std::string& username
 {
     LOGGER(trace) << "Vault::setTxOutScriptWhitelist(" << username << ", ...)" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::transaction t(db_->begin());
     std::shared_ptr<User> user = getUser_unwrapped(username);
     user->txoutscript_whitelist(txoutscripts);
@@ -4596,7 +6213,7 @@ std::shared_ptr<User> Vault::addTxOutScriptToWhitelist(const std::string& userna
 {
     LOGGER(trace) << "Vault::addTxOutScriptToWhitelist(" << username << ", " << uchar_vector(txoutscript).getHex() << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::transaction t(db_->begin());
     std::shared_ptr<User> user = getUser_unwrapped(username);
     user->addTxOutScriptToWhitelist(txoutscript);
@@ -4610,7 +6227,7 @@ std::shared_ptr<User> Vault::removeTxOutScriptFromWhitelist(const std::string& u
 {
     LOGGER(trace) << "Vault::removeTxOutScriptToWhitelist(" << username << ", " << uchar_vector(txoutscript).getHex() << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::transaction t(db_->begin());
     std::shared_ptr<User> user = getUser_unwrapped(username);
     if (user->removeTxOutScriptFromWhitelist(txoutscript))
@@ -4626,7 +6243,7 @@ std::shared_ptr<User> Vault::clearTxOutScriptWhitelist(const std::string& userna
 {
     LOGGER(trace) << "Vault::clearTxOutScriptWhitelist()" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::transaction t(db_->begin());
     std::shared_ptr<User> user = getUser_unwrapped(username);
     user->clearTxOutScriptWhitelist();
@@ -4640,7 +6257,7 @@ std::shared_ptr<User> Vault::enableTxOutScriptWhitelist(const std::string& usern
 {
     LOGGER(trace) << "Vault::enableTxOutScriptWhitelist(" << username << ", " << (enable ? "true" : "false") << ")" << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultWriteLock lock(mutex);
     odb::core::transaction t(db_->begin());
     std::shared_ptr<User> user = getUser_unwrapped(username);
     if (user->isTxOutScriptWhitelistEnabled() != enable)
@@ -4658,7 +6275,7 @@ bool Vault::isTxOutScriptWhitelistEnabled(const std::string& username) const
     LOGGER(trace) << "Vault::isTxOutScriptWhitelistEnabled(" << username << ")" << std::endl;
 
 #if defined(LOCK_ALL_CALLS)
-    boost::lock_guard<boost::mutex> lock(mutex);
+    VaultReadLock lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
 
@@ -15,6 +15,9 @@
 #include "VaultExceptions.h"
 #include "SigningRequest.h"
 #include "SignatureInfo.h"
+#include "TxSizeEstimator.h"
+#include "VaultArchive.h"
+#include "HistoryCursor.h"
 
 #include <Signals/Signals.h>
 #include <Signals/SignalQueue.h>
@@ -25,6 +28,9 @@
 
 #include <boost/thread.hpp>
 
+#include <atomic>
+#include <functional>
+
 // support for boost serialization
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
@@ -43,10 +49,100 @@ typedef Signals::Signal<std::shared_ptr<MerkleBlock>, const std::string& /*descr
 
 typedef Signals::Signal<std::shared_ptr<MerkleBlock>, bytes_t> TxConfirmationErrorSignal;
 
+// Blocks from the height up were removed. The txs they confirmed are unconfirmed again.
+typedef Signals::Signal<uint32_t /*height*/, const std::vector<unsigned long>& /*tx_ids*/, const std::vector<bytes_t>& /*tx_hashes*/> ReorgSignal;
+
+// Net effect of one or more committed vault transactions on stored txs.
+// A tx inserted and then updated is only reported as inserted, and a tx
+// deleted after being inserted or updated is only reported as deleted.
+struct VaultChangeSet
+{
+    VaultChangeSet() : chain_changed(false) { }
+
+    std::set<unsigned long>     inserted_tx_ids;
+    std::set<unsigned long>     updated_tx_ids;
+    std::set<unsigned long>     deleted_tx_ids;
+    std::set<std::string>       account_names;  // accounts with txouts in any of the txs above
+    bool                        chain_changed;  // merkle blocks were inserted or deleted, so confirmation counts changed
+
+    bool empty() const { return inserted_tx_ids.empty() && updated_tx_ids.empty() && deleted_tx_ids.empty() && !chain_changed; }
+
+    void clear()
+    {
+        inserted_tx_ids.clear();
+        updated_tx_ids.clear();
+        deleted_tx_ids.clear();
+        account_names.clear();
+        chain_changed = false;
+    }
+
+    void txInserted(unsigned long tx_id)
+    {
+        deleted_tx_ids.erase(tx_id);
+        updated_tx_ids.erase(tx_id);
+        inserted_tx_ids.insert(tx_id);
+    }
+
+    void txUpdated(unsigned long tx_id)
+    {
+        if (!inserted_tx_ids.count(tx_id)) { updated_tx_ids.insert(tx_id); }
+    }
+
+    void txDeleted(unsigned long tx_id)
+    {
+        inserted_tx_ids.erase(tx_id);
+        updated_tx_ids.erase(tx_id);
+        deleted_tx_ids.insert(tx_id);
+    }
+
+    // Appends a later change set.
+    void merge(const VaultChangeSet& other)
+    {
+        for (auto id: other.inserted_tx_ids)    { txInserted(id); }
+        for (auto id: other.updated_tx_ids)     { txUpdated(id); }
+        for (auto id: other.deleted_tx_ids)     { txDeleted(id); }
+        account_names.insert(other.account_names.begin(), other.account_names.end());
+        chain_changed = chain_changed || other.chain_changed;
+    }
+};
+
+typedef Signals::Signal<const VaultChangeSet&> ChangeSetSignal;
+
+// Accounts, keychains and bins change rarely, so snapshots share one immutable
+// copy until a write bumps the vault's metadata generation.
+struct VaultMetadata
+{
+    VaultMetadata() : generation(0), write_sequence(0) { }
+
+    uint64_t                    generation;
+    uint64_t                    write_sequence; // VaultMutex::write_sequence its snapshot read at
+    std::vector<AccountInfo>    accounts;
+    std::vector<KeychainView>   keychains;  // root keychains, not hidden
+    std::vector<AccountBinView> bins;
+};
+
+class VaultSnapshot;
+
+// The vault lock. Exclusive lock and unlock each bump write_sequence, so it is odd
+// while a write may be in progress and every write leaves it at a new even value.
+// Two reads that start while it holds the same even value see the same data.
+class VaultMutex : public boost::shared_mutex
+{
+public:
+    VaultMutex() : write_sequence(0) { }
+
+    void lock() { boost::shared_mutex::lock(); write_sequence++; }
+    void unlock() { write_sequence++; boost::shared_mutex::unlock(); }
+
+    std::atomic<uint64_t> write_sequence;
+};
+
 class Vault
 {
+    friend class VaultSnapshot;
+
 public:
-    Vault() : db_(nullptr) { }
+    Vault() : db_(nullptr), bPendingConfirmationsLoaded(false), pendingConfirmationsTx(nullptr), bBackgroundPoolRefill(false), bStopPoolRefill(false), metadataGeneration(0) { }
     Vault(int argc, char** argv, bool create = false, uint32_t version = SCHEMA_VERSION, const std::string& network = "", bool migrate = false);
     Vault(const std::string& dbname, bool create = false, uint32_t version = SCHEMA_VERSION, const std::string& network = "", bool migrate = false);
     Vault(const std::string& dbuser, const std::string& dbpasswd, const std::string& dbname, bool create = false, uint32_t version = SCHEMA_VERSION, const std::string& network = "", bool migrate = false);
@@ -80,9 +176,12 @@ public:
     uint32_t                                getHorizonHeight() const;
     std::vector<bytes_t>                    getLocatorHashes() const;
     Coin::BloomFilter                       getBloomFilter(double falsePositiveRate, uint32_t nTweak, uint32_t nFlags) const;
+    void                                    getCompactFilterElements(std::vector<bytes_t>& scripts, std::vector<Coin::OutPoint>& outpoints) const; // all txout scripts and unspent outpoints we send from
     hashvector_t                            getIncompleteBlockHashes() const;
 
-    void                                    exportVault(const std::string& filepath, bool exportprivkeys = true) const;
+    // Imports accept both text and binary archives.
+    static const uint32_t                   ARCHIVE_BATCH_SIZE = 1000; // records per session on export and on binary import
+    void                                    exportVault(const std::string& filepath, bool exportprivkeys = true, archive_format_t format = TEXT_ARCHIVE) const;
 
     void                                    importVault(const std::string& filepath, bool importprivkeys = true);
 
@@ -129,7 +228,7 @@ public:
     ////////////////////////
     // ACCOUNT OPERATIONS //
     ////////////////////////
-    void                                    exportAccount(const std::string& account_name, const std::string& filepath, bool exportprivkeys = false) const;
+    void                                    exportAccount(const std::string& account_name, const std::string& filepath, bool exportprivkeys = false, archive_format_t format = TEXT_ARCHIVE) const;
     std::shared_ptr<Account>                importAccount(const std::string& filepath, unsigned int& privkeysimported); // pass privkeysimported = 0 to not inport any private keys.
     bool                                    accountExists(const std::string& account_name) const;
     void                                    newAccount(const std::string& account_name, unsigned int minsigs, const std::vector<std::string>& keychain_names, uint32_t unused_pool_size = DEFAULT_UNUSED_POOL_SIZE, uint32_t time_created = time(NULL), bool compressed_keys = true, bool use_witness = false, bool use_witness_p2sh = false);
@@ -143,12 +242,27 @@ public:
     std::shared_ptr<AccountBin>             addAccountBin(const std::string& account_name, const std::string& bin_name);
     std::shared_ptr<SigningScript>          issueSigningScript(const std::string& account_name, const std::string& bin_name = DEFAULT_BIN_NAME, const std::string& label = "", uint32_t index = 0, const std::string& username = std::string());
     void                                    refillAccountPool(const std::string& account_name);
+    void                                    setBackgroundPoolRefill(bool enabled); // When enabled, pools are topped up on a worker thread and callers only derive keys if the pool is empty.
 
     // empty account_name or bin_name means do not filter on those fields
     std::vector<SigningScriptView>          getSigningScriptViews(const std::string& account_name = "", const std::string& bin_name = "", int flags = SigningScript::ALL) const;
     std::vector<TxOutView>                  getTxOutViews(const std::string& account_name = "", const std::string& bin_name = "", int role_flags = TxOut::ROLE_BOTH, int txout_status_flags = TxOut::BOTH, int tx_status_flags = Tx::ALL, bool hide_change = true) const;
     std::vector<TxOutView>                  getUnspentTxOutViews(const std::string& account_name, uint32_t min_confirmations = 0) const;
 
+    // Keyset pagination, newest first. Reads at most count rows after the cursor and moves the cursor past them.
+    // A row can split into a sending and a receiving view. cursor.isEnd() is set after the last page.
+    std::vector<TxOutView>                  getTxOutViewsPage(const HistoryFilter& filter, HistoryCursor& cursor, unsigned int count) const;
+
+    // Views for only the given txs, for applying a VaultChangeSet without reloading the whole history.
+    std::vector<TxOutView>                  getTxOutViewsForTxs(const std::string& account_name, const std::set<unsigned long>& tx_ids, int role_flags = TxOut::ROLE_BOTH, int txout_status_flags = TxOut::BOTH, bool hide_change = true) const;
+
+    ///////////////////////
+    // LEDGER OPERATIONS //
+    ///////////////////////
+    // Newest first, with running balances already computed. A count of zero returns the whole ledger.
+    std::vector<LedgerEntryView>            getLedgerViews(const std::string& account_name, unsigned int count = 0) const;
+    void                                    rebuildLedger(const std::string& account_name = ""); // Recomputes entries from stored txs. Empty account_name means all accounts.
+
     ////////////////////////////
     // ACCOUNT BIN OPERATIONS //
     ////////////////////////////
@@ -167,6 +281,7 @@ public:
     uint32_t                                getTxConfirmations(unsigned long tx_id) const;
     uint32_t                                getTxConfirmations(std::shared_ptr<Tx> tx) const;
     std::vector<TxView>                     getTxViews(int tx_status_flags = Tx::ALL, unsigned long start = 0, int count = -1, uint32_t minheight = 0) const; // count = -1 means display all
+    std::vector<TxView>                     getTxViewsPage(const HistoryFilter& filter, HistoryCursor& cursor, unsigned int count) const; // Only the tx status and time range filters apply
     std::vector<std::string>                getSerializedUnsignedTxs(const std::string& account_name) const;
     std::shared_ptr<Tx>                     insertTx(std::shared_ptr<Tx> tx, bool replace_labels = false); // Inserts transaction only if it affects one of our accounts. Returns transaction in vault if change occured. Otherwise returns nullptr.
     std::shared_ptr<Tx>                     insertNewTx(const Coin::Transaction& cointx, std::shared_ptr<BlockHeader> blockheader = nullptr, bool verifysigs = false, bool isCoinbase = false);
@@ -178,6 +293,11 @@ public:
     std::shared_ptr<Tx>                     createTx(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee, uint32_t min_confirmations, bool insert = false); // Pass empty output scripts to generate change outputs.
     txs_t                                   consolidateTxOuts(const std::string& account_name, uint32_t max_tx_size /* in bytes */, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations, bool insert = false);
     txs_t                                   consolidateTxOuts(const std::string& username, const std::string& account_name, uint32_t max_tx_size /* in bytes */, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations, bool insert = false);
+    // Fee-rate variants size the fee from the worst-case signed vsize. Leftover amounts below the dust threshold are added to the fee instead of creating change.
+    std::shared_ptr<Tx>                     createTxWithFeeRate(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee_rate /* satoshis per vbyte */, uint32_t min_confirmations, bool insert = false);
+    std::shared_ptr<Tx>                     createTxWithFeeRate(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee_rate /* satoshis per vbyte */, uint32_t min_confirmations, bool insert = false);
+    txs_t                                   consolidateTxOutsWithFeeRate(const std::string& account_name, uint32_t max_tx_weight, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t fee_rate /* satoshis per vbyte */, uint32_t min_confirmations, bool insert = false);
+    txs_t                                   consolidateTxOutsWithFeeRate(const std::string& username, const std::string& account_name, uint32_t max_tx_weight, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t fee_rate /* satoshis per vbyte */, uint32_t min_confirmations, bool insert = false);
     void                                    deleteTx(const bytes_t& tx_hash); // Tries both signed and unsigned hashes. Throws TxNotFoundException.
     void                                    deleteTx(unsigned long tx_id); // Throws TxNotFoundException.
     SigningRequest                          getSigningRequest(const bytes_t& hash, bool include_raw_tx = false) const; // Tries both signed and unsigned hashes. Throws TxNotFoundException.
@@ -187,6 +307,11 @@ public:
     // signTx tries only unsigned hashes for named keychains. If no keychains are named, tries all keychains. For signed hashes, signTx just returns the already signed transaction. Throws TxNotFoundException.
     std::shared_ptr<Tx>                     signTx(const bytes_t& hash, std::vector<std::string>& keychain_names, bool update = false);
     std::shared_ptr<Tx>                     signTx(unsigned long tx_id, std::vector<std::string>& keychain_names, bool update = false);
+    // signTxs signs many transactions in one database transaction, deriving each private key once and spreading the signing across cores.
+    // Returns only the transactions that got new signatures. keychain_names behaves as in signTx. Throws TxNotFoundException.
+    txs_t                                   signTxs(const ids_t& tx_ids, std::vector<std::string>& keychain_names, bool update = true);
+    // Signs all unsigned transactions sending from the account. Throws AccountNotFoundException.
+    txs_t                                   signTxs(const std::string& account_name, std::vector<std::string>& keychain_names, bool update = true);
 
     std::shared_ptr<TxOut>                  getTxOut(const bytes_t& outhash, uint32_t outindex) const;
     std::shared_ptr<TxOut>                  setSendingLabel(const bytes_t& outhash, uint32_t outindex, const std::string& label);
@@ -200,7 +325,7 @@ public:
     std::string                             exportTx(std::shared_ptr<Tx> tx) const;
     std::shared_ptr<Tx>                     importTx(const std::string& filepath);
     std::shared_ptr<Tx>                     importTxFromString(const std::string& txstr);
-    unsigned int                            exportTxs(const std::string& filepath, uint32_t minheight = 0) const;
+    unsigned int                            exportTxs(const std::string& filepath, uint32_t minheight = 0, archive_format_t format = TEXT_ARCHIVE) const;
     unsigned int                            importTxs(const std::string& filepath);
 
     //////////////////////////////
@@ -216,9 +341,14 @@ public:
     std::shared_ptr<BlockHeader>            getBlockHeader(uint32_t height) const;
     std::shared_ptr<BlockHeader>            getBestBlockHeader() const;
     std::shared_ptr<MerkleBlock>            insertMerkleBlock(std::shared_ptr<MerkleBlock> merkleblock);
+
+    // Blocks in chain order, each with the transactions matched in it, as passed on by NetworkSync or
+    // BlockFileImporter. Commits once every ARCHIVE_BATCH_SIZE blocks. Returns the number of transactions inserted or updated.
+    typedef std::pair<ChainMerkleBlock, std::vector<Coin::Transaction>> chain_merkle_block_txs_t;
+    unsigned int                            insertMerkleBlocks(const std::vector<chain_merkle_block_txs_t>& blocks);
     unsigned int                            deleteMerkleBlock(const bytes_t& hash);
     unsigned int                            deleteMerkleBlock(uint32_t height);
-    void                                    exportMerkleBlocks(const std::string& filepath) const;
+    void                                    exportMerkleBlocks(const std::string& filepath, archive_format_t format = TEXT_ARCHIVE) const;
     void                                    importMerkleBlocks(const std::string& filepath);
 
     /////////////////////
@@ -245,6 +375,12 @@ public:
     Signals::Connection subscribeTxDeleted(TxSignal::Slot slot) { return notifyTxDeleted.connect(slot); }
     Signals::Connection subscribeMerkleBlockInserted(MerkleBlockSignal::Slot slot) { return notifyMerkleBlockInserted.connect(slot); }
 
+    // Emitted once per rollback instead of a TxUpdated for each unconfirmed tx.
+    Signals::Connection subscribeReorg(ReorgSignal::Slot slot) { return notifyReorg.connect(slot); }
+
+    // Emitted once per committed write with the net changes, after the per-object signals above.
+    Signals::Connection subscribeChangeSet(ChangeSetSignal::Slot slot) { return notifyChangeSet.connect(slot); }
+
     Signals::Connection subscribeTxInsertionError(TxErrorSignal::Slot slot) { return notifyTxInsertionError.connect(slot); }
     Signals::Connection subscribeMerkleBlockInsertionError(MerkleBlockErrorSignal::Slot slot) { return notifyMerkleBlockInsertionError.connect(slot); }
 
@@ -259,6 +395,8 @@ public:
         notifyTxUpdated.clear();
         notifyTxDeleted.clear();
         notifyMerkleBlockInserted.clear();
+        notifyReorg.clear();
+        notifyChangeSet.clear();
 
         notifyTxInsertionError.clear();
         notifyMerkleBlockInsertionError.clear();
@@ -266,6 +404,26 @@ public:
         notifyTxConfirmationError.clear();
     }
 
+    // Delivers notifications on the executor's thread so slow subscribers never hold up
+    // the writer that emitted them. A null executor restores synchronous delivery.
+    void setNotificationExecutor(std::shared_ptr<Signals::Executor> executor)
+    {
+        notifyKeychainUnlocked.setExecutor(executor);
+        notifyKeychainLocked.setExecutor(executor);
+
+        notifyTxInserted.setExecutor(executor);
+        notifyTxUpdated.setExecutor(executor);
+        notifyTxDeleted.setExecutor(executor);
+        notifyMerkleBlockInserted.setExecutor(executor);
+        notifyReorg.setExecutor(executor);
+        notifyChangeSet.setExecutor(executor);
+
+        notifyTxInsertionError.setExecutor(executor);
+        notifyMerkleBlockInsertionError.setExecutor(executor);
+
+        notifyTxConfirmationError.setExecutor(executor);
+    }
+
 protected:
     ///////////////////////
     // GLOBAL OPERATIONS //
@@ -281,8 +439,13 @@ protected:
     uint32_t                                getHorizonHeight_unwrapped() const;
     std::vector<bytes_t>                    getLocatorHashes_unwrapped() const;
     Coin::BloomFilter                       getBloomFilter_unwrapped(double falsePositiveRate, uint32_t nTweak, uint32_t nFlags) const;
+    void                                    getCompactFilterElements_unwrapped(std::vector<bytes_t>& scripts, std::vector<Coin::OutPoint>& outpoints) const;
     hashvector_t                            getIncompleteBlockHashes_unwrapped() const;
 
+    // Caller must hold the write lock. Imports the whole archive in one transaction, so a truncated or corrupt archive imports nothing.
+    // privkeysimported behaves as in importAccount(). Returns the last account imported, if any.
+    std::shared_ptr<Account>                importBinaryArchive(BinaryArchiveReader& reader, unsigned int& privkeysimported, unsigned int& txcount);
+
     ////////////////////////
     // CONTACT OPERATIONS //
     ////////////////////////
@@ -319,6 +482,8 @@ protected:
     ////////////////////////
     void                                    exportAccount_unwrapped(Account& account, boost::archive::text_oarchive& oa, bool exportprivkeys) const;
     std::shared_ptr<Account>                importAccount_unwrapped(boost::archive::text_iarchive& ia, unsigned int& privkeysimported);
+    void                                    exportAccount_unwrapped(Account& account, BinaryArchiveWriter& writer, bool exportprivkeys) const;
+    std::shared_ptr<Account>                importAccount_unwrapped(std::shared_ptr<Account> account, unsigned int& privkeysimported);
 
     void                                    refillAccountPool_unwrapped(std::shared_ptr<Account> account);
 
@@ -326,14 +491,27 @@ protected:
     std::string                             getNextAvailableAccountName_unwrapped(const std::string& desired_account_name) const;
     std::shared_ptr<Account>                getAccount_unwrapped(const std::string& account_name) const; // throws AccountNotFoundException
 
+    std::vector<AccountInfo>                getAllAccountInfo_unwrapped() const;
+    uint64_t                                getAccountBalance_unwrapped(const std::string& account_name, unsigned int min_confirmations = 1, int tx_flags = Tx::ALL) const;
+
+    std::vector<TxOutView>                  getTxOutViews_unwrapped(const std::string& account_name = "", const std::string& bin_name = "", int role_flags = TxOut::ROLE_BOTH, int txout_status_flags = TxOut::BOTH, int tx_status_flags = Tx::ALL, bool hide_change = true) const;
     std::vector<TxOutView>                  getUnspentTxOutViews_unwrapped(std::shared_ptr<Account> account, uint32_t min_confirmations = 0) const;
+    std::vector<TxOutView>                  getTxOutViewsPage_unwrapped(const HistoryFilter& filter, HistoryCursor& cursor, unsigned int count) const;
+    std::vector<TxOutView>                  getTxOutViewsForTxs_unwrapped(const std::string& account_name, const std::set<unsigned long>& tx_ids, int role_flags = TxOut::ROLE_BOTH, int txout_status_flags = TxOut::BOTH, bool hide_change = true) const;
 
     ////////////////////////////
     // ACCOUNT BIN OPERATIONS //
     ////////////////////////////
     std::shared_ptr<AccountBin>             getAccountBin_unwrapped(const std::string& account_name, const std::string& bin_name) const;
+    std::vector<AccountBinView>             getAllAccountBinViews_unwrapped() const;
     std::shared_ptr<SigningScript>          issueAccountBinSigningScript_unwrapped(std::shared_ptr<AccountBin> account_bin, const std::string& label = "", uint32_t index = 0);
     void                                    refillAccountBinPool_unwrapped(std::shared_ptr<AccountBin> bin, uint32_t index = 0);
+    void                                    persistSigningScripts_unwrapped(const SigningScriptVector& scripts);
+    uint32_t                                getAccountBinPoolShortfall_unwrapped(std::shared_ptr<AccountBin> bin) const;
+    void                                    scheduleAccountBinPoolRefill(unsigned long bin_id);
+    void                                    refillAccountBinPoolInBackground(unsigned long bin_id);
+    void                                    poolRefillLoop();
+    void                                    stopPoolRefillThread();
     void                                    exportAccountBin_unwrapped(const std::shared_ptr<AccountBin> account_bin, const std::string& export_name, const std::string& filepath) const;
     std::shared_ptr<AccountBin>             importAccountBin_unwrapped(const std::string& filepath); 
 
@@ -345,6 +523,7 @@ protected:
     txs_t                                   getTxs_unwrapped(int tx_status_flags = Tx::ALL, unsigned long start = 0, int count = -1, uint32_t minheight = 0) const;
     std::vector<std::string>                getSerializedUnsignedTxs_unwrapped(const std::string& account_name) const;
     uint32_t                                getTxConfirmations_unwrapped(std::shared_ptr<Tx> tx) const;
+    std::vector<TxView>                     getTxViews_unwrapped(int tx_status_flags = Tx::ALL, unsigned long start = 0, int count = -1, uint32_t minheight = 0) const;
     std::shared_ptr<Tx>                     insertTx_unwrapped(std::shared_ptr<Tx> tx, bool replace_labels = false);
     std::shared_ptr<Tx>                     insertNewTx_unwrapped(const Coin::Transaction& cointx, std::shared_ptr<BlockHeader> blockheader = nullptr, bool verifysigs = false, bool isCoinbase = false);
     std::shared_ptr<Tx>                     insertMerkleTx_unwrapped(const ChainMerkleBlock& chainmerkleblock, const Coin::Transaction& cointx, unsigned int txindex, unsigned int txcount, bool verifysigs = false, bool isCoinbase = false);
@@ -354,11 +533,20 @@ protected:
     std::shared_ptr<Tx>                     createTx_unwrapped(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee, uint32_t min_confirmations);
     std::shared_ptr<Tx>                     createTx_unwrapped(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee, uint32_t min_confirmations);
     txs_t                                   consolidateTxOuts_unwrapped(const std::string& account_name, uint32_t max_tx_size /* in bytes */, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations);
+    std::shared_ptr<Tx>                     createTxWithFeeRate_unwrapped(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee_rate, uint32_t min_confirmations);
+    std::shared_ptr<Tx>                     createTxWithFeeRate_unwrapped(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee_rate, uint32_t min_confirmations);
+    txs_t                                   consolidateTxOutsWithFeeRate_unwrapped(const std::string& account_name, uint32_t max_tx_weight, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t fee_rate, uint32_t min_confirmations);
+    // Selects coins and adds change, with the fee for a given txin count and change output supplied by the caller.
+    // Change below min_change is left to the fee.
+    typedef std::function<uint64_t(std::size_t /*txin_count*/, bool /*with_change*/)> tx_fee_function_t;
+    std::shared_ptr<Tx>                     buildTx_unwrapped(std::shared_ptr<Account> account, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, tx_fee_function_t fee, uint64_t min_change, uint32_t min_confirmations);
+    std::vector<TxOutView>                  getSpendableTxOutViews_unwrapped(std::shared_ptr<Account> account, const ids_t& coin_ids, uint32_t min_confirmations) const; // Throws TxInvalidInputsException if any of coin_ids is not spendable.
     void                                    deleteTx_unwrapped(std::shared_ptr<Tx> tx);
     void                                    updateTx_unwrapped(std::shared_ptr<Tx> tx);
     SigningRequest                          getSigningRequest_unwrapped(std::shared_ptr<Tx> tx, bool include_raw_tx = false) const;
     SignatureInfo                           getSignatureInfo_unwrapped(std::shared_ptr<Tx> tx) const;
     unsigned int                            signTx_unwrapped(std::shared_ptr<Tx> tx, std::vector<std::string>& keychain_names); // Tries to sign as many as it can with the unlocked keychains.
+    unsigned int                            signTxs_unwrapped(txs_t& txs, std::vector<std::string>& keychain_names); // Leaves only the txs that got new signatures in txs.
 
     std::shared_ptr<TxOut>                  getTxOut_unwrapped(const bytes_t& outhash, uint32_t outindex) const;
     std::shared_ptr<TxOut>                  setSendingLabel_unwrapped(const bytes_t& outhash, uint32_t outindex, const std::string& label);
@@ -366,6 +554,21 @@ protected:
 
     unsigned int                            exportTxs_unwrapped(boost::archive::text_oarchive& oa, uint32_t minheight) const;
     unsigned int                            importTxs_unwrapped(boost::archive::text_iarchive& ia);
+    unsigned int                            exportTxs_unwrapped(BinaryArchiveWriter& writer, uint32_t minheight) const;
+
+    ///////////////////////
+    // LEDGER OPERATIONS //
+    ///////////////////////
+    // Entries are kept current from the signal queue helpers below, which every tx change goes through.
+    std::vector<LedgerEntryView>            getLedgerViews_unwrapped(const std::string& account_name, unsigned int count = 0) const;
+    void                                    updateLedger_unwrapped(std::shared_ptr<Tx> tx); // Reconciles the tx's entries with its current txouts and height.
+    void                                    eraseLedgerEntries_unwrapped(unsigned long tx_id);
+    void                                    insertLedgerEntry_unwrapped(std::shared_ptr<LedgerEntry> entry);
+    void                                    eraseLedgerEntry_unwrapped(std::shared_ptr<LedgerEntry> entry);
+    void                                    shiftLedger_unwrapped(const LedgerEntry& entry, int64_t delta, int64_t confirmed_delta); // Adds to the balances of all later entries of the account.
+    void                                    recomputeLedger_unwrapped(unsigned long account_id, uint32_t min_sort_height); // Recomputes running balances from min_sort_height on.
+    void                                    repairLedger_unwrapped(uint32_t min_height); // For all accounts, after a reorg.
+    void                                    rebuildLedger_unwrapped(std::shared_ptr<Account> account);
 
     //////////////////////////////
     // SIGNINGSCRIPT OPERATIONS //
@@ -380,13 +583,19 @@ protected:
     std::shared_ptr<BlockHeader>            getBlockHeader_unwrapped(uint32_t height) const;
     std::shared_ptr<BlockHeader>            getBestBlockHeader_unwrapped() const;
     std::shared_ptr<MerkleBlock>            insertMerkleBlock_unwrapped(std::shared_ptr<MerkleBlock> merkleblock);
+    unsigned int                            insertMerkleBlock_unwrapped(const ChainMerkleBlock& chainmerkleblock, const std::vector<Coin::Transaction>& cointxs);
     unsigned int                            deleteMerkleBlock_unwrapped(std::shared_ptr<MerkleBlock> merkleblock);
     unsigned int                            deleteMerkleBlock_unwrapped(uint32_t height);
     unsigned int                            updateConfirmations_unwrapped(std::shared_ptr<Tx> tx = nullptr); // If parameter is null, updates all unconfirmed transactions.
                                                                                                      // Returns the number of transaction previously unconfirmed that are now confirmed.
+    void                                    loadPendingConfirmations_unwrapped();
+    void                                    addPendingConfirmations_unwrapped(std::shared_ptr<BlockHeader> blockheader, const std::vector<bytes_t>& txhashes);
+    void                                    pendingConfirmationsChanging_unwrapped(); // Call before changing mapPendingConfirmations.
+    static void                             pendingConfirmationsTxEvent(unsigned short event, void* key, unsigned long long data);
 
     void                                    exportMerkleBlocks_unwrapped(boost::archive::text_oarchive& oa) const;
     void                                    importMerkleBlocks_unwrapped(boost::archive::text_iarchive& ia);
+    void                                    exportMerkleBlocks_unwrapped(BinaryArchiveWriter& writer) const;
 
     /////////////////////
     // USER OPERATIONS //
@@ -406,18 +615,71 @@ protected:
     TxSignal                                notifyTxUpdated;
     TxSignal                                notifyTxDeleted;
     MerkleBlockSignal                       notifyMerkleBlockInserted;
+    ReorgSignal                             notifyReorg;
+    ChangeSetSignal                         notifyChangeSet;
 
     TxErrorSignal                           notifyTxInsertionError;
     MerkleBlockErrorSignal                  notifyMerkleBlockInsertionError;
 
     TxConfirmationErrorSignal               notifyTxConfirmationError;
 
+    // Queue a signal and record the change in the pending change set.
+    void                                    queueTxInserted(std::shared_ptr<Tx> tx);
+    void                                    queueTxUpdated(std::shared_ptr<Tx> tx);
+    void                                    queueTxDeleted(std::shared_ptr<Tx> tx);
+    void                                    queueMerkleBlockInserted(std::shared_ptr<MerkleBlock> merkleblock);
+    void                                    queueChainChanged();
+    void                                    queueReorg(uint32_t height, const std::vector<unsigned long>& tx_ids, const std::vector<bytes_t>& tx_hashes, const std::set<std::string>& account_names);
+
+    // Emit queued signals and then the pending change set, or discard both on rollback.
+    void                                    flushSignals();
+    void                                    clearSignals();
+
+    boost::mutex                            changeSetMutex;
+    VaultChangeSet                          pendingChangeSet;
+
+    ///////////////////////
+    // SNAPSHOT METADATA //
+    ///////////////////////
+    // Call after committing any change to accounts, keychains or bins. flushSignals() also calls it.
+    void                                    invalidateMetadataCache();
+
+    // Returns null unless the cached copy was loaded at the given write sequence.
+    std::shared_ptr<const VaultMetadata>    getCachedMetadata(uint64_t write_sequence) const;
+    void                                    cacheMetadata(std::shared_ptr<const VaultMetadata> metadata) const;
+
 private:
-    mutable boost::mutex mutex;
+    // Read-only methods take this lock shared and run on their own pooled connection,
+    // so each sees a snapshot as of its first query. Writes take it exclusively, so
+    // they never overlap a read-only method of this vault; see Database.h.
+    mutable VaultMutex mutex;
     std::shared_ptr<odb::core::database> db_;
     std::string name_;
 
     mutable std::map<std::string, secure_bytes_t> mapPrivateKeyUnlock;
+
+    // Hashes of transactions we don't have yet that appear in stored merkle blocks, mapped to the block header id.
+    // Loaded on first use and kept current by block and tx insertion so confirming never scans all unconfirmed txs.
+    // Changes are made inside the write transaction. If it rolls back the map is dropped and reloaded on next use.
+    bool bPendingConfirmationsLoaded;
+    std::map<bytes_t, unsigned long> mapPendingConfirmations;
+    odb::transaction* pendingConfirmationsTx; // Set while a rollback callback is registered with this transaction.
+
+    // Background key pool refill
+    bool bBackgroundPoolRefill;
+    bool bStopPoolRefill;
+    boost::thread poolRefillThread;
+    boost::mutex poolRefillMutex;
+    boost::condition_variable poolRefillCondition;
+    std::set<unsigned long> poolRefillBinIds;
+
+    // Snapshots read through their own connections without taking the mutex above.
+    // close() takes this lock exclusively so it cannot drop the database under a snapshot read.
+    mutable boost::shared_mutex openMutex;
+
+    std::atomic<uint64_t> metadataGeneration;
+    mutable boost::mutex metadataCacheMutex;
+    mutable std::shared_ptr<const VaultMetadata> metadataCache;
 };
 
 }
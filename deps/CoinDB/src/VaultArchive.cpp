@@ -0,0 +1,264 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// VaultArchive.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "VaultArchive.h"
+
+#include <zlib.h>
+
+#include <cstring>
+#include <fstream>
+
+using namespace CoinDB;
+
+namespace
+{
+
+const char ARCHIVE_MAGIC[4] = { 'C', 'D', 'B', 'A' };
+const std::size_t ZLIB_BUFFER_SIZE = 0x10000;
+
+void putUint32(char* p, uint32_t n)
+{
+    p[0] = (char)(n & 0xff);
+    p[1] = (char)((n >> 8) & 0xff);
+    p[2] = (char)((n >> 16) & 0xff);
+    p[3] = (char)((n >> 24) & 0xff);
+}
+
+uint32_t getUint32(const char* p)
+{
+    const unsigned char* u = (const unsigned char*)p;
+    return (uint32_t)u[0] | ((uint32_t)u[1] << 8) | ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+}
+
+/////////////////
+// BinaryArchive
+//
+bool BinaryArchive::isBinaryArchive(std::istream& is)
+{
+    std::istream::pos_type pos = is.tellg();
+    char magic[sizeof(ARCHIVE_MAGIC)];
+    is.read(magic, sizeof(magic));
+    bool rval = is.gcount() == sizeof(magic) && memcmp(magic, ARCHIVE_MAGIC, sizeof(magic)) == 0;
+    is.clear();
+    is.seekg(pos);
+    return rval;
+}
+
+bool BinaryArchive::isBinaryArchive(const std::string& filepath)
+{
+    std::ifstream ifs(filepath, std::ios::binary);
+    return ifs && isBinaryArchive(ifs);
+}
+
+uint32_t BinaryArchive::checksum(const std::string& payload)
+{
+    uLong crc = crc32(0L, Z_NULL, 0);
+    return (uint32_t)crc32(crc, (const Bytef*)payload.data(), (uInt)payload.size());
+}
+
+///////////////////////
+// BinaryArchiveWriter
+//
+BinaryArchiveWriter::BinaryArchiveWriter(std::ostream& os, bool compress)
+    : os_(os), record_count_(0), finished_(false)
+{
+    char header[12];
+    memcpy(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    putUint32(header + 4, BinaryArchive::FORMAT_VERSION);
+    putUint32(header + 8, compress ? BinaryArchive::ARCHIVE_FLAG_COMPRESSED : 0);
+    os_.write(header, sizeof(header));
+
+    if (compress)
+    {
+        zs_.reset(new z_stream());
+        memset(zs_.get(), 0, sizeof(z_stream));
+        if (deflateInit(zs_.get(), Z_DEFAULT_COMPRESSION) != Z_OK) throw std::runtime_error("BinaryArchiveWriter - failed to initialize compressor.");
+        buffer_.resize(ZLIB_BUFFER_SIZE);
+    }
+}
+
+BinaryArchiveWriter::~BinaryArchiveWriter()
+{
+    if (zs_) { deflateEnd(zs_.get()); }
+}
+
+void BinaryArchiveWriter::writeRecord(BinaryArchive::record_type_t type, const std::string& payload)
+{
+    if (finished_) throw std::runtime_error("BinaryArchiveWriter::writeRecord() - archive already finished.");
+    if (payload.size() > BinaryArchive::MAX_RECORD_SIZE) throw std::runtime_error("BinaryArchiveWriter::writeRecord() - record too large.");
+
+    char prefix[5];
+    prefix[0] = (char)type;
+    putUint32(prefix + 1, (uint32_t)payload.size());
+    writeBytes(prefix, sizeof(prefix));
+    writeBytes(payload.data(), payload.size());
+
+    char suffix[4];
+    putUint32(suffix, BinaryArchive::checksum(payload));
+    writeBytes(suffix, sizeof(suffix));
+
+    if (type != BinaryArchive::END) { record_count_++; }
+}
+
+void BinaryArchiveWriter::finish()
+{
+    if (finished_) return;
+    writeRecord(BinaryArchive::END, std::string());
+    finished_ = true;
+
+    if (zs_)
+    {
+        int rval;
+        do
+        {
+            zs_->next_out = (Bytef*)&buffer_[0];
+            zs_->avail_out = buffer_.size();
+            rval = deflate(zs_.get(), Z_FINISH);
+            if (rval == Z_STREAM_ERROR) throw std::runtime_error("BinaryArchiveWriter::finish() - compressor error.");
+            os_.write(&buffer_[0], buffer_.size() - zs_->avail_out);
+        } while (rval != Z_STREAM_END);
+    }
+
+    os_.flush();
+    if (!os_) throw std::runtime_error("BinaryArchiveWriter::finish() - write failed.");
+}
+
+void BinaryArchiveWriter::writeBytes(const char* data, std::size_t size)
+{
+    if (!zs_)
+    {
+        os_.write(data, size);
+        if (!os_) throw std::runtime_error("BinaryArchiveWriter - write failed.");
+        return;
+    }
+
+    zs_->next_in = (Bytef*)data;
+    zs_->avail_in = size;
+    while (zs_->avail_in > 0)
+    {
+        zs_->next_out = (Bytef*)&buffer_[0];
+        zs_->avail_out = buffer_.size();
+        if (deflate(zs_.get(), Z_NO_FLUSH) == Z_STREAM_ERROR) throw std::runtime_error("BinaryArchiveWriter - compressor error.");
+        os_.write(&buffer_[0], buffer_.size() - zs_->avail_out);
+        if (!os_) throw std::runtime_error("BinaryArchiveWriter - write failed.");
+    }
+}
+
+///////////////////////
+// BinaryArchiveReader
+//
+BinaryArchiveReader::BinaryArchiveReader(std::istream& is)
+    : is_(is), version_(0), record_count_(0), stream_end_(false)
+{
+    char header[12];
+    is_.read(header, sizeof(header));
+    if (is_.gcount() != sizeof(header) || memcmp(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0) throw ArchiveInvalidFormatException();
+
+    version_ = getUint32(header + 4);
+    if (version_ == 0 || version_ > BinaryArchive::FORMAT_VERSION) throw ArchiveUnsupportedVersionException(version_);
+
+    uint32_t flags = getUint32(header + 8);
+    if (flags & ~BinaryArchive::ARCHIVE_FLAG_COMPRESSED) throw ArchiveInvalidFormatException();
+
+    if (flags & BinaryArchive::ARCHIVE_FLAG_COMPRESSED)
+    {
+        zs_.reset(new z_stream());
+        memset(zs_.get(), 0, sizeof(z_stream));
+        if (inflateInit(zs_.get()) != Z_OK) throw std::runtime_error("BinaryArchiveReader - failed to initialize decompressor.");
+        buffer_.resize(ZLIB_BUFFER_SIZE);
+    }
+}
+
+BinaryArchiveReader::~BinaryArchiveReader()
+{
+    if (zs_) { inflateEnd(zs_.get()); }
+}
+
+bool BinaryArchiveReader::readRecord(BinaryArchive::record_type_t& type, std::string& payload)
+{
+    char prefix[5];
+    readBytes(prefix, sizeof(prefix));
+    type = (BinaryArchive::record_type_t)prefix[0];
+
+    uint32_t size = getUint32(prefix + 1);
+    if (size > BinaryArchive::MAX_RECORD_SIZE) throw ArchiveCorruptException();
+
+    payload.resize(size);
+    if (size > 0) { readBytes(&payload[0], size); }
+
+    char suffix[4];
+    readBytes(suffix, sizeof(suffix));
+    if (getUint32(suffix) != BinaryArchive::checksum(payload)) throw ArchiveChecksumMismatchException(record_count_);
+
+    if (type == BinaryArchive::END)
+    {
+        if (zs_) { readStreamEnd(); }
+        return false;
+    }
+
+    record_count_++;
+    return true;
+}
+
+void BinaryArchiveReader::readBytes(char* data, std::size_t size)
+{
+    if (!zs_)
+    {
+        is_.read(data, size);
+        if ((std::size_t)is_.gcount() != size) throw ArchiveCorruptException();
+        return;
+    }
+
+    zs_->next_out = (Bytef*)data;
+    zs_->avail_out = size;
+    while (zs_->avail_out > 0)
+    {
+        if (zs_->avail_in == 0)
+        {
+            is_.read(&buffer_[0], buffer_.size());
+            if (is_.gcount() == 0) throw ArchiveCorruptException();
+            zs_->next_in = (Bytef*)&buffer_[0];
+            zs_->avail_in = is_.gcount();
+        }
+
+        int rval = inflate(zs_.get(), Z_NO_FLUSH);
+        if (rval == Z_STREAM_END)
+        {
+            if (zs_->avail_out > 0) throw ArchiveCorruptException();
+            stream_end_ = true;
+        }
+        else if (rval != Z_OK && rval != Z_BUF_ERROR) throw ArchiveCorruptException();
+    }
+}
+
+void BinaryArchiveReader::readStreamEnd()
+{
+    // Nothing may follow the END record, but the deflate trailer must be intact.
+    char extra;
+    while (!stream_end_)
+    {
+        zs_->next_out = (Bytef*)&extra;
+        zs_->avail_out = 1;
+        if (zs_->avail_in == 0)
+        {
+            is_.read(&buffer_[0], buffer_.size());
+            if (is_.gcount() == 0) throw ArchiveCorruptException();
+            zs_->next_in = (Bytef*)&buffer_[0];
+            zs_->avail_in = is_.gcount();
+        }
+
+        int rval = inflate(zs_.get(), Z_NO_FLUSH);
+        if (zs_->avail_out == 0) throw ArchiveCorruptException();
+        if (rval == Z_STREAM_END) { stream_end_ = true; }
+        else if (rval != Z_OK && rval != Z_BUF_ERROR) throw ArchiveCorruptException();
+    }
+}
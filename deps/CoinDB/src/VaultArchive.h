@@ -0,0 +1,136 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// VaultArchive.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include "VaultExceptions.h"
+
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct z_stream_s;
+
+namespace CoinDB
+{
+
+enum archive_format_t
+{
+    TEXT_ARCHIVE,                   // boost text archive, readable by all versions
+    BINARY_ARCHIVE,                 // record stream
+    COMPRESSED_BINARY_ARCHIVE       // record stream behind zlib deflate
+};
+
+// Binary archive layout (all integers little endian):
+//
+//   header:  "CDBA" | uint32 format version | uint32 flags
+//   record:  uint8 type | uint32 payload size | payload | uint32 crc32(payload)
+//
+// The header is never compressed. With ARCHIVE_FLAG_COMPRESSED set everything
+// after it is a single deflate stream. Payloads are boost binary archives of a
+// single object so the schema class versions still apply. The stream always
+// ends with an END record, so a truncated file is detected.
+class BinaryArchive
+{
+public:
+    enum record_type_t : uint8_t
+    {
+        END             = 0,
+        ACCOUNT         = 1,
+        MERKLEBLOCK     = 2,
+        TX              = 3
+    };
+
+    static const uint32_t FORMAT_VERSION            = 1;
+    static const uint32_t ARCHIVE_FLAG_COMPRESSED   = 0x1;
+    static const uint32_t MAX_RECORD_SIZE           = 0x4000000; // 64 MiB
+
+    // Returns true if the stream starts with the binary archive magic. The read position is left unchanged.
+    static bool isBinaryArchive(std::istream& is);
+    static bool isBinaryArchive(const std::string& filepath);
+
+    static uint32_t checksum(const std::string& payload);
+};
+
+class BinaryArchiveWriter
+{
+public:
+    BinaryArchiveWriter(std::ostream& os, bool compress = true);
+    ~BinaryArchiveWriter();
+
+    template<class T>
+    void write(BinaryArchive::record_type_t type, const T& object)
+    {
+        std::ostringstream ss;
+        {
+            boost::archive::binary_oarchive oa(ss);
+            oa << object;
+        }
+        writeRecord(type, ss.str());
+    }
+
+    void writeRecord(BinaryArchive::record_type_t type, const std::string& payload);
+
+    // Writes the END record and flushes the compressor. Must be called once all records are written.
+    void finish();
+
+    uint64_t record_count() const { return record_count_; }
+
+private:
+    void writeBytes(const char* data, std::size_t size);
+
+    std::ostream& os_;
+    std::unique_ptr<z_stream_s> zs_;
+    std::vector<char> buffer_;
+    uint64_t record_count_;
+    bool finished_;
+};
+
+class BinaryArchiveReader
+{
+public:
+    // Reads and validates the header.
+    explicit BinaryArchiveReader(std::istream& is);
+    ~BinaryArchiveReader();
+
+    // Returns false once the END record is reached.
+    bool readRecord(BinaryArchive::record_type_t& type, std::string& payload);
+
+    // Objects with shared_from_this() in their load() must already be owned by a shared_ptr.
+    template<class T>
+    static void read(const std::string& payload, T& object)
+    {
+        std::istringstream ss(payload);
+        boost::archive::binary_iarchive ia(ss);
+        ia >> object;
+    }
+
+    uint32_t version() const { return version_; }
+    bool compressed() const { return (bool)zs_; }
+    uint64_t record_count() const { return record_count_; }
+
+private:
+    void readBytes(char* data, std::size_t size);
+    void readStreamEnd();
+
+    std::istream& is_;
+    std::unique_ptr<z_stream_s> zs_;
+    std::vector<char> buffer_;
+    uint32_t version_;
+    uint64_t record_count_;
+    bool stream_end_;
+};
+
+}
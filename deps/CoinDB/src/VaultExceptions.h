@@ -26,6 +26,7 @@ enum ErrorCodes
     VAULT_FAILED_TO_OPEN_DATABASE,
     VAULT_MISSING_TXS,
     VAULT_NEEDS_SCHEMA_MIGRATION,
+    VAULT_CLOSED,
 
     // Chain code errors
     CHAINCODE_LOCKED = 201,
@@ -86,7 +87,13 @@ enum ErrorCodes
     // Contact errors
     CONTACT_NOT_FOUND = 1201,
     CONTACT_ALREADY_EXISTS,
-    CONTACT_INVALID_USERNAME
+    CONTACT_INVALID_USERNAME,
+
+    // Archive errors
+    ARCHIVE_INVALID_FORMAT = 1301,
+    ARCHIVE_UNSUPPORTED_VERSION,
+    ARCHIVE_CORRUPT,
+    ARCHIVE_CHECKSUM_MISMATCH
 };
 
 // VAULT EXCEPTIONS
@@ -159,6 +166,12 @@ private:
     uint32_t current_version_;
 };
 
+class VaultClosedException : public VaultException
+{
+public:
+    explicit VaultClosedException(const std::string& vault_name) : VaultException("Vault is closed.", VAULT_CLOSED, vault_name) { }
+};
+
 // CHAIN CODE EXCEPTIONS
 class ChainCodeException : public stdutils::custom_error
 {
@@ -581,4 +594,48 @@ public:
     explicit ContactInvalidUsernameException(const std::string& username) : ContactException("Invalid contact username.", CONTACT_INVALID_USERNAME, username) { }
 };
 
+// ARCHIVE EXCEPTIONS
+class ArchiveException : public stdutils::custom_error
+{
+public:
+    virtual ~ArchiveException() throw() { }
+
+protected:
+    explicit ArchiveException(const std::string& what, int code) : stdutils::custom_error(what, code) { }
+};
+
+class ArchiveInvalidFormatException : public ArchiveException
+{
+public:
+    explicit ArchiveInvalidFormatException() : ArchiveException("Invalid archive format.", ARCHIVE_INVALID_FORMAT) { }
+};
+
+class ArchiveUnsupportedVersionException : public ArchiveException
+{
+public:
+    explicit ArchiveUnsupportedVersionException(uint32_t version) : ArchiveException("Unsupported archive version.", ARCHIVE_UNSUPPORTED_VERSION), version_(version) { }
+
+    uint32_t version() const { return version_; }
+
+private:
+    uint32_t version_;
+};
+
+class ArchiveCorruptException : public ArchiveException
+{
+public:
+    explicit ArchiveCorruptException() : ArchiveException("Archive is truncated or corrupt.", ARCHIVE_CORRUPT) { }
+};
+
+class ArchiveChecksumMismatchException : public ArchiveException
+{
+public:
+    explicit ArchiveChecksumMismatchException(uint64_t record) : ArchiveException("Archive record checksum mismatch.", ARCHIVE_CHECKSUM_MISMATCH), record_(record) { }
+
+    uint64_t record() const { return record_; }
+
+private:
+    uint64_t record_;
+};
+
 }
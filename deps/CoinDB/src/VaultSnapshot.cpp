@@ -0,0 +1,259 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// VaultSnapshot.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "VaultSnapshot.h"
+#include "Database.h"
+
+#if defined(DATABASE_MYSQL)
+    #include "../odb/Schema-odb-mysql.hxx"
+#elif defined(DATABASE_SQLITE)
+    #include "../odb/Schema-odb-sqlite.hxx"
+#else
+    #error "No database engine selected."
+#endif
+
+#include <odb/session.hxx>
+
+#include <logger/logger.h>
+
+using namespace CoinDB;
+
+namespace
+{
+
+// Makes a transaction current in this thread without owning it.
+class CurrentTransaction
+{
+public:
+    explicit CurrentTransaction(odb::transaction& t)
+    {
+        if (odb::transaction::has_current()) throw std::runtime_error("VaultSnapshot - a transaction is already open in this thread.");
+        odb::transaction::current(t);
+    }
+
+    ~CurrentTransaction() { odb::transaction::reset_current(); }
+};
+
+}
+
+template<typename F>
+auto VaultSnapshot::read(F f) const -> decltype(f())
+{
+    boost::shared_lock<boost::shared_mutex> openLock(vault_.openMutex);
+    if (!transaction_ || vault_.db_ != db_) throw VaultClosedException(vault_.getName());
+
+    CurrentTransaction current(*transaction_);
+    odb::core::session s;
+    return f();
+}
+
+VaultSnapshot::VaultSnapshot(const Vault& vault, bool use_metadata_cache)
+    : vault_(vault), use_metadata_cache_(use_metadata_cache), shared_metadata_(false), generation_(0), write_sequence_(0), best_height_(0)
+{
+    LOGGER(trace) << "VaultSnapshot::VaultSnapshot(" << vault.getName() << ", " << (use_metadata_cache ? "true" : "false") << ")" << std::endl;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    begin();
+}
+
+VaultSnapshot::~VaultSnapshot()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    end();
+}
+
+void VaultSnapshot::refresh()
+{
+    LOGGER(trace) << "VaultSnapshot::refresh()" << std::endl;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    end();
+    begin();
+}
+
+uint64_t VaultSnapshot::getMetadataGeneration() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return generation_;
+}
+
+uint32_t VaultSnapshot::getBestHeight() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return best_height_;
+}
+
+void VaultSnapshot::begin()
+{
+    {
+        boost::shared_lock<boost::shared_mutex> openLock(vault_.openMutex);
+        if (!vault_.db_) throw VaultClosedException(vault_.getName());
+        db_ = vault_.db_;
+
+        // Taken before the transaction starts so any later metadata write also bumps them past ours.
+        generation_ = vault_.metadataGeneration;
+        write_sequence_ = vault_.mutex.write_sequence;
+    }
+
+    connection_ = db_->connection();
+    transaction_.reset(new odb::transaction(connection_->begin(), false));
+
+    // sqlite only fixes the read snapshot at the first statement.
+    best_height_ = read([&]() { return vault_.getBestHeight_unwrapped(); });
+
+    // If a write was in progress, or started and finished, since the sequence was read, we cannot
+    // tell whether our read includes it. Other snapshots at the same sequence might not agree, so
+    // metadata is loaded for this snapshot alone.
+    shared_metadata_ = use_metadata_cache_ && write_sequence_ % 2 == 0 && vault_.mutex.write_sequence == write_sequence_;
+}
+
+void VaultSnapshot::end()
+{
+    metadata_.reset();
+    if (transaction_)
+    {
+        // Nothing was written, so committing just releases the read lock without a rollback.
+        try
+        {
+            CurrentTransaction current(*transaction_);
+            transaction_->commit();
+        }
+        catch (const std::exception& e)
+        {
+            LOGGER(error) << "VaultSnapshot::end() - " << e.what() << std::endl;
+        }
+        transaction_.reset();
+    }
+    connection_.reset();
+    db_.reset();
+}
+
+///////////////////////////////////
+// ACCOUNTS, KEYCHAINS, AND BINS //
+///////////////////////////////////
+std::shared_ptr<const VaultMetadata> VaultSnapshot::getMetadata() const
+{
+    LOGGER(trace) << "VaultSnapshot::getMetadata()" << std::endl;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return getMetadata_unlocked();
+}
+
+std::shared_ptr<const VaultMetadata> VaultSnapshot::getMetadata_unlocked() const
+{
+    if (metadata_) return metadata_;
+
+    if (shared_metadata_)
+    {
+        metadata_ = vault_.getCachedMetadata(write_sequence_);
+        if (metadata_) return metadata_;
+    }
+
+    std::shared_ptr<VaultMetadata> metadata(new VaultMetadata());
+    metadata->generation = generation_;
+    metadata->write_sequence = write_sequence_;
+    read([&]()
+    {
+        metadata->accounts = vault_.getAllAccountInfo_unwrapped();
+        metadata->keychains = vault_.getRootKeychainViews_unwrapped();
+        metadata->bins = vault_.getAllAccountBinViews_unwrapped();
+    });
+
+    metadata_ = metadata;
+    if (shared_metadata_) { vault_.cacheMetadata(metadata_); }
+    return metadata_;
+}
+
+AccountInfo VaultSnapshot::getAccountInfo(const std::string& account_name) const
+{
+    LOGGER(trace) << "VaultSnapshot::getAccountInfo(" << account_name << ")" << std::endl;
+
+    std::shared_ptr<const VaultMetadata> metadata = getMetadata();
+    for (auto& info: metadata->accounts)
+    {
+        if (info.name() == account_name) return info;
+    }
+    throw AccountNotFoundException(account_name);
+}
+
+bool VaultSnapshot::accountExists(const std::string& account_name) const
+{
+    LOGGER(trace) << "VaultSnapshot::accountExists(" << account_name << ")" << std::endl;
+
+    std::shared_ptr<const VaultMetadata> metadata = getMetadata();
+    for (auto& info: metadata->accounts)
+    {
+        if (info.name() == account_name) return true;
+    }
+    return false;
+}
+
+////////////////////////
+// HISTORY AND TOTALS //
+////////////////////////
+uint64_t VaultSnapshot::getAccountBalance(const std::string& account_name, unsigned int min_confirmations, int tx_flags) const
+{
+    LOGGER(trace) << "VaultSnapshot::getAccountBalance(" << account_name << ", " << min_confirmations << ")" << std::endl;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return read([&]() { return vault_.getAccountBalance_unwrapped(account_name, min_confirmations, tx_flags); });
+}
+
+std::vector<TxOutView> VaultSnapshot::getTxOutViews(const std::string& account_name, const std::string& bin_name, int role_flags, int txout_status_flags, int tx_status_flags, bool hide_change) const
+{
+    LOGGER(trace) << "VaultSnapshot::getTxOutViews(" << account_name << ", " << bin_name << ", " << TxOut::getRoleString(role_flags) << ", " << TxOut::getStatusString(txout_status_flags) << ", " << Tx::getStatusString(tx_status_flags) << ")" << std::endl;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return read([&]() { return vault_.getTxOutViews_unwrapped(account_name, bin_name, role_flags, txout_status_flags, tx_status_flags, hide_change); });
+}
+
+std::vector<TxOutView> VaultSnapshot::getUnspentTxOutViews(const std::string& account_name, uint32_t min_confirmations) const
+{
+    LOGGER(trace) << "VaultSnapshot::getUnspentTxOutViews(" << account_name << ", " << min_confirmations << ")" << std::endl;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return read([&]() { return vault_.getUnspentTxOutViews_unwrapped(vault_.getAccount_unwrapped(account_name), min_confirmations); });
+}
+
+std::vector<TxOutView> VaultSnapshot::getTxOutViewsPage(const HistoryFilter& filter, HistoryCursor& cursor, unsigned int count) const
+{
+    LOGGER(trace) << "VaultSnapshot::getTxOutViewsPage(" << filter.account_name << ", " << filter.bin_name << ", " << cursor.token() << ", " << count << ")" << std::endl;
+
+    if (cursor.isEnd() || count == 0) return std::vector<TxOutView>();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return read([&]() { return vault_.getTxOutViewsPage_unwrapped(filter, cursor, count); });
+}
+
+std::vector<TxOutView> VaultSnapshot::getTxOutViewsForTxs(const std::string& account_name, const std::set<unsigned long>& tx_ids, int role_flags, int txout_status_flags, bool hide_change) const
+{
+    LOGGER(trace) << "VaultSnapshot::getTxOutViewsForTxs(" << account_name << ", " << tx_ids.size() << " txs, " << TxOut::getRoleString(role_flags) << ", " << TxOut::getStatusString(txout_status_flags) << ")" << std::endl;
+
+    if (tx_ids.empty()) return std::vector<TxOutView>();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return read([&]() { return vault_.getTxOutViewsForTxs_unwrapped(account_name, tx_ids, role_flags, txout_status_flags, hide_change); });
+}
+
+std::vector<TxView> VaultSnapshot::getTxViews(int tx_status_flags, unsigned long start, int count, uint32_t minheight) const
+{
+    LOGGER(trace) << "VaultSnapshot::getTxViews(" << Tx::getStatusString(tx_status_flags) << ", " << start << ", " << count << ")" << std::endl;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return read([&]() { return vault_.getTxViews_unwrapped(tx_status_flags, start, count, minheight); });
+}
+
+std::vector<LedgerEntryView> VaultSnapshot::getLedgerViews(const std::string& account_name, unsigned int count) const
+{
+    LOGGER(trace) << "VaultSnapshot::getLedgerViews(" << account_name << ", " << count << ")" << std::endl;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return read([&]() { return vault_.getLedgerViews_unwrapped(account_name, count); });
+}
@@ -0,0 +1,95 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// VaultSnapshot.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include "Vault.h"
+
+#include <odb/connection.hxx>
+#include <odb/transaction.hxx>
+
+#include <memory>
+#include <mutex>
+
+namespace CoinDB
+{
+
+// A read-only view of a vault as of the moment it was taken or last refreshed.
+//
+// The snapshot holds a read transaction open on its own pooled connection and
+// never takes the vault lock, so its reads do not wait for writers or delay them
+// beyond sqlite's own WAL locking.
+// In sqlite WAL mode the writer cannot checkpoint past an open reader, so keep
+// snapshots short-lived or refresh them regularly, e.g. once per UI update.
+//
+// Methods are thread-safe but serialized per snapshot, and must not be called
+// from a thread that already has a vault transaction open. Release all
+// snapshots before closing the vault; reads after close throw VaultClosedException.
+class VaultSnapshot
+{
+public:
+    // With use_metadata_cache, accounts, keychains and bins come from a copy shared by
+    // all snapshots that started between the same two vault writes instead of being
+    // queried. A snapshot that starts while a write is in progress queries its own.
+    explicit VaultSnapshot(const Vault& vault, bool use_metadata_cache = true);
+    ~VaultSnapshot();
+
+    // Ends the read transaction and starts a new one at the current vault state.
+    void                                    refresh();
+
+    uint64_t                                getMetadataGeneration() const;
+    uint32_t                                getBestHeight() const;
+
+    ///////////////////////////////////
+    // ACCOUNTS, KEYCHAINS, AND BINS //
+    ///////////////////////////////////
+    std::shared_ptr<const VaultMetadata>    getMetadata() const;
+    std::vector<AccountInfo>                getAllAccountInfo() const { return getMetadata()->accounts; }
+    AccountInfo                             getAccountInfo(const std::string& account_name) const; // throws AccountNotFoundException
+    bool                                    accountExists(const std::string& account_name) const;
+    std::vector<KeychainView>               getRootKeychainViews() const { return getMetadata()->keychains; }
+    std::vector<AccountBinView>             getAllAccountBinViews() const { return getMetadata()->bins; }
+
+    ////////////////////////
+    // HISTORY AND TOTALS //
+    ////////////////////////
+    uint64_t                                getAccountBalance(const std::string& account_name, unsigned int min_confirmations = 1, int tx_flags = Tx::ALL) const;
+    std::vector<TxOutView>                  getTxOutViews(const std::string& account_name = "", const std::string& bin_name = "", int role_flags = TxOut::ROLE_BOTH, int txout_status_flags = TxOut::BOTH, int tx_status_flags = Tx::ALL, bool hide_change = true) const;
+    std::vector<TxOutView>                  getUnspentTxOutViews(const std::string& account_name, uint32_t min_confirmations = 0) const;
+    std::vector<TxOutView>                  getTxOutViewsPage(const HistoryFilter& filter, HistoryCursor& cursor, unsigned int count) const;
+    std::vector<TxOutView>                  getTxOutViewsForTxs(const std::string& account_name, const std::set<unsigned long>& tx_ids, int role_flags = TxOut::ROLE_BOTH, int txout_status_flags = TxOut::BOTH, bool hide_change = true) const;
+    std::vector<TxView>                     getTxViews(int tx_status_flags = Tx::ALL, unsigned long start = 0, int count = -1, uint32_t minheight = 0) const;
+    std::vector<LedgerEntryView>            getLedgerViews(const std::string& account_name, unsigned int count = 0) const;
+
+private:
+    // Runs f with the snapshot transaction current in this thread. Caller must hold mutex_.
+    template<typename F>
+    auto read(F f) const -> decltype(f());
+
+    void                                    begin();
+    void                                    end();
+    std::shared_ptr<const VaultMetadata>    getMetadata_unlocked() const;
+
+    const Vault&                            vault_;
+    bool                                    use_metadata_cache_;
+
+    mutable std::mutex                      mutex_;
+    std::shared_ptr<odb::core::database>    db_;
+    odb::connection_ptr                     connection_;
+    std::unique_ptr<odb::transaction>       transaction_;
+
+    bool                                    shared_metadata_;
+    uint64_t                                generation_;
+    uint64_t                                write_sequence_;
+    uint32_t                                best_height_;
+    mutable std::shared_ptr<const VaultMetadata> metadata_;
+};
+
+}
@@ -0,0 +1,220 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// archive_roundtrip.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// Exports a vault with accounts, blocks and transactions in each archive
+// format, imports it into a new vault and compares the two. Then checks that
+// a binary archive cut short imports nothing at all.
+//
+
+#include <Vault.h>
+
+#include <CoinCore/MerkleTree.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+using namespace CoinDB;
+using namespace CoinQ;
+using namespace std;
+
+namespace
+{
+
+// Enough records to span several import batches
+const uint32_t BLOCKS = 400;
+const uint32_t TXS_PER_BLOCK = 3;
+const uint32_t BLOCK_INTERVAL = 600;
+const uint32_t BLOCK_BITS = 0x1d00ffff;
+
+std::mt19937_64 g_rng(0xa5c1);
+
+unsigned int failures = 0;
+
+void check(const string& name, bool ok)
+{
+    cout << "  " << name << (ok ? " OK" : " FAILED") << endl;
+    if (!ok) failures++;
+}
+
+bytes_t randomBytes(size_t size)
+{
+    bytes_t data(size);
+    for (auto& byte: data) { byte = (unsigned char)g_rng(); }
+    return data;
+}
+
+Coin::Transaction incomingTx(const bytes_t& txoutscript)
+{
+    Coin::Transaction tx;
+    tx.inputs.push_back(Coin::TxIn(Coin::OutPoint(randomBytes(32), 0), randomBytes(107), 0xffffffff));
+    tx.outputs.push_back(Coin::TxOut(100000 + g_rng() % 1000000, txoutscript));
+    return tx;
+}
+
+string tempPath(const string& name)
+{
+    return (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("coindb-" + name + "-%%%%%%%%")).string();
+}
+
+void populate(Vault& vault)
+{
+    vault.newKeychain("keychain1", randomBytes(32));
+    vault.newKeychain("keychain2", randomBytes(32));
+    vault.newKeychain("keychain3", randomBytes(32));
+    vault.newAccount("account1", 2, { "keychain1", "keychain2", "keychain3" }, 10);
+    vault.newAccount(true, false, "account2", 1, { "keychain1", "keychain2" }, 10);
+
+    vault.issueSigningScript("account1", DEFAULT_BIN_NAME, "first");
+    vault.issueSigningScript("account2", DEFAULT_BIN_NAME, "second");
+
+    std::vector<bytes_t> scripts;
+    for (auto& view: vault.getSigningScriptViews("", "", SigningScript::ALL)) { scripts.push_back(view.txoutscript); }
+
+    uint32_t timestamp = vault.getMaxFirstBlockTimestamp();
+    uchar_vector prevhash = randomBytes(32);
+    std::vector<Vault::chain_merkle_block_txs_t> blocks;
+    for (uint32_t height = 1; height <= BLOCKS; height++)
+    {
+        std::vector<Coin::Transaction> txs;
+        std::vector<uchar_vector> txhashes;
+        for (uint32_t i = 0; i < TXS_PER_BLOCK; i++)
+        {
+            txs.push_back(incomingTx(scripts[g_rng() % scripts.size()]));
+            txhashes.push_back(txs.back().hash());
+        }
+
+        Coin::MerkleBlock coinmerkleblock(Coin::randomPartialMerkleTree(txhashes, txs.size() * 2), 2, prevhash, timestamp, BLOCK_BITS, g_rng());
+        ChainMerkleBlock chainmerkleblock(coinmerkleblock, true, height, 0);
+        prevhash = chainmerkleblock.blockHeader.hash();
+        timestamp += BLOCK_INTERVAL;
+        blocks.push_back(Vault::chain_merkle_block_txs_t(chainmerkleblock, txs));
+    }
+    vault.insertMerkleBlocks(blocks);
+}
+
+// Everything the archive carries, in a form that does not depend on row ids.
+string describe(const Vault& vault)
+{
+    stringstream ss;
+    for (auto& info: vault.getAllAccountInfo())
+    {
+        ss << "account " << info.name() << " " << info.minsigs() << " " << info.unused_pool_size() << " " << info.time_created() << " " << info.use_witness();
+        for (auto& name: info.keychain_names()) { ss << " " << name; }
+        for (auto& name: info.bin_names()) { ss << " " << name; }
+        ss << endl;
+    }
+
+    std::vector<string> lines;
+    for (auto& view: vault.getSigningScriptViews("", "", SigningScript::ALL))
+    {
+        stringstream line;
+        line << "script " << view.account_name << " " << view.account_bin_name << " " << view.index << " " << view.label << " " << view.status << " " << uchar_vector(view.txoutscript).getHex();
+        lines.push_back(line.str());
+    }
+    for (auto& view: vault.getTxViews())
+    {
+        stringstream line;
+        line << "tx " << uchar_vector(view.hash).getHex() << " " << view.status;
+        lines.push_back(line.str());
+    }
+    std::sort(lines.begin(), lines.end());
+    for (auto& line: lines) { ss << line << endl; }
+
+    ss << "best height " << vault.getBestHeight() << endl;
+    return ss.str();
+}
+
+void testRoundTrip(const Vault& source, archive_format_t format, const string& name)
+{
+    cout << name << endl;
+
+    string archive = tempPath("archive");
+    string dbname = tempPath("import");
+    source.exportVault(archive, true, format);
+    {
+        Vault imported(dbname, true);
+        imported.importVault(archive, true);
+        check("contents match", describe(imported) == describe(source));
+    }
+    boost::filesystem::remove(archive);
+    boost::filesystem::remove(dbname);
+}
+
+void testTruncatedImport(const Vault& source)
+{
+    cout << "truncated binary archive" << endl;
+
+    string archive = tempPath("archive");
+    string dbname = tempPath("import");
+    source.exportVault(archive, true, BINARY_ARCHIVE);
+
+    // The cut is in the last record, several batches in, so an import that committed per batch would leave records behind
+    uintmax_t size = boost::filesystem::file_size(archive);
+    boost::filesystem::resize_file(archive, size - 16);
+    {
+        Vault imported(dbname, true);
+        string empty = describe(imported);
+
+        bool threw = false;
+        try
+        {
+            imported.importVault(archive, true);
+        }
+        catch (const exception&)
+        {
+            threw = true;
+        }
+        check("import throws", threw);
+        check("vault unchanged", describe(imported) == empty);
+        check("no accounts", imported.getAllAccountInfo().empty());
+        check("no transactions", imported.getTxViews().empty());
+    }
+    boost::filesystem::remove(archive);
+    boost::filesystem::remove(dbname);
+}
+
+}
+
+int main()
+{
+    string dbname = tempPath("source");
+    try
+    {
+        {
+            Vault source(dbname, true);
+            populate(source);
+            cout << "source vault: " << source.getTxViews().size() << " transaction(s), best height " << source.getBestHeight() << endl;
+
+            testRoundTrip(source, TEXT_ARCHIVE, "text archive");
+            testRoundTrip(source, BINARY_ARCHIVE, "binary archive");
+            testRoundTrip(source, COMPRESSED_BINARY_ARCHIVE, "compressed binary archive");
+            testTruncatedImport(source);
+        }
+        boost::filesystem::remove(dbname);
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+
+    if (failures)
+    {
+        cout << failures << " check(s) failed." << endl;
+        return 1;
+    }
+
+    cout << "All checks passed." << endl;
+    return 0;
+}
@@ -0,0 +1,193 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ledger_test.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// Inserts, confirms and deletes transactions and reorgs the chain, and after
+// each step checks that the incrementally maintained ledger matches the one
+// rebuildLedger() recomputes from the stored transactions.
+//
+
+#include <Vault.h>
+
+#include <CoinCore/MerkleTree.h>
+
+#include <boost/filesystem.hpp>
+
+#include <iostream>
+#include <random>
+#include <sstream>
+
+using namespace CoinDB;
+using namespace CoinQ;
+using namespace std;
+
+namespace
+{
+
+const uint32_t BLOCKS = 20;
+const uint32_t BLOCK_INTERVAL = 600;
+const uint32_t BLOCK_BITS = 0x1d00ffff;
+
+std::mt19937_64 g_rng(0x1ed9);
+
+unsigned int failures = 0;
+
+void check(const string& name, bool ok)
+{
+    cout << "  " << name << (ok ? " OK" : " FAILED") << endl;
+    if (!ok) failures++;
+}
+
+bytes_t randomBytes(size_t size)
+{
+    bytes_t data(size);
+    for (auto& byte: data) { byte = (unsigned char)g_rng(); }
+    return data;
+}
+
+Coin::Transaction incomingTx(const bytes_t& txoutscript)
+{
+    Coin::Transaction tx;
+    tx.inputs.push_back(Coin::TxIn(Coin::OutPoint(randomBytes(32), 0), randomBytes(107), 0xffffffff));
+    tx.outputs.push_back(Coin::TxOut(100000 + g_rng() % 1000000, txoutscript));
+    return tx;
+}
+
+// Spends the first output of prev, less a fee, to a script that is not ours.
+Coin::Transaction spendingTx(const Coin::Transaction& prev)
+{
+    Coin::Transaction tx;
+    tx.inputs.push_back(Coin::TxIn(Coin::OutPoint(prev.hash(), 0), randomBytes(107), 0xffffffff));
+    tx.outputs.push_back(Coin::TxOut(prev.outputs[0].value - 1000, randomBytes(23)));
+    return tx;
+}
+
+string tempPath(const string& name)
+{
+    return (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("coindb-" + name + "-%%%%%%%%")).string();
+}
+
+// hashes[h] is the hash of the block at height h, and hashes[0] the parent of the first block.
+void mine(Vault& vault, std::vector<uchar_vector>& hashes, uint32_t timestamp, std::vector<Coin::Transaction> txs)
+{
+    // Every block also carries a tx that is not ours, so none is empty
+    txs.push_back(incomingTx(randomBytes(23)));
+    std::vector<uchar_vector> txhashes;
+    for (auto& tx: txs) { txhashes.push_back(tx.hash()); }
+
+    uint32_t height = hashes.size();
+    Coin::MerkleBlock coinmerkleblock(Coin::randomPartialMerkleTree(txhashes, txs.size() * 2), 2, hashes.back(), timestamp + height * BLOCK_INTERVAL, BLOCK_BITS, g_rng());
+    ChainMerkleBlock chainmerkleblock(coinmerkleblock, true, height, 0);
+    vault.insertMerkleBlocks(std::vector<Vault::chain_merkle_block_txs_t>(1, Vault::chain_merkle_block_txs_t(chainmerkleblock, txs)));
+    hashes.push_back(chainmerkleblock.blockHeader.hash());
+}
+
+string describeLedger(const Vault& vault)
+{
+    stringstream ss;
+    for (auto& info: vault.getAllAccountInfo())
+    {
+        for (auto& view: vault.getLedgerViews(info.name()))
+        {
+            ss << info.name() << " " << uchar_vector(view.hash()).getHex() << " " << view.sort_height << " " << view.delta << " " << view.confirmed_balance << " " << view.balance << endl;
+        }
+    }
+    return ss.str();
+}
+
+void checkLedger(Vault& vault, const string& name)
+{
+    string incremental = describeLedger(vault);
+    vault.rebuildLedger();
+    check(name, !incremental.empty() && incremental == describeLedger(vault));
+}
+
+void testLedger(Vault& vault)
+{
+    vault.newKeychain("keychain1", randomBytes(32));
+    vault.newKeychain("keychain2", randomBytes(32));
+    vault.newAccount("account1", 1, { "keychain1" }, 10);
+    vault.newAccount("account2", 1, { "keychain2" }, 10);
+    vault.issueSigningScript("account1", DEFAULT_BIN_NAME, "first");
+    vault.issueSigningScript("account2", DEFAULT_BIN_NAME, "second");
+
+    std::vector<bytes_t> scripts;
+    for (auto& view: vault.getSigningScriptViews("", "", SigningScript::ALL)) { scripts.push_back(view.txoutscript); }
+
+    uint32_t timestamp = vault.getMaxFirstBlockTimestamp();
+    std::vector<uchar_vector> hashes(1, randomBytes(32));
+
+    cout << "Confirmed blocks" << endl;
+    std::vector<Coin::Transaction> paid;
+    for (uint32_t height = 1; height <= BLOCKS; height++)
+    {
+        std::vector<Coin::Transaction> txs;
+        txs.push_back(incomingTx(scripts[g_rng() % scripts.size()]));
+        txs.push_back(incomingTx(scripts[g_rng() % scripts.size()]));
+        paid.insert(paid.end(), txs.begin(), txs.end());
+        mine(vault, hashes, timestamp, txs);
+    }
+    checkLedger(vault, "ledger matches recompute");
+
+    cout << "Unconfirmed txs" << endl;
+    std::vector<Coin::Transaction> unconfirmed;
+    for (int i = 0; i < 4; i++) { unconfirmed.push_back(incomingTx(scripts[g_rng() % scripts.size()])); }
+    unconfirmed.push_back(spendingTx(paid[6]));
+    unconfirmed.push_back(spendingTx(paid[20]));
+    for (auto& tx: unconfirmed) { vault.insertNewTx(tx); }
+    checkLedger(vault, "ledger matches recompute");
+
+    cout << "Confirmation" << endl;
+    mine(vault, hashes, timestamp, { unconfirmed[0], unconfirmed[4] });
+    checkLedger(vault, "ledger matches recompute");
+
+    cout << "Deletion" << endl;
+    vault.deleteTx(unconfirmed[1].hash());
+    vault.deleteTx(paid[10].hash());
+    checkLedger(vault, "ledger matches recompute");
+
+    cout << "Reorg" << endl;
+    check("blocks deleted", vault.deleteMerkleBlock(15) == BLOCKS + 1 - 14);
+    hashes.resize(15);
+    checkLedger(vault, "ledger matches recompute");
+
+    // Confirmations at the fork, below every tx the reorg left unconfirmed
+    mine(vault, hashes, timestamp, { unconfirmed[2], paid[34] });
+    mine(vault, hashes, timestamp, { unconfirmed[4], paid[29], paid[30] });
+    mine(vault, hashes, timestamp, { unconfirmed[5] });
+    checkLedger(vault, "new branch matches recompute");
+}
+
+}
+
+int main()
+{
+    string dbname = tempPath("ledger");
+    try
+    {
+        {
+            Vault vault(dbname, true);
+            testLedger(vault);
+        }
+        boost::filesystem::remove(dbname);
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+
+    if (failures)
+    {
+        cout << failures << " check(s) failed." << endl;
+        return 1;
+    }
+
+    cout << "All checks passed." << endl;
+    return 0;
+}
@@ -0,0 +1,225 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// reorg_test.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// Deletes the blocks from a height and checks that exactly the transactions
+// in them lose their confirmations, in the txs and in the ledger, that the
+// merkle blocks and headers above the height are gone, and that a single
+// reorg notification names the unconfirmed transactions.
+//
+
+#include <Vault.h>
+
+#include <CoinCore/MerkleTree.h>
+
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+
+using namespace CoinDB;
+using namespace CoinQ;
+using namespace std;
+
+namespace
+{
+
+const uint32_t BLOCKS = 20;
+const uint32_t REORG_HEIGHT = 15;
+const uint32_t BLOCK_INTERVAL = 600;
+const uint32_t BLOCK_BITS = 0x1d00ffff;
+
+std::mt19937_64 g_rng(0x7e0a);
+
+unsigned int failures = 0;
+
+void check(const string& name, bool ok)
+{
+    cout << "  " << name << (ok ? " OK" : " FAILED") << endl;
+    if (!ok) failures++;
+}
+
+bytes_t randomBytes(size_t size)
+{
+    bytes_t data(size);
+    for (auto& byte: data) { byte = (unsigned char)g_rng(); }
+    return data;
+}
+
+Coin::Transaction incomingTx(const bytes_t& txoutscript)
+{
+    Coin::Transaction tx;
+    tx.inputs.push_back(Coin::TxIn(Coin::OutPoint(randomBytes(32), 0), randomBytes(107), 0xffffffff));
+    tx.outputs.push_back(Coin::TxOut(100000 + g_rng() % 1000000, txoutscript));
+    return tx;
+}
+
+string tempPath(const string& name)
+{
+    return (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("coindb-" + name + "-%%%%%%%%")).string();
+}
+
+uint32_t merkleBlockCount(const Vault& vault)
+{
+    string path = tempPath("merkleblocks");
+    vault.exportMerkleBlocks(path);
+    uint32_t count;
+    {
+        std::ifstream ifs(path);
+        boost::archive::text_iarchive ia(ifs);
+        ia >> count;
+    }
+    boost::filesystem::remove(path);
+    return count;
+}
+
+bool hasBlockHeader(const Vault& vault, uint32_t height)
+{
+    try
+    {
+        vault.getBlockHeader(height);
+        return true;
+    }
+    catch (const BlockHeaderNotFoundException&)
+    {
+        return false;
+    }
+}
+
+void testReorg(Vault& vault)
+{
+    vault.newKeychain("keychain1", randomBytes(32));
+    vault.newKeychain("keychain2", randomBytes(32));
+    vault.newAccount("account1", 1, { "keychain1" }, 10);
+    vault.newAccount("account2", 1, { "keychain2" }, 10);
+    vault.issueSigningScript("account1", DEFAULT_BIN_NAME, "first");
+    vault.issueSigningScript("account2", DEFAULT_BIN_NAME, "second");
+
+    std::vector<bytes_t> scripts;
+    for (auto& view: vault.getSigningScriptViews("", "", SigningScript::ALL)) { scripts.push_back(view.txoutscript); }
+
+    // Two of our txs and one that is not in each block
+    uint32_t timestamp = vault.getMaxFirstBlockTimestamp();
+    uchar_vector prevhash = randomBytes(32);
+    std::vector<Vault::chain_merkle_block_txs_t> blocks;
+    std::vector<std::pair<Coin::Transaction, uint32_t>> ours;
+    for (uint32_t height = 1; height <= BLOCKS; height++)
+    {
+        std::vector<Coin::Transaction> txs;
+        for (int i = 0; i < 2; i++)
+        {
+            txs.push_back(incomingTx(scripts[g_rng() % scripts.size()]));
+            ours.push_back(std::make_pair(txs.back(), height));
+        }
+        txs.push_back(incomingTx(randomBytes(23)));
+
+        std::vector<uchar_vector> txhashes;
+        for (auto& tx: txs) { txhashes.push_back(tx.hash()); }
+        Coin::MerkleBlock coinmerkleblock(Coin::randomPartialMerkleTree(txhashes, txs.size() * 2), 2, prevhash, timestamp + height * BLOCK_INTERVAL, BLOCK_BITS, g_rng());
+        ChainMerkleBlock chainmerkleblock(coinmerkleblock, true, height, 0);
+        prevhash = chainmerkleblock.blockHeader.hash();
+        blocks.push_back(Vault::chain_merkle_block_txs_t(chainmerkleblock, txs));
+    }
+    vault.insertMerkleBlocks(blocks);
+
+    // Already unconfirmed, so the reorg must leave it out
+    Coin::Transaction pending = incomingTx(scripts[0]);
+    vault.insertNewTx(pending);
+
+    std::set<unsigned long> expected_tx_ids;
+    for (auto& item: ours)
+    {
+        if (item.second >= REORG_HEIGHT) { expected_tx_ids.insert(vault.getTx(item.first.hash())->id()); }
+    }
+
+    std::vector<uint32_t> reorg_heights;
+    std::set<unsigned long> reorg_tx_ids;
+    vault.subscribeReorg([&](uint32_t height, const std::vector<unsigned long>& tx_ids, const std::vector<bytes_t>& /*tx_hashes*/)
+    {
+        reorg_heights.push_back(height);
+        reorg_tx_ids.insert(tx_ids.begin(), tx_ids.end());
+    });
+
+    cout << "Delete from height " << REORG_HEIGHT << endl;
+    check("blocks deleted", vault.deleteMerkleBlock(REORG_HEIGHT) == BLOCKS - REORG_HEIGHT + 1);
+
+    bool bTxs = true;
+    for (auto& item: ours)
+    {
+        std::shared_ptr<Tx> tx = vault.getTx(item.first.hash());
+        if (item.second >= REORG_HEIGHT)
+        {
+            if (tx->status() != Tx::PROPAGATED || tx->blockheader()) { bTxs = false; }
+        }
+        else
+        {
+            if (tx->status() != Tx::CONFIRMED || !tx->blockheader() || tx->blockheader()->height() != item.second) { bTxs = false; }
+        }
+    }
+    check("tx status and block headers", bTxs);
+
+    std::map<bytes_t, uint32_t> heights;
+    for (auto& item: ours) { heights[item.first.hash()] = item.second < REORG_HEIGHT ? item.second : (uint32_t)LedgerEntry::UNCONFIRMED_HEIGHT; }
+    heights[pending.hash()] = LedgerEntry::UNCONFIRMED_HEIGHT;
+    unsigned int entries = 0;
+    bool bLedger = true;
+    for (auto& info: vault.getAllAccountInfo())
+    {
+        for (auto& view: vault.getLedgerViews(info.name()))
+        {
+            entries++;
+            auto it = heights.find(view.hash());
+            if (it == heights.end() || it->second != view.sort_height) { bLedger = false; }
+        }
+    }
+    check("ledger sort heights", bLedger && entries == heights.size());
+
+    check("merkle blocks", merkleBlockCount(vault) == REORG_HEIGHT - 1);
+    bool bHeaders = vault.getBestHeight() == REORG_HEIGHT - 1;
+    for (uint32_t height = 1; height <= BLOCKS; height++)
+    {
+        if (hasBlockHeader(vault, height) != (height < REORG_HEIGHT)) { bHeaders = false; }
+    }
+    check("block headers", bHeaders);
+
+    check("one reorg event", reorg_heights.size() == 1 && reorg_heights[0] == REORG_HEIGHT);
+    check("reorg tx ids", reorg_tx_ids == expected_tx_ids);
+}
+
+}
+
+int main()
+{
+    string dbname = tempPath("reorg");
+    try
+    {
+        {
+            Vault vault(dbname, true);
+            testReorg(vault);
+        }
+        boost::filesystem::remove(dbname);
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+
+    if (failures)
+    {
+        cout << failures << " check(s) failed." << endl;
+        return 1;
+    }
+
+    cout << "All checks passed." << endl;
+    return 0;
+}
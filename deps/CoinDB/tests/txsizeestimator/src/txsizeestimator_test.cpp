@@ -0,0 +1,206 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// txsizeestimator_test.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// Checks TxSizeEstimator against fully signed worst-case transactions
+// serialized by CoinCore, and against hand-computed sizes for common
+// multisig layouts.
+//
+
+#include "TxSizeEstimator.h"
+
+#include <CoinCore/CoinNodeData.h>
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace CoinDB;
+using namespace std;
+
+typedef TxSizeEstimator::script_type_t script_type_t;
+
+static unsigned int failures = 0;
+
+static void check(const string& name, uint64_t actual, uint64_t expected)
+{
+    cout << "  " << name << ": " << actual;
+    if (actual == expected)
+    {
+        cout << " OK" << endl;
+    }
+    else
+    {
+        cout << " FAILED (expected " << expected << ")" << endl;
+        failures++;
+    }
+}
+
+static uchar_vector pushData(const uchar_vector& data)
+{
+    uchar_vector rval;
+    if (data.size() < 0x4c)         { rval.push_back((unsigned char)data.size()); }
+    else if (data.size() <= 0xff)   { rval.push_back(0x4c); rval.push_back((unsigned char)data.size()); }
+    else throw runtime_error("pushData() - data too large for test.");
+    rval += data;
+    return rval;
+}
+
+static uchar_vector multisigScript(uint32_t minsigs, uint32_t pubkeys, bool compressed_keys)
+{
+    uchar_vector script;
+    script.push_back(0x50 + minsigs);
+    for (uint32_t i = 0; i < pubkeys; i++)
+    {
+        uchar_vector pubkey(compressed_keys ? TxSizeEstimator::COMPRESSED_PUBKEY_SIZE : TxSizeEstimator::UNCOMPRESSED_PUBKEY_SIZE, 0x11 + i);
+        pubkey[0] = compressed_keys ? 0x02 : 0x04;
+        script += pushData(pubkey);
+    }
+    script.push_back(0x50 + pubkeys);
+    script.push_back(0xae); // OP_CHECKMULTISIG
+    return script;
+}
+
+static uchar_vector outputScript(script_type_t type)
+{
+    uchar_vector script;
+    if (type == TxSizeEstimator::P2WSH)
+    {
+        script.push_back(0x00);
+        script += pushData(uchar_vector(32, 0x22));
+    }
+    else
+    {
+        script.push_back(0xa9); // OP_HASH160
+        script += pushData(uchar_vector(20, 0x33));
+        script.push_back(0x87); // OP_EQUAL
+    }
+    return script;
+}
+
+// Builds an input spending an m-of-n multisig output with maximum size signatures.
+static Coin::TxIn signedInput(script_type_t type, uint32_t minsigs, uint32_t pubkeys, bool compressed_keys, uint32_t index)
+{
+    uchar_vector redeemscript = multisigScript(minsigs, pubkeys, compressed_keys);
+    uchar_vector signature(TxSizeEstimator::MAX_SIGNATURE_SIZE, 0x44);
+
+    Coin::TxIn txin(Coin::OutPoint(uchar_vector(32, 0x55), index), uchar_vector(), 0xffffffff);
+    switch (type)
+    {
+    case TxSizeEstimator::P2SH:
+        txin.scriptSig.push_back(0x00);
+        for (uint32_t i = 0; i < minsigs; i++) { txin.scriptSig += pushData(signature); }
+        txin.scriptSig += pushData(redeemscript);
+        break;
+
+    case TxSizeEstimator::P2SH_P2WSH:
+        txin.scriptSig = pushData(outputScript(TxSizeEstimator::P2WSH));
+        // fall through
+
+    case TxSizeEstimator::P2WSH:
+        txin.scriptWitness.push(uchar_vector());
+        for (uint32_t i = 0; i < minsigs; i++) { txin.scriptWitness.push(signature); }
+        txin.scriptWitness.push(redeemscript);
+        break;
+    }
+    return txin;
+}
+
+static void testAgainstSerialized(script_type_t type, uint32_t minsigs, uint32_t pubkeys, bool compressed_keys, size_t txin_count, size_t txout_count)
+{
+    stringstream name;
+    name << "type " << type << ", " << minsigs << "-of-" << pubkeys << (compressed_keys ? " compressed" : " uncompressed") << ", " << txin_count << " in, " << txout_count << " out";
+    cout << name.str() << endl;
+
+    Coin::Transaction tx;
+    TxSizeEstimator estimator;
+    for (size_t i = 0; i < txin_count; i++)
+    {
+        tx.addInput(signedInput(type, minsigs, pubkeys, compressed_keys, i));
+    }
+    estimator.addInput(type, minsigs, pubkeys, compressed_keys, txin_count);
+
+    for (size_t i = 0; i < txout_count; i++)
+    {
+        uchar_vector script = outputScript(type);
+        tx.addOutput(Coin::TxOut(100000, script));
+        estimator.addOutput(script);
+    }
+
+    uint64_t base_size = tx.getSize(false);
+    uint64_t total_size = tx.getSize(true);
+    uint64_t weight = base_size * (TxSizeEstimator::WITNESS_SCALE_FACTOR - 1) + total_size;
+
+    check("base size", estimator.base_size(), base_size);
+    check("total size", estimator.total_size(), total_size);
+    check("weight", estimator.weight(), weight);
+    check("vsize", estimator.vsize(), (weight + 3) / 4);
+}
+
+static void testKnownSizes()
+{
+    cout << "known sizes" << endl;
+
+    // 2-of-3 compressed redeemscript: OP_2 3*(push + 33) OP_3 OP_CHECKMULTISIG
+    check("2-of-3 redeemscript", TxSizeEstimator::redeemScriptSize(3, true), 105);
+
+    // outpoint + 3-byte varint + scriptsig (OP_0, 2*(push + 73), pushdata1 + 105) + sequence
+    check("2-of-3 p2sh txin", TxSizeEstimator::txInBaseSize(TxSizeEstimator::P2SH, 2, 3, true), 299);
+    check("2-of-3 p2wsh txin", TxSizeEstimator::txInBaseSize(TxSizeEstimator::P2WSH, 2, 3, true), 41);
+    check("2-of-3 p2sh-p2wsh txin", TxSizeEstimator::txInBaseSize(TxSizeEstimator::P2SH_P2WSH, 2, 3, true), 76);
+
+    // item count, empty item, 2*(1 + 73), 1 + 105
+    check("2-of-3 witness", TxSizeEstimator::txInWitnessSize(TxSizeEstimator::P2WSH, 2, 3, true), 256);
+
+    TxSizeEstimator p2sh;
+    p2sh.addInput(TxSizeEstimator::P2SH, 2, 3, true);
+    p2sh.addOutput(TxSizeEstimator::txOutScriptSize(TxSizeEstimator::P2SH), 2);
+    check("2-of-3 p2sh 1 in 2 out vsize", p2sh.vsize(), 373);
+
+    TxSizeEstimator p2wsh;
+    p2wsh.addInput(TxSizeEstimator::P2WSH, 2, 3, true);
+    p2wsh.addOutput(TxSizeEstimator::txOutScriptSize(TxSizeEstimator::P2WSH), 2);
+    check("2-of-3 p2wsh 1 in 2 out base size", p2wsh.base_size(), 137);
+    check("2-of-3 p2wsh 1 in 2 out total size", p2wsh.total_size(), 395);
+    check("2-of-3 p2wsh 1 in 2 out vsize", p2wsh.vsize(), 202);
+    check("2-of-3 p2wsh 1 in 2 out fee at 10", p2wsh.fee(10), 2020);
+
+    // 3 * (43-byte output + 41 + ceil(256 / 4))
+    check("2-of-3 p2wsh dust", TxSizeEstimator::dustThreshold(TxSizeEstimator::P2WSH, 2, 3, true), 444);
+}
+
+int main()
+{
+    try
+    {
+        testKnownSizes();
+
+        const script_type_t types[] = { TxSizeEstimator::P2SH, TxSizeEstimator::P2WSH, TxSizeEstimator::P2SH_P2WSH };
+        for (auto type: types)
+        {
+            testAgainstSerialized(type, 1, 1, true, 1, 1);
+            testAgainstSerialized(type, 2, 3, true, 1, 2);
+            testAgainstSerialized(type, 2, 3, false, 3, 2);
+            testAgainstSerialized(type, 3, 5, true, 300, 1);
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+
+    if (failures)
+    {
+        cout << failures << " check(s) failed." << endl;
+        return 1;
+    }
+
+    cout << "All checks passed." << endl;
+    return 0;
+}
@@ -26,6 +26,7 @@
 #include <CoinQ/CoinQ_coinparams.h>
 
 #include <logger/logger.h>
+#include <logger/metrics.h>
 
 #include <iostream>
 #include <sstream>
@@ -45,6 +46,15 @@ using namespace CoinDB;
 
 std::string g_dbuser;
 std::string g_dbpasswd;
+cli::Shell* g_shell = nullptr;
+
+archive_format_t getArchiveFormat(const cli::params_t& params, size_t i)
+{
+    if (params.size() <= i || params[i] == "text")  return TEXT_ARCHIVE;
+    if (params[i] == "binary")                      return BINARY_ARCHIVE;
+    if (params[i] == "compressed")                  return COMPRESSED_BINARY_ARCHIVE;
+    throw std::runtime_error("Invalid archive format. Use text, binary or compressed.");
+}
 
 // Global operations
 cli::result_t cmd_create(const cli::params_t& params)
@@ -98,7 +108,7 @@ cli::result_t cmd_exportvault(const cli::params_t& params)
     bool exportprivkeys = params.size() <= 1 || params[1] == "true";
 
     std::string output_file = params.size() > 2 ? params[2] : (params[0] + ".portable");
-    vault.exportVault(output_file, exportprivkeys);
+    vault.exportVault(output_file, exportprivkeys, getArchiveFormat(params, 3));
 
     stringstream ss;
     ss << "Vault " << params[0] << " exported to " << output_file << ".";
@@ -493,7 +503,7 @@ cli::result_t cmd_exportaccount(const cli::params_t& params)
     Vault vault(g_dbuser, g_dbpasswd, params[0], false);
 
     std::string output_file = params.size() > 2 ? params[2] : (params[1] + ".acct");
-    vault.exportAccount(params[1], output_file, true);
+    vault.exportAccount(params[1], output_file, true, getArchiveFormat(params, 3));
 
     stringstream ss;
     ss << "Account " << params[1] << " exported to " << output_file << ".";
@@ -505,7 +515,7 @@ cli::result_t cmd_exportsharedaccount(const cli::params_t& params)
     Vault vault(g_dbuser, g_dbpasswd, params[0], false);
 
     std::string output_file = params.size() > 2 ? params[2] : (params[1] + ".sharedacct");
-    vault.exportAccount(params[1], output_file, false);
+    vault.exportAccount(params[1], output_file, false, getArchiveFormat(params, 3));
 
     stringstream ss;
     ss << "Account " << params[1] << " exported to " << output_file << ".";
@@ -623,7 +633,8 @@ cli::result_t cmd_listscripts(const cli::params_t& params)
     return ss.str();
 }
 
-cli::result_t cmd_history(const cli::params_t& params)
+// Shared by history and historycsv. A page size of zero returns the whole history.
+vector<TxOutView> getHistory(Vault& vault, const cli::params_t& params, HistoryCursor& cursor, unsigned int& page_size)
 {
     std::string account_name = params.size() > 1 ? params[1] : std::string("@all");
     if (account_name == "@all") account_name = "";
@@ -632,36 +643,47 @@ cli::result_t cmd_history(const cli::params_t& params)
     if (bin_name == "@all") bin_name = "";
 
     bool hide_change = params.size() > 3 ? params[3] == "true" : true;
-    
+
+    page_size = params.size() > 4 ? strtoul(params[4].c_str(), NULL, 0) : 0;
+    if (page_size == 0) return vault.getTxOutViews(account_name, bin_name, TxOut::ROLE_BOTH, TxOut::BOTH, Tx::ALL, hide_change);
+
+    HistoryFilter filter;
+    filter.account_name = account_name;
+    filter.bin_name = bin_name;
+    filter.hide_change = hide_change;
+    cursor = HistoryCursor(params.size() > 5 ? params[5] : std::string());
+    return vault.getTxOutViewsPage(filter, cursor, page_size);
+}
+
+cli::result_t cmd_history(const cli::params_t& params)
+{
     Vault vault(g_dbuser, g_dbpasswd, params[0], false);
     CoinQ::NetworkSelector networkSelector(vault.getNetwork());
     const CoinQ::CoinParams& coinParams = networkSelector.getCoinParams();
 
     uint32_t best_height = vault.getBestHeight();
-    vector<TxOutView> txOutViews = vault.getTxOutViews(account_name, bin_name, TxOut::ROLE_BOTH, TxOut::BOTH, Tx::ALL, hide_change);
+    HistoryCursor cursor;
+    unsigned int page_size;
+    vector<TxOutView> txOutViews = getHistory(vault, params, cursor, page_size);
     stringstream ss;
     ss << formattedTxOutViewHeader();
     for (auto& txOutView: txOutViews)
         ss << endl << formattedTxOutView(txOutView, best_height, coinParams);
+    if (page_size > 0 && !cursor.isEnd())
+        ss << endl << "Resume token: " << cursor.token();
     return ss.str();
 }
 
 cli::result_t cmd_historycsv(const cli::params_t& params)
 {
-    std::string account_name = params.size() > 1 ? params[1] : std::string("@all");
-    if (account_name == "@all") account_name = "";
-
-    std::string bin_name = params.size() > 2 ? params[2] : std::string("@all");
-    if (bin_name == "@all") bin_name = "";
-
-    bool hide_change = params.size() > 3 ? params[3] == "true" : true;
-    
     Vault vault(g_dbuser, g_dbpasswd, params[0], false);
     CoinQ::NetworkSelector networkSelector(vault.getNetwork());
     const CoinQ::CoinParams& coinParams = networkSelector.getCoinParams();
 
     uint32_t best_height = vault.getBestHeight();
-    vector<TxOutView> txOutViews = vault.getTxOutViews(account_name, bin_name, TxOut::ROLE_BOTH, TxOut::BOTH, Tx::ALL, hide_change);
+    HistoryCursor cursor;
+    unsigned int page_size;
+    vector<TxOutView> txOutViews = getHistory(vault, params, cursor, page_size);
     stringstream ss;
     bool bNewLine = false;
     for (auto& txOutView: txOutViews)
@@ -670,6 +692,39 @@ cli::result_t cmd_historycsv(const cli::params_t& params)
         else            { bNewLine = true; }
         ss << formattedTxOutViewCSV(txOutView, best_height, coinParams);
     }
+    if (page_size > 0 && !cursor.isEnd())
+    {
+        // Keep the token out of the data rows so the output can be appended page by page
+        std::cerr << "Resume token: " << cursor.token() << std::endl;
+    }
+    return ss.str();
+}
+
+cli::result_t cmd_ledger(const cli::params_t& params)
+{
+    Vault vault(g_dbuser, g_dbpasswd, params[0], false);
+
+    unsigned int count = params.size() > 2 ? strtoul(params[2].c_str(), NULL, 0) : 0;
+
+    uint32_t best_height = vault.getBestHeight();
+    vector<LedgerEntryView> views = vault.getLedgerViews(params[1], count);
+    stringstream ss;
+    ss << formattedLedgerEntryViewHeader();
+    for (auto& view: views)
+        ss << endl << formattedLedgerEntryView(view, best_height);
+    return ss.str();
+}
+
+cli::result_t cmd_rebuildledger(const cli::params_t& params)
+{
+    std::string account_name = params.size() > 1 ? params[1] : std::string("@all");
+    if (account_name == "@all") account_name = "";
+
+    Vault vault(g_dbuser, g_dbpasswd, params[0], false);
+    vault.rebuildLedger(account_name);
+
+    stringstream ss;
+    ss << "Ledger rebuilt.";
     return ss.str();
 }
 
@@ -997,6 +1052,53 @@ cli::result_t cmd_createtx(const cli::params_t& params)
     return tx->toJson();
 }
 
+cli::result_t cmd_createtxfeerate(const cli::params_t& params)
+{
+    using namespace CoinQ::Script;
+    const size_t MAX_VERSION_LEN = 2;
+
+    Vault vault(g_dbuser, g_dbpasswd, params[0], false);
+
+    // Get txout ids (inputs)
+    ids_t coin_ids;
+    string coin_ids_param(params[2]);
+    boost::trim(coin_ids_param);
+    if (!coin_ids_param.empty())
+    {
+        vector<string> str_coin_ids;
+        boost::split(str_coin_ids, coin_ids_param, boost::is_any_of(","));
+        for (auto& str_coin_id: str_coin_ids)
+        {
+            boost::trim(str_coin_id);
+            if (str_coin_id.empty() || !all_of(str_coin_id.begin(), str_coin_id.end(), ::isdigit))
+                throw runtime_error("Invalid txout ids.");
+            coin_ids.push_back(strtoul(str_coin_id.c_str(), NULL, 10));
+        }
+    }
+
+    // Get outputs
+    size_t i = 3;
+    txouts_t txouts;
+    do
+    {
+        string address(params[i++]);
+        bytes_t txoutscript;
+        if (address != "change") { txoutscript = getTxOutScriptForAddress(address, BASE58_VERSIONS); }
+        uint64_t value = strtoull(params[i++].c_str(), NULL, 0);
+        std::shared_ptr<TxOut> txout(new TxOut(value, txoutscript));
+        txouts.push_back(txout);
+         
+    } while (i < (params.size() - 1) && params[i].size() > MAX_VERSION_LEN);
+
+    uint64_t fee_rate = i < params.size() ? strtoull(params[i++].c_str(), NULL, 0) : 1;
+    uint64_t min_confirmations = i < params.size() ? strtoull(params[i++].c_str(), NULL, 0) : 1;
+    uint32_t version = i < params.size() ? strtoul(params[i++].c_str(), NULL, 0) : 1;
+    uint32_t locktime = i < params.size() ? strtoul(params[i++].c_str(), NULL, 0) : 0;
+
+    std::shared_ptr<Tx> tx = vault.createTxWithFeeRate(params[1], version, locktime, coin_ids, txouts, fee_rate, min_confirmations, true);
+    return tx->toJson();
+}
+
 cli::result_t cmd_deletetx(const cli::params_t& params)
 {
     Vault vault(g_dbuser, g_dbpasswd, params[0], false);
@@ -1041,6 +1143,29 @@ cli::result_t cmd_consolidate(const cli::params_t& params)
     return ss.str();
 } 
 
+cli::result_t cmd_consolidatefeerate(const cli::params_t& params)
+{
+    using namespace CoinQ::Script;
+
+    Vault vault(g_dbuser, g_dbpasswd, params[0], false);
+    CoinQ::NetworkSelector networkSelector(vault.getNetwork());
+    const CoinQ::CoinParams& coinParams = networkSelector.getCoinParams();
+
+    string account_name(params[1]);
+    uint32_t max_tx_weight = strtoul(params[2].c_str(), NULL, 0);
+    bytes_t txoutscript = getTxOutScriptForAddress(params[3], coinParams.address_versions());
+    uint64_t fee_rate = params.size() > 4 ? strtoull(params[4].c_str(), NULL, 0) : 1;
+    uint32_t min_confirmations = params.size() > 5 ? strtoul(params[5].c_str(), NULL, 0) : 1;
+    uint32_t tx_version = params.size() > 6 ? strtoul(params[6].c_str(), NULL, 0) : 1;
+    uint32_t tx_locktime = params.size() > 7 ? strtoul(params[7].c_str(), NULL, 0) : 0;
+
+    txs_t txs = vault.consolidateTxOutsWithFeeRate(account_name, max_tx_weight, tx_version, tx_locktime, ids_t(), txoutscript, fee_rate, min_confirmations, false);
+
+    stringstream ss;
+    for (auto& tx: txs) { ss << uchar_vector(tx->raw()).getHex() << endl; }
+    return ss.str();
+} 
+
 cli::result_t cmd_signingrequest(const cli::params_t& params)
 {
     Vault vault(g_dbuser, g_dbpasswd, params[0], false);
@@ -1113,13 +1238,30 @@ cli::result_t cmd_signtx(const cli::params_t& params)
     return ss.str();
 }
 
+cli::result_t cmd_signaccounttxs(const cli::params_t& params)
+{
+    Vault vault(g_dbuser, g_dbpasswd, params[0], false);
+
+    secure_bytes_t lock_key;
+    if (params.size() > 3) { lock_key = passphraseHash(params[3]); }
+    vault.unlockKeychain(params[2], lock_key);
+
+    std::vector<std::string> keychain_names;
+    keychain_names.push_back(params[2]);
+    txs_t txs = vault.signTxs(params[1], keychain_names, true);
+
+    stringstream ss;
+    ss << "Signatures added to " << txs.size() << " transaction" << (txs.size() == 1 ? "." : "s.");
+    return ss.str();
+}
+
 cli::result_t cmd_exporttxs(const cli::params_t& params)
 {
     Vault vault(g_dbuser, g_dbpasswd, params[0], false);
 
     uint32_t minheight = params.size() > 1 ? strtoul(params[1].c_str(), NULL, 0) : 0;
     std::string output_file = params.size() > 2 ? params[2] : (params[0] + ".txs");
-    vault.exportTxs(output_file, minheight);
+    vault.exportTxs(output_file, minheight, getArchiveFormat(params, 3));
 
     stringstream ss;
     ss << "Transactions exported to " << output_file << ".";
@@ -1254,7 +1396,7 @@ cli::result_t cmd_exportmerkleblocks(const cli::params_t& params)
     Vault vault(g_dbuser, g_dbpasswd, params[0], false);
 
     std::string output_file = params.size() > 1 ? params[1] : (params[0] + ".chain");
-    vault.exportMerkleBlocks(output_file);
+    vault.exportMerkleBlocks(output_file, getArchiveFormat(params, 2));
 
     stringstream ss;
     ss << "Merkle blocks exported to " << output_file << ".";
@@ -1293,6 +1435,19 @@ cli::result_t cmd_randombytes(const cli::params_t& params)
     return bytes.getHex();
 }
 
+// Diagnostics
+cli::result_t cmd_metrics(const cli::params_t& params)
+{
+    if (params[0] == "metrics") throw std::runtime_error("Invalid command metrics.");
+
+    cli::params_t cmdparams(params.begin() + 1, params.end());
+    cli::result_t result = g_shell->exec(params[0], cmdparams);
+
+    stringstream ss;
+    ss << result << endl << endl << metrics::report();
+    return ss.str();
+}
+
 int main(int argc, char* argv[])
 {
     stringstream helpMessage;
@@ -1300,6 +1455,7 @@ int main(int argc, char* argv[])
 
     using namespace cli;
     Shell shell(helpMessage.str());
+    g_shell = &shell;
 
     // Global operations
     shell.add(command(
@@ -1323,7 +1479,7 @@ int main(int argc, char* argv[])
         "exportvault",
         "export vault contents to portable file",
         command::params(1, "db file"),
-        command::params(2, "export private keys = true", "output file = *.portable")));
+        command::params(3, "export private keys = true", "output file = *.portable", "format = text|binary|compressed")));
     shell.add(command(
         &cmd_importvault,
         "importvault",
@@ -1459,13 +1615,13 @@ int main(int argc, char* argv[])
         "exportaccount",
         "export account to file",
         command::params(2, "db file", "account name"),
-        command::params(1, "output file = *.acct")));
+        command::params(2, "output file = *.acct", "format = text|binary|compressed")));
     shell.add(command(
         &cmd_exportsharedaccount,
         "exportsharedaccount",
         "export shared account to file",
         command::params(2, "db file", "account name"),
-        command::params(1, "output file = *.sharedacct")));
+        command::params(2, "output file = *.sharedacct", "format = text|binary|compressed")));
     shell.add(command(
         &cmd_importaccount,
         "importaccount",
@@ -1499,13 +1655,25 @@ int main(int argc, char* argv[])
         "history",
         "display transaction history",
         command::params(1, "db file"),
-        command::params(3, "account name = @all", "bin name = @all", "hide change = true")));
+        command::params(5, "account name = @all", "bin name = @all", "hide change = true", "page size = 0 (all)", "resume token = newest")));
     shell.add(command(
         &cmd_historycsv,
         "historycsv",
         "display transaction history in csv format",
         command::params(1, "db file"),
-        command::params(3, "account name = @all", "bin name = @all", "hide change = true")));
+        command::params(5, "account name = @all", "bin name = @all", "hide change = true", "page size = 0 (all)", "resume token = newest")));
+    shell.add(command(
+        &cmd_ledger,
+        "ledger",
+        "display account ledger with running balances, newest first",
+        command::params(2, "db file", "account name"),
+        command::params(1, "count = 0 (all)")));
+    shell.add(command(
+        &cmd_rebuildledger,
+        "rebuildledger",
+        "recompute account ledgers from stored transactions",
+        command::params(1, "db file"),
+        command::params(1, "account name = @all")));
     shell.add(command(
         &cmd_unspent,
         "unspent",
@@ -1588,6 +1756,12 @@ int main(int argc, char* argv[])
         "create a new transaction",
         command::params(5, "db file", "account name", "txout index list", "address 1", "value 1"),
         command::params(7, "address 2", "value 2", "...", "fee = 0", "min confirmations = 1", "version = 1", "locktime = 0")));
+    shell.add(command(
+        &cmd_createtxfeerate,
+        "createtxfeerate",
+        "create a new transaction paying a fee rate in satoshis per vbyte",
+        command::params(5, "db file", "account name", "txout index list", "address 1", "value 1"),
+        command::params(7, "address 2", "value 2", "...", "fee rate = 1", "min confirmations = 1", "version = 1", "locktime = 0")));
     shell.add(command(
         &cmd_deletetx,
         "deletetx",
@@ -1599,6 +1773,12 @@ int main(int argc, char* argv[])
         "consolidate transaction outputs",
         command::params(4, "db file", "account name", "max tx size(bytes)", "address"),
         command::params(4, "min fee = 0", "min confirmations = 1", "version = 1", "locktime = 0")));
+    shell.add(command(
+        &cmd_consolidatefeerate,
+        "consolidatefeerate",
+        "consolidate transaction outputs paying a fee rate in satoshis per vbyte",
+        command::params(4, "db file", "account name", "max tx weight", "address"),
+        command::params(4, "fee rate = 1", "min confirmations = 1", "version = 1", "locktime = 0")));
     shell.add(command(
         &cmd_signingrequest,
         "signingrequest",
@@ -1610,12 +1790,18 @@ int main(int argc, char* argv[])
         "add signatures to transaction for specified keychain",
         command::params(3, "db file", "tx hash or id", "keychain name"),
         command::params(1, "passphrase")));
+    shell.add(command(
+        &cmd_signaccounttxs,
+        "signaccounttxs",
+        "add signatures to all unsigned transactions of an account for specified keychain",
+        command::params(3, "db file", "account name", "keychain name"),
+        command::params(1, "passphrase")));
     shell.add(command(
         &cmd_exporttxs,
         "exporttxs",
         "export transactions to file",
         command::params(1, "db file"),
-        command::params(2, "minheight = 0", "output file = *.txs")));
+        command::params(3, "minheight = 0", "output file = *.txs", "format = text|binary|compressed")));
     shell.add(command(
         &cmd_importtxs,
         "importtxs",
@@ -1672,7 +1858,7 @@ int main(int argc, char* argv[])
         "exportmerkleblocks",
         "export all merkle blocks to file",
         command::params(1, "db file"),
-        command::params(1, "output file = *.chain")));
+        command::params(2, "output file = *.chain", "format = text|binary|compressed")));
     shell.add(command(
         &cmd_importmerkleblocks,
         "importmerkleblocks",
@@ -1691,6 +1877,14 @@ int main(int argc, char* argv[])
         "output random bytes in hex",
         command::params(1, "length")));
 
+    // Diagnostics
+    shell.add(command(
+        &cmd_metrics,
+        "metrics",
+        "run a command, then display counters, gauges and latency histograms",
+        command::params(1, "command"),
+        command::params(3, "param 1", "param 2", "...")));
+
     try 
     {
         CoinDBConfig config;
@@ -26,21 +26,6 @@
 // TODO: Get this from a config file
 const unsigned char BASE58_VERSIONS[] = { 0x00, 0x05 };
 
-// Data formatting
-inline std::string getAddressFromScript(const bytes_t& script)
-{
-    using namespace CoinQ::Script;
-
-    payee_t payee = getScriptPubKeyPayee(script);
-    if (payee.first == SCRIPT_PUBKEY_PAY_TO_PUBKEY_HASH)
-        return toBase58Check(payee.second, BASE58_VERSIONS[0]);
-    else if (payee.first == SCRIPT_PUBKEY_PAY_TO_SCRIPT_HASH)
-        return toBase58Check(payee.second, BASE58_VERSIONS[1]);
-    else
-        return "N/A";
-}
-
-
 const int COIN_EXP = 100000000ull;
 
 ////////////
@@ -287,6 +272,49 @@ inline std::string formattedUnspentTxOutView(const CoinDB::TxOutView& view, unsi
     return ss.str();
 }
 
+// Ledger
+inline std::string formattedLedgerEntryViewHeader()
+{
+    using namespace std;
+
+    stringstream ss;
+    ss << " ";
+    ss << right << setw(6)  << "tx id" << " | "
+       << left  << setw(64) << "tx hash" << " | "
+       << left  << setw(10) << "tx status" << " | "
+       << right << setw(6)  << "confs" << " | "
+       << right << setw(16) << "delta" << " | "
+       << right << setw(16) << "confirmed" << " | "
+       << right << setw(16) << "balance";
+    ss << " ";
+
+    size_t header_length = ss.str().size();
+    ss << endl;
+    for (size_t i = 0; i < header_length; i++) { ss << "="; }
+    return ss.str();
+}
+
+inline std::string formattedLedgerEntryView(const CoinDB::LedgerEntryView& view, unsigned int best_height)
+{
+    using namespace std;
+    using namespace CoinDB;
+
+    unsigned int confirmations = view.height() == 0
+        ? 0 : best_height - view.height() + 1;
+
+    stringstream ss;
+    ss << " ";
+    ss << right << setw(6)  << view.tx_id << " | "
+       << left  << setw(64) << uchar_vector(view.hash()).getHex() << " | "
+       << left  << setw(10) << Tx::getStatusString(view.tx_status) << " | "
+       << right << setw(6)  << confirmations << " | "
+       << right << setw(16) << fixed << setprecision(8) << 1.0*view.delta/COIN_EXP << " | "
+       << right << setw(16) << fixed << setprecision(8) << 1.0*view.confirmed_balance/COIN_EXP << " | "
+       << right << setw(16) << fixed << setprecision(8) << 1.0*view.balance/COIN_EXP;
+    ss << " ";
+    return ss.str();
+}
+
 // Transactions
 inline std::string formattedTxViewHeader()
 {
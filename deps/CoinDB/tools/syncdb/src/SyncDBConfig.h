@@ -16,6 +16,8 @@
 const double DEFAULT_FILTER_FALSE_POSITIVE_RATE = 0.001;
 const uint32_t DEFAULT_FILTER_TWEAK = 0;
 const uint8_t DEFAULT_FILTER_FLAGS = 0;
+const uint32_t DEFAULT_METRICS_INTERVAL = 0;
+const unsigned int DEFAULT_IMPORT_THREADS = 0;
 
 class SyncDBConfig : public CoinDBConfig
 {
@@ -27,11 +29,25 @@ public:
     double getFilterFalsePositiveRate() const { return m_filterFalsePositiveRate; }
     uint32_t getFilterTweak() const { return m_filterTweak; }
     uint8_t getFilterFlags() const { return m_filterFlags; }
+    uint32_t getMetricsInterval() const { return m_metricsInterval; }
+    const std::string& getImportBlocksDir() const { return m_importBlocksDir; }
+    unsigned int getImportThreads() const { return m_importThreads; }
+    bool getRescan() const { return m_bRescan; }
+    const std::string& getCaptureFile() const { return m_captureFile; }
+    const std::string& getReplayFile() const { return m_replayFile; }
+    bool getReplayPacing() const { return m_bReplayPacing; }
 
 protected:
     double m_filterFalsePositiveRate;
     uint32_t m_filterTweak;
     uint8_t m_filterFlags;
+    uint32_t m_metricsInterval;
+    std::string m_importBlocksDir;
+    unsigned int m_importThreads;
+    bool m_bRescan;
+    std::string m_captureFile;
+    std::string m_replayFile;
+    bool m_bReplayPacing;
 };
 
 inline SyncDBConfig::SyncDBConfig() : CoinDBConfig()
@@ -42,6 +58,13 @@ inline SyncDBConfig::SyncDBConfig() : CoinDBConfig()
         ("filterfpr", po::value<double>(&m_filterFalsePositiveRate), "filter false positive rate")
         ("filtertweak", po::value<uint32_t>(&m_filterTweak), "filter tweak")
         ("filterflags", po::value<uint8_t>(&m_filterFlags), "filter flags")
+        ("metricsinterval", po::value<uint32_t>(&m_metricsInterval), "seconds between metrics dumps, 0 to disable")
+        ("importblocks", po::value<std::string>(&m_importBlocksDir), "import from a bitcoin core blocks directory instead of connecting to a peer")
+        ("importthreads", po::value<unsigned int>(&m_importThreads), "block parser threads for importblocks and rescan, 0 for one per core")
+        ("rescan", "download full blocks from the peer and match them locally instead of a filtered sync, resuming from <dbname>.rescan")
+        ("capture", po::value<std::string>(&m_captureFile), "record all peer traffic to a file for replay")
+        ("replay", po::value<std::string>(&m_replayFile), "benchmark a sync against a file recorded with capture instead of connecting to a peer")
+        ("replaypacing", "replay messages at their recorded times instead of as fast as possible")
     ;
 }
 
@@ -52,6 +75,10 @@ inline bool SyncDBConfig::parseParams(int argc, char* argv[])
     if (!m_vm.count("filterfpr"))   { m_filterFalsePositiveRate = DEFAULT_FILTER_FALSE_POSITIVE_RATE; }
     if (!m_vm.count("filtertweak")) { m_filterTweak = DEFAULT_FILTER_TWEAK; }
     if (!m_vm.count("filterflags")) { m_filterFlags = DEFAULT_FILTER_FLAGS; }
+    if (!m_vm.count("metricsinterval")) { m_metricsInterval = DEFAULT_METRICS_INTERVAL; }
+    if (!m_vm.count("importthreads")) { m_importThreads = DEFAULT_IMPORT_THREADS; }
+    m_bRescan = m_vm.count("rescan") > 0;
+    m_bReplayPacing = m_vm.count("replaypacing") > 0;
 
     return true;
 }
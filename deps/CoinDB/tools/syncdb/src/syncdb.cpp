@@ -15,16 +15,28 @@
 
 #include <SynchedVault.h>
 
+#include <CoinQ/BlockchainRescan.h>
+#include <CoinQ/CoinQ_blockfile.h>
 #include <CoinQ/CoinQ_coinparams.h>
+#include <CoinQ/CoinQ_peer_capture.h>
 
 #include <logger/logger.h>
+#include <logger/metrics.h>
 #include <stdutils/stringutils.h>
 
 #include <iostream>
+#include <iomanip>
 #include <signal.h>
 
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <thread>
 #include <chrono>
+#include <mutex>
 
 using namespace CoinDB;
 using namespace CoinQ;
@@ -74,6 +86,14 @@ void subscribeHandlers(SynchedVault& synchedVault)
         cout << ss.str() << endl;
     });
 
+    synchedVault.subscribeReorg([](uint32_t height, const std::vector<unsigned long>& txIds, const std::vector<bytes_t>& /*txHashes*/)
+    {
+        stringstream ss;
+        ss << "Reorganization: blocks from height " << height << " removed, " << txIds.size() << " transaction(s) unconfirmed";
+        LOGGER(info) << ss.str() << endl;
+        cout << ss.str() << endl;
+    });
+
     synchedVault.subscribeTxInsertionError([](std::shared_ptr<Tx> tx, const std::string& description)
     {
         stringstream ss;
@@ -131,6 +151,377 @@ void subscribeHandlers(SynchedVault& synchedVault)
     });
 }
 
+// Offline import from a Bitcoin Core blocks directory. Blocks after the vault's best block are
+// read from the block files and inserted in batches, and any new headers are saved to the block tree.
+int importBlockFiles(const CoinParams& coinParams, const SyncDBConfig& config, const string& dbname, const string& blocktreefile)
+{
+    Vault vault;
+    CoinQBlockTreeMem blockTree;
+
+    try
+    {
+        cout << "Opening coin database " << dbname << endl;
+        LOGGER(info) << "Opening coin database " << dbname << endl;
+        vault.open(config.getDatabaseUser(), config.getDatabasePassword(), dbname);
+
+        uint32_t startTime = vault.getMaxFirstBlockTimestamp();
+        if (startTime == 0)
+        {
+            cout << "No accounts to import blocks for." << endl;
+            return 0;
+        }
+
+        cout << "Loading block tree " << blocktreefile << "..." << endl;
+        LOGGER(info) << "Loading block tree " << blocktreefile << endl;
+        try
+        {
+            blockTree.loadFromFile(blocktreefile, false, [&](const CoinQBlockTreeMem& /*blockTree*/) { return !g_bShutdown; });
+        }
+        catch (const BlockTreeLoadInterruptedException&)
+        {
+            throw;
+        }
+        catch (const exception& e)
+        {
+            LOGGER(info) << "Starting a new block tree: " << e.what() << endl;
+            blockTree.clear();
+            blockTree.setGenesisBlock(coinParams.genesis_block());
+        }
+
+        BlockFileImporter importer(blockTree, coinParams.magic_bytes(), config.getImportThreads());
+
+        cout << "Indexing block files in " << config.getImportBlocksDir() << "..." << endl;
+        LOGGER(info) << "Indexing block files in " << config.getImportBlocksDir() << endl;
+        importer.index(config.getImportBlocksDir());
+        if (importer.getStats().headersAdded > 0)
+        {
+            cout << "Saving " << importer.getStats().headersAdded << " new header(s) to " << blocktreefile << endl;
+            blockTree.flushToFile(blocktreefile);
+        }
+        cout << "  " << importer.getStats().blocksIndexed << " block(s) in " << importer.getStats().files << " file(s). Best height: " << blockTree.getBestHeight() << endl;
+
+        // Same starting point as SynchedVault::syncBlocks().
+        int startHeight = -1;
+        for (auto& hash: vault.getLocatorHashes())
+        {
+            if (blockTree.hasHeader(hash) && blockTree.getHeader(hash).inBestChain)
+            {
+                startHeight = blockTree.getHeader(hash).height + 1;
+                break;
+            }
+        }
+        if (startHeight == -1) { startHeight = blockTree.getHeaderBefore(startTime).height; }
+
+        int endHeight = importer.getLastContiguousHeight(startHeight);
+        if (endHeight < startHeight)
+        {
+            cout << "Nothing to import from height " << startHeight << "." << endl;
+            return 0;
+        }
+
+        std::vector<bytes_t> scripts;
+        std::vector<Coin::OutPoint> outpoints;
+        vault.getCompactFilterElements(scripts, outpoints);
+        importer.setFilterScripts(scripts, outpoints);
+
+        cout << "Importing blocks " << startHeight << " to " << endHeight << "..." << endl;
+        LOGGER(info) << "Importing blocks " << startHeight << " to " << endHeight << endl;
+
+        std::vector<Vault::chain_merkle_block_txs_t> batch;
+        unsigned int txcount = 0;
+        int lastHeight = importer.import(startHeight, endHeight,
+            [&](const ChainMerkleBlock& merkleblock, const std::vector<Coin::Transaction>& txs)
+            {
+                batch.push_back(std::make_pair(merkleblock, txs));
+                if (batch.size() < Vault::ARCHIVE_BATCH_SIZE) return;
+
+                txcount += vault.insertMerkleBlocks(batch);
+                batch.clear();
+                cout << "  height: " << merkleblock.height << " transactions: " << txcount << endl;
+            },
+            [&](int /*height*/) { return !g_bShutdown; });
+        txcount += vault.insertMerkleBlocks(batch);
+
+        stringstream ss;
+        ss << "Imported blocks " << startHeight << " to " << lastHeight << ". Transactions inserted or updated: " << txcount;
+        LOGGER(info) << ss.str() << endl;
+        cout << ss.str() << endl;
+        if (g_bShutdown) { cout << "Interrupted." << endl; }
+    }
+    catch (const std::exception& e)
+    {
+        LOGGER(error) << "Error: " << e.what() << endl;
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Full-block rescan from a peer, for audits. Starts from the block before the vault's earliest account,
+// or from the checkpoint in <dbname>.rescan. Blocks are inserted from this thread once a second, and
+// each batch is acknowledged once committed so the checkpoint never gets ahead of the vault.
+int rescanBlocks(const CoinParams& coinParams, const SyncDBConfig& config, const string& dbname, const string& blocktreefile, const string& host, const string& port)
+{
+    Vault vault;
+    std::mutex batchMutex;
+    std::vector<Vault::chain_merkle_block_txs_t> batch;
+    unsigned int reorgs = 0;
+    Network::BlockchainRescan rescan(coinParams, config.getImportThreads());
+
+    rescan.subscribeBlock([&](const ChainMerkleBlock& merkleblock, const std::vector<Coin::Transaction>& txs)
+    {
+        std::lock_guard<std::mutex> lock(batchMutex);
+        batch.push_back(std::make_pair(merkleblock, txs));
+    });
+
+    // Blocks above the fork that were already inserted are replaced by the vault when the new branch arrives.
+    rescan.subscribeReorg([&](int height, const uchar_vector& hash)
+    {
+        {
+            std::lock_guard<std::mutex> lock(batchMutex);
+            batch.erase(std::remove_if(batch.begin(), batch.end(), [&](const Vault::chain_merkle_block_txs_t& block) { return block.first.height > height; }), batch.end());
+            reorgs++;
+        }
+
+        stringstream ss;
+        ss << "Reorganization: rescanning from block " << hash.getHex() << " height: " << height;
+        LOGGER(info) << ss.str() << endl;
+        cout << ss.str() << endl;
+    });
+
+    rescan.subscribeError([](const string& error, int /*code*/)
+    {
+        LOGGER(error) << "Rescan error: " << error << endl;
+        cout << "Rescan error: " << error << endl;
+        g_bShutdown = true;
+    });
+
+    rescan.getDownload().subscribeClose([]()
+    {
+        cout << "Peer connection closed." << endl;
+        g_bShutdown = true;
+    });
+
+    rescan.getDownload().subscribeConnectionError([](const string& error, int /*code*/)
+    {
+        LOGGER(error) << "Connection error: " << error << endl;
+        cout << "Connection error: " << error << endl;
+        g_bShutdown = true;
+    });
+
+    unsigned int txcount = 0;
+    auto insertBatch = [&]()
+    {
+        std::vector<Vault::chain_merkle_block_txs_t> blocks;
+        unsigned int batchReorgs;
+        {
+            std::lock_guard<std::mutex> lock(batchMutex);
+            blocks.swap(batch);
+            batchReorgs = reorgs;
+        }
+        if (blocks.empty()) return;
+
+        txcount += vault.insertMerkleBlocks(blocks);
+        cout << "  height: " << blocks.back().first.height << " transactions: " << txcount << endl;
+
+        // Blocks orphaned while they were being inserted must not be acknowledged.
+        std::lock_guard<std::mutex> lock(batchMutex);
+        if (reorgs == batchReorgs) { rescan.acknowledge(blocks.back().first.height); }
+    };
+
+    try
+    {
+        cout << "Opening coin database " << dbname << endl;
+        LOGGER(info) << "Opening coin database " << dbname << endl;
+        vault.open(config.getDatabaseUser(), config.getDatabasePassword(), dbname);
+
+        uint32_t startTime = vault.getMaxFirstBlockTimestamp();
+        if (startTime == 0)
+        {
+            cout << "No accounts to rescan for." << endl;
+            return 0;
+        }
+
+        // Without headers there is no telling which block comes before the accounts, so start after genesis.
+        uchar_vector startHash;
+        int startHeight = 0;
+        {
+            CoinQBlockTreeMem blockTree;
+            cout << "Loading block tree " << blocktreefile << "..." << endl;
+            LOGGER(info) << "Loading block tree " << blocktreefile << endl;
+            try
+            {
+                blockTree.loadFromFile(blocktreefile, false, [&](const CoinQBlockTreeMem& /*blockTree*/) { return !g_bShutdown; });
+                const ChainHeader& header = blockTree.getHeaderBefore(startTime);
+                if (header.height > 0)
+                {
+                    startHash = header.prevBlockHash();
+                    startHeight = header.height - 1;
+                }
+            }
+            catch (const BlockTreeLoadInterruptedException&)
+            {
+                cout << "Interrupted." << endl;
+                return 0;
+            }
+            catch (const exception& e)
+            {
+                LOGGER(info) << "Rescanning from the genesis block: " << e.what() << endl;
+                cout << "Rescanning from the genesis block: " << e.what() << endl;
+            }
+        }
+
+        std::vector<bytes_t> scripts;
+        std::vector<Coin::OutPoint> outpoints;
+        vault.getCompactFilterElements(scripts, outpoints);
+        rescan.setFilterScripts(scripts, outpoints);
+        rescan.setCheckpointFile(dbname + ".rescan", Network::BlockchainRescan::DEFAULT_CHECKPOINT_INTERVAL, true);
+
+        cout << "Connecting to " << host << ":" << port << endl;
+        LOGGER(info) << "Connecting to " << host << ":" << port << endl;
+        rescan.start(host, port, startHash, startHeight);
+        cout << "Rescanning blocks after height " << rescan.getHeight() << "..." << endl;
+
+        while (!g_bShutdown)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            insertBatch();
+        }
+
+        // Blocks passed on before stopping can still be acknowledged.
+        rescan.stop();
+        insertBatch();
+
+        stringstream ss;
+        ss << "Rescanned to height " << rescan.getHeight() << ". Transactions inserted or updated: " << txcount;
+        LOGGER(info) << ss.str() << endl;
+        cout << ss.str() << endl;
+    }
+    catch (const std::exception& e)
+    {
+        LOGGER(error) << "Error: " << e.what() << endl;
+        cerr << "Error: " << e.what() << endl;
+        rescan.stop();
+        return 1;
+    }
+
+    return 0;
+}
+
+// Peak resident set size in kilobytes, or 0 where not available.
+uint64_t getPeakRSS()
+{
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__) && defined(__MACH__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// Sync benchmark against traffic recorded with --capture, played back by a local stand-in peer.
+// For comparable runs, start each one from copies of the vault and headers file as they were when
+// the capture was made. The clock stops at the last header, merkle block or transaction handled.
+int replaySync(const CoinParams& coinParams, const SyncDBConfig& config, const string& dbname, const string& blocktreefile)
+{
+    const std::chrono::seconds IDLE_TIMEOUT(2);
+
+    SynchedVault synchedVault(coinParams);
+    std::atomic<uint64_t> txsInserted(0);
+    synchedVault.subscribeTxInserted([&](std::shared_ptr<Tx> /*tx*/) { txsInserted++; });
+    synchedVault.subscribeStatusChanged([](SynchedVault::status_t status) { if (status == SynchedVault::STOPPED) { g_bShutdown = true; } });
+    synchedVault.subscribeConnectionError([](const string& error, int /*code*/) { cout << "Connection error: " << error << endl; });
+    synchedVault.subscribeProtocolError([](const string& error, int /*code*/) { cout << "Protocol error: " << error << endl; });
+    synchedVault.subscribeBlockTreeError([](const string& error, int /*code*/) { cout << "Blocktree error: " << error << endl; });
+
+    try
+    {
+        cout << "Loading capture " << config.getReplayFile() << endl;
+        PeerReplay replay(config.getReplayFile(), config.getReplayPacing());
+        cout << "  " << replay.getMessageCount() << " inbound message(s)." << endl;
+
+        cout << "Opening coin database " << dbname << endl;
+        LOGGER(info) << "Opening coin database " << dbname << endl;
+        synchedVault.openVault(config.getDatabaseUser(), config.getDatabasePassword(), dbname);
+
+        cout << "Loading block tree " << blocktreefile << "..." << endl;
+        LOGGER(info) << "Loading block tree " << blocktreefile << endl;
+        synchedVault.loadHeaders(blocktreefile, false, [&](const CoinQBlockTreeMem& /*blockTree*/) { return !g_bShutdown; });
+        if (g_bShutdown)
+        {
+            cout << "Interrupted." << endl;
+            return 0;
+        }
+
+        metrics::counter& headers = metrics::get_counter("sync.headers");
+        metrics::counter& merkleblocks = metrics::get_counter("sync.merkleblocks");
+        metrics::reset();
+
+        replay.start();
+        cout << "Replaying" << (config.getReplayPacing() ? " at recorded pacing" : "") << "..." << endl;
+        LOGGER(info) << "Replaying " << config.getReplayFile() << " on port " << replay.getPort() << endl;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point lastActivity = start;
+        uint64_t activity = 0;
+        synchedVault.startSync("127.0.0.1", (int)replay.getPort());
+
+        while (!g_bShutdown)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            uint64_t newActivity = headers.value() + merkleblocks.value() + txsInserted;
+            if (newActivity != activity)
+            {
+                activity = newActivity;
+                lastActivity = now;
+            }
+            else if (replay.done() && now - lastActivity >= IDLE_TIMEOUT)
+            {
+                break;
+            }
+        }
+
+        synchedVault.stopSync();
+        replay.stop();
+
+        double seconds = std::max(std::chrono::duration_cast<std::chrono::microseconds>(lastActivity - start).count() / 1000000.0, 0.000001);
+        PeerReplay::Stats stats = replay.getStats();
+        uint64_t txs = txsInserted;
+
+        stringstream ss;
+        ss << fixed << setprecision(1)
+           << endl << "Replay Results" << endl
+           << "-------------------------------------------" << endl
+           << "  elapsed:          " << setprecision(3) << seconds << " s" << setprecision(1) << endl
+           << "  messages:         " << stats.messagesSent << " / " << replay.getMessageCount() << " (" << stats.stalls << " stall(s))" << endl
+           << "  headers:          " << headers.value() << " (" << headers.value() / seconds << "/s)" << endl
+           << "  merkle blocks:    " << merkleblocks.value() << " (" << merkleblocks.value() / seconds << "/s)" << endl
+           << "  txs inserted:     " << txs << " (" << txs / seconds << "/s)" << endl
+           << "  peak rss:         " << getPeakRSS() << " kB" << endl;
+        if (g_bShutdown) { ss << "  interrupted" << endl; }
+
+        LOGGER(info) << ss.str() << endl << metrics::report() << endl;
+        cout << ss.str() << endl;
+    }
+    catch (const std::exception& e)
+    {
+        LOGGER(error) << "Error: " << e.what() << endl;
+        cerr << "Error: " << e.what() << endl;
+        synchedVault.stopSync();
+        return 1;
+    }
+
+    return 0;
+}
+
 int main(int argc, char* argv[])
 {
     SyncDBConfig config;
@@ -144,10 +535,14 @@ int main(int argc, char* argv[])
             return 0;
         }
 
-        if (argc < 4)
+        bool bOffline = !config.getImportBlocksDir().empty() || !config.getReplayFile().empty();
+        if (argc < (bOffline ? 3 : 4))
         {
             cerr << "SyncDB by Eric Lombrozo " << VERSION_INFO << endl
                  << "# Usage: " << argv[0] << " <network> <dbname> <host> [port]" << endl
+                 << "#        " << argv[0] << " <network> <dbname> <host> [port] --rescan" << endl
+                 << "#        " << argv[0] << " <network> <dbname> --importblocks=<bitcoin core blocks directory>" << endl
+                 << "#        " << argv[0] << " <network> <dbname> --replay=<capture file>" << endl
                  << "# Supported networks: " << stdutils::delimited_list(networkSelector.getNetworkNames(), ", ") << endl
                  << "# Use " << argv[0] << " --help for more options." << endl;
             return -1;
@@ -164,8 +559,6 @@ int main(int argc, char* argv[])
     const CoinParams& coinParams = networkSelector.getCoinParams();
 
     string dbname = argv[2];
-    string host = argv[3];
-    string port = argc > 4 ? argv[4] : coinParams.default_port();
 
     string logfile = config.getDataDir() + "/syncdb.log";    
     INIT_LOGGER(logfile.c_str());
@@ -175,6 +568,14 @@ int main(int argc, char* argv[])
     signal(SIGINT, &finish);
     signal(SIGTERM, &finish);
 
+    if (!config.getImportBlocksDir().empty()) return importBlockFiles(coinParams, config, dbname, blocktreefile);
+    if (!config.getReplayFile().empty()) return replaySync(coinParams, config, dbname, blocktreefile);
+
+    string host = argv[3];
+    string port = argc > 4 ? argv[4] : coinParams.default_port();
+
+    if (config.getRescan()) return rescanBlocks(coinParams, config, dbname, blocktreefile, host, port);
+
     LOGGER(trace) << "foo" << endl;
     SynchedVault synchedVault(coinParams);
     LOGGER(trace) << "bar" << endl;
@@ -214,6 +615,12 @@ int main(int argc, char* argv[])
         LOGGER(info) << ss.str() << endl;
         cout << ss.str() << endl;
 
+        if (!config.getCaptureFile().empty())
+        {
+            cout << "Capturing peer traffic to " << config.getCaptureFile() << endl;
+            synchedVault.setCaptureFile(config.getCaptureFile());
+        }
+
         cout << "Connecting to " << host << ":" << port << endl;
         LOGGER(info) << "Connecting to " << host << ":" << port << endl;
         synchedVault.startSync(host, port);
@@ -226,7 +633,25 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    while (!g_bShutdown) { std::this_thread::sleep_for(std::chrono::microseconds(200)); }
+    // Each dump covers the interval since the previous one
+    std::chrono::seconds metricsInterval(config.getMetricsInterval());
+    std::chrono::steady_clock::time_point nextMetricsDump = std::chrono::steady_clock::now() + metricsInterval;
+    metrics::reset();
+
+    while (!g_bShutdown)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+        if (metricsInterval.count() && std::chrono::steady_clock::now() >= nextMetricsDump)
+        {
+            std::string report = metrics::report();
+            metrics::reset();
+            nextMetricsDump += metricsInterval;
+
+            LOGGER(info) << "Metrics" << endl << report << endl;
+            cout << endl << "Metrics" << endl << report << endl << endl;
+        }
+    }
 
     synchedVault.stopSync();
 
@@ -0,0 +1,91 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// VaultBenchConfig.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include <CoinDBConfig.h>
+
+const unsigned int DEFAULT_KEYCHAINS = 3;
+const unsigned int DEFAULT_ACCOUNTS = 10;
+const unsigned int DEFAULT_MINSIGS = 2;
+const uint32_t DEFAULT_POOL_SIZE = 1000;
+const uint32_t DEFAULT_BLOCKS = 10000;
+const unsigned int DEFAULT_TXS_PER_BLOCK = 10;
+const unsigned int DEFAULT_ITERATIONS = 100;
+const unsigned int DEFAULT_EXPORT_ITERATIONS = 3;
+const unsigned int DEFAULT_PAGE_SIZE = 100;
+
+class VaultBenchConfig : public CoinDBConfig
+{
+public:
+    VaultBenchConfig();
+
+    bool parseParams(int argc, char* argv[]);
+
+    unsigned int getKeychains() const { return m_keychains; }
+    unsigned int getAccounts() const { return m_accounts; }
+    unsigned int getMinSigs() const { return m_minSigs; }
+    uint32_t getPoolSize() const { return m_poolSize; }
+    uint32_t getBlocks() const { return m_blocks; }
+    unsigned int getTxsPerBlock() const { return m_txsPerBlock; }
+    unsigned int getIterations() const { return m_iterations; }
+    unsigned int getExportIterations() const { return m_exportIterations; }
+    unsigned int getPageSize() const { return m_pageSize; }
+    const std::string& getOutFile() const { return m_outFile; }
+
+protected:
+    unsigned int m_keychains;
+    unsigned int m_accounts;
+    unsigned int m_minSigs;
+    uint32_t m_poolSize;
+    uint32_t m_blocks;
+    unsigned int m_txsPerBlock;
+    unsigned int m_iterations;
+    unsigned int m_exportIterations;
+    unsigned int m_pageSize;
+    std::string m_outFile;
+};
+
+inline VaultBenchConfig::VaultBenchConfig() : CoinDBConfig()
+{
+    namespace po = boost::program_options;
+
+    m_options.add_options()
+        ("keychains", po::value<unsigned int>(&m_keychains), "generate: keychains, all of which sign for every account")
+        ("accounts", po::value<unsigned int>(&m_accounts), "generate: multisig accounts")
+        ("minsigs", po::value<unsigned int>(&m_minSigs), "generate: signatures required by each account")
+        ("pool", po::value<uint32_t>(&m_poolSize), "generate: unused script pool size of each account bin")
+        ("blocks", po::value<uint32_t>(&m_blocks), "generate: confirmed merkle blocks")
+        ("txsperblock", po::value<unsigned int>(&m_txsPerBlock), "generate: transactions paying to the vault in each block")
+        ("iterations", po::value<unsigned int>(&m_iterations), "run: calls timed for each operation")
+        ("exportiterations", po::value<unsigned int>(&m_exportIterations), "run: calls timed for exportVault, which is slow on large vaults")
+        ("pagesize", po::value<unsigned int>(&m_pageSize), "run: transactions fetched by each getTxViews call")
+        ("out", po::value<std::string>(&m_outFile), "run: write results as JSON to a file instead of stdout")
+    ;
+}
+
+inline bool VaultBenchConfig::parseParams(int argc, char* argv[])
+{
+    if (!CoinDBConfig::parseParams(argc, argv)) return false;
+
+    if (!m_vm.count("keychains"))   { m_keychains = DEFAULT_KEYCHAINS; }
+    if (!m_vm.count("accounts"))    { m_accounts = DEFAULT_ACCOUNTS; }
+    if (!m_vm.count("minsigs"))     { m_minSigs = DEFAULT_MINSIGS; }
+    if (!m_vm.count("pool"))        { m_poolSize = DEFAULT_POOL_SIZE; }
+    if (!m_vm.count("blocks"))      { m_blocks = DEFAULT_BLOCKS; }
+    if (!m_vm.count("txsperblock")) { m_txsPerBlock = DEFAULT_TXS_PER_BLOCK; }
+    if (!m_vm.count("iterations"))  { m_iterations = DEFAULT_ITERATIONS; }
+    if (!m_vm.count("exportiterations")) { m_exportIterations = DEFAULT_EXPORT_ITERATIONS; }
+    if (!m_vm.count("pagesize"))    { m_pageSize = DEFAULT_PAGE_SIZE; }
+
+    if (m_minSigs == 0 || m_minSigs > m_keychains) throw std::runtime_error("minsigs must be between 1 and keychains.");
+
+    return true;
+}
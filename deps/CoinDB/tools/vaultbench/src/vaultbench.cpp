@@ -0,0 +1,398 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// vaultbench.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// Generates large synthetic vaults and times the vault operations that matter
+// most to syncing and wallet use against them.
+//
+// generate creates a new vault with multisig accounts and fills it with
+// confirmed transactions paying to them, going through the same batch insertion
+// path as syncdb --importblocks. run then times each operation and reports
+// latency percentiles. run inserts and removes blocks and transactions, so
+// point it at a copy of a generated vault to keep results comparable.
+//
+
+#include "VaultBenchConfig.h"
+
+#include <Vault.h>
+
+#include <CoinCore/MerkleTree.h>
+#include <CoinQ/CoinQ_blocks.h>
+
+#include <logger/logger.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <signal.h>
+
+using namespace CoinDB;
+using namespace CoinQ;
+using namespace std;
+
+const std::string VERSION_INFO = "v0.1.0";
+
+const uint32_t BLOCK_INTERVAL = 600;
+const uint32_t BLOCK_BITS = 0x1d00ffff;
+
+// Leaves per merkle block for each of our transactions, so partial trees look
+// like they would for a filtered block.
+const unsigned int LEAVES_PER_TX = 4;
+
+bool g_bShutdown = false;
+
+void finish(int sig)
+{
+    LOGGER(debug) << "Stopping..." << endl;
+    g_bShutdown = true;
+}
+
+namespace
+{
+
+// Fixed seed so that generated vaults with the same options have the same contents.
+std::mt19937_64 g_rng(0x5eed);
+
+bytes_t randomBytes(size_t size)
+{
+    bytes_t data(size);
+    for (auto& byte: data) { byte = (unsigned char)g_rng(); }
+    return data;
+}
+
+bytes_t randomPayToPubKeyHashScript()
+{
+    uchar_vector script("76a914");
+    script += randomBytes(20);
+    script += uchar_vector("88ac");
+    return script;
+}
+
+// A transaction from someone else paying to one of our scripts, with change
+// going back to them.
+Coin::Transaction incomingTx(const bytes_t& txoutscript)
+{
+    Coin::Transaction tx;
+    tx.inputs.push_back(Coin::TxIn(Coin::OutPoint(randomBytes(32), g_rng() % 4), randomBytes(107), 0xffffffff));
+    tx.outputs.push_back(Coin::TxOut(100000 + g_rng() % 10000000, txoutscript));
+    tx.outputs.push_back(Coin::TxOut(100000 + g_rng() % 10000000, randomPayToPubKeyHashScript()));
+    return tx;
+}
+
+// Our transactions in a block with as many other leaves.
+ChainMerkleBlock merkleBlock(const std::vector<Coin::Transaction>& txs, const uchar_vector& prevhash, uint32_t height, uint32_t timestamp)
+{
+    std::vector<uchar_vector> txhashes;
+    for (auto& tx: txs) { txhashes.push_back(tx.hash()); }
+
+    unsigned int nTxs = std::max<size_t>(1, txs.size() * LEAVES_PER_TX);
+    Coin::MerkleBlock coinmerkleblock(Coin::randomPartialMerkleTree(txhashes, nTxs), 2, prevhash, timestamp, BLOCK_BITS, g_rng());
+    return ChainMerkleBlock(coinmerkleblock, true, height, 0);
+}
+
+std::vector<bytes_t> getTxOutScripts(const Vault& vault)
+{
+    std::vector<bytes_t> scripts;
+    for (auto& view: vault.getSigningScriptViews("", "", SigningScript::ALL)) { scripts.push_back(view.txoutscript); }
+    if (scripts.empty()) throw runtime_error("Vault has no scripts.");
+    return scripts;
+}
+
+double elapsedSeconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+}
+
+}
+
+int generate(const VaultBenchConfig& config, const string& dbname)
+{
+    try
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        cout << "Creating vault " << dbname << endl;
+        Vault vault(config.getDatabaseUser(), config.getDatabasePassword(), dbname, true, SCHEMA_VERSION, config.getNetworkName());
+
+        std::vector<string> keychainNames;
+        for (unsigned int i = 1; i <= config.getKeychains(); i++)
+        {
+            stringstream name;
+            name << "keychain" << i;
+            vault.newKeychain(name.str(), randomBytes(32));
+            keychainNames.push_back(name.str());
+        }
+
+        for (unsigned int i = 1; i <= config.getAccounts(); i++)
+        {
+            stringstream name;
+            name << "account" << i;
+            cout << "Creating " << name.str() << " (" << config.getMinSigs() << " of " << keychainNames.size() << ", pool: " << config.getPoolSize() << ")" << endl;
+            vault.newAccount(name.str(), config.getMinSigs(), keychainNames, config.getPoolSize());
+        }
+
+        std::vector<bytes_t> scripts = getTxOutScripts(vault);
+        cout << "Scripts: " << scripts.size() << endl;
+
+        // The first block must be old enough for the accounts. Heights start at 1 since
+        // the vault does not take a genesis block.
+        uint32_t timestamp = vault.getMaxFirstBlockTimestamp();
+        uchar_vector prevhash = randomBytes(32);
+        size_t nextScript = 0;
+        uint64_t txcount = 0;
+
+        std::vector<Vault::chain_merkle_block_txs_t> batch;
+        for (uint32_t height = 1; height <= config.getBlocks() && !g_bShutdown; height++)
+        {
+            std::vector<Coin::Transaction> txs;
+            for (unsigned int i = 0; i < config.getTxsPerBlock(); i++) { txs.push_back(incomingTx(scripts[nextScript++ % scripts.size()])); }
+
+            ChainMerkleBlock chainmerkleblock = merkleBlock(txs, prevhash, height, timestamp);
+            prevhash = chainmerkleblock.blockHeader.hash();
+            timestamp += BLOCK_INTERVAL;
+            batch.push_back(Vault::chain_merkle_block_txs_t(chainmerkleblock, txs));
+
+            if (batch.size() == Vault::ARCHIVE_BATCH_SIZE || height == config.getBlocks())
+            {
+                txcount += vault.insertMerkleBlocks(batch);
+                batch.clear();
+                cout << "  height: " << height << " txs: " << txcount << " elapsed: " << fixed << setprecision(1) << elapsedSeconds(start) << "s" << endl;
+            }
+        }
+
+        if (g_bShutdown)
+        {
+            cout << "Interrupted." << endl;
+            return 0;
+        }
+
+        double seconds = elapsedSeconds(start);
+        cout << "Done. " << config.getBlocks() << " blocks and " << txcount << " transactions in " << fixed << setprecision(1) << seconds << "s";
+        if (seconds > 0) { cout << " (" << setprecision(0) << txcount / seconds << " txs/s)"; }
+        cout << endl;
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+namespace
+{
+
+struct Result
+{
+    string name;
+    std::vector<uint64_t> micros; // sorted
+};
+
+std::vector<Result> g_results;
+
+void timeOperation(const string& name, unsigned int iterations, std::function<void(unsigned int)> op)
+{
+    if (iterations == 0 || g_bShutdown) return;
+
+    Result result;
+    result.name = name;
+    for (unsigned int i = 0; i < iterations && !g_bShutdown; i++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        op(i);
+        result.micros.push_back(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(result.micros.begin(), result.micros.end());
+    g_results.push_back(result);
+
+    cerr << "  " << left << setw(32) << name << right << setw(8) << result.micros.size() << " calls" << setw(12) << result.micros[result.micros.size() / 2] << " us p50" << endl;
+}
+
+uint64_t percentile(const std::vector<uint64_t>& sorted, unsigned int p)
+{
+    size_t i = (sorted.size() * p + 99) / 100;
+    return sorted[std::min(sorted.size(), std::max<size_t>(i, 1)) - 1];
+}
+
+void writeResults(ostream& os)
+{
+    os << "{" << endl << "    \"benchmarks\": [" << endl;
+    for (size_t i = 0; i < g_results.size(); i++)
+    {
+        const Result& result = g_results[i];
+        uint64_t total = 0;
+        for (auto micros: result.micros) { total += micros; }
+
+        os << "        { \"name\": \"" << result.name << "\", \"iterations\": " << result.micros.size()
+           << ", \"mean_us\": " << fixed << setprecision(1) << (double)total / result.micros.size()
+           << ", \"p50_us\": " << percentile(result.micros, 50)
+           << ", \"p90_us\": " << percentile(result.micros, 90)
+           << ", \"p99_us\": " << percentile(result.micros, 99)
+           << ", \"max_us\": " << result.micros.back()
+           << " }" << (i + 1 < g_results.size() ? "," : "") << endl;
+    }
+    os << "    ]" << endl << "}" << endl;
+}
+
+}
+
+int run(const VaultBenchConfig& config, const string& dbname)
+{
+    try
+    {
+        cerr << "Opening vault " << dbname << endl;
+        Vault vault(config.getDatabaseUser(), config.getDatabasePassword(), dbname);
+
+        std::vector<string> accountNames;
+        for (auto& info: vault.getAllAccountInfo()) { accountNames.push_back(info.name()); }
+        if (accountNames.empty()) throw runtime_error("Vault has no accounts.");
+
+        std::vector<bytes_t> scripts = getTxOutScripts(vault);
+        std::shared_ptr<BlockHeader> bestHeader = vault.getBestBlockHeader();
+        if (!bestHeader) throw runtime_error("Vault has no blocks.");
+
+        unsigned int iterations = config.getIterations();
+        cerr << "Running benchmarks..." << endl;
+
+        // Reads
+        timeOperation("getBloomFilter", iterations, [&](unsigned int)
+        {
+            vault.getBloomFilter(0.001, 0, 0);
+        });
+
+        timeOperation("getUnspentTxOutViews", iterations, [&](unsigned int i)
+        {
+            vault.getUnspentTxOutViews(accountNames[i % accountNames.size()]);
+        });
+
+        timeOperation("getTxViews.page", iterations, [&](unsigned int i)
+        {
+            vault.getTxViews(Tx::ALL, (unsigned long)i * config.getPageSize(), config.getPageSize());
+        });
+
+        timeOperation("getTxViews.all", config.getExportIterations(), [&](unsigned int)
+        {
+            vault.getTxViews(Tx::ALL);
+        });
+
+        // Unsigned and never inserted, so the vault is left as it was.
+        timeOperation("createTx", iterations, [&](unsigned int i)
+        {
+            txouts_t txouts;
+            txouts.push_back(std::make_shared<TxOut>(10000, randomPayToPubKeyHashScript()));
+            vault.createTx(accountNames[i % accountNames.size()], 1, 0, txouts, 10000);
+        });
+
+        string exportFile = config.getDataDir() + "/vaultbench_export.tmp";
+        timeOperation("exportVault.binary", config.getExportIterations(), [&](unsigned int)
+        {
+            vault.exportVault(exportFile, true, BINARY_ARCHIVE);
+        });
+        boost::system::error_code ec;
+        boost::filesystem::remove(exportFile, ec);
+
+        // Writes. New transactions arrive unconfirmed, then one block each confirms
+        // them, and finally the blocks are removed again from the top.
+        std::vector<Coin::Transaction> txs;
+        timeOperation("insertNewTx", iterations, [&](unsigned int i)
+        {
+            txs.push_back(incomingTx(scripts[i % scripts.size()]));
+            if (!vault.insertNewTx(txs.back())) throw runtime_error("insertNewTx did not insert transaction.");
+        });
+
+        uchar_vector prevhash = bestHeader->hash();
+        uint32_t height = bestHeader->height();
+        uint32_t timestamp = bestHeader->timestamp();
+        timeOperation("insertMerkleBlock", txs.size(), [&](unsigned int i)
+        {
+            height++;
+            timestamp += BLOCK_INTERVAL;
+            ChainMerkleBlock chainmerkleblock = merkleBlock(std::vector<Coin::Transaction>(1, txs[i]), prevhash, height, timestamp);
+            prevhash = chainmerkleblock.blockHeader.hash();
+            std::shared_ptr<MerkleBlock> merkleblock(new MerkleBlock(chainmerkleblock));
+            if (!vault.insertMerkleBlock(merkleblock)) throw runtime_error("insertMerkleBlock did not connect block.");
+        });
+
+        timeOperation("deleteMerkleBlock", height - bestHeader->height(), [&](unsigned int i)
+        {
+            vault.deleteMerkleBlock(height - i);
+        });
+
+        if (g_bShutdown)
+        {
+            cerr << "Interrupted." << endl;
+            return 0;
+        }
+
+        if (config.getOutFile().empty())
+        {
+            writeResults(cout);
+        }
+        else
+        {
+            ofstream out(config.getOutFile());
+            writeResults(out);
+            if (!out.good()) throw runtime_error("Failed to write " + config.getOutFile() + ".");
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    VaultBenchConfig config;
+
+    try
+    {
+        if (!config.parseParams(argc, argv))
+        {
+            cout << config.getHelpOptions();
+            return 0;
+        }
+
+        if (argc < 3 || (string(argv[1]) != "generate" && string(argv[1]) != "run"))
+        {
+            cerr << "VaultBench " << VERSION_INFO << endl
+                 << "# Usage: " << argv[0] << " generate <dbname> [--keychains=<n>] [--accounts=<n>] [--minsigs=<n>] [--pool=<n>] [--blocks=<n>] [--txsperblock=<n>]" << endl
+                 << "#        " << argv[0] << " run <dbname> [--iterations=<n>] [--exportiterations=<n>] [--pagesize=<n>] [--out=<json file>]" << endl
+                 << "# run modifies the vault, so give it a copy of a generated one." << endl
+                 << "# Use " << argv[0] << " --help for more options." << endl;
+            return -1;
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -2;
+    }
+
+    string command = argv[1];
+    string dbname = argv[2];
+
+    string logfile = config.getDataDir() + "/vaultbench.log";
+    INIT_LOGGER(logfile.c_str());
+
+    signal(SIGINT, &finish);
+    signal(SIGTERM, &finish);
+
+    if (command == "generate") return generate(config, dbname);
+    return run(config, dbname);
+}
@@ -132,16 +132,45 @@ BlockchainDownload::BlockchainDownload(const CoinQ::CoinParams& coinParams, bool
         }
 
         notifyBlock(block);
+        requestBlocks();
+    });
+
+    m_peer.subscribeRawBlock([&](CoinQ::Peer& /*peer*/, const uchar_vector& bytes)
+    {
+        if (bytes.size() < MIN_COIN_BLOCK_HEADER_SIZE)
+        {
+            notifyProtocolError("Block is too short.", -1);
+            return;
+        }
+
+        Coin::CoinBlockHeader header(uchar_vector(bytes.begin(), bytes.begin() + MIN_COIN_BLOCK_HEADER_SIZE));
+        m_lastReceivedBlockHash = header.hash();
+        LOGGER(trace) << "BlockchainDownload - Received raw block: " << m_lastReceivedBlockHash.getHex() << endl;
 
+        bool bNew = false;
         try
         {
-            m_peer.getBlocks(m_blockTree.getLocatorHashes(-1));
+            if (m_blockTree.isEmpty())
+            {
+                m_blockTree.setGenesisBlock(header);
+                bNew = true;
+            }
+            else
+            {
+                bNew = m_blockTree.insertHeader(header);
+            }
         }
         catch (const exception& e)
         {
-            LOGGER(error) << "BlockchainDownload - Failed to request blocks: " << e.what() << endl;
-            notifyConnectionError(e.what(), -1);
+            LOGGER(error) << "BlockchainDownload - Failed to insert header: " << e.what() << endl;
+            notifyBlockTreeError(e.what(), -1);
         }
+
+        if (bNew) { notifyRawBlock(m_blockTree.getHeader(m_lastReceivedBlockHash), bytes); }
+
+        // Ask for more only once the last block requested arrives, rather than after every
+        // block, so the same blocks are not requested over and over.
+        if (m_lastReceivedBlockHash.getReverse() == m_lastRequestedBlockHash) { requestBlocks(); }
     });
 }
 
@@ -209,6 +238,19 @@ void BlockchainDownload::stop()
     notifyStopped();
 }
 
+void BlockchainDownload::requestBlocks()
+{
+    try
+    {
+        m_peer.getBlocks(m_blockTree.getLocatorHashes(-1));
+    }
+    catch (const exception& e)
+    {
+        LOGGER(error) << "BlockchainDownload - Failed to request blocks: " << e.what() << endl;
+        notifyConnectionError(e.what(), -1);
+    }
+}
+
 void BlockchainDownload::startIOServiceThread()
 {
     if (m_bIOServiceStarted) throw std::runtime_error("BlockchainDownload - io service already started.");
@@ -46,6 +46,14 @@ public:
 
     void enableCheckProofOfWork(bool bCheckProofOfWork = true) { m_bCheckProofOfWork = bCheckProofOfWork; }
 
+    // Blocks are then passed on serialized, and only the first time they are received,
+    // to raw block subscribers instead of block subscribers. Deserializing them is left
+    // to the subscriber, so it can happen off the io thread.
+    void setRawBlocks(bool bRawBlocks) { m_peer.setRawBlocks(bRawBlocks); }
+
+    // While stopped, so that the next start() begins from its locator hashes.
+    void clearBlockTree() { m_blockTree.clear(); }
+
     int getBestHeight() const { return m_blockTree.getBestHeight(); }
     const bytes_t& getBestHash() const { return m_blockTree.getBestHash(); }
 
@@ -56,6 +64,7 @@ public:
 
     typedef Signals::Signal<>                           VoidSignal;
     typedef Signals::Signal<const Coin::CoinBlock&>     BlockSignal;
+    typedef Signals::Signal<const ChainHeader&, const uchar_vector&> RawBlockSignal;
     typedef Signals::Signal<const std::string&, int>    ErrorSignal;
 
     // SYNC EVENT SUBSCRIPTIONS
@@ -73,6 +82,7 @@ public:
 
     // PEER EVENT SUBSCRIPTIONS
     Signals::Connection subscribeBlock(BlockSignal::Slot slot)              { return notifyBlock.connect(slot); }
+    Signals::Connection subscribeRawBlock(RawBlockSignal::Slot slot)        { return notifyRawBlock.connect(slot); }
 
 private:
     CoinQ::CoinParams m_coinParams;
@@ -92,6 +102,7 @@ private:
     boost::mutex m_ioServiceMutex;
     void startIOServiceThread();
     void stopIOServiceThread();
+    void requestBlocks();
     CoinQ::io_service_t m_ioService;
     boost::thread m_ioServiceThread;
     CoinQ::io_service_t::work m_work;
@@ -114,6 +125,7 @@ private:
 
     // Peer signals
     BlockSignal         notifyBlock;
+    RawBlockSignal      notifyRawBlock;
 };
 
     }
@@ -0,0 +1,539 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// BlockchainRescan.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "BlockchainRescan.h"
+
+#include <logger/logger.h>
+#include <logger/metrics.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+using namespace CoinQ::Network;
+using namespace std;
+
+// Checkpoints saved while the consumer falls behind with acknowledgements.
+const size_t MAX_UNACKED_CHECKPOINTS = 16;
+
+BlockchainRescan::BlockchainRescan(const CoinQ::CoinParams& coinParams, unsigned int threads) :
+    m_coinParams(coinParams),
+    m_threads(threads),
+    m_download(coinParams),
+    m_checkpointInterval(DEFAULT_CHECKPOINT_INTERVAL),
+    m_bRequireAck(false),
+    m_bRunning(false),
+    m_height(0),
+    m_lastCheckpointHeight(0),
+    m_checkpointHeight(0),
+    m_ackedHeight(0),
+    m_queuedHeight(0),
+    m_reorgHeight(-1),
+    m_bStopping(false)
+{
+    if (m_threads == 0) { m_threads = std::max(1u, std::thread::hardware_concurrency()); }
+
+    m_download.setRawBlocks(true);
+    m_download.subscribeRawBlock([this](const ChainHeader& header, const uchar_vector& bytes) { insertBlock(header, bytes); });
+}
+
+BlockchainRescan::~BlockchainRescan()
+{
+    stop();
+}
+
+void BlockchainRescan::setFilterScripts(const std::vector<bytes_t>& scripts, const std::vector<Coin::OutPoint>& outpoints)
+{
+    if (m_bRunning) throw runtime_error("BlockchainRescan - cannot change scripts while running.");
+
+    LOGGER(trace) << "BlockchainRescan - setting scripts: " << scripts.size() << " outpoints: " << outpoints.size() << endl;
+    m_matcher.setFilterScripts(scripts, outpoints);
+}
+
+void BlockchainRescan::setCheckpointFile(const std::string& filename, unsigned int interval, bool requireAck)
+{
+    if (m_bRunning) throw runtime_error("BlockchainRescan - cannot change checkpoint file while running.");
+
+    m_checkpointFile = filename;
+    m_checkpointInterval = std::max(1u, interval);
+    m_bRequireAck = requireAck;
+}
+
+void BlockchainRescan::start(const std::string& host, const std::string& port, const uchar_vector& startHash, int startHeight)
+{
+    LOGGER(trace) << "BlockchainRescan::start(" << host << ", " << port << ", " << startHash.getHex() << ", " << startHeight << ")" << endl;
+
+    startPipeline(startHash, startHeight);
+
+    try
+    {
+        m_download.start(host, port, std::vector<uchar_vector>(1, m_hash));
+    }
+    catch (...)
+    {
+        stop();
+        throw;
+    }
+}
+
+void BlockchainRescan::startOffline(const uchar_vector& startHash, int startHeight)
+{
+    LOGGER(trace) << "BlockchainRescan::startOffline(" << startHash.getHex() << ", " << startHeight << ")" << endl;
+
+    startPipeline(startHash, startHeight);
+}
+
+void BlockchainRescan::startPipeline(const uchar_vector& startHash, int startHeight)
+{
+    if (m_bRunning) throw runtime_error("BlockchainRescan - already started.");
+
+    if (!loadCheckpoint())
+    {
+        if (startHash.empty())
+        {
+            m_hash = m_coinParams.genesis_block().hash();
+            m_height = 0;
+        }
+        else
+        {
+            m_hash = startHash;
+            m_height = startHeight;
+        }
+    }
+    m_lastCheckpointHeight = m_height;
+    m_undo.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(m_checkpointMutex);
+        m_checkpointHeight = m_height;
+        m_ackedHeight = m_height;
+        m_unackedCheckpoints.clear();
+    }
+
+    m_queuedHeight = m_height;
+    m_queuedHash = m_hash;
+    m_queuedHashes.clear();
+    m_queuedHeights.clear();
+    m_queuedHashes[m_height] = m_hash;
+    m_queuedHeights[m_hash] = m_height;
+    m_branchBlocks.clear();
+    m_queue.clear();
+    m_blocks.clear();
+    m_reorgHeight = -1;
+    m_reorgHash.clear();
+    m_bStopping = false;
+
+    for (unsigned int i = 0; i < m_threads; i++) { m_workers.push_back(std::thread(&BlockchainRescan::parseBlocks, this)); }
+    m_emitter = std::thread(&BlockchainRescan::emitBlocks, this);
+    m_bRunning = true;
+
+    LOGGER(debug) << "BlockchainRescan - starting after block " << m_hash.getHex() << " height: " << m_height << " threads: " << m_threads << endl;
+}
+
+void BlockchainRescan::stop()
+{
+    if (!m_bRunning) return;
+
+    LOGGER(trace) << "BlockchainRescan::stop()" << endl;
+
+    // Wake the io thread first in case it is waiting for room in the pipeline.
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStopping = true;
+        m_condition.notify_all();
+    }
+    m_download.stop();
+    m_download.clearBlockTree();
+
+    for (auto& worker: m_workers) { worker.join(); }
+    m_workers.clear();
+    m_emitter.join();
+
+    m_queue.clear();
+    m_blocks.clear();
+    m_branchBlocks.clear();
+    m_bRunning = false;
+
+    if (m_checkpointFile.empty()) return;
+
+    Checkpoint checkpoint = { m_height, m_hash, m_matcher.getOutPoints() };
+    std::string error;
+    {
+        std::lock_guard<std::mutex> lock(m_checkpointMutex);
+        if (m_bRequireAck && m_ackedHeight < m_height)
+        {
+            // Saved if the consumer acknowledges the rest after all.
+            if (m_unackedCheckpoints.empty() || m_unackedCheckpoints.back().height < m_height) { m_unackedCheckpoints.push_back(std::move(checkpoint)); }
+            return;
+        }
+        if (m_height == m_checkpointHeight) return;
+        error = saveCheckpoint(checkpoint);
+    }
+    reportCheckpoint(checkpoint, error);
+}
+
+void BlockchainRescan::acknowledge(int height)
+{
+    Checkpoint checkpoint;
+    std::string error;
+    {
+        std::lock_guard<std::mutex> lock(m_checkpointMutex);
+        if (height <= m_ackedHeight) return;
+        m_ackedHeight = height;
+
+        bool bSave = false;
+        while (!m_unackedCheckpoints.empty() && m_unackedCheckpoints.front().height <= height)
+        {
+            checkpoint = std::move(m_unackedCheckpoints.front());
+            m_unackedCheckpoints.pop_front();
+            bSave = true;
+        }
+        if (!bSave) return;
+        error = saveCheckpoint(checkpoint);
+    }
+    reportCheckpoint(checkpoint, error);
+}
+
+void BlockchainRescan::insertBlock(const ChainHeader& header, const uchar_vector& bytes)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_bStopping) return;
+
+    uchar_vector hash = header.hash();
+    if (m_queuedHeights.count(hash) || m_branchBlocks.count(hash)) return;
+
+    if (header.prevBlockHash() == m_queuedHash)
+    {
+        queueBlock(lock, header, bytes);
+        return;
+    }
+
+    // Walk back through the blocks held back to the chain we queued.
+    std::vector<std::pair<ChainHeader, uchar_vector>> branch(1, std::make_pair(header, bytes));
+    uchar_vector forkHash = header.prevBlockHash();
+    while (!m_queuedHeights.count(forkHash))
+    {
+        auto it = m_branchBlocks.find(forkHash);
+        if (it == m_branchBlocks.end())
+        {
+            LOGGER(debug) << "BlockchainRescan - ignoring block " << hash.getHex() << " that does not connect to " << m_queuedHash.getHex() << endl;
+            return;
+        }
+        branch.push_back(it->second);
+        forkHash = it->second.first.prevBlockHash();
+    }
+    int forkHeight = m_queuedHeights[forkHash];
+
+    if (!header.inBestChain)
+    {
+        if (m_branchBlocks.size() >= MAX_REORG_DEPTH)
+        {
+            LOGGER(debug) << "BlockchainRescan - dropping " << m_branchBlocks.size() << " block(s) held back on branches." << endl;
+            m_branchBlocks.clear();
+        }
+        m_branchBlocks[hash] = std::make_pair(header, bytes);
+        LOGGER(debug) << "BlockchainRescan - holding back block " << hash.getHex() << " on a branch from height " << forkHeight << endl;
+        return;
+    }
+
+    LOGGER(debug) << "BlockchainRescan - reorg at height " << forkHeight << " to block " << hash.getHex() << endl;
+
+    // Workers drop orphaned blocks they are parsing when they are done with them.
+    for (auto it = m_blocks.upper_bound(forkHeight); it != m_blocks.end(); it = m_blocks.erase(it)) { it->second->orphaned = true; }
+    m_queue.erase(std::remove_if(m_queue.begin(), m_queue.end(), [](const std::shared_ptr<PendingBlock>& block) { return block->orphaned; }), m_queue.end());
+    for (auto it = m_queuedHashes.upper_bound(forkHeight); it != m_queuedHashes.end(); it = m_queuedHashes.erase(it)) { m_queuedHeights.erase(it->second); }
+    m_queuedHeight = forkHeight;
+    m_queuedHash = forkHash;
+
+    // The emitter rolls back to the lowest fork it has not handled yet.
+    if (m_reorgHeight == -1 || forkHeight < m_reorgHeight)
+    {
+        m_reorgHeight = forkHeight;
+        m_reorgHash = forkHash;
+    }
+    m_condition.notify_all();
+
+    for (auto it = branch.rbegin(); it != branch.rend(); ++it)
+    {
+        m_branchBlocks.erase(it->first.hash());
+        if (!queueBlock(lock, it->first, it->second)) return;
+    }
+}
+
+bool BlockchainRescan::queueBlock(std::unique_lock<std::mutex>& lock, const ChainHeader& header, const uchar_vector& bytes)
+{
+    m_condition.wait(lock, [this]() { return m_blocks.size() < MAX_BLOCKS_IN_FLIGHT || m_bStopping; });
+    if (m_bStopping) return false;
+
+    std::shared_ptr<PendingBlock> block(new PendingBlock());
+    block->height = ++m_queuedHeight;
+    block->chainWork = header.chainWork;
+    block->bytes = bytes;
+    block->orphaned = false;
+
+    m_queuedHash = header.hash();
+    m_queuedHashes[m_queuedHeight] = m_queuedHash;
+    m_queuedHeights[m_queuedHash] = m_queuedHeight;
+    while (m_queuedHashes.begin()->first <= m_queuedHeight - (int)MAX_REORG_DEPTH)
+    {
+        m_queuedHeights.erase(m_queuedHashes.begin()->second);
+        m_queuedHashes.erase(m_queuedHashes.begin());
+    }
+
+    m_blocks[block->height] = block;
+    m_queue.push_back(block);
+    m_condition.notify_all();
+    return true;
+}
+
+void BlockchainRescan::parseBlocks()
+{
+    while (true)
+    {
+        std::shared_ptr<PendingBlock> block;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return !m_queue.empty() || m_bStopping; });
+            if (m_bStopping) return;
+
+            block = m_queue.front();
+            m_queue.pop_front();
+        }
+
+        std::shared_ptr<BlockMatcher::ParsedBlock> parsed(new BlockMatcher::ParsedBlock());
+        m_matcher.parse(block->bytes, *parsed);
+        block->bytes.clear();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (block->orphaned) continue;
+        block->parsed = parsed;
+        m_condition.notify_all();
+    }
+}
+
+void BlockchainRescan::emitBlocks()
+{
+    static metrics::counter& blocksScanned = metrics::get_counter("rescan.blocks");
+    static metrics::counter& txsMatched = metrics::get_counter("rescan.txs_matched");
+    static metrics::counter& reorgs = metrics::get_counter("rescan.reorgs");
+
+    while (true)
+    {
+        std::shared_ptr<PendingBlock> block;
+        int reorgHeight = -1;
+        uchar_vector reorgHash;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]()
+            {
+                if (m_reorgHeight != -1 || m_bStopping) return true;
+                auto it = m_blocks.find(m_height + 1);
+                return it != m_blocks.end() && it->second->parsed;
+            });
+            if (m_bStopping) return;
+
+            if (m_reorgHeight != -1)
+            {
+                reorgHeight = m_reorgHeight;
+                reorgHash = m_reorgHash;
+                m_reorgHeight = -1;
+            }
+            else
+            {
+                auto it = m_blocks.find(m_height + 1);
+                block = it->second;
+                m_blocks.erase(it);
+                m_condition.notify_all();
+            }
+        }
+
+        if (reorgHeight != -1)
+        {
+            reorgs.add();
+            if (!rollBack(reorgHeight, reorgHash)) return;
+            continue;
+        }
+
+        int height = m_height + 1;
+        BlockMatcher::Undo undo;
+        try
+        {
+            Coin::MerkleBlock merkleBlock;
+            std::vector<Coin::Transaction> txs = m_matcher.match(*block->parsed, merkleBlock, &undo);
+            notifyBlock(ChainMerkleBlock(merkleBlock, true, height, block->chainWork), txs);
+
+            blocksScanned.add();
+            txsMatched.add(txs.size());
+        }
+        catch (const std::exception& e)
+        {
+            // Skipping a block could miss transactions, so stop here and leave the checkpoint before it.
+            m_matcher.unmatch(undo);
+            std::stringstream err;
+            err << "BlockchainRescan - block at height " << height << ": " << e.what();
+            stopEmitting(err.str());
+            return;
+        }
+
+        m_height = height;
+        m_hash = block->parsed->block.blockHeader.hash();
+        m_undo.push_back(std::make_pair(height, std::move(undo)));
+        if (m_undo.size() > MAX_REORG_DEPTH) { m_undo.pop_front(); }
+
+        if (!m_checkpointFile.empty() && m_height - m_lastCheckpointHeight >= (int)m_checkpointInterval) { checkpoint(); }
+    }
+}
+
+bool BlockchainRescan::rollBack(int height, const uchar_vector& hash)
+{
+    // Nothing passed on above the fork yet.
+    if (m_height <= height) return true;
+
+    if ((int)m_undo.size() < m_height - height)
+    {
+        std::stringstream err;
+        err << "BlockchainRescan - reorg at height " << height << " is deeper than the last " << m_undo.size() << " block(s) passed on.";
+        stopEmitting(err.str());
+        return false;
+    }
+
+    while (m_height > height)
+    {
+        m_matcher.unmatch(m_undo.back().second);
+        m_undo.pop_back();
+        m_height--;
+    }
+    m_hash = hash;
+    m_lastCheckpointHeight = std::min(m_lastCheckpointHeight, m_height);
+
+    LOGGER(debug) << "BlockchainRescan - rolled back to block " << m_hash.getHex() << " height: " << m_height << endl;
+
+    // Acknowledgements for orphaned blocks count until subscribers have been told.
+    notifyReorg(m_height, m_hash);
+
+    // A checkpoint past the fork would resume on the orphaned branch. The consumer had
+    // acknowledged the blocks up to it, so it has the ones up to the fork.
+    if (!m_checkpointFile.empty())
+    {
+        Checkpoint checkpoint = { m_height, m_hash, m_matcher.getOutPoints() };
+        std::string error;
+        bool bSaved = false;
+        {
+            std::lock_guard<std::mutex> lock(m_checkpointMutex);
+            while (!m_unackedCheckpoints.empty() && m_unackedCheckpoints.back().height > m_height) { m_unackedCheckpoints.pop_back(); }
+            m_ackedHeight = std::min(m_ackedHeight, m_height);
+            if (m_checkpointHeight > m_height)
+            {
+                error = saveCheckpoint(checkpoint);
+                bSaved = true;
+            }
+        }
+        if (bSaved) { reportCheckpoint(checkpoint, error); }
+    }
+
+    return true;
+}
+
+void BlockchainRescan::stopEmitting(const std::string& error)
+{
+    LOGGER(error) << error << endl;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStopping = true;
+        m_condition.notify_all();
+    }
+    notifyError(error, -1);
+}
+
+// Checkpoint files are text: the height and hash of the last block passed on,
+// then one line per tracked outpoint with its txhash in wire order and index.
+bool BlockchainRescan::loadCheckpoint()
+{
+    if (m_checkpointFile.empty() || !boost::filesystem::exists(m_checkpointFile)) return false;
+
+    std::ifstream fs(m_checkpointFile);
+    if (!fs.good()) throw runtime_error("BlockchainRescan - failed to open checkpoint file " + m_checkpointFile + ".");
+
+    int height;
+    std::string hash;
+    if (!(fs >> height >> hash) || height < 0) throw runtime_error("BlockchainRescan - invalid checkpoint file " + m_checkpointFile + ".");
+
+    std::vector<BlockMatcher::outpoint_t> outpoints;
+    std::string txhash;
+    uint32_t index;
+    while (fs >> txhash >> index) { outpoints.push_back(BlockMatcher::outpoint_t(uchar_vector(txhash), index)); }
+    if (!fs.eof()) throw runtime_error("BlockchainRescan - invalid checkpoint file " + m_checkpointFile + ".");
+
+    m_height = height;
+    m_hash = uchar_vector(hash);
+    for (auto& outpoint: outpoints) { m_matcher.insertOutPoint(outpoint); }
+
+    LOGGER(debug) << "BlockchainRescan - loaded checkpoint at height " << m_height << " with " << outpoints.size() << " outpoint(s)." << endl;
+    return true;
+}
+
+void BlockchainRescan::checkpoint()
+{
+    m_lastCheckpointHeight = m_height;
+
+    Checkpoint checkpoint = { m_height, m_hash, m_matcher.getOutPoints() };
+    std::string error;
+    {
+        std::lock_guard<std::mutex> lock(m_checkpointMutex);
+        if (m_bRequireAck && m_ackedHeight < m_height)
+        {
+            m_unackedCheckpoints.push_back(std::move(checkpoint));
+            if (m_unackedCheckpoints.size() > MAX_UNACKED_CHECKPOINTS) { m_unackedCheckpoints.pop_front(); }
+            return;
+        }
+        error = saveCheckpoint(checkpoint);
+    }
+    reportCheckpoint(checkpoint, error);
+}
+
+// Call with m_checkpointMutex held. Returns an error description, or an empty string on success.
+std::string BlockchainRescan::saveCheckpoint(const Checkpoint& checkpoint)
+{
+    try
+    {
+        std::string swapfile = m_checkpointFile + ".swp";
+        {
+            std::ofstream fs(swapfile, std::ios::trunc);
+            fs << checkpoint.height << " " << checkpoint.hash.getHex() << "\n";
+            for (auto& outpoint: checkpoint.outpoints) { fs << uchar_vector(outpoint.first).getHex() << " " << outpoint.second << "\n"; }
+            fs.flush();
+            if (!fs.good()) throw runtime_error("failed to write " + swapfile + ".");
+        }
+        boost::filesystem::rename(swapfile, m_checkpointFile);
+        m_checkpointHeight = checkpoint.height;
+
+        LOGGER(debug) << "BlockchainRescan - saved checkpoint at height " << checkpoint.height << endl;
+        return std::string();
+    }
+    catch (const std::exception& e)
+    {
+        LOGGER(error) << "BlockchainRescan - " << e.what() << endl;
+        return e.what();
+    }
+}
+
+void BlockchainRescan::reportCheckpoint(const Checkpoint& checkpoint, const std::string& error)
+{
+    if (error.empty())
+    {
+        notifyCheckpoint(checkpoint.height, checkpoint.hash);
+    }
+    else
+    {
+        notifyError(std::string("BlockchainRescan - checkpoint not saved: ") + error, -1);
+    }
+}
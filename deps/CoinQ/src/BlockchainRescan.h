@@ -0,0 +1,176 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// BlockchainRescan.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include "BlockchainDownload.h"
+#include "CoinQ_blockmatch.h"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace CoinQ
+{
+    namespace Network
+    {
+
+// Downloads full blocks and picks out the transactions paying to a set of
+// scripts or spending outputs we know of. Unlike a bloom filtered sync nothing
+// is left to the peer, so it is suited to audits.
+//
+// Blocks arrive serialized on the download's io thread and are handed to a
+// pool of workers that deserialize them and match their outputs. A single
+// emitter thread then matches spends and passes blocks on in chain order, so
+// block and reorg subscribers are called from that thread. When the workers
+// fall behind, the io thread waits, which in turn throttles the peer.
+//
+// Blocks on a branch are held back until the branch has the most work. Then
+// the blocks queued above the fork are dropped and, if some were already
+// passed on, the outpoints they touched are restored and subscribers are told
+// the height of the fork. The last MAX_REORG_DEPTH blocks can be rolled back.
+//
+// With a checkpoint file, the last block passed on and the outpoints being
+// tracked are saved every so often and when stopped, and start() resumes from
+// there. If the consumer only commits blocks some time after they are passed
+// on, it should ask for acknowledgements and call acknowledge() once blocks
+// are safely stored, so a checkpoint never gets ahead of them.
+class BlockchainRescan
+{
+public:
+    typedef Signals::Signal<const ChainMerkleBlock&, const std::vector<Coin::Transaction>&> BlockSignal;
+    typedef Signals::Signal<int, const uchar_vector&>   ReorgSignal;        // height and hash of the fork, blocks above it are orphaned
+    typedef Signals::Signal<int, const uchar_vector&>   CheckpointSignal;
+    typedef Signals::Signal<const std::string&, int>    ErrorSignal;
+
+    // Blocks received ahead of the one being matched. Bounds memory use.
+    static const unsigned int MAX_BLOCKS_IN_FLIGHT = 64;
+    static const unsigned int MAX_REORG_DEPTH = 100;
+    static const unsigned int DEFAULT_CHECKPOINT_INTERVAL = 1000;
+
+    // threads = 0 uses one parser per core.
+    BlockchainRescan(const CoinQ::CoinParams& coinParams = CoinQ::getBitcoinParams(), unsigned int threads = 0);
+    ~BlockchainRescan();
+
+    // Call before starting.
+    void setFilterScripts(const std::vector<bytes_t>& scripts, const std::vector<Coin::OutPoint>& outpoints);
+    void setCheckpointFile(const std::string& filename, unsigned int interval = DEFAULT_CHECKPOINT_INTERVAL, bool requireAck = false);
+
+    // Rescans the blocks after startHash, which is at startHeight, or after the checkpoint
+    // if there is one. An empty startHash starts right after the genesis block.
+    void start(const std::string& host, const std::string& port = std::string(), const uchar_vector& startHash = uchar_vector(), int startHeight = 0);
+
+    // As start() but without a peer, for blocks from elsewhere passed to insertBlock().
+    void startOffline(const uchar_vector& startHash = uchar_vector(), int startHeight = 0);
+
+    // Headers must come from a block tree that holds the blocks before them, so that
+    // inBestChain and chainWork are set. Waits while too many blocks are in flight.
+    void insertBlock(const ChainHeader& header, const uchar_vector& bytes);
+
+    void stop();
+    bool running() const { return m_bRunning; }
+
+    // With requireAck, tells the rescan that blocks up to height are stored. Also works
+    // after stop(). Blocks orphaned by a reorg can only be acknowledged until the reorg
+    // subscribers return.
+    void acknowledge(int height);
+
+    // The last block passed on.
+    int getHeight() const { return m_height; }
+    const uchar_vector& getHash() const { return m_hash; }
+
+    // For connection events.
+    BlockchainDownload& getDownload() { return m_download; }
+
+    Signals::Connection subscribeBlock(BlockSignal::Slot slot)              { return notifyBlock.connect(slot); }
+    Signals::Connection subscribeReorg(ReorgSignal::Slot slot)              { return notifyReorg.connect(slot); }
+    Signals::Connection subscribeCheckpoint(CheckpointSignal::Slot slot)    { return notifyCheckpoint.connect(slot); }
+    Signals::Connection subscribeError(ErrorSignal::Slot slot)              { return notifyError.connect(slot); }
+
+private:
+    struct PendingBlock
+    {
+        int height;
+        BigInt chainWork;
+        uchar_vector bytes;
+        std::shared_ptr<BlockMatcher::ParsedBlock> parsed;  // CoinBlock copies on move, so pass pointers
+        bool orphaned;                                      // by a reorg while a worker had it
+    };
+
+    struct Checkpoint
+    {
+        int height;
+        uchar_vector hash;
+        std::set<BlockMatcher::outpoint_t> outpoints;
+    };
+
+    void startPipeline(const uchar_vector& startHash, int startHeight);
+    bool queueBlock(std::unique_lock<std::mutex>& lock, const ChainHeader& header, const uchar_vector& bytes);
+    void parseBlocks();
+    void emitBlocks();
+    bool rollBack(int height, const uchar_vector& hash);
+    void stopEmitting(const std::string& error);
+
+    bool loadCheckpoint();
+    void checkpoint();
+    std::string saveCheckpoint(const Checkpoint& checkpoint);
+    void reportCheckpoint(const Checkpoint& checkpoint, const std::string& error);
+
+    CoinQ::CoinParams m_coinParams;
+    unsigned int m_threads;
+    BlockchainDownload m_download;
+    BlockMatcher m_matcher;
+
+    std::string m_checkpointFile;
+    unsigned int m_checkpointInterval;
+    bool m_bRequireAck;
+
+    bool m_bRunning;
+    std::vector<std::thread> m_workers;
+    std::thread m_emitter;
+
+    // Only touched by the emitter thread while running.
+    int m_height;
+    uchar_vector m_hash;
+    int m_lastCheckpointHeight;                                     // saved, or held back until acknowledged
+    std::deque<std::pair<int, BlockMatcher::Undo>> m_undo;         // for the blocks passed on last
+
+    // Checkpoint state, guarded by m_checkpointMutex.
+    std::mutex m_checkpointMutex;
+    int m_checkpointHeight;
+    int m_ackedHeight;
+    std::deque<Checkpoint> m_unackedCheckpoints;
+
+    // Pipeline state, guarded by m_mutex.
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    int m_queuedHeight;
+    uchar_vector m_queuedHash;
+    std::map<int, uchar_vector> m_queuedHashes;                     // recent blocks in the queued chain
+    std::map<uchar_vector, int> m_queuedHeights;
+    std::map<uchar_vector, std::pair<ChainHeader, uchar_vector>> m_branchBlocks;    // held back until their branch has the most work
+    std::deque<std::shared_ptr<PendingBlock>> m_queue;                  // waiting for a worker
+    std::map<int, std::shared_ptr<PendingBlock>> m_blocks;              // queued and not yet passed on
+    int m_reorgHeight;                                              // lowest fork not yet handled by the emitter, or -1
+    uchar_vector m_reorgHash;
+    bool m_bStopping;
+
+    BlockSignal         notifyBlock;
+    ReorgSignal         notifyReorg;
+    CheckpointSignal    notifyCheckpoint;
+    ErrorSignal         notifyError;
+};
+
+    }
+}
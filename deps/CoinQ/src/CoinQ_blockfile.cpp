@@ -0,0 +1,325 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_blockfile.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "CoinQ_blockfile.h"
+
+#include <logger/logger.h>
+#include <logger/metrics.h>
+
+#include <boost/filesystem.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace CoinQ;
+
+namespace
+{
+
+// Each record in a block file is the network magic, the block size and the block.
+const unsigned int RECORD_HEADER_SIZE = 8;
+
+uint32_t readLE32(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+}
+
+BlockFileImporter::BlockFileImporter(CoinQBlockTreeMem& blockTree, uint32_t magicBytes, unsigned int threads) :
+    m_blockTree(blockTree),
+    m_magicBytes(magicBytes),
+    m_threads(threads),
+    m_inFlight(0),
+    m_bReadDone(false),
+    m_bStopping(false)
+{
+    if (m_threads == 0) { m_threads = std::max(1u, std::thread::hardware_concurrency()); }
+}
+
+void BlockFileImporter::setFilterScripts(const std::vector<bytes_t>& scripts, const std::vector<Coin::OutPoint>& outpoints)
+{
+    LOGGER(trace) << "BlockFileImporter - setting scripts: " << scripts.size() << " outpoints: " << outpoints.size() << std::endl;
+
+    m_matcher.setFilterScripts(scripts, outpoints);
+}
+
+void BlockFileImporter::index(const std::string& blocksDir)
+{
+    LOGGER(trace) << "BlockFileImporter::index(" << blocksDir << ")" << std::endl;
+
+    if (m_blockTree.isEmpty()) throw std::runtime_error("BlockFileImporter::index - block tree has no genesis block.");
+    if (!boost::filesystem::is_directory(blocksDir)) throw std::runtime_error("BlockFileImporter::index - " + blocksDir + " is not a directory.");
+
+    m_blocksDir = blocksDir;
+    m_locations.clear();
+    m_stats = Stats();
+
+    m_xorKey.clear();
+    boost::filesystem::path xorFile = boost::filesystem::path(blocksDir) / "xor.dat";
+    if (boost::filesystem::exists(xorFile))
+    {
+        std::ifstream fs(xorFile.string(), std::ios::binary);
+        m_xorKey.resize(8);
+        fs.read((char*)&m_xorKey[0], m_xorKey.size());
+        if (fs.gcount() != (std::streamsize)m_xorKey.size()) throw std::runtime_error("BlockFileImporter::index - invalid xor.dat.");
+        if (m_xorKey == uchar_vector(m_xorKey.size(), 0)) { m_xorKey.clear(); }
+    }
+
+    // Headers not yet in the tree, by parent. Blocks are stored roughly but not exactly in
+    // chain order, so they are only connected once every file has been read.
+    std::multimap<uchar_vector, Coin::CoinBlockHeader> newHeaders;
+
+    for (unsigned int file = 0; boost::filesystem::exists(getFileName(file)); file++)
+    {
+        std::string fileName = getFileName(file);
+        uint64_t fileSize = boost::filesystem::file_size(fileName);
+        std::ifstream fs(fileName, std::ios::binary);
+        if (!fs.good()) throw std::runtime_error("BlockFileImporter::index - failed to open " + fileName + ".");
+
+        uint64_t pos = 0;
+        unsigned char record[RECORD_HEADER_SIZE + MIN_COIN_BLOCK_HEADER_SIZE];
+        while (pos + sizeof(record) <= fileSize)
+        {
+            fs.seekg(pos);
+            fs.read((char*)record, sizeof(record));
+            if (fs.gcount() != (std::streamsize)sizeof(record)) break;
+            unscramble(record, sizeof(record), pos);
+
+            // Files are preallocated with zeros, and a crash can leave a partial record at the end.
+            uint32_t magic = readLE32(record);
+            uint32_t size = readLE32(record + 4);
+            if (magic != m_magicBytes || size < MIN_COIN_BLOCK_HEADER_SIZE || pos + RECORD_HEADER_SIZE + size > fileSize)
+            {
+                if (magic != 0) { LOGGER(warning) << "BlockFileImporter::index - stopped reading " << fileName << " at invalid record at offset " << pos << "." << std::endl; }
+                break;
+            }
+
+            Coin::CoinBlockHeader header(uchar_vector(record + RECORD_HEADER_SIZE, record + sizeof(record)));
+            uchar_vector hash = header.hash();
+
+            Location& location = m_locations[hash];
+            location.file = file;
+            location.offset = pos + RECORD_HEADER_SIZE;
+            location.size = size;
+            m_stats.blocksIndexed++;
+
+            if (!m_blockTree.hasHeader(hash)) { newHeaders.insert(std::make_pair(header.prevBlockHash(), header)); }
+
+            pos += RECORD_HEADER_SIZE + size;
+        }
+
+        m_stats.files++;
+        LOGGER(debug) << "BlockFileImporter::index - " << fileName << ": " << m_stats.blocksIndexed << " block(s) so far." << std::endl;
+    }
+
+    // Connect new headers breadth first from the ones already in the tree.
+    std::deque<uchar_vector> parents;
+    for (auto it = newHeaders.begin(); it != newHeaders.end(); it = newHeaders.upper_bound(it->first))
+    {
+        if (m_blockTree.hasHeader(it->first)) { parents.push_back(it->first); }
+    }
+
+    while (!parents.empty())
+    {
+        auto range = newHeaders.equal_range(parents.front());
+        parents.pop_front();
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            try
+            {
+                if (m_blockTree.insertHeader(it->second)) { m_stats.headersAdded++; }
+                parents.push_back(it->second.hash());
+            }
+            catch (const std::exception& e)
+            {
+                LOGGER(warning) << "BlockFileImporter::index - rejected header " << it->second.hash().getHex() << ": " << e.what() << std::endl;
+            }
+        }
+    }
+
+    LOGGER(debug) << "BlockFileImporter::index - files: " << m_stats.files << " blocks: " << m_stats.blocksIndexed << " headers added: " << m_stats.headersAdded << std::endl;
+}
+
+int BlockFileImporter::getLastContiguousHeight(int startHeight) const
+{
+    int height = startHeight;
+    while (height <= m_blockTree.getBestHeight() && m_locations.count(m_blockTree.getHeader(height).hash())) { height++; }
+    return height - 1;
+}
+
+int BlockFileImporter::import(int startHeight, int endHeight, block_slot_t onBlock, progress_t onProgress)
+{
+    LOGGER(trace) << "BlockFileImporter::import(" << startHeight << ", " << endHeight << ")" << std::endl;
+
+    static metrics::counter& blocksImported = metrics::get_counter("blockfile.blocks");
+    static metrics::counter& txsMatched = metrics::get_counter("blockfile.txs_matched");
+
+    if (startHeight < 0 || endHeight > m_blockTree.getBestHeight()) throw std::runtime_error("BlockFileImporter::import - invalid height range.");
+    for (int height = startHeight; height <= endHeight; height++)
+    {
+        if (!m_locations.count(m_blockTree.getHeader(height).hash()))
+            throw std::runtime_error("BlockFileImporter::import - block at height " + std::to_string(height) + " is not in the block files.");
+    }
+
+    m_readQueue.clear();
+    m_parsedBlocks.clear();
+    m_inFlight = 0;
+    m_bReadDone = false;
+    m_bStopping = false;
+    m_readError.clear();
+
+    std::vector<std::thread> threads;
+    threads.push_back(std::thread(&BlockFileImporter::readBlocks, this, startHeight, endHeight));
+    for (unsigned int i = 0; i < m_threads; i++) { threads.push_back(std::thread(&BlockFileImporter::parseBlocks, this)); }
+
+    auto stop = [&]()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bStopping = true;
+            m_condition.notify_all();
+        }
+        for (auto& thread: threads) { thread.join(); }
+        m_readQueue.clear();
+        m_parsedBlocks.clear();
+    };
+
+    int height = startHeight;
+    try
+    {
+        for (; height <= endHeight; height++)
+        {
+            std::shared_ptr<BlockMatcher::ParsedBlock> parsed;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [&]() { return m_parsedBlocks.count(height) || !m_readError.empty(); });
+                if (!m_readError.empty()) throw std::runtime_error(m_readError);
+
+                auto it = m_parsedBlocks.find(height);
+                parsed = it->second;
+                m_parsedBlocks.erase(it);
+                m_inFlight--;
+                m_condition.notify_all();
+            }
+
+            if (!parsed->error.empty()) throw std::runtime_error("BlockFileImporter::import - block at height " + std::to_string(height) + ": " + parsed->error);
+
+            const ChainHeader& header = m_blockTree.getHeader(height);
+            Coin::MerkleBlock merkleBlock;
+            std::vector<Coin::Transaction> txs = m_matcher.match(*parsed, merkleBlock);
+            if (merkleBlock.hash() != header.hash()) throw std::runtime_error("BlockFileImporter::import - block at height " + std::to_string(height) + " does not match its header.");
+
+            onBlock(ChainMerkleBlock(merkleBlock, true, header.height, header.chainWork), txs);
+
+            m_stats.blocksImported++;
+            m_stats.txsMatched += txs.size();
+            blocksImported.add();
+            txsMatched.add(txs.size());
+
+            if (onProgress && !onProgress(height)) break;
+        }
+    }
+    catch (...)
+    {
+        stop();
+        throw;
+    }
+
+    stop();
+    return std::min(height, endHeight);
+}
+
+void BlockFileImporter::readBlocks(int startHeight, int endHeight)
+{
+    try
+    {
+        std::ifstream fs;
+        unsigned int openFile = 0;
+        for (int height = startHeight; height <= endHeight; height++)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [this]() { return m_inFlight < MAX_BLOCKS_IN_FLIGHT || m_bStopping; });
+                if (m_bStopping) return;
+            }
+
+            const Location& location = m_locations.at(m_blockTree.getHeader(height).hash());
+            if (!fs.is_open() || openFile != location.file)
+            {
+                fs.close();
+                fs.open(getFileName(location.file), std::ios::binary);
+                if (!fs.good()) throw std::runtime_error("failed to open " + getFileName(location.file) + ".");
+                openFile = location.file;
+            }
+
+            uchar_vector bytes(location.size);
+            fs.seekg(location.offset);
+            fs.read((char*)&bytes[0], bytes.size());
+            if (fs.gcount() != (std::streamsize)bytes.size()) throw std::runtime_error("unexpected end of " + getFileName(location.file) + ".");
+            unscramble(&bytes[0], bytes.size(), location.offset);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_readQueue.push_back(std::make_pair(height, std::move(bytes)));
+            m_inFlight++;
+            m_stats.bytesRead += location.size;
+            m_condition.notify_all();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        LOGGER(error) << "BlockFileImporter::readBlocks - " << e.what() << std::endl;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_readError = std::string("BlockFileImporter - ") + e.what();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bReadDone = true;
+    m_condition.notify_all();
+}
+
+void BlockFileImporter::parseBlocks()
+{
+    while (true)
+    {
+        std::pair<int, uchar_vector> item;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return !m_readQueue.empty() || m_bReadDone || m_bStopping; });
+            if (m_bStopping || m_readQueue.empty()) return;
+
+            item = std::move(m_readQueue.front());
+            m_readQueue.pop_front();
+        }
+
+        std::shared_ptr<BlockMatcher::ParsedBlock> parsed(new BlockMatcher::ParsedBlock());
+        m_matcher.parse(item.second, *parsed);
+        if (parsed->error.empty() && parsed->block.blockHeader.hash() != m_blockTree.getHeader(item.first).hash()) { parsed->error = "block hash does not match the block tree."; }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_parsedBlocks[item.first] = parsed;
+        m_condition.notify_all();
+    }
+}
+
+void BlockFileImporter::unscramble(unsigned char* data, size_t size, uint64_t offset) const
+{
+    if (m_xorKey.empty()) return;
+    for (size_t i = 0; i < size; i++) { data[i] ^= m_xorKey[(offset + i) % m_xorKey.size()]; }
+}
+
+std::string BlockFileImporter::getFileName(unsigned int file) const
+{
+    char name[16];
+    std::snprintf(name, sizeof(name), "blk%05u.dat", file);
+    return (boost::filesystem::path(m_blocksDir) / name).string();
+}
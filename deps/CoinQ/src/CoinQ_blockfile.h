@@ -0,0 +1,124 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_blockfile.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include "CoinQ_blockmatch.h"
+#include "CoinQ_blocks.h"
+#include "CoinQ_typedefs.h"
+
+#include <CoinCore/CoinNodeData.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace CoinQ
+{
+
+// Reads blocks straight out of a Bitcoin Core blocks directory (blk?????.dat)
+// and passes on the transactions paying to a set of scripts or spending
+// outputs we know of, as merkle blocks in height order just like NetworkSync
+// does while synching. No network connection is needed.
+//
+// Only blocks in the best chain of the block tree are used. Each must hash to
+// its header in the tree and have a valid merkle root. Headers found in the
+// files that connect to the tree are checked and added to it first, so a tree
+// holding only the genesis block is enough.
+//
+// One thread reads blocks in height order, a pool of workers parses them and
+// matches outputs against the scripts, and the calling thread picks out spends
+// in chain order. Spends are found through the outpoints created by earlier
+// matched transactions, so rev?????.dat undo data is never needed.
+class BlockFileImporter
+{
+public:
+    typedef std::function<void(const ChainMerkleBlock&, const std::vector<Coin::Transaction>&)> block_slot_t;
+    typedef std::function<bool(int)> progress_t; // called with each height passed on, return false to stop
+
+    // Blocks parsed ahead of the one being matched. Bounds memory use.
+    static const unsigned int MAX_BLOCKS_IN_FLIGHT = 64;
+
+    struct Stats
+    {
+        Stats() : files(0), blocksIndexed(0), headersAdded(0), blocksImported(0), bytesRead(0), txsMatched(0) { }
+
+        unsigned int files;
+        uint64_t blocksIndexed;
+        uint64_t headersAdded;
+        uint64_t blocksImported;
+        uint64_t bytesRead;
+        uint64_t txsMatched;
+    };
+
+    // threads = 0 uses one parser per core.
+    BlockFileImporter(CoinQBlockTreeMem& blockTree, uint32_t magicBytes, unsigned int threads = 0);
+
+    void setFilterScripts(const std::vector<bytes_t>& scripts, const std::vector<Coin::OutPoint>& outpoints);
+
+    // Finds every block in the directory by reading only the record headers, and
+    // adds headers that extend the block tree.
+    void index(const std::string& blocksDir);
+
+    // The best chain height up to which all indexed blocks from startHeight are
+    // on disk, or startHeight - 1. Pruned nodes only keep recent blocks, and the
+    // newest few may not have been written yet.
+    int getLastContiguousHeight(int startHeight) const;
+
+    // Passes on blocks startHeight to endHeight, which must have been indexed.
+    // Returns the last height passed on, which is less than endHeight if
+    // onProgress asked to stop.
+    int import(int startHeight, int endHeight, block_slot_t onBlock, progress_t onProgress = nullptr);
+
+    const Stats& getStats() const { return m_stats; }
+
+private:
+    struct Location
+    {
+        unsigned int file;
+        uint64_t offset; // of the serialized block
+        uint32_t size;
+    };
+
+    void readBlocks(int startHeight, int endHeight);
+    void parseBlocks();
+
+    void unscramble(unsigned char* data, size_t size, uint64_t offset) const;
+    std::string getFileName(unsigned int file) const;
+
+    CoinQBlockTreeMem& m_blockTree;
+    uint32_t m_magicBytes;
+    unsigned int m_threads;
+
+    std::string m_blocksDir;
+    uchar_vector m_xorKey; // newer Bitcoin Core versions obfuscate block files with blocks/xor.dat
+    std::map<uchar_vector, Location> m_locations;
+
+    BlockMatcher m_matcher;
+
+    // Pipeline state, guarded by m_mutex.
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::pair<int, uchar_vector>> m_readQueue;   // height, serialized block
+    std::map<int, std::shared_ptr<BlockMatcher::ParsedBlock>> m_parsedBlocks;  // CoinBlock copies on move, so pass pointers
+    unsigned int m_inFlight;
+    bool m_bReadDone;
+    bool m_bStopping;
+    std::string m_readError;
+
+    Stats m_stats;
+};
+
+}
@@ -0,0 +1,109 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_blockmatch.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "CoinQ_blockmatch.h"
+
+#include <CoinCore/MerkleTree.h>
+
+#include <stdexcept>
+
+using namespace CoinQ;
+
+void BlockMatcher::setFilterScripts(const std::vector<bytes_t>& scripts, const std::vector<Coin::OutPoint>& outpoints)
+{
+    m_scripts.clear();
+    m_scripts.insert(scripts.begin(), scripts.end());
+    m_outPoints.clear();
+    for (auto& outpoint: outpoints) { m_outPoints.insert(outpoint_t(bytes_t(outpoint.hash, outpoint.hash + 32), outpoint.index)); }
+}
+
+void BlockMatcher::parse(const uchar_vector& bytes, ParsedBlock& parsed) const
+{
+    try
+    {
+        parsed.block.setSerialized(bytes);
+        if (!parsed.block.isValidMerkleRoot()) throw std::runtime_error("invalid merkle root.");
+
+        parsed.txHashes.reserve(parsed.block.txs.size());
+        parsed.paysToUs.reserve(parsed.block.txs.size());
+        for (auto& tx: parsed.block.txs)
+        {
+            parsed.txHashes.push_back(tx.hash().getReverse());
+
+            bool bPaysToUs = false;
+            for (auto& txOut: tx.outputs)
+            {
+                if (m_scripts.count(txOut.scriptPubKey))
+                {
+                    bPaysToUs = true;
+                    break;
+                }
+            }
+            parsed.paysToUs.push_back(bPaysToUs);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        parsed.error = e.what();
+    }
+}
+
+std::vector<Coin::Transaction> BlockMatcher::match(const ParsedBlock& parsed, Coin::MerkleBlock& merkleBlock, Undo* undo)
+{
+    if (!parsed.error.empty()) throw std::runtime_error("BlockMatcher::match - " + parsed.error);
+
+    // In block order, so that spends of outputs created earlier in the same block are caught.
+    std::vector<Coin::Transaction> txs;
+    std::vector<Coin::MerkleLeaf> leaves;
+    leaves.reserve(parsed.block.txs.size());
+    for (size_t i = 0; i < parsed.block.txs.size(); i++)
+    {
+        const Coin::Transaction& tx = parsed.block.txs[i];
+        bool bRelevant = parsed.paysToUs[i];
+
+        if (!m_outPoints.empty())
+        {
+            for (auto& txIn: tx.inputs)
+            {
+                outpoint_t outpoint(bytes_t(txIn.previousOut.hash, txIn.previousOut.hash + 32), txIn.previousOut.index);
+                if (m_outPoints.erase(outpoint))
+                {
+                    bRelevant = true;
+                    if (undo) { undo->erased.push_back(outpoint); }
+                }
+            }
+        }
+
+        if (parsed.paysToUs[i])
+        {
+            for (uint32_t j = 0; j < tx.outputs.size(); j++)
+            {
+                if (m_scripts.count(tx.outputs[j].scriptPubKey) && m_outPoints.insert(outpoint_t(parsed.txHashes[i], j)).second && undo)
+                {
+                    undo->inserted.push_back(outpoint_t(parsed.txHashes[i], j));
+                }
+            }
+        }
+
+        leaves.push_back(Coin::MerkleLeaf(parsed.txHashes[i], bRelevant));
+        if (bRelevant) { txs.push_back(tx); }
+    }
+
+    const Coin::CoinBlockHeader& header = parsed.block.blockHeader;
+    merkleBlock = Coin::MerkleBlock(Coin::PartialMerkleTree(leaves), header.version(), header.prevBlockHash(), header.timestamp(), header.bits(), header.nonce());
+    return txs;
+}
+
+void BlockMatcher::unmatch(const Undo& undo)
+{
+    // Outputs created and spent in the same block are in both lists, so put spends back first.
+    for (auto& outpoint: undo.erased)   { m_outPoints.insert(outpoint); }
+    for (auto& outpoint: undo.inserted) { m_outPoints.erase(outpoint); }
+}
@@ -0,0 +1,71 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_blockmatch.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include "CoinQ_typedefs.h"
+
+#include <CoinCore/CoinNodeData.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+namespace CoinQ
+{
+
+// Picks out the transactions in full blocks that pay to a set of scripts or
+// spend outputs we know of.
+//
+// Deserializing a block and matching its outputs is the costly part and can
+// run on any number of threads at once. Spends must then be matched one block
+// at a time in chain order, since a block can spend outputs created by the
+// blocks before it.
+class BlockMatcher
+{
+public:
+    typedef std::pair<bytes_t, uint32_t> outpoint_t; // txhash in wire order, index
+
+    struct ParsedBlock
+    {
+        Coin::CoinBlock block;
+        std::vector<uchar_vector> txHashes;     // wire order
+        std::vector<bool> paysToUs;             // per transaction
+        std::string error;                      // set instead of throwing, so workers can hand it on
+    };
+
+    // What match() changed in the tracked outpoints, so a block can be taken back on a reorg.
+    struct Undo
+    {
+        std::vector<outpoint_t> inserted;
+        std::vector<outpoint_t> erased;
+    };
+
+    void setFilterScripts(const std::vector<bytes_t>& scripts, const std::vector<Coin::OutPoint>& outpoints);
+    void insertOutPoint(const outpoint_t& outpoint) { m_outPoints.insert(outpoint); }
+    const std::set<outpoint_t>& getOutPoints() const { return m_outPoints; }
+
+    // Deserializes a block, checks its merkle root and matches its outputs.
+    // Safe to call from several threads, but not while the scripts change.
+    void parse(const uchar_vector& bytes, ParsedBlock& parsed) const;
+
+    // Call in chain order. Returns the matched transactions in block order and sets
+    // merkleBlock to the block header with a partial merkle tree of them.
+    std::vector<Coin::Transaction> match(const ParsedBlock& parsed, Coin::MerkleBlock& merkleBlock, Undo* undo = nullptr);
+
+    // Takes back the last block matched. Call in reverse chain order.
+    void unmatch(const Undo& undo);
+
+private:
+    std::set<bytes_t> m_scripts;
+    std::set<outpoint_t> m_outPoints;
+};
+
+}
@@ -13,9 +13,14 @@
 
 #include <logger/logger.h>
 
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+
 using namespace CoinQ;
 
-bool CoinQBlockTreeMem::setBestChain(ChainHeader& header)
+bool CoinQBlockTreeMem::setBestChain(ChainHeader& header, bool bNotifyEach)
 {
     if (header.inBestChain) return false;
 
@@ -44,18 +49,20 @@ bool CoinQBlockTreeMem::setBestChain(ChainHeader& header)
 
     // Pop back up stack and make this the best chain
     int count = 0;
+    ChainHeader* pFirst = newBestChain.top();
     while (!newBestChain.empty())
     {
         ChainHeader* pChild = newBestChain.top();
         pChild->inBestChain = true;
         mHeaderHeightMap[pChild->height] = pChild;
         if (count == 0) notifyReorg(*pChild);
-        notifyAddBestChain(*pChild);
+        if (bNotifyEach) notifyAddBestChain(*pChild);
         newBestChain.pop();
         count++;
     }
 
     pHead = &header;
+    if (!bNotifyEach) notifyAddBestChainRange(*pFirst, header);
 
     return true;
 }
@@ -150,6 +157,103 @@ bool CoinQBlockTreeMem::insertHeader(const Coin::CoinBlockHeader& header, bool b
     return true;
 }
 
+unsigned int CoinQBlockTreeMem::insertHeaders(const std::vector<Coin::CoinBlockHeader>& headers, bool bCheckProofOfWork, bool bReplaceTip)
+{
+    if (mHeaderHashMap.size() == 0) throw std::runtime_error("No genesis block.");
+    if (headers.empty()) return 0;
+
+    // Hashes are cached in each header, so hash our own copies in parallel. The proof
+    // of work hash can be far more expensive than the block hash, as with scrypt.
+    std::vector<Coin::CoinBlockHeader> batch(headers);
+    std::vector<char> badProofOfWork(batch.size(), 0);
+    auto hash = [&](size_t begin, size_t step)
+    {
+        for (size_t i = begin; i < batch.size(); i += step)
+        {
+            batch[i].hash();
+            if (bCheckProofOfWork && BigInt(batch[i].getPOWHashLittleEndian()) > batch[i].getTarget()) { badProofOfWork[i] = 1; }
+        }
+    };
+
+    // Thread startup costs more than hashing a few headers
+    const size_t MIN_HEADERS_PER_THREAD = 64;
+    size_t threadCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), batch.size() / MIN_HEADERS_PER_THREAD);
+    if (threadCount < 2)
+    {
+        hash(0, 1);
+    }
+    else
+    {
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < threadCount; t++)
+        {
+            threads.push_back(std::thread([&, t]()
+            {
+                try
+                {
+                    hash(t, threadCount);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) { error = std::current_exception(); }
+                }
+            }));
+        }
+        for (auto& thread: threads) { thread.join(); }
+        if (error) std::rethrow_exception(error);
+    }
+
+    // Validate the whole batch before changing anything
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        if (i > 0 && batch[i].prevBlockHash() != batch[i - 1].hash()) throw std::runtime_error("Headers do not link.");
+        if (badProofOfWork[i]) throw std::runtime_error("Header hash is too big.");
+    }
+
+    header_hash_map_t::iterator it = mHeaderHashMap.find(batch[0].prevBlockHash());
+    if (it == mHeaderHashMap.end()) throw std::runtime_error("Parent not found.");
+
+    // Each header commits to its parent, so once one is new so are all that follow.
+    size_t first = 0;
+    while (first < batch.size() && hasHeader(batch[first].hash())) { first++; }
+    if (first == batch.size()) return 0;
+
+    ChainHeader* pParent = &mHeaderHashMap.at(batch[first].prevBlockHash());
+
+    // Difficulty only changes at retargets, so most of a batch shares the same work.
+    uint32_t bits = batch[first].bits();
+    BigInt work = batch[first].getWork();
+    for (size_t i = first; i < batch.size(); i++)
+    {
+        if (batch[i].bits() != bits)
+        {
+            bits = batch[i].bits();
+            work = batch[i].getWork();
+        }
+
+        const uchar_vector& headerHash = batch[i].hash();
+        ChainHeader& chainHeader = mHeaderHashMap[headerHash] = batch[i];
+        chainHeader.height = pParent->height + 1;
+        chainHeader.chainWork = pParent->chainWork + work;
+        pParent->childHashes.insert(headerHash);
+        notifyInsert(chainHeader);
+        pParent = &chainHeader;
+    }
+
+    bFlushed = false;
+
+    // Work only grows along the batch, so no header short of the last could win where it does not.
+    if ((bReplaceTip && pParent->chainWork >= mTotalWork) || pParent->chainWork > mTotalWork)
+    {
+        setBestChain(*pParent, false);
+    }
+
+    return batch.size() - first;
+}
+
 bool CoinQBlockTreeMem::deleteHeader(const uchar_vector& hash)
 {
     header_hash_map_t::iterator it = mHeaderHashMap.find(hash);
@@ -78,6 +78,7 @@ public:
 typedef std::function<void(const ChainHeader&)>      chain_header_slot_t;
 typedef std::function<void(const ChainBlock&)>       chain_block_slot_t;
 typedef std::function<void(const ChainMerkleBlock&)> chain_merkle_block_slot_t;
+typedef std::function<void(const ChainHeader& /*first*/, const ChainHeader& /*last*/)> chain_header_range_slot_t;
 
 class ICoinQBlockTree
 {
@@ -87,11 +88,15 @@ public:
     virtual void subscribeInsert(chain_header_slot_t slot) = 0;
     virtual void subscribeDelete(chain_header_slot_t slot) = 0;
 
+    // slot is passed the oldest and newest headers insertHeaders added to the best chain
+    virtual void subscribeAddBestChainRange(chain_header_range_slot_t slot) = 0;
+
     virtual void clearAddBestChain() = 0;
     virtual void clearRemoveBestChain() = 0;
     virtual void clearInsert() = 0;
     virtual void clearDelete() = 0;
-    void unsubscribeAll() { clearAddBestChain(); clearRemoveBestChain(); clearInsert(); clearDelete(); }
+    virtual void clearAddBestChainRange() = 0;
+    void unsubscribeAll() { clearAddBestChain(); clearRemoveBestChain(); clearInsert(); clearDelete(); clearAddBestChainRange(); }
 
     // slot is passed the header of the oldest block not in the old chain
     virtual void subscribeReorg(chain_header_slot_t slot) = 0;
@@ -105,6 +110,12 @@ public:
 //    virtual bool insertHeader(const Coin::CoinBlockHeader& header) = 0;
     virtual bool insertHeader(const Coin::CoinBlockHeader& header, bool bCheckProofOfWork, bool bReplaceTip) = 0;
 
+    // inserts consecutive headers, such as those of a headers message, as a unit
+    // returns the number of new headers, skipping any already known at the start
+    // throws runtime_error and inserts nothing if the headers do not link, their parent is not known or any header is invalid
+    // the best chain is extended once, emitting AddBestChainRange instead of AddBestChain for each header
+    virtual unsigned int insertHeaders(const std::vector<Coin::CoinBlockHeader>& headers, bool bCheckProofOfWork, bool bReplaceTip) = 0;
+
     // returns true if header removed, false if header unknown
     virtual bool deleteHeader(const uchar_vector& hash) = 0;
  
@@ -149,9 +160,10 @@ private:
     CoinQSignal<const ChainHeader&> notifyInsert;
     CoinQSignal<const ChainHeader&> notifyDelete;
     CoinQSignal<const ChainHeader&> notifyReorg;
+    CoinQSignal<const ChainHeader&, const ChainHeader&> notifyAddBestChainRange;
 
 protected:
-    bool setBestChain(ChainHeader& header);
+    bool setBestChain(ChainHeader& header, bool bNotifyEach = true);
     bool unsetBestChain(ChainHeader& header);
 
 public:
@@ -165,16 +177,19 @@ public:
     void subscribeInsert(chain_header_slot_t slot) { notifyInsert.connect(slot); }
     void subscribeDelete(chain_header_slot_t slot) { notifyDelete.connect(slot); }
     void subscribeReorg(chain_header_slot_t slot) { notifyReorg.connect(slot); }
+    void subscribeAddBestChainRange(chain_header_range_slot_t slot) { notifyAddBestChainRange.connect(slot); }
 
     void clearAddBestChain() { notifyAddBestChain.clear(); }
     void clearRemoveBestChain() { notifyRemoveBestChain.clear(); }
     void clearInsert() { notifyInsert.clear(); }
     void clearDelete() { notifyDelete.clear(); }
     void clearReorg() { notifyReorg.clear();; }
+    void clearAddBestChainRange() { notifyAddBestChainRange.clear(); }
 
     void setGenesisBlock(const Coin::CoinBlockHeader& header);
     bool isEmpty() const { return pHead == nullptr; }
     bool insertHeader(const Coin::CoinBlockHeader& header, bool bCheckProofOfWork = true, bool bReplaceTip = false);
+    unsigned int insertHeaders(const std::vector<Coin::CoinBlockHeader>& headers, bool bCheckProofOfWork = true, bool bReplaceTip = false);
     bool deleteHeader(const uchar_vector& hash);
 
     bool hasHeader(const uchar_vector& hash) const;
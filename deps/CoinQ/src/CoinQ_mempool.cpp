@@ -0,0 +1,311 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_mempool.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "CoinQ_mempool.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+using namespace CoinQ;
+
+namespace
+{
+
+// Rough per-entry cost of a hash-only entry and of the index nodes of any entry.
+const uint64_t ENTRY_OVERHEAD = 128;
+
+uint64_t read64(const bytes_t& data, size_t offset)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8 && offset + i < data.size(); i++) { value |= (uint64_t)data[offset + i] << (8 * i); }
+    return value;
+}
+
+uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+}
+
+/*
+ * class RollingFilter
+ */
+RollingFilter::RollingFilter(unsigned int nElements, double falsePositiveRate) :
+    nElements_(nElements), nCurrent_(0)
+{
+    if (nElements == 0) throw std::runtime_error("RollingFilter - nElements must be positive.");
+    if (falsePositiveRate <= 0 || falsePositiveRate >= 1) throw std::runtime_error("RollingFilter - falsePositiveRate must be between 0 and 1.");
+
+    // Both generations can answer positively, so give each half the rate.
+    double rate = falsePositiveRate / 2;
+    double bits = -(double)nElements * std::log(rate) / (std::log(2.0) * std::log(2.0));
+    nBits_ = std::max<uint32_t>(64, (uint32_t)std::ceil(bits / 64) * 64);
+    nHashFuncs_ = std::max(1u, std::min(50u, (unsigned int)std::lround(nBits_ * std::log(2.0) / nElements)));
+
+    std::random_device rd;
+    tweak_[0] = ((uint64_t)rd() << 32) | rd();
+    tweak_[1] = ((uint64_t)rd() << 32) | rd();
+
+    current_.assign(nBits_ / 64, 0);
+    previous_.assign(nBits_ / 64, 0);
+}
+
+void RollingFilter::insert(const bytes_t& hash)
+{
+    if (nCurrent_ >= nElements_)
+    {
+        current_.swap(previous_);
+        std::fill(current_.begin(), current_.end(), 0);
+        nCurrent_ = 0;
+    }
+
+    std::vector<uint32_t> bits;
+    indices(hash, bits);
+    for (auto bit: bits) { current_[bit >> 6] |= (uint64_t)1 << (bit & 63); }
+    nCurrent_++;
+}
+
+bool RollingFilter::contains(const bytes_t& hash) const
+{
+    std::vector<uint32_t> bits;
+    indices(hash, bits);
+
+    bool inCurrent = true;
+    bool inPrevious = true;
+    for (auto bit: bits)
+    {
+        uint64_t mask = (uint64_t)1 << (bit & 63);
+        if (!(current_[bit >> 6] & mask))   { inCurrent = false; }
+        if (!(previous_[bit >> 6] & mask))  { inPrevious = false; }
+        if (!inCurrent && !inPrevious) return false;
+    }
+    return true;
+}
+
+void RollingFilter::clear()
+{
+    std::fill(current_.begin(), current_.end(), 0);
+    std::fill(previous_.begin(), previous_.end(), 0);
+    nCurrent_ = 0;
+}
+
+void RollingFilter::indices(const bytes_t& hash, std::vector<uint32_t>& result) const
+{
+    // Double hashing: the i-th index is h1 + i*h2.
+    uint64_t h1 = mix64(read64(hash, 0) ^ read64(hash, 16) ^ tweak_[0]);
+    uint64_t h2 = mix64(read64(hash, 8) ^ read64(hash, 24) ^ tweak_[1]) | 1;
+
+    result.resize(nHashFuncs_);
+    for (unsigned int i = 0; i < nHashFuncs_; i++) { result[i] = (uint32_t)((h1 + i * h2) % nBits_); }
+}
+
+
+/*
+ * class RequestTracker
+ */
+RequestTracker::RequestTracker(uint32_t timeoutSeconds, size_t maxRequests) :
+    timeoutSeconds_(timeoutSeconds), maxRequests_(maxRequests)
+{
+}
+
+bool RequestTracker::request(const bytes_t& hash, uint32_t now)
+{
+    expire(now);
+    if (requests_.size() >= maxRequests_) return false;
+    if (!requests_.insert(std::make_pair(hash, now)).second) return false;
+
+    byTime_.insert(std::make_pair(now, hash));
+    return true;
+}
+
+bool RequestTracker::received(const bytes_t& hash)
+{
+    auto it = requests_.find(hash);
+    if (it == requests_.end()) return false;
+
+    auto range = byTime_.equal_range(it->second);
+    for (auto entry = range.first; entry != range.second; ++entry)
+    {
+        if (entry->second == hash)
+        {
+            byTime_.erase(entry);
+            break;
+        }
+    }
+    requests_.erase(it);
+    return true;
+}
+
+void RequestTracker::expire(uint32_t now)
+{
+    while (!byTime_.empty() && byTime_.begin()->first + timeoutSeconds_ <= now)
+    {
+        requests_.erase(byTime_.begin()->second);
+        byTime_.erase(byTime_.begin());
+    }
+}
+
+void RequestTracker::clear()
+{
+    requests_.clear();
+    byTime_.clear();
+}
+
+
+/*
+ * class Mempool
+ */
+Mempool::Mempool(uint64_t maxBytes, uint32_t expirySeconds) :
+    maxBytes_(maxBytes), expirySeconds_(expirySeconds), nextSeq_(0), bytes_(0)
+{
+}
+
+bool Mempool::insert(const Coin::Transaction& tx, uint32_t now)
+{
+    bytes_t txHash = tx.hash();
+    auto it = entries_.find(txHash);
+    if (it != entries_.end())
+    {
+        if (it->second.tx) return false;
+        erase(it);
+    }
+
+    Entry entry;
+    entry.tx = std::make_shared<const Coin::Transaction>(tx);
+    entry.time = now;
+    entry.seq = nextSeq_++;
+    entry.size = tx.getSize() + ENTRY_OVERHEAD;
+
+    for (auto& txIn: tx.inputs)
+    {
+        outpoint_t outpoint(bytes_t(txIn.previousOut.hash, txIn.previousOut.hash + 32), txIn.previousOut.index);
+        bySpentOutpoint_[outpoint] = txHash;
+    }
+
+    bySeq_[entry.seq] = txHash;
+    bytes_ += entry.size;
+    entries_[txHash] = entry;
+
+    limit();
+    return true;
+}
+
+bool Mempool::insert(const bytes_t& txHash, uint32_t now)
+{
+    if (entries_.count(txHash)) return false;
+
+    Entry entry;
+    entry.time = now;
+    entry.seq = nextSeq_++;
+    entry.size = ENTRY_OVERHEAD;
+
+    bySeq_[entry.seq] = txHash;
+    bytes_ += entry.size;
+    entries_[txHash] = entry;
+
+    limit();
+    return true;
+}
+
+bool Mempool::hasBody(const bytes_t& txHash) const
+{
+    auto it = entries_.find(txHash);
+    return it != entries_.end() && it->second.tx;
+}
+
+Mempool::tx_ptr_t Mempool::get(const bytes_t& txHash) const
+{
+    auto it = entries_.find(txHash);
+    return it != entries_.end() ? it->second.tx : tx_ptr_t();
+}
+
+bytes_t Mempool::getSpender(const outpoint_t& outpoint) const
+{
+    auto it = bySpentOutpoint_.find(outpoint);
+    return it != bySpentOutpoint_.end() ? it->second : bytes_t();
+}
+
+bool Mempool::erase(const bytes_t& txHash)
+{
+    auto it = entries_.find(txHash);
+    if (it == entries_.end()) return false;
+
+    erase(it);
+    return true;
+}
+
+std::vector<bytes_t> Mempool::eraseConflicts(const Coin::Transaction& tx)
+{
+    bytes_t txHash = tx.hash();
+
+    std::set<bytes_t> conflicts;
+    for (auto& txIn: tx.inputs)
+    {
+        outpoint_t outpoint(bytes_t(txIn.previousOut.hash, txIn.previousOut.hash + 32), txIn.previousOut.index);
+        auto it = bySpentOutpoint_.find(outpoint);
+        if (it != bySpentOutpoint_.end() && it->second != txHash) { conflicts.insert(it->second); }
+    }
+
+    for (auto& conflict: conflicts) { erase(conflict); }
+    return std::vector<bytes_t>(conflicts.begin(), conflicts.end());
+}
+
+void Mempool::expire(uint32_t now)
+{
+    if (now < expirySeconds_) return;
+    uint32_t cutoff = now - expirySeconds_;
+
+    // Entries are nearly always inserted in time order, so stop at the first recent one.
+    while (!bySeq_.empty())
+    {
+        auto it = entries_.find(bySeq_.begin()->second);
+        if (it->second.time >= cutoff) break;
+        erase(it);
+    }
+}
+
+void Mempool::clear()
+{
+    entries_.clear();
+    bySeq_.clear();
+    bySpentOutpoint_.clear();
+    bytes_ = 0;
+}
+
+void Mempool::erase(entries_t::iterator it)
+{
+    const Entry& entry = it->second;
+    if (entry.tx)
+    {
+        for (auto& txIn: entry.tx->inputs)
+        {
+            outpoint_t outpoint(bytes_t(txIn.previousOut.hash, txIn.previousOut.hash + 32), txIn.previousOut.index);
+            auto spender = bySpentOutpoint_.find(outpoint);
+            if (spender != bySpentOutpoint_.end() && spender->second == it->first) { bySpentOutpoint_.erase(spender); }
+        }
+    }
+
+    bySeq_.erase(entry.seq);
+    bytes_ -= entry.size;
+    entries_.erase(it);
+}
+
+void Mempool::limit()
+{
+    while (bytes_ > maxBytes_ && !bySeq_.empty()) { erase(entries_.find(bySeq_.begin()->second)); }
+}
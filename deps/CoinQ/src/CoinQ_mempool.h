@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_mempool.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include "CoinQ_typedefs.h"
+
+#include <CoinCore/CoinNodeData.h>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+namespace CoinQ
+{
+
+// Remembers roughly the last nElements hashes inserted, with a bounded false
+// positive rate and constant memory. Two bloom filters take turns: once the
+// current one holds nElements it becomes the previous one and a fresh one
+// starts, so between nElements and 2*nElements recent items are remembered.
+//
+// Meant for hashes that are already uniformly distributed (txids, block
+// hashes). A random per-instance tweak keeps peers from choosing collisions.
+class RollingFilter
+{
+public:
+    RollingFilter(unsigned int nElements, double falsePositiveRate);
+
+    void insert(const bytes_t& hash);
+    bool contains(const bytes_t& hash) const;
+    void clear();
+
+private:
+    void indices(const bytes_t& hash, std::vector<uint32_t>& result) const;
+
+    unsigned int nElements_;
+    unsigned int nHashFuncs_;
+    uint32_t nBits_;
+    uint64_t tweak_[2];
+
+    std::vector<uint64_t> current_;
+    std::vector<uint64_t> previous_;
+    unsigned int nCurrent_;
+};
+
+// Hashes we have asked a peer for and not yet received. A request that gets
+// no reply within the timeout is forgotten so the next announcement of the
+// hash asks again; peers may drop requests or answer with notfound.
+class RequestTracker
+{
+public:
+    explicit RequestTracker(uint32_t timeoutSeconds = 60, size_t maxRequests = 50000);
+
+    // Returns false, recording nothing, if a request for the hash is pending or too many are.
+    bool request(const bytes_t& hash, uint32_t now);
+
+    // Returns false if the hash was not pending.
+    bool received(const bytes_t& hash);
+
+    bool pending(const bytes_t& hash) const { return requests_.count(hash) > 0; }
+
+    // Forgets requests made before now - timeoutSeconds.
+    void expire(uint32_t now);
+
+    void clear();
+
+    size_t size() const { return requests_.size(); }
+
+private:
+    uint32_t timeoutSeconds_;
+    size_t maxRequests_;
+
+    std::map<bytes_t, uint32_t> requests_;
+    std::multimap<uint32_t, bytes_t> byTime_;
+};
+
+// Unconfirmed transactions we know about, indexed by txid and by the outpoints
+// they spend. Bounded by total serialized size and by age: the oldest entries
+// are dropped first. Entries may be added by hash alone when the body is held
+// elsewhere, e.g. our own transactions stored in a vault.
+class Mempool
+{
+public:
+    typedef std::shared_ptr<const Coin::Transaction> tx_ptr_t;
+    typedef std::pair<bytes_t, uint32_t> outpoint_t;
+
+    explicit Mempool(uint64_t maxBytes = 32 * 1024 * 1024, uint32_t expirySeconds = 14 * 24 * 60 * 60);
+
+    // Returns false if already present with a body. A body replaces a hash-only entry.
+    bool insert(const Coin::Transaction& tx, uint32_t now);
+    bool insert(const bytes_t& txHash, uint32_t now);
+
+    bool contains(const bytes_t& txHash) const { return entries_.count(txHash) > 0; }
+    bool hasBody(const bytes_t& txHash) const;
+    tx_ptr_t get(const bytes_t& txHash) const; // null if absent or hash-only
+
+    // Txid of the mempool transaction spending the outpoint, or empty.
+    bytes_t getSpender(const outpoint_t& outpoint) const;
+
+    bool erase(const bytes_t& txHash);
+
+    // Drops transactions that spend any input of tx, other than tx itself.
+    // Call with confirmed transactions, whose double spends can no longer confirm.
+    // Returns the hashes dropped.
+    std::vector<bytes_t> eraseConflicts(const Coin::Transaction& tx);
+
+    // Drops entries received before now - expirySeconds.
+    void expire(uint32_t now);
+
+    void clear();
+
+    size_t size() const { return entries_.size(); }
+    uint64_t bytes() const { return bytes_; }
+
+private:
+    struct Entry
+    {
+        tx_ptr_t tx;
+        uint32_t time;
+        uint64_t seq;
+        uint64_t size;
+    };
+
+    typedef std::map<bytes_t, Entry> entries_t;
+
+    void erase(entries_t::iterator it);
+    void limit();
+
+    uint64_t maxBytes_;
+    uint32_t expirySeconds_;
+
+    entries_t entries_;
+    std::map<uint64_t, bytes_t> bySeq_; // oldest first
+    std::map<outpoint_t, bytes_t> bySpentOutpoint_;
+    uint64_t nextSeq_;
+    uint64_t bytes_;
+};
+
+}
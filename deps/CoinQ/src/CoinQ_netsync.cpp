@@ -14,10 +14,12 @@
 #include "CoinQ_typedefs.h"
 
 #include <CoinCore/MerkleTree.h>
+#include <CoinCore/GolombFilter.h>
 
 #include <stdint.h>
 
 #include <logger/logger.h>
+#include <logger/metrics.h>
 
 #include <thread>
 #include <chrono>
@@ -25,6 +27,14 @@
 using namespace CoinQ::Network;
 using namespace std;
 
+namespace
+{
+
+// BIP157 allows up to 2000 filter headers and 1000 filters per request.
+const int CFILTER_BATCH_SIZE = 1000;
+
+}
+
 NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOfWork) :
     m_coinParams(coinParams),
     m_bCheckProofOfWork(bCheckProofOfWork),
@@ -35,6 +45,12 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
     m_peer(m_ioService),
     m_bFlushingToFile(false),
     m_bHeadersSynched(false),
+    m_bHeadersFailed(false),
+    m_bCompactFilters(false),
+    m_cfStartHeight(0),
+    m_cfStopHeight(-1),
+    m_cfNextHeight(0),
+    m_knownTxs(50000, 0.000001),
     m_bMissingTxs(false)
 {
     // Select hash functions
@@ -75,6 +91,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
             }
 
             LOGGER(trace) << "Peer connection opened." << endl;
+            m_bHeadersFailed = false;
             m_peer.getHeaders(m_blockTree.getLocatorHashes(-1));
         }
         catch (const std::exception& e)
@@ -111,36 +128,72 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
         if (!m_bConnected) return;
         LOGGER(trace) << "Received inventory message:" << std::endl << inv.toIndentedString(2) << std::endl;
 
+        static metrics::counter& knownTxCounter = metrics::get_counter("sync.inv.known_txs");
+        static metrics::counter& pendingTxCounter = metrics::get_counter("sync.inv.pending_txs");
+
         using namespace Coin;
         GetDataMessage getData;
-        for (auto& item: inv.items)
+        bool bGetHeaders = false;
         {
-            switch (item.itemType)
+            boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
+            uint32_t now = time(NULL);
+            for (auto& item: inv.items)
             {
-            case MSG_TX:
-                getData.items.push_back(InventoryItem(MSG_TX | peer.inv_flags(), item.hash));
-                break;
-            case MSG_BLOCK:
-                getData.items.push_back(InventoryItem(MSG_FILTERED_BLOCK | peer.inv_flags(), item.hash));
-                break;
-            default:
-                break;
-            } 
+                switch (item.itemType)
+                {
+                case MSG_TX:
+                {
+                    // Don't download transactions we already have. Ones we have asked for are
+                    // only asked for again once the request times out without a reply.
+                    uchar_vector txHash = uchar_vector(item.hash, 32).getReverse();
+                    if (m_knownTxs.contains(txHash) || m_mempool.contains(txHash))
+                    {
+                        knownTxCounter.add();
+                        break;
+                    }
+                    if (!m_txRequests.request(txHash, now))
+                    {
+                        pendingTxCounter.add();
+                        break;
+                    }
+                    getData.items.push_back(InventoryItem(MSG_TX | peer.inv_flags(), item.hash));
+                    break;
+                }
+                case MSG_BLOCK:
+                    // With compact filters new blocks are picked up once their headers connect.
+                    if (m_bCompactFilters)  { bGetHeaders = true; }
+                    else                    { getData.items.push_back(InventoryItem(MSG_FILTERED_BLOCK | peer.inv_flags(), item.hash)); }
+                    break;
+                default:
+                    break;
+                } 
+            }
         }
 
         if (!getData.items.empty()) { m_peer.send(getData); }
+        if (bGetHeaders) { m_peer.getHeaders(m_blockTree.getLocatorHashes(-1)); }
     });
 
     m_peer.subscribeTx([&](CoinQ::Peer& /*peer*/, const Coin::Transaction& tx)
     {
         LOGGER(trace) << "Received transaction: " << tx.hash().getHex() << endl;
 
+        {
+            boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
+            m_txRequests.received(tx.hash());
+        }
+
         boost::unique_lock<boost::mutex> syncLock(m_syncMutex);
         if (m_currentMerkleTxHashes.empty())
         {
             {
                 boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
-                m_mempoolTxs.insert(tx.hash());
+                m_knownTxs.insert(tx.hash());
+                if (!insertMempoolTx_unwrapped(tx))
+                {
+                    LOGGER(trace) << "Transaction already in mempool: " << tx.hash().getHex() << endl;
+                    return;
+                }
             }
 
             syncLock.unlock();
@@ -163,42 +216,59 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
             if (headersMessage.headers.size() > 0)
             {
                 notifySynchingHeaders();
+
+                const std::vector<Coin::CoinBlockHeader>& headers = headersMessage.headers;
+                const uchar_vector& lastHash = headers.back().hash();
+
+                // The peer continues from the last header it sent, so ask for more before inserting
+                // and let the round trip overlap with the work. Proof of work and chain work are
+                // left to insertHeaders, but a batch that does not link up gets no request, and
+                // neither does anything after a batch that failed, so a peer sending bad headers
+                // is not walked to its tip.
                 boost::unique_lock<boost::mutex> fileFlushLock(m_fileFlushMutex);
-                for (auto& item: headersMessage.headers)
+                bool bLinked = m_blockTree.hasHeader(headers.front().prevBlockHash());
+                for (size_t i = 1; bLinked && i < headers.size(); i++)
                 {
-                    try
-                    {
-                        if (m_blockTree.insertHeader(item)) { m_bHeadersSynched = false; }
-                    }
-                    catch (const std::exception& e)
-                    {
-                        std::stringstream err;
-                        err << "Block tree insertion error for block " << item.hash().getHex() << ": " << e.what(); // TODO: localization
-                        LOGGER(error) << err.str() << std::endl;
-                        // TODO: propagate code
-                        notifyBlockTreeError(err.str(), -1);
-                        throw e;
-                    }
+                    if (headers[i].prevBlockHash() != headers[i - 1].hash()) { bLinked = false; }
+                }
+
+                if (bLinked && !m_bHeadersFailed)
+                {
+                    peer.getHeaders(vector<uchar_vector>(1, lastHash));
+                }
+
+                try
+                {
+                    if (m_blockTree.insertHeaders(headers) > 0) { m_bHeadersSynched = false; }
+                }
+                catch (const std::exception& e)
+                {
+                    m_bHeadersFailed = true;
+                    std::stringstream err;
+                    err << "Block tree insertion error for headers " << headers.front().hash().getHex() << " to " << lastHash.getHex() << ": " << e.what(); // TODO: localization
+                    LOGGER(error) << err.str() << std::endl;
+                    // TODO: propagate code
+                    notifyBlockTreeError(err.str(), -1);
+                    throw;
                 }
 
+                static metrics::counter& headersProcessed = metrics::get_counter("sync.headers");
+                headersProcessed.add(headersMessage.headers.size());
+
                 LOGGER(trace)   << "Processed " << headersMessage.headers.size() << " headers."
                                 << " mBestHeight: " << m_blockTree.getBestHeight()
-                                << " mTotalWork: " << m_blockTree.getTotalWork().getDec()
-                                << " Attempting to fetch more headers..." << std::endl;
+                                << " mTotalWork: " << m_blockTree.getTotalWork().getDec() << std::endl;
 
                 notifyBlockTreeChanged();
                 std::stringstream status;
                 status << "Best Height: " << m_blockTree.getBestHeight() << " / " << "Total Work: " << m_blockTree.getTotalWork().getDec();
                 notifyStatus(status.str());
 
-                vector<uchar_vector> locatorHashes = m_blockTree.getLocatorHashes(1);
-                if (locatorHashes.empty()) throw runtime_error("Blocktree is empty.");
-                if (headersMessage.headers[headersMessage.headers.size() - 1].hash() != locatorHashes[0])
+                if (lastHash != m_blockTree.getBestHash())
                 {
+                    m_bHeadersFailed = true;
                     throw runtime_error("Blocktree conflicts with peer.");
                 }
- 
-                peer.getHeaders(locatorHashes);
             }
             else
             {
@@ -217,6 +287,8 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
                     m_bHeadersSynched = true;
                     notifyHeadersSynched();
                 }
+
+                if (m_bCompactFilters) { followCompactFilterTip(); }
             }
         }
         catch (const std::exception& e)
@@ -231,6 +303,8 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
 
         LOGGER(trace) << "Received block: " << block.hash().getHex() << endl;
 
+        if (processCompactFilterBlock(block)) return;
+
         try
         {
             boost::unique_lock<boost::mutex> syncLock(m_syncMutex);
@@ -250,7 +324,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
 
                     {
                         boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
-                        m_mempoolTxs.erase(tx.hash());
+                        confirmMempoolTx_unwrapped(tx);
                     }
                 }
             }
@@ -299,10 +373,25 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
         }
     });
 
+    m_peer.subscribeCFHeaders([&](CoinQ::Peer& /*peer*/, const Coin::CFHeadersMessage& cfheaders)
+    {
+        if (!m_bConnected) return;
+        processCFHeaders(cfheaders);
+    });
+
+    m_peer.subscribeCFilter([&](CoinQ::Peer& /*peer*/, const Coin::CFilterMessage& cfilter)
+    {
+        if (!m_bConnected) return;
+        processCFilter(cfilter);
+    });
+
     m_peer.subscribeMerkleBlock([&](CoinQ::Peer& /*peer*/, const Coin::MerkleBlock& merkleBlock)
     {
         if (!m_bConnected) return;
 
+        static metrics::counter& merkleBlocksReceived = metrics::get_counter("sync.merkleblocks");
+        merkleBlocksReceived.add();
+
         uchar_vector merkleBlockHash = merkleBlock.hash();
         LOGGER(trace) << "Received merkle block: " << merkleBlockHash.getHex() << endl;
 
@@ -324,6 +413,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
                 LOGGER(trace) << "REORG - attempting again to resync block headers from peer..." << endl;
                 try
                 {
+                    m_bHeadersFailed = false;
                     m_peer.getHeaders(m_blockTree.getLocatorHashes(-1));
                 }
                 catch (const exception& e)
@@ -408,6 +498,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
 
                 LOGGER(trace) << "REORG - resynching block headers from peer..." << endl;
                 m_bHeadersSynched = false;
+                m_bHeadersFailed = false;
                 try
                 {
                     m_peer.getHeaders(m_blockTree.getLocatorHashes(-1));
@@ -443,6 +534,15 @@ void NetworkSync::setCoinParams(const CoinQ::CoinParams& coinParams)
     m_coinParams = coinParams;    
 }
 
+void NetworkSync::setCaptureFile(const std::string& captureFile)
+{
+    if (m_bStarted) throw std::runtime_error("NetworkSync::setCaptureFile() - must be stopped to set capture file.");
+    boost::lock_guard<boost::mutex> lock(m_startMutex);
+    if (m_bStarted) throw std::runtime_error("NetworkSync::setCaptureFile() - must be stopped to set capture file.");
+
+    m_peer.setCapture(captureFile.empty() ? nullptr : std::make_shared<CoinQ::PeerCapture>(captureFile));
+}
+
 void NetworkSync::loadHeaders(const std::string& blockTreeFile, bool bCheckProofOfWork, CoinQBlockTreeMem::callback_t callback)
 {
     stopFileFlushThread();
@@ -539,9 +639,26 @@ void NetworkSync::syncBlocks(int startHeight)
 void NetworkSync::do_syncBlocks(int startHeight)
 {
     m_lastSynchedMerkleBlockHash.clear();
+
+    if (m_bCompactFilters)
+    {
+        if (!peerServesCompactFilters()) throw runtime_error("NetworkSync::syncBlocks() - peer does not serve compact block filters.");
+
+        // The first filter header is taken on trust from the peer. Later batches must chain from it.
+        m_cfPending.clear();
+        m_cfRequestedBlockHash.clear();
+        m_cfPrevHeader.clear();
+        m_cfLastHash = startHeight > 0 ? m_blockTree.getHeader(startHeight - 1).hash() : uchar_vector();
+
+        LOGGER(trace) << "Resynching blocks with compact filters " << startHeight << " - " << m_blockTree.getTipHeight() << endl;
+        notifySynchingBlocks();
+        requestCompactFilters_unwrapped(startHeight);
+        return;
+    }
+
     m_lastRequestedMerkleBlockHash = m_blockTree.getHeader(startHeight).hash();
 
-    LOGGER(trace) "Resynching blocks " << startHeight << " - " << m_blockTree.getTipHeight() << endl;
+    LOGGER(trace) << "Resynching blocks " << startHeight << " - " << m_blockTree.getTipHeight() << endl;
     notifySynchingBlocks();
 
     LOGGER(trace) << "Asking for filtered block (3) " << m_lastRequestedMerkleBlockHash.getHex() << endl;
@@ -553,20 +670,52 @@ void NetworkSync::stopSynchingBlocks(bool bClearFilter)
     boost::lock_guard<boost::mutex> lock(m_syncMutex);
     m_lastRequestedMerkleBlockHash.clear();
     m_lastSynchedMerkleBlockHash.clear();
-    if (bClearFilter) { clearBloomFilter(); }
+
+    m_cfStopHash.clear();
+    m_cfFilterHashes.clear();
+    m_cfPending.clear();
+    m_cfRequestedBlockHash.clear();
+    m_cfLastHash.clear();
+
+    if (bClearFilter)
+    {
+        clearBloomFilter();
+        m_filterScripts.clear();
+        m_filterScriptSet.clear();
+        m_filterOutPoints.clear();
+    }
 }
 
 void NetworkSync::addToMempool(const uchar_vector& txHash)
 {
     boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
-    m_mempoolTxs.insert(txHash);
+    m_knownTxs.insert(txHash);
+    m_mempool.expire(time(NULL));
+    m_mempool.insert(txHash, time(NULL));
+    updateMempoolMetrics_unwrapped();
+}
+
+void NetworkSync::clearMempool()
+{
+    boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
+    m_knownTxs.clear();
+    m_txRequests.clear();
+    m_mempool.clear();
+    updateMempoolMetrics_unwrapped();
+}
+
+size_t NetworkSync::getMempoolSize() const
+{
+    boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
+    return m_mempool.size();
 }
 
 void NetworkSync::insertTx(const Coin::Transaction& tx)
 {
     {
         boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
-        m_mempoolTxs.insert(tx.hash());
+        m_knownTxs.insert(tx.hash());
+        insertMempoolTx_unwrapped(tx);
     }
 
     notifyNewTx(tx);
@@ -602,7 +751,7 @@ void NetworkSync::insertMerkleBlock(const Coin::MerkleBlock& merkleBlock, const
 
             {
                 boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
-                m_mempoolTxs.erase(tx.hash());
+                confirmMempoolTx_unwrapped(tx);
             }
         }
     }
@@ -653,8 +802,20 @@ void NetworkSync::stop()
 
         m_bStarted = false;
         m_bHeadersSynched = false;
+        m_bHeadersFailed = false;
         m_lastRequestedMerkleBlockHash.clear();
         while (!m_currentMerkleTxHashes.empty()) { m_currentMerkleTxHashes.pop(); }
+
+        m_cfStopHash.clear();
+        m_cfFilterHashes.clear();
+        m_cfPending.clear();
+        m_cfRequestedBlockHash.clear();
+    }
+
+    {
+        // Requests to the old peer will never be answered
+        boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
+        m_txRequests.clear();
     }
 
     notifyStopped();
@@ -703,6 +864,42 @@ void NetworkSync::clearBloomFilter()
     m_peer.send(filterClear);
 }
 
+void NetworkSync::setFilterScripts(const std::vector<bytes_t>& scripts, const std::vector<Coin::OutPoint>& outpoints)
+{
+    LOGGER(trace) << "Setting compact filter scripts: " << scripts.size() << " outpoints: " << outpoints.size() << endl;
+
+    boost::lock_guard<boost::mutex> lock(m_syncMutex);
+    m_bCompactFilters = true;
+    m_filterScripts.assign(scripts.begin(), scripts.end());
+    m_filterScriptSet.clear();
+    m_filterScriptSet.insert(scripts.begin(), scripts.end());
+    for (auto& outpoint: outpoints) { m_filterOutPoints.insert(outpoint_t(bytes_t(outpoint.hash, outpoint.hash + 32), outpoint.index)); }
+}
+
+void NetworkSync::clearFilterScripts()
+{
+    boost::lock_guard<boost::mutex> lock(m_syncMutex);
+    m_bCompactFilters = false;
+    m_filterScripts.clear();
+    m_filterScriptSet.clear();
+    m_filterOutPoints.clear();
+}
+
+void NetworkSync::insertCFHeaders(const Coin::CFHeadersMessage& cfheaders)
+{
+    processCFHeaders(cfheaders);
+}
+
+void NetworkSync::insertCFilter(const Coin::CFilterMessage& cfilter)
+{
+    processCFilter(cfilter);
+}
+
+void NetworkSync::insertBlock(const Coin::CoinBlock& block)
+{
+    processCompactFilterBlock(block);
+}
+
 void NetworkSync::startIOServiceThread()
 {
     if (m_bIOServiceStarted) throw std::runtime_error("NetworkSync - io service already started.");
@@ -909,8 +1106,8 @@ void NetworkSync::processBlockTx(const Coin::Transaction& tx)
 void NetworkSync::processMempoolConfirmations()
 {
     boost::unique_lock<boost::mutex> mempoolLock(m_mempoolMutex);
-    LOGGER(trace) << "Confirming " << m_currentMerkleTxHashes.size() << " merkle block transactions from " << m_mempoolTxs.size() << " mempool transactions..." << endl;
-    while (!m_currentMerkleTxHashes.empty() && m_mempoolTxs.count(m_currentMerkleTxHashes.front()))
+    LOGGER(trace) << "Confirming " << m_currentMerkleTxHashes.size() << " merkle block transactions from " << m_mempool.size() << " mempool transactions..." << endl;
+    while (!m_currentMerkleTxHashes.empty() && m_mempool.contains(m_currentMerkleTxHashes.front()))
     {
         const uchar_vector& txHash = m_currentMerkleTxHashes.front();
         LOGGER(trace) << "  Confirming tx (" << (m_currentMerkleTxIndex + 1) << " of " << m_currentMerkleTxCount << "): " << txHash.getHex() << endl;
@@ -918,8 +1115,315 @@ void NetworkSync::processMempoolConfirmations()
         notifyTxConfirmed(m_currentMerkleBlock, txHash, m_currentMerkleTxIndex++, m_currentMerkleTxCount);
 
         mempoolLock.lock();
-        m_mempoolTxs.erase(txHash);
+        Mempool::tx_ptr_t tx = m_mempool.get(txHash);
+        if (tx)     { confirmMempoolTx_unwrapped(*tx); }
+        else        { m_mempool.erase(txHash); updateMempoolMetrics_unwrapped(); }
         m_currentMerkleTxHashes.pop();
     }
     LOGGER(trace) << "Done processing mempool confirmations." << endl;
 }
+
+bool NetworkSync::insertMempoolTx_unwrapped(const Coin::Transaction& tx)
+{
+    static metrics::counter& duplicateCounter = metrics::get_counter("sync.mempool.duplicate_txs");
+
+    uint32_t now = time(NULL);
+    m_mempool.expire(now);
+    if (!m_mempool.insert(tx, now))
+    {
+        duplicateCounter.add();
+        return false;
+    }
+
+    updateMempoolMetrics_unwrapped();
+    return true;
+}
+
+void NetworkSync::confirmMempoolTx_unwrapped(const Coin::Transaction& tx)
+{
+    m_knownTxs.insert(tx.hash());
+    m_mempool.erase(tx.hash());
+
+    // Anything else spending the same outputs can never confirm now.
+    for (auto& conflict: m_mempool.eraseConflicts(tx))
+    {
+        LOGGER(debug) << "Dropped mempool transaction " << uchar_vector(conflict).getHex() << " conflicting with confirmed transaction " << tx.hash().getHex() << endl;
+    }
+
+    updateMempoolMetrics_unwrapped();
+}
+
+void NetworkSync::updateMempoolMetrics_unwrapped()
+{
+    static metrics::gauge& txsGauge = metrics::get_gauge("sync.mempool.txs");
+    static metrics::gauge& bytesGauge = metrics::get_gauge("sync.mempool.bytes");
+
+    txsGauge.set(m_mempool.size());
+    bytesGauge.set(m_mempool.bytes());
+}
+
+void NetworkSync::processCFHeaders(const Coin::CFHeadersMessage& cfheaders)
+{
+    LOGGER(trace) << "Received filter headers for " << cfheaders.filterHashes.size() << " blocks up to " << cfheaders.stopHash.getHex() << endl;
+
+    try
+    {
+        boost::lock_guard<boost::mutex> syncLock(m_syncMutex);
+        if (!m_bCompactFilters || m_cfStopHash.empty() || !m_cfFilterHashes.empty()) return;
+        if (cfheaders.filterType != Coin::GolombFilter::BASIC_FILTER_TYPE || cfheaders.stopHash != m_cfStopHash) return; // Not the batch we asked for.
+
+        if (cfheaders.filterHashes.size() != (size_t)(m_cfStopHeight - m_cfStartHeight + 1))
+            throw runtime_error("Peer sent the wrong number of filter headers.");
+
+        if (!m_cfPrevHeader.empty() && cfheaders.prevFilterHeader != m_cfPrevHeader)
+            throw runtime_error("Filter header chain conflicts with peer.");
+
+        uchar_vector header = cfheaders.prevFilterHeader;
+        for (auto& filterHash: cfheaders.filterHashes) { header = Coin::GolombFilter::getHeaderFromHash(filterHash, header); }
+
+        m_cfFilterHashes.assign(cfheaders.filterHashes.begin(), cfheaders.filterHashes.end());
+        m_cfPrevHeader = header;
+
+        LOGGER(trace) << "Asking for filters " << m_cfStartHeight << " - " << m_cfStopHeight << endl;
+        m_peer.getCFilters(Coin::GolombFilter::BASIC_FILTER_TYPE, m_cfStartHeight, m_cfStopHash);
+    }
+    catch (const exception& e)
+    {
+        LOGGER(error) << "NetworkSync - cfheaders error: " << e.what() << endl;
+        // TODO: propagate code
+        notifyProtocolError(e.what(), -1);
+    }
+}
+
+void NetworkSync::processCFilter(const Coin::CFilterMessage& cfilter)
+{
+    static metrics::counter& filtersReceived = metrics::get_counter("sync.cfilters");
+    static metrics::counter& filtersMatched = metrics::get_counter("sync.cfilters.matched");
+    static metrics::histogram& matchTime = metrics::get_histogram("sync.cfilters.match");
+
+    try
+    {
+        boost::unique_lock<boost::mutex> syncLock(m_syncMutex);
+        if (!m_bCompactFilters || m_cfFilterHashes.empty() || m_cfNextHeight > m_cfStopHeight) return;
+
+        // Filters arrive in height order. Anything else is left over from an earlier request.
+        const ChainHeader& header = m_blockTree.getHeader(m_cfNextHeight);
+        if (cfilter.filterType != Coin::GolombFilter::BASIC_FILTER_TYPE || cfilter.blockHash != header.hash())
+        {
+            LOGGER(trace) << "Ignoring filter for block " << cfilter.blockHash.getHex() << endl;
+            return;
+        }
+
+        Coin::GolombFilter filter(cfilter.blockHash, cfilter.filter);
+        if (filter.getHash() != m_cfFilterHashes[m_cfNextHeight - m_cfStartHeight])
+            throw runtime_error("Filter does not match its filter header.");
+
+        filtersReceived.add();
+
+        bool bMatched = false;
+        if (filter.getN() > 0 && !m_filterScripts.empty())
+        {
+            metrics::scoped_timer timer(matchTime);
+            filter.hashElements(m_filterScripts, m_hashedFilterScripts);
+            bMatched = filter.matchAnyHashed(m_hashedFilterScripts);
+        }
+
+        if (bMatched)
+        {
+            LOGGER(trace) << "Filter matched block " << cfilter.blockHash.getHex() << " height: " << m_cfNextHeight << endl;
+            filtersMatched.add();
+        }
+
+        m_cfPending.push_back(std::make_pair(m_cfNextHeight++, bMatched));
+        if (processCompactFilterQueue_unwrapped())
+        {
+            syncLock.unlock();
+            notifyBlocksSynched();
+        }
+    }
+    catch (const exception& e)
+    {
+        LOGGER(error) << "NetworkSync - cfilter error: " << e.what() << endl;
+        // TODO: propagate code
+        notifyProtocolError(e.what(), -1);
+    }
+}
+
+bool NetworkSync::processCompactFilterBlock(const Coin::CoinBlock& block)
+{
+    boost::unique_lock<boost::mutex> syncLock(m_syncMutex);
+    if (!m_bCompactFilters || m_cfRequestedBlockHash.empty() || block.hash() != m_cfRequestedBlockHash) return false;
+
+    try
+    {
+        syncCompactFilterBlock_unwrapped(block, m_blockTree.getHeader(m_cfPending.front().first));
+        m_cfPending.pop_front();
+        m_cfRequestedBlockHash.clear();
+
+        if (processCompactFilterQueue_unwrapped())
+        {
+            syncLock.unlock();
+            notifyBlocksSynched();
+        }
+    }
+    catch (const exception& e)
+    {
+        syncLock.unlock();
+        LOGGER(error) << "NetworkSync - compact filter block error: " << e.what() << endl;
+        // TODO: propagate code
+        notifyProtocolError(e.what(), -1);
+    }
+    return true;
+}
+
+void NetworkSync::followCompactFilterTip()
+{
+    try
+    {
+        boost::lock_guard<boost::mutex> syncLock(m_syncMutex);
+        if (!m_bCompactFilters || m_cfLastHash.empty()) return; // Not synching.
+
+        bool bReorg = !m_blockTree.hasHeader(m_cfLastHash) || !m_blockTree.getHeader(m_cfLastHash).inBestChain ||
+            (!m_cfStopHash.empty() && (!m_blockTree.hasHeader(m_cfStopHash) || !m_blockTree.getHeader(m_cfStopHash).inBestChain));
+
+        if (!bReorg && (!m_cfStopHash.empty() || m_cfLastHash == m_blockTree.getTip().hash())) return; // Still synching or nothing new.
+
+        if (bReorg)
+        {
+            LOGGER(trace) << "REORG - resynching compact filters..." << endl;
+            m_cfPrevHeader.clear();
+            m_cfFilterHashes.clear();
+            m_cfPending.clear();
+            m_cfRequestedBlockHash.clear();
+        }
+
+        m_lastSynchedMerkleBlockHash.clear();
+        notifySynchingBlocks();
+        requestCompactFilters_unwrapped(getCompactFilterResumeHeight_unwrapped());
+    }
+    catch (const exception& e)
+    {
+        LOGGER(error) << "NetworkSync - compact filter sync error: " << e.what() << endl;
+        // TODO: propagate code
+        notifyBlockTreeError(e.what(), -1);
+    }
+}
+
+void NetworkSync::requestCompactFilters_unwrapped(int startHeight)
+{
+    m_cfStartHeight = startHeight;
+    m_cfStopHeight = std::min(startHeight + CFILTER_BATCH_SIZE - 1, m_blockTree.getTipHeight());
+    m_cfNextHeight = startHeight;
+    m_cfStopHash = m_blockTree.getHeader(m_cfStopHeight).hash();
+    m_cfFilterHashes.clear();
+    m_lastRequestedMerkleBlockHash = m_cfStopHash;
+
+    LOGGER(trace) << "Asking for filter headers " << m_cfStartHeight << " - " << m_cfStopHeight << endl;
+    m_peer.getCFHeaders(Coin::GolombFilter::BASIC_FILTER_TYPE, m_cfStartHeight, m_cfStopHash);
+}
+
+bool NetworkSync::processCompactFilterQueue_unwrapped()
+{
+    // Blocks are passed on in order, so everything behind a matched block waits for it to download.
+    while (!m_cfPending.empty() && m_cfRequestedBlockHash.empty())
+    {
+        const ChainHeader& header = m_blockTree.getHeader(m_cfPending.front().first);
+        if (m_cfPending.front().second)
+        {
+            m_cfRequestedBlockHash = header.hash();
+            LOGGER(trace) << "Asking for block " << m_cfRequestedBlockHash.getHex() << endl;
+            m_peer.getBlock(m_cfRequestedBlockHash);
+            return false;
+        }
+
+        Coin::MerkleBlock merkleBlock(header, 0, std::vector<uchar_vector>(), uchar_vector());
+        notifyMerkleBlock(ChainMerkleBlock(merkleBlock, true, header.height, header.chainWork));
+        m_cfLastHash = header.hash();
+        m_cfPending.pop_front();
+    }
+
+    if (!m_cfPending.empty() || !m_cfRequestedBlockHash.empty() || m_cfNextHeight <= m_cfStopHeight) return false;
+
+    if (m_cfStopHeight < m_blockTree.getTipHeight())
+    {
+        requestCompactFilters_unwrapped(m_cfStopHeight + 1);
+        return false;
+    }
+
+    LOGGER(trace) << "Block sync detected from compact filters." << endl;
+    m_lastRequestedMerkleBlockHash.clear();
+    m_lastSynchedMerkleBlockHash = m_cfStopHash;
+    m_cfStopHash.clear();
+    m_cfFilterHashes.clear();
+    return true;
+}
+
+void NetworkSync::syncCompactFilterBlock_unwrapped(const Coin::CoinBlock& block, const ChainHeader& header)
+{
+    static metrics::counter& falsePositives = metrics::get_counter("sync.cfilters.false_positives");
+
+    if (!block.isValidMerkleRoot()) throw runtime_error("Block has invalid merkle root.");
+
+    // Pick out transactions paying to our scripts or spending outputs we know of, in block order so
+    // that spends of outputs created earlier in the same block are caught.
+    std::vector<Coin::MerkleLeaf> leaves;
+    std::vector<const Coin::Transaction*> txs;
+    for (auto& tx: block.txs)
+    {
+        uchar_vector txHash = tx.hash().getReverse(); // merkle trees use wire order
+        bool bRelevant = false;
+
+        for (auto& txIn: tx.inputs)
+        {
+            if (m_filterOutPoints.erase(outpoint_t(bytes_t(txIn.previousOut.hash, txIn.previousOut.hash + 32), txIn.previousOut.index))) { bRelevant = true; }
+        }
+
+        for (uint32_t i = 0; i < tx.outputs.size(); i++)
+        {
+            if (m_filterScriptSet.count(tx.outputs[i].scriptPubKey))
+            {
+                m_filterOutPoints.insert(outpoint_t(txHash, i));
+                bRelevant = true;
+            }
+        }
+
+        leaves.push_back(Coin::MerkleLeaf(txHash, bRelevant));
+        if (bRelevant) { txs.push_back(&tx); }
+    }
+
+    Coin::PartialMerkleTree merkleTree(leaves);
+    Coin::MerkleBlock merkleBlock(merkleTree, header.version(), header.prevBlockHash(), header.timestamp(), header.bits(), header.nonce());
+    if (merkleBlock.hash() != header.hash()) throw runtime_error("Block does not match its header.");
+
+    ChainMerkleBlock chainMerkleBlock(merkleBlock, true, header.height, header.chainWork);
+    LOGGER(trace) << "Synchronizing block " << header.hash().getHex() << " height: " << header.height << " transactions: " << txs.size() << " of " << block.txs.size() << endl;
+
+    if (txs.empty())
+    {
+        falsePositives.add();
+        notifyMerkleBlock(chainMerkleBlock);
+    }
+    else
+    {
+        unsigned int i = 0;
+        for (auto tx: txs)
+        {
+            notifyMerkleTx(chainMerkleBlock, *tx, i++, txs.size());
+
+            boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
+            confirmMempoolTx_unwrapped(*tx);
+        }
+    }
+
+    m_cfLastHash = header.hash();
+}
+
+int NetworkSync::getCompactFilterResumeHeight_unwrapped() const
+{
+    if (m_cfLastHash.empty()) return 0;
+
+    // Walk back to where the last block passed on meets the best chain.
+    const ChainHeader* pHeader = &m_blockTree.getHeader(m_cfLastHash);
+    while (!pHeader->inBestChain) { pHeader = &m_blockTree.getHeader(pHeader->prevBlockHash()); }
+    return pHeader->height + 1;
+}
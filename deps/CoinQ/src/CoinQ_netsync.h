@@ -18,6 +18,7 @@
 #include "CoinQ_peer_io.h"
 #include "CoinQ_blocks.h"
 #include "CoinQ_filter.h"
+#include "CoinQ_mempool.h"
 
 #include "CoinQ_signals.h"
 #include "CoinQ_slots.h"
@@ -30,7 +31,9 @@
 #include <CoinCore/typedefs.h>
 #include <CoinCore/BloomFilter.h>
 
+#include <deque>
 #include <queue>
+#include <set>
 
 typedef Coin::Transaction coin_tx_t;
 typedef ChainHeader chain_header_t;
@@ -61,6 +64,9 @@ public:
 
     void enableCheckProofOfWork(bool bCheckProofOfWork = true) { m_bCheckProofOfWork = bCheckProofOfWork; }
 
+    // Records all peer traffic to a file that PeerReplay can play back. Empty to stop capturing.
+    void setCaptureFile(const std::string& captureFile);
+
     void loadHeaders(const std::string& blockTreeFile, bool bCheckProofOfWork = true, CoinQBlockTreeMem::callback_t callback = nullptr);
     bool headersSynched() const { return m_bHeadersSynched; }
     int getBestHeight() const;
@@ -83,6 +89,17 @@ public:
     void setBloomFilter(const Coin::BloomFilter& bloomFilter);
     void clearBloomFilter();
 
+    // Switches block sync to BIP157/158 compact filters: filters are fetched
+    // and matched against scripts locally and only matching blocks are
+    // downloaded in full. Transactions are passed on if they pay to one of
+    // the scripts or spend one of the outpoints, or an output found earlier.
+    // Blocks ruled out by their filter are passed on as merkle blocks with
+    // no transactions. Calling again replaces the scripts and adds outpoints.
+    void setFilterScripts(const std::vector<bytes_t>& scripts, const std::vector<Coin::OutPoint>& outpoints);
+    void clearFilterScripts(); // back to bloom filters
+    bool usingCompactFilters() const { return m_bCompactFilters; }
+    bool peerServesCompactFilters() const { return (m_peer.services() & NODE_COMPACT_FILTERS) != 0; }
+
     void syncBlocks(const std::vector<bytes_t>& locatorHashes, uint32_t startTime);
     void syncBlocks(int startHeight);
     void stopSynchingBlocks(bool bClearFilter = true);
@@ -90,6 +107,10 @@ public:
     // TRANSACTIONS PUSHED OFF CHAIN MUST BE ADDED BACK TO MEMPOOL
     void addToMempool(const uchar_vector& txHash);
 
+    // Forgets all mempool transactions and known inventory, e.g. when switching vaults.
+    void clearMempool();
+    size_t getMempoolSize() const;
+
     // FOR TESTING
     void insertTx(const Coin::Transaction& tx);
     void insertMerkleBlock(const Coin::MerkleBlock& merkleBlock, const std::vector<Coin::Transaction>& txs);
@@ -101,6 +122,11 @@ public:
     void getMempool();
     void getFilteredBlock(const bytes_t& hash);
 
+    // FOR TESTING - as if received from the peer
+    void insertCFHeaders(const Coin::CFHeadersMessage& cfheaders);
+    void insertCFilter(const Coin::CFilterMessage& cfilter);
+    void insertBlock(const Coin::CoinBlock& block);
+
     // SYNC EVENT SUBSCRIPTIONS
     void subscribeStarted(void_slot_t slot) { notifyStarted.connect(slot); }
     void subscribeStopped(void_slot_t slot) { notifyStopped.connect(slot); }
@@ -162,6 +188,7 @@ private:
     CoinQBlockTreeMem m_blockTree;
     bool m_blockTreeLoaded;
     bool m_bHeadersSynched;
+    bool m_bHeadersFailed;
 
     uchar_vector m_lastRequestedBlockHash;
     uchar_vector m_lastRequestedMerkleBlockHash;
@@ -173,9 +200,41 @@ private:
 
     void initBlockFilter();
 
+    // Compact filter state, guarded by m_syncMutex
+    typedef std::pair<bytes_t, uint32_t> outpoint_t; // txhash in wire order, index
+
+    bool m_bCompactFilters;
+    std::vector<uchar_vector> m_filterScripts;
+    std::set<bytes_t> m_filterScriptSet;
+    std::set<outpoint_t> m_filterOutPoints;
+    std::vector<uint64_t> m_hashedFilterScripts;    // reused across filters
+
+    int m_cfStartHeight;                            // current batch
+    int m_cfStopHeight;
+    int m_cfNextHeight;                             // next filter expected
+    uchar_vector m_cfStopHash;
+    std::vector<bytes_t> m_cfFilterHashes;          // from cfheaders, for the current batch
+    uchar_vector m_cfPrevHeader;                    // filter header at the end of the last cfheaders batch, empty if not yet known
+    std::deque<std::pair<int, bool>> m_cfPending;   // heights filtered but not yet passed on, and whether they matched
+    uchar_vector m_cfRequestedBlockHash;
+    uchar_vector m_cfLastHash;                      // last block passed on
+
+    void processCFHeaders(const Coin::CFHeadersMessage& cfheaders);
+    void processCFilter(const Coin::CFilterMessage& cfilter);
+    bool processCompactFilterBlock(const Coin::CoinBlock& block); // Returns false if it is not a block we asked for.
+    void followCompactFilterTip(); // after headers sync, catch up to a new tip or recover from a reorg
+
+    // Call with m_syncMutex held.
+    void requestCompactFilters_unwrapped(int startHeight);
+    bool processCompactFilterQueue_unwrapped(); // Returns true once synched to the tip.
+    void syncCompactFilterBlock_unwrapped(const Coin::CoinBlock& block, const ChainHeader& header);
+    int getCompactFilterResumeHeight_unwrapped() const;
+
     // Merkle block state
     mutable boost::mutex m_mempoolMutex;
-    std::set<bytes_t> m_mempoolTxs;
+    RollingFilter m_knownTxs;       // transactions received, so announcements aren't downloaded again
+    RequestTracker m_txRequests;    // transactions asked for and not yet received
+    Mempool m_mempool;              // unconfirmed transactions already passed on
     ChainMerkleBlock m_currentMerkleBlock;
     std::queue<bytes_t> m_currentMerkleTxHashes;
     unsigned int m_currentMerkleTxIndex;
@@ -186,6 +245,11 @@ private:
     void processBlockTx(const Coin::Transaction& tx);
     void processMempoolConfirmations();
 
+    // Call with m_mempoolMutex held.
+    bool insertMempoolTx_unwrapped(const Coin::Transaction& tx); // Returns false if already in the mempool.
+    void confirmMempoolTx_unwrapped(const Coin::Transaction& tx);
+    void updateMempoolMetrics_unwrapped();
+
     // Sync signals
     CoinQSignal<void> notifyStarted;
     CoinQSignal<void> notifyStopped;
@@ -0,0 +1,298 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_peer_capture.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "CoinQ_peer_capture.h"
+
+#include <CoinCore/CoinNodeData.h>
+#include <CoinCore/numericdata.h>
+
+#include <logger/logger.h>
+
+#include <stdexcept>
+
+using namespace CoinQ;
+using namespace std;
+
+namespace
+{
+
+const char CAPTURE_MAGIC[] = "CoinQcap";
+const size_t CAPTURE_MAGIC_SIZE = 8;
+const uint32_t CAPTURE_VERSION = 1;
+const size_t RECORD_HEADER_SIZE = 13;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+//
+// PeerCapture
+//
+PeerCapture::PeerCapture(const std::string& filename) :
+    m_filename(filename),
+    m_file(filename, std::ios::binary | std::ios::trunc),
+    m_start(std::chrono::steady_clock::now())
+{
+    if (!m_file.good()) throw runtime_error("PeerCapture - failed to open " + filename + ".");
+
+    uchar_vector header((const unsigned char*)CAPTURE_MAGIC, (const unsigned char*)CAPTURE_MAGIC + CAPTURE_MAGIC_SIZE);
+    header += uint_to_vch(CAPTURE_VERSION, LITTLE_ENDIAN_);
+    m_file.write((const char*)&header[0], header.size());
+
+    LOGGER(debug) << "PeerCapture - capturing to " << filename << endl;
+}
+
+PeerCapture::~PeerCapture()
+{
+    m_file.flush();
+}
+
+void PeerCapture::write(direction_t direction, const unsigned char* data, size_t size)
+{
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+
+    uchar_vector header;
+    header.push_back((unsigned char)direction);
+    header += uint_to_vch(micros, LITTLE_ENDIAN_);
+    header += uint_to_vch((uint32_t)size, LITTLE_ENDIAN_);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file.write((const char*)&header[0], header.size());
+    m_file.write((const char*)data, size);
+    if (!m_file.good()) { LOGGER(error) << "PeerCapture - failed to write to " << m_filename << endl; }
+}
+
+std::vector<PeerCapture::Record> PeerCapture::load(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.good()) throw runtime_error("PeerCapture - failed to open " + filename + ".");
+
+    uchar_vector header(CAPTURE_MAGIC_SIZE + 4);
+    if (!file.read((char*)&header[0], header.size()) ||
+        !std::equal(header.begin(), header.begin() + CAPTURE_MAGIC_SIZE, (const unsigned char*)CAPTURE_MAGIC))
+        throw runtime_error("PeerCapture - " + filename + " is not a capture file.");
+
+    uint32_t version = vch_to_uint<uint32_t>(uchar_vector(header.begin() + CAPTURE_MAGIC_SIZE, header.end()), LITTLE_ENDIAN_);
+    if (version != CAPTURE_VERSION) throw runtime_error("PeerCapture - unsupported capture file version.");
+
+    std::vector<Record> records;
+    uchar_vector recordHeader(RECORD_HEADER_SIZE);
+    while (file.read((char*)&recordHeader[0], RECORD_HEADER_SIZE))
+    {
+        Record record;
+        record.direction = recordHeader[0] == OUTBOUND ? OUTBOUND : INBOUND;
+        record.micros = vch_to_uint<uint64_t>(uchar_vector(recordHeader.begin() + 1, recordHeader.begin() + 9), LITTLE_ENDIAN_);
+        uint32_t size = vch_to_uint<uint32_t>(uchar_vector(recordHeader.begin() + 9, recordHeader.end()), LITTLE_ENDIAN_);
+        record.message.resize(size);
+        if (size > 0 && !file.read((char*)&record.message[0], size))
+        {
+            // A capture cut short by a crash is still useful up to the last whole record.
+            LOGGER(warning) << "PeerCapture - ignoring truncated record at the end of " << filename << endl;
+            break;
+        }
+        records.push_back(std::move(record));
+    }
+
+    return records;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+//
+// PeerReplay
+//
+PeerReplay::PeerReplay(const std::string& captureFile, bool bRecordedPacing) :
+    m_bRecordedPacing(bRecordedPacing),
+    m_acceptor(m_ioService),
+    m_socket(m_ioService),
+    m_port(0),
+    m_bRunning(false),
+    m_bStopping(false),
+    m_bAccepted(false),
+    m_bClientClosed(false),
+    m_bDone(false)
+{
+    uint64_t requests = 0;
+    for (auto& record: PeerCapture::load(captureFile))
+    {
+        if (record.direction == PeerCapture::OUTBOUND)
+        {
+            requests++;
+            continue;
+        }
+
+        Message message;
+        message.micros = record.micros;
+        message.requestsBefore = requests;
+        message.data = std::move(record.message);
+        m_messages.push_back(std::move(message));
+    }
+
+    LOGGER(debug) << "PeerReplay - loaded " << m_messages.size() << " inbound and " << requests << " outbound message(s) from " << captureFile << endl;
+}
+
+PeerReplay::~PeerReplay()
+{
+    stop();
+}
+
+void PeerReplay::start()
+{
+    if (m_bRunning) throw runtime_error("PeerReplay - already started.");
+
+    using boost::asio::ip::tcp;
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), 0);
+    m_acceptor.open(endpoint.protocol());
+    m_acceptor.bind(endpoint);
+    m_acceptor.listen();
+    m_port = m_acceptor.local_endpoint().port();
+
+    m_bStopping = false;
+    m_bAccepted = false;
+    m_bClientClosed = false;
+    m_bDone = false;
+    m_stats = Stats();
+    m_bRunning = true;
+    m_serverThread = std::thread(&PeerReplay::serve, this);
+
+    LOGGER(debug) << "PeerReplay - listening on port " << m_port << endl;
+}
+
+void PeerReplay::stop()
+{
+    if (!m_bRunning) return;
+
+    bool bAccepted;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStopping = true;
+        bAccepted = m_bAccepted;
+        m_condition.notify_all();
+    }
+
+    boost::system::error_code ec;
+    if (bAccepted)
+    {
+        // Wakes the reader and any write in progress.
+        m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+    }
+    else
+    {
+        // Closing the acceptor does not wake a blocked accept everywhere, but a connection does.
+        boost::asio::ip::tcp::socket waker(m_ioService);
+        waker.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), m_port), ec);
+    }
+
+    m_serverThread.join();
+    if (m_readerThread.joinable()) { m_readerThread.join(); }
+
+    m_socket.close(ec);
+    m_acceptor.close(ec);
+    m_bRunning = false;
+}
+
+PeerReplay::Stats PeerReplay::getStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void PeerReplay::serve()
+{
+    boost::system::error_code ec;
+    m_acceptor.accept(m_socket, ec);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (ec || m_bStopping)
+        {
+            if (ec) { LOGGER(error) << "PeerReplay - accept failed: " << ec.message() << endl; }
+            m_bDone = true;
+            return;
+        }
+        m_bAccepted = true;
+    }
+    m_readerThread = std::thread(&PeerReplay::readRequests, this);
+
+    LOGGER(debug) << "PeerReplay - client connected, replaying " << m_messages.size() << " message(s)." << endl;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (auto& message: m_messages)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_bStopping && !m_bClientClosed && m_stats.messagesReceived < message.requestsBefore)
+            {
+                uint64_t received = m_stats.messagesReceived;
+                if (!m_condition.wait_for(lock, std::chrono::milliseconds(STALL_TIMEOUT_MS), [&]() { return m_bStopping || m_bClientClosed || m_stats.messagesReceived != received; }))
+                {
+                    LOGGER(debug) << "PeerReplay - no request from client, sending message " << m_stats.messagesSent << " anyway." << endl;
+                    m_stats.stalls++;
+                    break;
+                }
+            }
+
+            if (m_bRecordedPacing)
+            {
+                m_condition.wait_until(lock, start + std::chrono::microseconds(message.micros), [this]() { return m_bStopping || m_bClientClosed; });
+            }
+
+            if (m_bStopping || m_bClientClosed) break;
+        }
+
+        boost::asio::write(m_socket, boost::asio::buffer(message.data), ec);
+        if (ec)
+        {
+            LOGGER(debug) << "PeerReplay - write failed: " << ec.message() << endl;
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.messagesSent++;
+        m_stats.bytesSent += message.data.size();
+    }
+
+    LOGGER(debug) << "PeerReplay - done." << endl;
+    m_bDone = true;
+}
+
+// Only counts the client's messages. Their contents do not matter for playback.
+void PeerReplay::readRequests()
+{
+    unsigned char buffer[65536];
+    uchar_vector pending;
+    while (true)
+    {
+        boost::system::error_code ec;
+        size_t bytes = m_socket.read_some(boost::asio::buffer(buffer), ec);
+        if (ec) break;
+
+        pending.insert(pending.end(), buffer, buffer + bytes);
+        uint64_t messages = 0;
+        size_t offset = 0;
+        while (pending.size() - offset >= MIN_MESSAGE_HEADER_SIZE)
+        {
+            uint32_t payloadSize = vch_to_uint<uint32_t>(uchar_vector(pending.begin() + offset + 16, pending.begin() + offset + 20), LITTLE_ENDIAN_);
+            if (pending.size() - offset < MIN_MESSAGE_HEADER_SIZE + payloadSize) break;
+            offset += MIN_MESSAGE_HEADER_SIZE + payloadSize;
+            messages++;
+        }
+        pending.erase(pending.begin(), pending.begin() + offset);
+
+        if (messages)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.messagesReceived += messages;
+            m_condition.notify_all();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bClientClosed = true;
+    m_condition.notify_all();
+}
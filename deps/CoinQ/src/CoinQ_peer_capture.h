@@ -0,0 +1,136 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_peer_capture.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include <stdutils/uchar_vector.h>
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace CoinQ {
+
+// Records every framed message a Peer sends and receives, so that a sync can
+// be played back later without a live peer.
+//
+// Files start with "CoinQcap" and a 4 byte version, followed by one record per
+// message: a direction byte, 8 bytes of microseconds since the capture was
+// opened, a 4 byte size and the message as it went over the wire. All integers
+// are little endian.
+class PeerCapture
+{
+public:
+    enum direction_t { INBOUND = 0, OUTBOUND = 1 };
+
+    struct Record
+    {
+        direction_t direction;
+        uint64_t micros;
+        uchar_vector message;
+    };
+
+    // Truncates the file.
+    explicit PeerCapture(const std::string& filename);
+    ~PeerCapture();
+
+    // Called from the peer's io thread and from senders, so thread safe.
+    void write(direction_t direction, const unsigned char* data, size_t size);
+
+    const std::string& getFileName() const { return m_filename; }
+
+    static std::vector<Record> load(const std::string& filename);
+
+private:
+    std::string m_filename;
+    std::mutex m_mutex;
+    std::ofstream m_file;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// A stand-in peer that plays back the inbound side of a capture to whoever
+// connects to it on the loopback interface.
+//
+// Each message is held back until the client has sent as many messages as it
+// had when the message was captured, so responses never overtake the requests
+// they answer. A client whose requests diverge from the capture would wait
+// forever, so after STALL_TIMEOUT_MS without a new request the next message is
+// sent anyway and counted as a stall. With recorded pacing, messages are also
+// held back until their captured time since the start.
+class PeerReplay
+{
+public:
+    static const unsigned int STALL_TIMEOUT_MS = 1000;
+
+    struct Stats
+    {
+        Stats() : messagesSent(0), bytesSent(0), messagesReceived(0), stalls(0) { }
+
+        uint64_t messagesSent;
+        uint64_t bytesSent;
+        uint64_t messagesReceived;
+        uint64_t stalls;
+    };
+
+    explicit PeerReplay(const std::string& captureFile, bool bRecordedPacing = false);
+    ~PeerReplay();
+
+    // Listens on an ephemeral loopback port and serves a single connection.
+    void start();
+    void stop();
+
+    unsigned short getPort() const { return m_port; }
+
+    // All inbound messages have been sent or the client went away.
+    bool done() const { return m_bDone; }
+
+    size_t getMessageCount() const { return m_messages.size(); }
+    Stats getStats() const;
+
+private:
+    struct Message
+    {
+        uint64_t micros;
+        uint64_t requestsBefore; // outbound messages captured ahead of this one
+        uchar_vector data;
+    };
+
+    void serve();
+    void readRequests();
+
+    std::vector<Message> m_messages;
+    bool m_bRecordedPacing;
+
+    boost::asio::io_service m_ioService;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    boost::asio::ip::tcp::socket m_socket;
+    unsigned short m_port;
+
+    std::thread m_serverThread;
+    std::thread m_readerThread;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_bRunning;
+    bool m_bStopping;
+    bool m_bAccepted;
+    bool m_bClientClosed;
+    std::atomic<bool> m_bDone;
+    Stats m_stats;
+};
+
+}
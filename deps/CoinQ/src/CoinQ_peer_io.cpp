@@ -11,11 +11,83 @@
 
 #include "CoinQ_peer_io.h"
 
+#include <CoinCore/hash.h>
+
+#include <logger/metrics.h>
+
 #include <sstream>
+#include <chrono>
+#include <memory>
+#include <vector>
 
 using namespace CoinQ;
 using namespace std;
 
+namespace
+{
+
+// Metrics for one command, looked up once so recording a message is only
+// atomic updates.
+struct CommandMetrics
+{
+    explicit CommandMetrics(const std::string& command)
+        : recvBytes(metrics::get_counter("peer.recv." + command + ".bytes"))
+        , recvTime(metrics::get_histogram("peer.recv." + command))
+        , sendBytes(metrics::get_counter("peer.send." + command + ".bytes"))
+        , sendMessages(metrics::get_counter("peer.send." + command + ".messages")) { }
+
+    metrics::counter& recvBytes;
+    metrics::histogram& recvTime;
+    metrics::counter& sendBytes;
+    metrics::counter& sendMessages;
+};
+
+// Commands we send or handle get their own metrics. Anything else a peer sends is
+// lumped together so a misbehaving peer cannot create unbounded metric names.
+const char* const KNOWN_COMMANDS[] =
+{
+    "version", "verack", "inv", "getdata", "getblocks", "getheaders", "tx", "block", "merkleblock", "headers",
+    "addr", "mempool", "ping", "pong", "filterload", "getcfilters", "cfilter", "getcfheaders", "cfheaders"
+};
+const std::size_t KNOWN_COMMAND_COUNT = sizeof(KNOWN_COMMANDS) / sizeof(KNOWN_COMMANDS[0]);
+
+CommandMetrics& commandMetrics(const std::string& command)
+{
+    // Built on first use; function statics are initialized once even with concurrent callers
+    static std::vector<std::unique_ptr<CommandMetrics>> table = []()
+    {
+        std::vector<std::unique_ptr<CommandMetrics>> table;
+        for (auto name: KNOWN_COMMANDS) { table.emplace_back(new CommandMetrics(name)); }
+        table.emplace_back(new CommandMetrics("other"));
+        return table;
+    }();
+
+    for (std::size_t i = 0; i < KNOWN_COMMAND_COUNT; i++) { if (command == KNOWN_COMMANDS[i]) return *table[i]; }
+    return *table.back();
+}
+
+void recordReceived(const std::string& command, uint64_t bytes, std::chrono::steady_clock::time_point start)
+{
+    static metrics::counter& totalBytes = metrics::get_counter("peer.recv.bytes");
+    totalBytes.add(bytes);
+
+    CommandMetrics& m = commandMetrics(command);
+    m.recvBytes.add(bytes);
+    m.recvTime.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void recordSent(const std::string& command, uint64_t bytes)
+{
+    static metrics::counter& totalBytes = metrics::get_counter("peer.send.bytes");
+    totalBytes.add(bytes);
+
+    CommandMetrics& m = commandMetrics(command);
+    m.sendBytes.add(bytes);
+    m.sendMessages.add();
+}
+
+}
+
 const unsigned char Peer::DEFAULT_Ipv6[] = {0,0,0,0,0,0,0,0,0,0,255,255,127,0,0,1};
 
 void Peer::do_handshake()
@@ -116,6 +188,18 @@ void Peer::do_read()
                 break;
             }
 
+            if (capture_) { capture_->write(PeerCapture::INBOUND, &read_message[0], MIN_MESSAGE_HEADER_SIZE + payloadSize); }
+
+            // Decode and handling time, including our subscribers
+            std::chrono::steady_clock::time_point messageStart = std::chrono::steady_clock::now();
+            if (bRawBlocks_ && std::string((const char*)command) == "block")
+            {
+                readRawBlock(payloadSize);
+                recordReceived((const char*)command, MIN_MESSAGE_HEADER_SIZE + payloadSize, messageStart);
+                read_message.assign(read_message.begin() + MIN_MESSAGE_HEADER_SIZE + payloadSize, read_message.end());
+                continue;
+            }
+
             try
             {
                 Coin::CoinNodeMessage peerMessage(read_message);
@@ -141,6 +225,9 @@ void Peer::do_read()
                     LOGGER(trace) << "Peer read handler - VERSION" << std::endl;
 
                     // TODO: Check version information
+                    Coin::VersionMessage* pVersion = static_cast<Coin::VersionMessage*>(peerMessage.getPayload());
+                    services_ = pVersion->services();
+
                     Coin::VerackMessage verackMessage;
                     Coin::CoinNodeMessage msg(magic_bytes_, &verackMessage);
                     do_send(msg);
@@ -187,6 +274,20 @@ void Peer::do_read()
                     Coin::HeadersMessage* pHeaders = static_cast<Coin::HeadersMessage*>(peerMessage.getPayload());
                     notifyHeaders(*this, *pHeaders);
                 }
+                else if (command == "cfilter")
+                {
+                    LOGGER(trace) << "Peer read handler - CFILTER" << std::endl;
+
+                    Coin::CFilterMessage* pCFilter = static_cast<Coin::CFilterMessage*>(peerMessage.getPayload());
+                    notifyCFilter(*this, *pCFilter);
+                }
+                else if (command == "cfheaders")
+                {
+                    LOGGER(trace) << "Peer read handler - CFHEADERS" << std::endl;
+
+                    Coin::CFHeadersMessage* pCFHeaders = static_cast<Coin::CFHeadersMessage*>(peerMessage.getPayload());
+                    notifyCFHeaders(*this, *pCFHeaders);
+                }
                 else if (command == "ping")
                 {
                     LOGGER(trace) << "Peer read handler - PING" << std::endl;
@@ -215,6 +316,7 @@ void Peer::do_read()
                 notifyProtocolError(*this, err.str(), -1);
                 min_read_bytes = MIN_MESSAGE_HEADER_SIZE;
             }
+            recordReceived((const char*)command, MIN_MESSAGE_HEADER_SIZE + payloadSize, messageStart);
 
             read_message.assign(read_message.begin() + MIN_MESSAGE_HEADER_SIZE + payloadSize, read_message.end());
             LOGGER(debug) << "Peer read handler - remaining message bytes: " << read_message.size() << endl;
@@ -224,15 +326,44 @@ void Peer::do_read()
     }));
 }
 
+void Peer::readRawBlock(unsigned int payloadSize)
+{
+    LOGGER(trace) << "Peer read handler - BLOCK (raw)" << std::endl;
+
+    uchar_vector payload(read_message.begin() + MIN_MESSAGE_HEADER_SIZE, read_message.begin() + MIN_MESSAGE_HEADER_SIZE + payloadSize);
+    uint32_t checksum = vch_to_uint<uint32_t>(uchar_vector(read_message.begin() + 20, read_message.begin() + 24), LITTLE_ENDIAN_);
+    uchar_vector hash = sha256_2(payload);
+    if (vch_to_uint<uint32_t>(uchar_vector(hash.begin(), hash.begin() + 4), LITTLE_ENDIAN_) != checksum)
+    {
+        LOGGER(error) << "Peer read handler error: Message decode error: Invalid checksum." << std::endl;
+        notifyProtocolError(*this, "Message decode error: Invalid checksum.", -1);
+        return;
+    }
+
+    try
+    {
+        notifyRawBlock(*this, payload);
+    }
+    catch (const std::exception& e)
+    {
+        LOGGER(error) << "Peer read handler error: " << e.what() << std::endl;
+        notifyProtocolError(*this, e.what(), -1);
+    }
+}
+
 void Peer::do_write(boost::shared_ptr<uchar_vector> data)
 {
     if (!bRunning) return;
 
+    std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
     boost::asio::async_write(socket_, boost::asio::buffer(*data), boost::asio::transfer_all(),
-    strand_.wrap([this](const boost::system::error_code& ec, std::size_t bytes_written) {
+    strand_.wrap([this, writeStart](const boost::system::error_code& ec, std::size_t bytes_written) {
         if (!bRunning) return;
         LOGGER(trace) << "Peer write handler." << std::endl;
 
+        static metrics::histogram& writeTime = metrics::get_histogram("peer.write");
+        writeTime.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - writeStart).count());
+
         if (ec)
         {
             if (ec == boost::asio::error::operation_aborted) return;
@@ -252,6 +383,8 @@ void Peer::do_write(boost::shared_ptr<uchar_vector> data)
 void Peer::do_send(const Coin::CoinNodeMessage& message)
 {
     boost::shared_ptr<uchar_vector> data(new uchar_vector(message.getSerialized()));
+    recordSent(message.getCommand(), data->size());
+    if (capture_) { capture_->write(PeerCapture::OUTBOUND, &(*data)[0], data->size()); }
     // LOGGER(trace) << "do_send() - data: " << data->getHex() << std::endl;
     boost::lock_guard<boost::mutex> sendLock(sendMutex);
     sendQueue.push(data);
@@ -315,6 +448,7 @@ void Peer::start()
     bRunning = true;
     bHandshakeComplete = false;
     bWriteReady = false;
+    services_ = 0;
     read_message.clear();
     min_read_bytes = MIN_MESSAGE_HEADER_SIZE;
 
@@ -13,12 +13,15 @@
 
 #include "CoinQ_signals.h"
 #include "CoinQ_slots.h"
+#include "CoinQ_peer_capture.h"
 
 #include <CoinCore/typedefs.h>
 #include <CoinCore/numericdata.h>
 
 #include <logger/logger.h>
 
+#include <atomic>
+#include <memory>
 #include <queue>
 
 #include <boost/shared_ptr.hpp>
@@ -56,10 +59,13 @@ typedef std::function<void(Peer&, const std::string&, int)>         peer_error_s
 typedef std::function<void(Peer&, const Coin::CoinNodeMessage&)>    peer_message_slot_t;
 typedef std::function<void(Peer&, const Coin::HeadersMessage&)>     peer_headers_slot_t;
 typedef std::function<void(Peer&, const Coin::CoinBlock&)>          peer_block_slot_t;
+typedef std::function<void(Peer&, const uchar_vector&)>             peer_raw_block_slot_t;
 typedef std::function<void(Peer&, const Coin::MerkleBlock&)>        peer_merkle_block_slot_t;
 typedef std::function<void(Peer&, const Coin::Transaction&)>        peer_tx_slot_t;
 typedef std::function<void(Peer&, const Coin::AddrMessage&)>        peer_addr_slot_t;
 typedef std::function<void(Peer&, const Coin::Inventory&)>          peer_inv_slot_t; 
+typedef std::function<void(Peer&, const Coin::CFilterMessage&)>     peer_cfilter_slot_t;
+typedef std::function<void(Peer&, const Coin::CFHeadersMessage&)>   peer_cfheaders_slot_t;
 
 
 class Peer
@@ -79,6 +85,8 @@ public:
         start_height_(start_height),
         relay_(relay),
         invFlags_(invFlags),
+        bRawBlocks_(false),
+        services_(0),
         bRunning(false)
     {
         magic_bytes_vector_ = uint_to_vch(magic_bytes_, LITTLE_ENDIAN_);
@@ -102,13 +110,23 @@ public:
 
     void setInvFlags(uint32_t invFlags) { invFlags_ = invFlags; }
 
+    // Blocks are then passed serialized to raw block subscribers instead of block subscribers,
+    // so that deserializing them can be left to other threads.
+    void setRawBlocks(bool bRawBlocks) { bRawBlocks_ = bRawBlocks; }
+
+    // Every framed message sent or received is then written to the capture. Call while stopped.
+    void setCapture(std::shared_ptr<PeerCapture> capture) { capture_ = capture; }
+
     void subscribeMessage(peer_message_slot_t slot) { notifyMessage.connect(slot); }
     void subscribeHeaders(peer_headers_slot_t slot) { notifyHeaders.connect(slot); }
     void subscribeBlock(peer_block_slot_t slot) { notifyBlock.connect(slot); }
+    void subscribeRawBlock(peer_raw_block_slot_t slot) { notifyRawBlock.connect(slot); }
     void subscribeMerkleBlock(peer_merkle_block_slot_t slot) { notifyMerkleBlock.connect(slot); }
     void subscribeTx(peer_tx_slot_t slot) { notifyTx.connect(slot); }
     void subscribeAddr(peer_addr_slot_t slot) { notifyAddr.connect(slot); }
     void subscribeInv(peer_inv_slot_t slot) { notifyInv.connect(slot); }
+    void subscribeCFilter(peer_cfilter_slot_t slot) { notifyCFilter.connect(slot); }
+    void subscribeCFHeaders(peer_cfheaders_slot_t slot) { notifyCFHeaders.connect(slot); }
     void subscribeProtocolError(peer_error_slot_t slot) { notifyProtocolError.connect(slot); }
 
     void subscribeStart(peer_slot_t slot) { notifyStart.connect(slot); }
@@ -133,6 +151,9 @@ public:
 
     uint32_t inv_flags() const { return invFlags_; }
 
+    // Service bits from the peer's version message, or 0 before the handshake.
+    uint64_t services() const { return services_; }
+
     void getTx(const bytes_t& hash)
     {
         if (hash.size() != 32)
@@ -278,6 +299,37 @@ public:
         getBlocks(locatorHashes);
     }
 
+    // BIP157 compact filters for the blocks from startHeight up to and including stopHash.
+    void getCFilters(uint8_t filterType, uint32_t startHeight, const uchar_vector& stopHash)
+    {
+        if (stopHash.size() != 32)
+        {
+            std::stringstream err;
+            err << "Invalid stop hash: " << uchar_vector(stopHash).getHex();
+            LOGGER(error) << "Peer::getCFilters() - " << err.str() << std::endl;
+            notifyProtocolError(*this, err.str(), -1);
+            return;
+        }
+
+        Coin::GetCFiltersMessage getCFilters(filterType, startHeight, stopHash);
+        send(getCFilters);
+    }
+
+    void getCFHeaders(uint8_t filterType, uint32_t startHeight, const uchar_vector& stopHash)
+    {
+        if (stopHash.size() != 32)
+        {
+            std::stringstream err;
+            err << "Invalid stop hash: " << uchar_vector(stopHash).getHex();
+            LOGGER(error) << "Peer::getCFHeaders() - " << err.str() << std::endl;
+            notifyProtocolError(*this, err.str(), -1);
+            return;
+        }
+
+        Coin::GetCFHeadersMessage getCFHeaders(filterType, startHeight, stopHash);
+        send(getCFHeaders);
+    }
+
     void getMempool()
     {
         Coin::BlankMessage mempool("mempool");
@@ -313,6 +365,9 @@ private:
 
     // Protocol flags
     uint32_t invFlags_;
+    bool bRawBlocks_;
+    std::shared_ptr<PeerCapture> capture_;
+    std::atomic<uint64_t> services_;
 
     // State members
     boost::shared_mutex mutex;
@@ -327,10 +382,13 @@ private:
     CoinQSignal<Peer&, const Coin::CoinNodeMessage&>    notifyMessage;
     CoinQSignal<Peer&, const Coin::HeadersMessage&>     notifyHeaders;
     CoinQSignal<Peer&, const Coin::CoinBlock&>          notifyBlock;
+    CoinQSignal<Peer&, const uchar_vector&>             notifyRawBlock;
     CoinQSignal<Peer&, const Coin::MerkleBlock&>        notifyMerkleBlock;
     CoinQSignal<Peer&, const Coin::Transaction&>        notifyTx;
     CoinQSignal<Peer&, const Coin::AddrMessage&>        notifyAddr;
     CoinQSignal<Peer&, const Coin::Inventory&>          notifyInv;
+    CoinQSignal<Peer&, const Coin::CFilterMessage&>     notifyCFilter;
+    CoinQSignal<Peer&, const Coin::CFHeadersMessage&>   notifyCFHeaders;
     CoinQSignal<Peer&, const std::string&, int>         notifyProtocolError;
 
     CoinQSignal<Peer&>                                  notifyStart;
@@ -352,6 +410,7 @@ private:
 
     void do_connect(tcp::resolver::iterator iter);
     void do_read();
+    void readRawBlock(unsigned int payloadSize); // from the front of read_message
     void do_write(boost::shared_ptr<uchar_vector> data);
     void do_send(const Coin::CoinNodeMessage& message); // calls do_write from the strand thread 
     void do_handshake();
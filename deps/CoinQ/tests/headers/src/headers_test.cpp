@@ -0,0 +1,170 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// headers_test.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// Checks that CoinQBlockTreeMem::insertHeaders leaves the tree as inserting
+// the same headers one at a time with insertHeader does, on a 4000 header
+// chain and on a branch that overtakes it, and that a bad batch inserts
+// nothing.
+//
+
+#include "CoinQ_blocks.h"
+
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+static unsigned int failures = 0;
+
+static void check(const string& name, bool ok)
+{
+    cout << "  " << name << (ok ? " OK" : " FAILED") << endl;
+    if (!ok) failures++;
+}
+
+static const uint32_t BLOCK_BITS = 0x207fffff;
+static const int CHAIN_LENGTH = 4000;
+
+static std::vector<Coin::CoinBlockHeader> mine(const uchar_vector& prevHash, uint32_t timestamp, int count)
+{
+    std::vector<Coin::CoinBlockHeader> headers;
+    uchar_vector prev = prevHash;
+    for (int i = 0; i < count; i++)
+    {
+        Coin::CoinBlockHeader header(1, prev, g_zero32bytes, timestamp + i, BLOCK_BITS, 0);
+        while (BigInt(header.getPOWHashLittleEndian()) > header.getTarget()) { header.incrementNonce(); }
+        headers.push_back(header);
+        prev = header.hash();
+    }
+    return headers;
+}
+
+static bool sameTree(const CoinQBlockTreeMem& a, const CoinQBlockTreeMem& b, const std::vector<Coin::CoinBlockHeader>& headers)
+{
+    if (a.getBestHash() != b.getBestHash() || a.getBestHeight() != b.getBestHeight() || a.getTotalWork() != b.getTotalWork()) return false;
+
+    for (auto& header: headers)
+    {
+        if (!a.hasHeader(header.hash()) || !b.hasHeader(header.hash())) return false;
+        if (a.getHeader(header.hash()) != b.getHeader(header.hash())) return false;
+    }
+    return true;
+}
+
+static void testChain()
+{
+    cout << "Chain" << endl;
+
+    Coin::CoinBlockHeader genesis(1, 1000, BLOCK_BITS, 0);
+    std::vector<Coin::CoinBlockHeader> chain = mine(genesis.hash(), 2000, CHAIN_LENGTH);
+
+    CoinQBlockTreeMem single(genesis);
+    for (auto& header: chain) { single.insertHeader(header); }
+
+    // Overlapping batches, as when a peer resends headers we already have.
+    CoinQBlockTreeMem batched(genesis);
+    unsigned int ranges = 0;
+    unsigned int adds = 0;
+    batched.subscribeAddBestChain([&](const ChainHeader&) { adds++; });
+    batched.subscribeAddBestChainRange([&](const ChainHeader&, const ChainHeader&) { ranges++; });
+
+    std::vector<Coin::CoinBlockHeader> first(chain.begin(), chain.begin() + 2000);
+    std::vector<Coin::CoinBlockHeader> second(chain.begin() + 1500, chain.end());
+    check("first batch inserted", batched.insertHeaders(first) == 2000);
+    check("known headers skipped", batched.insertHeaders(second) == CHAIN_LENGTH - 2000);
+    check("repeated batch inserts nothing", batched.insertHeaders(second) == 0);
+
+    check("same best hash, height and work", sameTree(single, batched, chain));
+    check("best height", batched.getBestHeight() == CHAIN_LENGTH);
+    check("one range notification per batch", ranges == 2 && adds == 0);
+}
+
+static void testReorg()
+{
+    cout << "Branch overtaking the chain" << endl;
+
+    Coin::CoinBlockHeader genesis(1, 1000, BLOCK_BITS, 0);
+    std::vector<Coin::CoinBlockHeader> chain = mine(genesis.hash(), 2000, 100);
+    std::vector<Coin::CoinBlockHeader> branch = mine(chain[49].hash(), 5000, 60);
+
+    std::vector<Coin::CoinBlockHeader> all(chain);
+    all.insert(all.end(), branch.begin(), branch.end());
+
+    CoinQBlockTreeMem single(genesis);
+    for (auto& header: all) { single.insertHeader(header); }
+
+    CoinQBlockTreeMem batched(genesis);
+    batched.insertHeaders(chain);
+    batched.insertHeaders(branch);
+
+    check("same tree", sameTree(single, batched, all));
+    check("branch is the best chain", batched.getBestHash() == branch.back().hash() && batched.getBestHeight() == 110);
+    check("old tip left the best chain", !batched.getHeader(chain.back().hash()).inBestChain);
+}
+
+static void testBadBatches()
+{
+    cout << "Bad batches" << endl;
+
+    Coin::CoinBlockHeader genesis(1, 1000, BLOCK_BITS, 0);
+    std::vector<Coin::CoinBlockHeader> chain = mine(genesis.hash(), 2000, 10);
+
+    CoinQBlockTreeMem tree(genesis);
+
+    std::vector<Coin::CoinBlockHeader> unlinked(chain);
+    std::swap(unlinked[3], unlinked[4]);
+    bool bThrew = false;
+    try
+    {
+        tree.insertHeaders(unlinked);
+    }
+    catch (const exception&)
+    {
+        bThrew = true;
+    }
+    check("unlinked batch throws", bThrew);
+    check("unlinked batch inserts nothing", tree.getBestHeight() == 0 && !tree.hasHeader(chain[0].hash()));
+
+    std::vector<Coin::CoinBlockHeader> orphans(chain.begin() + 5, chain.end());
+    bThrew = false;
+    try
+    {
+        tree.insertHeaders(orphans);
+    }
+    catch (const exception&)
+    {
+        bThrew = true;
+    }
+    check("orphan batch throws", bThrew);
+    check("orphan batch inserts nothing", tree.getBestHeight() == 0 && !tree.hasHeader(chain[5].hash()));
+}
+
+int main()
+{
+    try
+    {
+        testChain();
+        testReorg();
+        testBadBatches();
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+
+    if (failures)
+    {
+        cout << failures << " check(s) failed." << endl;
+        return 1;
+    }
+
+    cout << "All checks passed." << endl;
+    return 0;
+}
@@ -0,0 +1,205 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// mempool_test.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// Checks RollingFilter's memory and false positive rate, Mempool's indexes
+// and limits, and RequestTracker's timeouts.
+//
+
+#include "CoinQ_mempool.h"
+
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+using namespace CoinQ;
+using namespace std;
+
+static unsigned int failures = 0;
+
+static void check(const string& name, bool ok)
+{
+    cout << "  " << name << (ok ? " OK" : " FAILED") << endl;
+    if (!ok) failures++;
+}
+
+static std::mt19937_64 g_rng(0x6d656d);
+
+static bytes_t randomHash()
+{
+    bytes_t hash(32);
+    for (auto& byte: hash) { byte = (unsigned char)g_rng(); }
+    return hash;
+}
+
+static Coin::Transaction spendingTx(const bytes_t& prevHash, uint32_t prevIndex, uint64_t value)
+{
+    Coin::Transaction tx;
+    tx.inputs.push_back(Coin::TxIn(Coin::OutPoint(prevHash, prevIndex), bytes_t(107, 0x01), 0xffffffff));
+    tx.outputs.push_back(Coin::TxOut(value, bytes_t(23, 0x02)));
+    return tx;
+}
+
+static void testRollingFilter()
+{
+    cout << "RollingFilter" << endl;
+
+    const unsigned int N = 1000;
+    RollingFilter filter(N, 0.001);
+
+    std::vector<bytes_t> hashes;
+    for (unsigned int i = 0; i < 3 * N; i++) { hashes.push_back(randomHash()); }
+
+    for (unsigned int i = 0; i < N; i++) { filter.insert(hashes[i]); }
+    bool allFound = true;
+    for (unsigned int i = 0; i < N; i++) { if (!filter.contains(hashes[i])) allFound = false; }
+    check("remembers the last nElements", allFound);
+
+    // A second generation still answers for the first
+    for (unsigned int i = N; i < 2 * N; i++) { filter.insert(hashes[i]); }
+    allFound = true;
+    for (unsigned int i = 0; i < 2 * N; i++) { if (!filter.contains(hashes[i])) allFound = false; }
+    check("remembers up to 2 * nElements", allFound);
+
+    // A third generation pushes out the first
+    for (unsigned int i = 2 * N; i < 3 * N; i++) { filter.insert(hashes[i]); }
+    unsigned int oldFound = 0;
+    for (unsigned int i = 0; i < N; i++) { if (filter.contains(hashes[i])) oldFound++; }
+    check("forgets older generations", oldFound < N / 100);
+
+    allFound = true;
+    for (unsigned int i = N; i < 3 * N; i++) { if (!filter.contains(hashes[i])) allFound = false; }
+    check("keeps the two newest generations", allFound);
+
+    unsigned int falsePositives = 0;
+    const unsigned int TRIALS = 100000;
+    for (unsigned int i = 0; i < TRIALS; i++) { if (filter.contains(randomHash())) falsePositives++; }
+    cout << "  false positives: " << falsePositives << " of " << TRIALS << endl;
+    check("false positive rate within 2x of target", falsePositives <= TRIALS * 0.002);
+
+    filter.clear();
+    bool noneFound = true;
+    for (unsigned int i = N; i < 3 * N; i++) { if (filter.contains(hashes[i])) noneFound = false; }
+    check("clear forgets everything", noneFound);
+
+    bool threw = false;
+    try { RollingFilter bad(0, 0.01); } catch (const std::exception&) { threw = true; }
+    check("rejects zero elements", threw);
+}
+
+static void testMempool()
+{
+    cout << "Mempool" << endl;
+
+    Mempool mempool(1024 * 1024, 100);
+    bytes_t funding = randomHash();
+
+    Coin::Transaction tx1 = spendingTx(funding, 0, 1000);
+    Coin::Transaction tx2 = spendingTx(funding, 1, 2000);
+    check("insert", mempool.insert(tx1, 10));
+    check("duplicate insert rejected", !mempool.insert(tx1, 11));
+    check("contains", mempool.contains(tx1.hash()) && mempool.hasBody(tx1.hash()));
+    check("get", mempool.get(tx1.hash()) && mempool.get(tx1.hash())->hash() == tx1.hash());
+    check("spender indexed", mempool.getSpender(Mempool::outpoint_t(funding, 0)) == tx1.hash());
+
+    // Hash-only entries are upgraded when the body arrives
+    check("hash-only insert", mempool.insert(tx2.hash(), 20));
+    check("hash-only has no body", mempool.contains(tx2.hash()) && !mempool.hasBody(tx2.hash()) && !mempool.get(tx2.hash()));
+    check("body replaces hash-only", mempool.insert(tx2, 21) && mempool.hasBody(tx2.hash()));
+    check("size", mempool.size() == 2);
+
+    // A confirmed double spend of tx1's input evicts tx1 but not tx2
+    Coin::Transaction doubleSpend = spendingTx(funding, 0, 999);
+    std::vector<bytes_t> conflicts = mempool.eraseConflicts(doubleSpend);
+    check("eraseConflicts returns the conflict", conflicts.size() == 1 && conflicts[0] == tx1.hash());
+    check("conflict removed", !mempool.contains(tx1.hash()) && mempool.contains(tx2.hash()));
+    check("spender index cleaned", mempool.getSpender(Mempool::outpoint_t(funding, 0)).empty());
+    check("tx is not its own conflict", mempool.eraseConflicts(tx2).empty());
+
+    check("erase", mempool.erase(tx2.hash()) && !mempool.erase(tx2.hash()));
+    check("empty after erase", mempool.size() == 0 && mempool.bytes() == 0);
+
+    // Expiry drops entries older than the cutoff
+    Coin::Transaction old = spendingTx(randomHash(), 0, 1);
+    Coin::Transaction recent = spendingTx(randomHash(), 0, 1);
+    mempool.insert(old, 1000);
+    mempool.insert(recent, 1050);
+    mempool.expire(1120);
+    check("expire drops old", !mempool.contains(old.hash()) && mempool.contains(recent.hash()));
+
+    // The byte limit evicts oldest first
+    Mempool small(4096, 1000000);
+    std::vector<bytes_t> inserted;
+    for (int i = 0; i < 100; i++)
+    {
+        Coin::Transaction tx = spendingTx(randomHash(), i, 1000 + i);
+        small.insert(tx, 1000 + i);
+        inserted.push_back(tx.hash());
+    }
+    check("byte limit respected", small.bytes() <= 4096);
+    check("newest kept", small.contains(inserted.back()));
+    check("oldest evicted", !small.contains(inserted.front()));
+}
+
+static void testRequestTracker()
+{
+    cout << "RequestTracker" << endl;
+
+    RequestTracker tracker(60, 3);
+    bytes_t a = randomHash();
+    bytes_t b = randomHash();
+    bytes_t c = randomHash();
+    bytes_t d = randomHash();
+
+    check("first request", tracker.request(a, 1000));
+    check("repeat request while pending refused", !tracker.request(a, 1010));
+    check("pending", tracker.pending(a));
+    check("received", tracker.received(a) && !tracker.pending(a));
+    check("unrequested receipt", !tracker.received(a));
+    check("request again after receipt", tracker.request(a, 1020));
+
+    // Requests without a reply are forgotten after the timeout
+    check("request b", tracker.request(b, 1030));
+    check("still pending before timeout", !tracker.request(a, 1079));
+    check("request again after timeout", tracker.request(a, 1080));
+    check("b pending", tracker.pending(b));
+
+    // The limit caps outstanding requests
+    check("request c", tracker.request(c, 1081));
+    check("limit reached", !tracker.request(d, 1082) && !tracker.pending(d));
+    tracker.expire(1090);
+    check("expire frees b", !tracker.pending(b) && tracker.size() == 2);
+    check("request d after expiry", tracker.request(d, 1091));
+
+    tracker.clear();
+    check("clear", tracker.size() == 0 && !tracker.pending(a));
+}
+
+int main()
+{
+    try
+    {
+        testRollingFilter();
+        testMempool();
+        testRequestTracker();
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+
+    if (failures)
+    {
+        cout << failures << " check(s) failed." << endl;
+        return 1;
+    }
+
+    cout << "All checks passed." << endl;
+    return 0;
+}
@@ -0,0 +1,360 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// rescan_test.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// Feeds BlockchainRescan blocks from a local block tree and checks that they
+// are passed on in order with their chain work, that a branch overtaking the
+// chain rolls back the outpoints spent above the fork, and that checkpoints
+// wait for the consumer's acknowledgements.
+//
+
+#include "BlockchainRescan.h"
+
+#include <boost/filesystem.hpp>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using namespace CoinQ;
+using namespace CoinQ::Network;
+using namespace std;
+
+static unsigned int failures = 0;
+
+static void check(const string& name, bool ok)
+{
+    cout << "  " << name << (ok ? " OK" : " FAILED") << endl;
+    if (!ok) failures++;
+}
+
+static std::mt19937_64 g_rng(0x726573);
+
+static const uint32_t BLOCK_BITS = 0x207fffff;
+
+static bytes_t randomBytes(size_t size)
+{
+    bytes_t data(size);
+    for (auto& byte: data) { byte = (unsigned char)g_rng(); }
+    return data;
+}
+
+static const bytes_t OUR_SCRIPT = uchar_vector("a914000102030405060708090a0b0c0d0e0f1011121387");
+
+static Coin::Transaction payingTx(const bytes_t& script)
+{
+    Coin::Transaction tx;
+    tx.inputs.push_back(Coin::TxIn(Coin::OutPoint(randomBytes(32), 0), randomBytes(107), 0xffffffff));
+    tx.outputs.push_back(Coin::TxOut(100000, script));
+    return tx;
+}
+
+static Coin::Transaction spendingTx(const Coin::Transaction& prev)
+{
+    Coin::Transaction tx;
+    tx.inputs.push_back(Coin::TxIn(Coin::OutPoint(prev.hash().getReverse(), 0), randomBytes(107), 0xffffffff));
+    tx.outputs.push_back(Coin::TxOut(90000, randomBytes(23)));
+    return tx;
+}
+
+// Blocks mined ahead of time, and a block tree that only learns of them as they are fed
+// to a rescan, the way BlockchainDownload would.
+class Chain
+{
+public:
+    Chain()
+    {
+        Coin::CoinBlock genesis(2, 1400000000, BLOCK_BITS);
+        genesis.addTransaction(payingTx(randomBytes(23)));
+        genesis.updateMerkleRoot();
+        m_tree.setGenesisBlock(genesis.blockHeader);
+        m_genesisHash = genesis.blockHeader.hash();
+        m_blocks[m_genesisHash] = genesis;
+    }
+
+    const uchar_vector& genesisHash() const { return m_genesisHash; }
+    const CoinQBlockTreeMem& tree() const { return m_tree; }
+
+    uchar_vector mine(const uchar_vector& prevHash, const std::vector<Coin::Transaction>& txs = std::vector<Coin::Transaction>())
+    {
+        Coin::CoinBlock block(2, m_blocks.at(prevHash).timestamp() + 600, BLOCK_BITS, prevHash);
+        block.addTransaction(payingTx(randomBytes(23)));
+        for (auto& tx: txs) { block.addTransaction(tx); }
+        block.updateMerkleRoot();
+        block.blockHeader.nonce((uint32_t)g_rng());
+
+        uchar_vector hash = block.blockHeader.hash();
+        m_blocks[hash] = block;
+        return hash;
+    }
+
+    void feed(BlockchainRescan& rescan, const uchar_vector& hash)
+    {
+        const Coin::CoinBlock& block = m_blocks.at(hash);
+        m_tree.insertHeader(block.blockHeader, false);
+        rescan.insertBlock(m_tree.getHeader(hash), block.getSerialized());
+    }
+
+private:
+    CoinQBlockTreeMem m_tree;
+    uchar_vector m_genesisHash;
+    std::map<uchar_vector, Coin::CoinBlock> m_blocks;
+};
+
+struct Received
+{
+    std::mutex mutex;
+    std::vector<ChainMerkleBlock> blocks;
+    std::vector<std::vector<Coin::Transaction>> txs;
+    std::vector<int> reorgs;
+
+    void subscribe(BlockchainRescan& rescan)
+    {
+        rescan.subscribeBlock([this](const ChainMerkleBlock& block, const std::vector<Coin::Transaction>& blockTxs)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            blocks.push_back(block);
+            txs.push_back(blockTxs);
+        });
+        rescan.subscribeReorg([this](int height, const uchar_vector& /*hash*/)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            reorgs.push_back(height);
+            while (!blocks.empty() && blocks.back().height > height)
+            {
+                blocks.pop_back();
+                txs.pop_back();
+            }
+        });
+    }
+
+    bool hasTx(const Coin::Transaction& tx)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& blockTxs: txs)
+        {
+            for (auto& blockTx: blockTxs) { if (blockTx.hash() == tx.hash()) return true; }
+        }
+        return false;
+    }
+
+    bool waitForTip(const uchar_vector& hash)
+    {
+        for (int i = 0; i < 500; i++)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!blocks.empty() && blocks.back().blockHeader.hash() == hash) return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+};
+
+static int checkpointHeight(const string& filename)
+{
+    std::ifstream fs(filename);
+    int height = -1;
+    fs >> height;
+    return height;
+}
+
+static string tempPath(const string& name)
+{
+    return (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("rescan-" + name + "-%%%%%%%%")).string();
+}
+
+static void testChain()
+{
+    cout << "Blocks in order" << endl;
+
+    Chain chain;
+    Coin::Transaction pay = payingTx(OUR_SCRIPT);
+    Coin::Transaction spend = spendingTx(pay);
+    Coin::Transaction other = payingTx(randomBytes(23));
+
+    std::vector<uchar_vector> hashes(1, chain.genesisHash());
+    for (int height = 1; height <= 200; height++)
+    {
+        std::vector<Coin::Transaction> txs;
+        if (height == 10) { txs.push_back(pay); }
+        if (height == 20) { txs.push_back(other); }
+        if (height == 150) { txs.push_back(spend); }
+        hashes.push_back(chain.mine(hashes.back(), txs));
+    }
+
+    BlockchainRescan rescan(getBitcoinParams(), 4);
+    rescan.setFilterScripts(std::vector<bytes_t>(1, OUR_SCRIPT), std::vector<Coin::OutPoint>());
+    Received received;
+    received.subscribe(rescan);
+
+    rescan.startOffline(chain.genesisHash(), 0);
+    for (size_t i = 1; i < hashes.size(); i++) { chain.feed(rescan, hashes[i]); }
+    check("reaches the tip", received.waitForTip(hashes.back()));
+    rescan.stop();
+
+    bool bInOrder = received.blocks.size() == hashes.size() - 1;
+    bool bChainWork = bInOrder;
+    for (size_t i = 0; bInOrder && i < received.blocks.size(); i++)
+    {
+        const ChainMerkleBlock& block = received.blocks[i];
+        if (block.height != (int)i + 1 || block.blockHeader.hash() != hashes[i + 1]) bInOrder = false;
+        if (block.chainWork != chain.tree().getHeader(hashes[i + 1]).chainWork) bChainWork = false;
+    }
+    check("heights and hashes", bInOrder);
+    check("chain work from the headers", bChainWork);
+    check("payment matched", received.hasTx(pay));
+    check("spend matched", received.hasTx(spend));
+    check("unrelated tx skipped", !received.hasTx(other));
+}
+
+static void testReorg()
+{
+    cout << "Reorg" << endl;
+
+    Chain chain;
+    Coin::Transaction pay = payingTx(OUR_SCRIPT);
+    Coin::Transaction spendA = spendingTx(pay);
+    Coin::Transaction spendB = spendingTx(pay);
+
+    // The payment at height 3 and a spend of it at 6.
+    std::vector<uchar_vector> main(1, chain.genesisHash());
+    for (int height = 1; height <= 8; height++)
+    {
+        std::vector<Coin::Transaction> txs;
+        if (height == 3) { txs.push_back(pay); }
+        if (height == 6) { txs.push_back(spendA); }
+        main.push_back(chain.mine(main.back(), txs));
+    }
+
+    // A branch from height 5 with another spend at 7 that takes over at 9.
+    std::vector<uchar_vector> branch(1, main[5]);
+    for (int height = 6; height <= 9; height++)
+    {
+        std::vector<Coin::Transaction> txs;
+        if (height == 7) { txs.push_back(spendB); }
+        branch.push_back(chain.mine(branch.back(), txs));
+    }
+
+    BlockchainRescan rescan(getBitcoinParams(), 2);
+    rescan.setFilterScripts(std::vector<bytes_t>(1, OUR_SCRIPT), std::vector<Coin::OutPoint>());
+    Received received;
+    received.subscribe(rescan);
+
+    rescan.startOffline(chain.genesisHash(), 0);
+    for (size_t i = 1; i < main.size(); i++) { chain.feed(rescan, main[i]); }
+    check("chain passed on", received.waitForTip(main.back()));
+    check("first spend matched", received.hasTx(spendA));
+
+    // Blocks 6 to 8 of the branch are held back, 9 has more work than the chain.
+    for (size_t i = 1; i < branch.size(); i++) { chain.feed(rescan, branch[i]); }
+    check("branch passed on", received.waitForTip(branch.back()));
+    rescan.stop();
+
+    check("one reorg at the fork", received.reorgs == std::vector<int>(1, 5));
+    check("tip height", rescan.getHeight() == 9);
+
+    bool bBlocks = received.blocks.size() == 9;
+    for (size_t i = 0; bBlocks && i < received.blocks.size(); i++)
+    {
+        const uchar_vector& expected = i < 5 ? main[i + 1] : branch[i - 4];
+        if (received.blocks[i].blockHeader.hash() != expected || received.blocks[i].height != (int)i + 1) bBlocks = false;
+    }
+    check("blocks after the reorg", bBlocks);
+    check("orphaned spend dropped", !received.hasTx(spendA));
+    check("spent output restored and matched again", received.hasTx(spendB));
+}
+
+static void testCheckpoints()
+{
+    cout << "Checkpoints" << endl;
+
+    Chain chain;
+    Coin::Transaction pay = payingTx(OUR_SCRIPT);
+    Coin::Transaction spend = spendingTx(pay);
+
+    std::vector<uchar_vector> hashes(1, chain.genesisHash());
+    for (int height = 1; height <= 10; height++)
+    {
+        std::vector<Coin::Transaction> txs;
+        if (height == 2) { txs.push_back(pay); }
+        if (height == 8) { txs.push_back(spend); }
+        hashes.push_back(chain.mine(hashes.back(), txs));
+    }
+
+    string checkpointFile = tempPath("checkpoint");
+    {
+        BlockchainRescan rescan(getBitcoinParams(), 2);
+        rescan.setFilterScripts(std::vector<bytes_t>(1, OUR_SCRIPT), std::vector<Coin::OutPoint>());
+        rescan.setCheckpointFile(checkpointFile, 2, true);
+        Received received;
+        received.subscribe(rescan);
+
+        rescan.startOffline(chain.genesisHash(), 0);
+        for (int i = 1; i <= 5; i++) { chain.feed(rescan, hashes[i]); }
+        check("blocks passed on", received.waitForTip(hashes[5]));
+        check("nothing saved before acknowledgement", !boost::filesystem::exists(checkpointFile));
+
+        rescan.acknowledge(3);
+        check("saved up to the acknowledged height", checkpointHeight(checkpointFile) == 2);
+
+        rescan.stop();
+        check("not saved past it when stopped", checkpointHeight(checkpointFile) == 2);
+
+        rescan.acknowledge(5);
+        check("saved once acknowledged after stopping", checkpointHeight(checkpointFile) == 5);
+    }
+
+    {
+        BlockchainRescan rescan(getBitcoinParams(), 2);
+        rescan.setFilterScripts(std::vector<bytes_t>(1, OUR_SCRIPT), std::vector<Coin::OutPoint>());
+        rescan.setCheckpointFile(checkpointFile, 2, true);
+        Received received;
+        received.subscribe(rescan);
+        rescan.subscribeBlock([&](const ChainMerkleBlock& block, const std::vector<Coin::Transaction>& /*txs*/) { rescan.acknowledge(block.height); });
+
+        rescan.startOffline(chain.genesisHash(), 0);
+        check("resumes from the checkpoint", rescan.getHeight() == 5 && rescan.getHash() == hashes[5]);
+        for (int i = 1; i <= 10; i++) { chain.feed(rescan, hashes[i]); }
+        check("blocks passed on", received.waitForTip(hashes[10]));
+        check("saved as acknowledged", checkpointHeight(checkpointFile) == 9);
+        rescan.stop();
+        check("saved when stopped", checkpointHeight(checkpointFile) == 10);
+
+        check("only blocks after the checkpoint", received.blocks.size() == 5 && received.blocks.front().height == 6);
+        check("spend of a checkpointed outpoint matched", received.hasTx(spend));
+    }
+    boost::filesystem::remove(checkpointFile);
+}
+
+int main()
+{
+    try
+    {
+        testChain();
+        testReorg();
+        testCheckpoints();
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+
+    if (failures)
+    {
+        cout << failures << " check(s) failed." << endl;
+        return 1;
+    }
+
+    cout << "All checks passed." << endl;
+    return 0;
+}
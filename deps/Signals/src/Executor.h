@@ -0,0 +1,246 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Executor.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include "LockFreeQueue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Signals
+{
+
+// Runs tasks in post order on one dedicated thread. Posting never waits for
+// tasks to run, and only takes a lock to wake the thread when it is idle.
+//
+// A task posted with a key replaces a still pending task with the same key,
+// keeping the earlier one's place in the queue. This coalesces bursts of
+// events where only the latest matters.
+//
+// Exceptions thrown by tasks are passed to the error handler, if any, and
+// otherwise ignored so one bad subscriber cannot stop delivery to the rest.
+//
+// The thread shares ownership of the queue and its state, so a task may stop
+// the executor, or drop the last reference to it, while it is still running.
+class Executor
+{
+public:
+    typedef std::function<void()> Task;
+    typedef std::function<void(const std::exception&)> ErrorHandler;
+
+    explicit Executor(ErrorHandler errorHandler = nullptr);
+    ~Executor() { stop(); }
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    void post(Task task);
+    void post(const void* key, Task task);
+
+    // Blocks until everything posted before the call has run. Must not be called from a task.
+    void wait();
+
+    // With drain, runs pending tasks first. Tasks posted after stop() are dropped.
+    // Called from a task, returns at once without draining: the thread drops any
+    // pending tasks and exits when the task returns.
+    void stop(bool drain = true);
+
+    bool isRunning() const { return state_->running; }
+    bool isExecutorThread() const { return std::this_thread::get_id() == state_->threadId; }
+
+private:
+    struct State
+    {
+        explicit State(ErrorHandler errorHandler_)
+            : errorHandler(errorHandler_), running(true), drain(true), sleeping(false), posted(0), completed(0) { }
+
+        void wake();
+        void runTask(Task& task);
+
+        ErrorHandler errorHandler;
+        LockFreeQueue<Task> queue;
+
+        std::mutex coalesceMutex;
+        std::map<const void*, Task> coalesced;
+
+        std::atomic<bool> running;
+        std::atomic<bool> drain;
+        std::atomic<bool> sleeping;
+        std::atomic<uint64_t> posted;
+        std::atomic<uint64_t> completed;
+
+        std::mutex mutex;
+        std::condition_variable wakeCondition;
+        std::condition_variable idleCondition;
+        std::thread::id threadId;
+    };
+
+    static void run(std::shared_ptr<State> state);
+
+    std::shared_ptr<State> state_;
+    std::thread thread_;
+};
+
+inline Executor::Executor(ErrorHandler errorHandler)
+    : state_(std::make_shared<State>(errorHandler))
+{
+    // Set before the thread can run a task that asks isExecutorThread()
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    thread_ = std::thread(&Executor::run, state_);
+    state_->threadId = thread_.get_id();
+}
+
+inline void Executor::post(Task task)
+{
+    if (!state_->running) return;
+
+    state_->posted++;
+    state_->queue.push(std::move(task));
+    state_->wake();
+}
+
+inline void Executor::post(const void* key, Task task)
+{
+    if (!state_->running) return;
+
+    {
+        std::lock_guard<std::mutex> lock(state_->coalesceMutex);
+        auto it = state_->coalesced.find(key);
+        if (it != state_->coalesced.end())
+        {
+            it->second = std::move(task);
+            return;
+        }
+        state_->coalesced[key] = std::move(task);
+    }
+
+    // The queued placeholder runs whatever task is latest for the key when its turn comes.
+    // It holds the state weakly since the state owns the queue it sits in.
+    std::weak_ptr<State> weakState(state_);
+    post([weakState, key]()
+    {
+        std::shared_ptr<State> state = weakState.lock();
+        if (!state) return;
+
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(state->coalesceMutex);
+            auto it = state->coalesced.find(key);
+            if (it == state->coalesced.end()) return;
+            task = std::move(it->second);
+            state->coalesced.erase(it);
+        }
+        task();
+    });
+}
+
+inline void Executor::wait()
+{
+    uint64_t target = state_->posted;
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->idleCondition.wait(lock, [&]() { return state_->completed >= target || !state_->running; });
+}
+
+inline void Executor::stop(bool drain)
+{
+    bool fromTask = isExecutorThread();
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (!state_->running) return;
+        state_->drain = drain && !fromTask;
+        state_->running = false;
+        state_->wakeCondition.notify_one();
+        state_->idleCondition.notify_all();
+    }
+
+    // From a task the thread exits once the task returns, keeping the state alive until then
+    if (fromTask)
+    {
+        thread_.detach();
+        return;
+    }
+    if (thread_.joinable()) { thread_.join(); }
+
+    state_->queue.clear();
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->coalesced.clear();
+    state_->idleCondition.notify_all();
+}
+
+inline void Executor::State::wake()
+{
+    // The thread sets sleeping before its last check of the queue, so either it sees our task or we see it sleeping.
+    if (sleeping)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeCondition.notify_one();
+    }
+}
+
+inline void Executor::run(std::shared_ptr<State> state)
+{
+    {
+        // Wait for the constructor to record our id
+        std::lock_guard<std::mutex> lock(state->mutex);
+    }
+
+    while (true)
+    {
+        while (!state->queue.empty() && (state->running || state->drain))
+        {
+            state->queue.consume([&](Task& task)
+            {
+                if (state->running || state->drain) { state->runTask(task); }
+                state->completed++;
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->idleCondition.notify_all();
+        if (!state->running)
+        {
+            // Nobody joins a thread stopped from a task, so drop what is left here
+            lock.unlock();
+            state->queue.clear();
+            std::lock_guard<std::mutex> coalesceLock(state->coalesceMutex);
+            state->coalesced.clear();
+            return;
+        }
+
+        state->sleeping = true;
+        state->wakeCondition.wait(lock, [&]() { return !state->queue.empty() || !state->running; });
+        state->sleeping = false;
+    }
+}
+
+inline void Executor::State::runTask(Task& task)
+{
+    try
+    {
+        task();
+    }
+    catch (const std::exception& e)
+    {
+        if (errorHandler) { errorHandler(e); }
+    }
+    catch (...)
+    {
+    }
+}
+
+}
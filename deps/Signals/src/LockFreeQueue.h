@@ -0,0 +1,157 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// LockFreeQueue.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace Signals
+{
+
+// Multi-producer queue. push() is a single compare-and-swap and never blocks.
+// Consumers take everything queued so far in one exchange, so any number of
+// threads may consume, each getting a disjoint batch in push order.
+template<typename T>
+class LockFreeQueue
+{
+public:
+    LockFreeQueue() : head_(nullptr) { }
+    ~LockFreeQueue() { clear(); }
+
+    LockFreeQueue(const LockFreeQueue&) = delete;
+    LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+    void push(T value);
+    bool empty() const { return head_.load() == nullptr; }
+
+    // Calls f on each item queued so far, oldest first. Items pushed by f go into
+    // the next batch. If f throws, the untaken rest of the batch is put back ahead
+    // of anything queued in the meantime, so the next consumer resumes in push
+    // order, and the exception propagates.
+    template<typename F>
+    void consume(F f);
+
+    void clear();
+
+private:
+    struct Node
+    {
+        Node(T&& value_) : value(std::move(value_)), next(nullptr) { }
+
+        T value;
+        Node* next;
+    };
+
+    // Detaches the whole list and returns it oldest first.
+    Node* take();
+
+    // Returns an oldest first list to the queue, older than everything in it.
+    void restore(Node* node);
+
+    std::atomic<Node*> head_;
+};
+
+template<typename T>
+inline void LockFreeQueue<T>::push(T value)
+{
+    Node* node = new Node(std::move(value));
+    node->next = head_.load(std::memory_order_relaxed);
+
+    // Sequentially consistent so a consumer that checks empty() after announcing it will sleep cannot miss this push
+    while (!head_.compare_exchange_weak(node->next, node));
+}
+
+template<typename T>
+inline typename LockFreeQueue<T>::Node* LockFreeQueue<T>::take()
+{
+    Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+
+    // The list is newest first
+    Node* reversed = nullptr;
+    while (node)
+    {
+        Node* next = node->next;
+        node->next = reversed;
+        reversed = node;
+        node = next;
+    }
+    return reversed;
+}
+
+template<typename T>
+inline void LockFreeQueue<T>::restore(Node* node)
+{
+    // Back to newest first, so the oldest node ends the list
+    Node* top = nullptr;
+    while (node)
+    {
+        Node* next = node->next;
+        node->next = top;
+        top = node;
+        node = next;
+    }
+
+    // Only an empty queue can take the list as is. Whatever was pushed since is
+    // newer, so it is detached and goes on top until the queue is found empty.
+    Node* expected = nullptr;
+    while (!head_.compare_exchange_weak(expected, top))
+    {
+        if (!expected) continue;
+
+        Node* queued = head_.exchange(nullptr, std::memory_order_acquire);
+        if (queued)
+        {
+            Node* last = queued;
+            while (last->next) { last = last->next; }
+            last->next = top;
+            top = queued;
+        }
+        expected = nullptr;
+    }
+}
+
+template<typename T>
+template<typename F>
+inline void LockFreeQueue<T>::consume(F f)
+{
+    Node* node = take();
+    while (node)
+    {
+        Node* next = node->next;
+        T value(std::move(node->value));
+        delete node;
+        node = next;
+
+        try
+        {
+            f(value);
+        }
+        catch (...)
+        {
+            if (node) { restore(node); }
+            throw;
+        }
+    }
+}
+
+template<typename T>
+inline void LockFreeQueue<T>::clear()
+{
+    Node* node = take();
+    while (node)
+    {
+        Node* next = node->next;
+        delete node;
+        node = next;
+    }
+}
+
+}
@@ -11,48 +11,81 @@
 
 #pragma once
 
+#include "LockFreeQueue.h"
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
 #include <functional>
-#include <queue>
 #include <mutex>
+#include <thread>
 
 namespace Signals
 {
 
+// Producers never block each other and may push from within queued
+// functions. Flushes are serialized so signals are delivered in push order;
+// a flush called from a queued function returns at once and the outer flush
+// delivers whatever was pushed. If queued functions throw, the rest are still
+// delivered and the first exception is rethrown once the queue is empty.
 class SignalQueue
 {
 public:
+    SignalQueue() : size_(0) { }
+
     void push(std::function<void()> f);
     void flush();
     void clear();
 
+    // Approximate while other threads push or flush.
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+
 private:
-    std::mutex mutex_;
-    std::queue<std::function<void()>> queue_;
+    LockFreeQueue<std::function<void()>> queue_;
+    std::atomic<size_t> size_;
+
+    std::mutex flushMutex_;
+    std::atomic<std::thread::id> flushingThread_;
 };
 
 inline void SignalQueue::push(std::function<void()> f)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(f);
+    size_.fetch_add(1, std::memory_order_relaxed);
+    queue_.push(std::move(f));
 }
 
 inline void SignalQueue::flush()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    if (flushingThread_.load() == std::this_thread::get_id()) return;
+
+    std::lock_guard<std::mutex> lock(flushMutex_);
+    flushingThread_ = std::this_thread::get_id();
+
+    // Signals pushed by handlers are flushed too
+    std::exception_ptr error;
     while (!queue_.empty())
     {
-        queue_.front()();
-        queue_.pop();
-    } 
+        queue_.consume([&](std::function<void()>& f)
+        {
+            size_.fetch_sub(1, std::memory_order_relaxed);
+            try
+            {
+                f();
+            }
+            catch (...)
+            {
+                if (!error) { error = std::current_exception(); }
+            }
+        });
+    }
+
+    flushingThread_ = std::thread::id();
+    if (error) std::rethrow_exception(error);
 }
 
 inline void SignalQueue::clear()
 {
-    std::queue<std::function<void()>> empty;
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        std::swap(queue_, empty);
-    }
+    queue_.consume([this](std::function<void()>&) { size_.fetch_sub(1, std::memory_order_relaxed); });
 }
 
 }
@@ -11,7 +11,10 @@
 
 #pragma once
 
+#include "Executor.h"
+
 #include <functional>
+#include <memory>
 #include <set>
 #include <map>
 #include <mutex>
@@ -21,6 +24,18 @@ namespace Signals
 
 typedef uint64_t Connection;
 
+enum DispatchMode
+{
+    SYNCHRONOUS,    // slots run on the emitting thread before the emitter continues
+    ASYNCHRONOUS,   // every emission is queued on the executor
+    COALESCED       // queued, but an emission still pending is replaced by a newer one
+};
+
+// Slots are held in an immutable map that connect() and disconnect() replace,
+// so emitting only loads a pointer and never holds a lock while slots run.
+// A slot may therefore connect or disconnect slots, or emit again. A slot
+// disconnected while an emission is in progress can still be called once by it.
+
 template<typename... Values>
 class Signal
 {
@@ -36,6 +51,9 @@ public:
     std::function<void()> bind(Values... values) const;
     void operator()(Values... values) const { exec(values...); }
 
+    // Synchronous dispatch is the default. A null executor restores it.
+    void setExecutor(std::shared_ptr<Executor> executor, DispatchMode mode = ASYNCHRONOUS);
+
 #ifdef SIGNALS_TEST
     std::string getTextualState()
     {
@@ -44,23 +62,29 @@ public:
         ss << "next_: " << next_ << std::endl << "available_:";
         for (auto n: available_) ss << " " << n;
         ss << std::endl << "slots_:";
-        for (auto& slot: slots_) ss << " " << slot.first;
+        for (auto& slot: *slots_) ss << " " << slot.first;
         ss << std::endl;
         return ss.str(); 
     }
 #endif
 
 private:
+    typedef std::map<Connection, Slot> slots_t;
+
     void exec(Values... values) const;
+    std::shared_ptr<const slots_t> getSlots() const { return std::atomic_load(&slots_); }
 
     mutable std::mutex mutex_;
     Connection next_;
     std::set<Connection> available_;
-    std::map<Connection, Slot> slots_;
+    std::shared_ptr<const slots_t> slots_;
+
+    std::shared_ptr<Executor> executor_;
+    DispatchMode mode_;
 };
 
 template<typename... Values>
-inline Signal<Values...>::Signal() : next_(0)
+inline Signal<Values...>::Signal() : next_(0), slots_(std::make_shared<slots_t>()), mode_(SYNCHRONOUS)
 {
 }
 
@@ -85,7 +109,9 @@ inline Connection Signal<Values...>::connect(Slot slot)
         connection = *it;
         available_.erase(it);
     }
-    slots_.insert(std::pair<Connection, Slot>(connection, slot));
+    std::shared_ptr<slots_t> slots = std::make_shared<slots_t>(*slots_);
+    slots->insert(std::pair<Connection, Slot>(connection, slot));
+    std::atomic_store(&slots_, std::shared_ptr<const slots_t>(slots));
     return connection;
 }
 
@@ -93,10 +119,11 @@ template<typename... Values>
 inline bool Signal<Values...>::disconnect(Connection connection)
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    const auto& it = slots_.find(connection);
-    if (it == slots_.end()) return false;
+    if (!slots_->count(connection)) return false;
 
-    slots_.erase(it);
+    std::shared_ptr<slots_t> slots = std::make_shared<slots_t>(*slots_);
+    slots->erase(connection);
+    std::atomic_store(&slots_, std::shared_ptr<const slots_t>(slots));
     available_.insert(connection);
 
     // remove contiguous available connections from end
@@ -110,16 +137,45 @@ template<typename... Values>
 inline void Signal<Values...>::clear()
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    slots_.clear();
+    std::atomic_store(&slots_, std::shared_ptr<const slots_t>(std::make_shared<slots_t>()));
     available_.clear();
     next_ = 0;
 }
 
 template<typename... Values>
-inline void Signal<Values...>::exec(Values... values) const
+inline void Signal<Values...>::setExecutor(std::shared_ptr<Executor> executor, DispatchMode mode)
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    for (auto slot: slots_) slot.second(values...); 
+    executor_ = executor;
+    mode_ = executor ? mode : SYNCHRONOUS;
+}
+
+template<typename... Values>
+inline void Signal<Values...>::exec(Values... values) const
+{
+    std::shared_ptr<Executor> executor;
+    DispatchMode mode;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        executor = executor_;
+        mode = mode_;
+    }
+
+    std::shared_ptr<const slots_t> slots = getSlots();
+    if (slots->empty()) return;
+
+    if (mode == SYNCHRONOUS)
+    {
+        for (auto& slot: *slots) slot.second(values...);
+        return;
+    }
+
+    // The task owns copies of the values and of the slot map as of this emission
+    std::function<void()> task = std::bind([slots](Values... values) { for (auto& slot: *slots) slot.second(values...); }, values...);
+    if (mode == COALESCED)
+        executor->post(this, std::move(task));
+    else
+        executor->post(std::move(task));
 }
 
 template<typename... Values>
@@ -143,6 +199,9 @@ public:
     std::function<void()> bind() const;
     void operator()() const { exec(); }
 
+    // Synchronous dispatch is the default. A null executor restores it.
+    void setExecutor(std::shared_ptr<Executor> executor, DispatchMode mode = ASYNCHRONOUS);
+
 #ifdef SIGNALS_TEST
     std::string getTextualState()
     {
@@ -151,23 +210,29 @@ public:
         ss << "next_: " << next_ << std::endl << "available_:";
         for (auto n: available_) ss << " " << n;
         ss << std::endl << "slots_:";
-        for (auto& slot: slots_) ss << " " << slot.first;
+        for (auto& slot: *slots_) ss << " " << slot.first;
         ss << std::endl;
         return ss.str(); 
     }
 #endif
 
 private:
+    typedef std::map<Connection, Slot> slots_t;
+
     void exec() const;
+    std::shared_ptr<const slots_t> getSlots() const { return std::atomic_load(&slots_); }
 
     mutable std::mutex mutex_;
     Connection next_;
     std::set<Connection> available_;
-    std::map<Connection, Slot> slots_;
+    std::shared_ptr<const slots_t> slots_;
+
+    std::shared_ptr<Executor> executor_;
+    DispatchMode mode_;
 };
 
 template<>
-inline Signal<>::Signal() : next_(0)
+inline Signal<>::Signal() : next_(0), slots_(std::make_shared<slots_t>()), mode_(SYNCHRONOUS)
 {
 }
 
@@ -192,7 +257,9 @@ inline Connection Signal<>::connect(Slot slot)
         connection = *it;
         available_.erase(it);
     }
-    slots_.insert(std::pair<Connection, Slot>(connection, slot));
+    std::shared_ptr<slots_t> slots = std::make_shared<slots_t>(*slots_);
+    slots->insert(std::pair<Connection, Slot>(connection, slot));
+    std::atomic_store(&slots_, std::shared_ptr<const slots_t>(slots));
     return connection;
 }
 
@@ -200,10 +267,11 @@ template<>
 inline bool Signal<>::disconnect(Connection connection)
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    const auto& it = slots_.find(connection);
-    if (it == slots_.end()) return false;
+    if (!slots_->count(connection)) return false;
 
-    slots_.erase(it);
+    std::shared_ptr<slots_t> slots = std::make_shared<slots_t>(*slots_);
+    slots->erase(connection);
+    std::atomic_store(&slots_, std::shared_ptr<const slots_t>(slots));
     available_.insert(connection);
 
     // remove contiguous available connections from end
@@ -217,16 +285,44 @@ template<>
 inline void Signal<>::clear()
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    slots_.clear();
+    std::atomic_store(&slots_, std::shared_ptr<const slots_t>(std::make_shared<slots_t>()));
     available_.clear();
     next_ = 0;
 }
 
 template<>
-inline void Signal<>::exec() const
+inline void Signal<>::setExecutor(std::shared_ptr<Executor> executor, DispatchMode mode)
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    for (auto slot: slots_) slot.second(); 
+    executor_ = executor;
+    mode_ = executor ? mode : SYNCHRONOUS;
+}
+
+template<>
+inline void Signal<>::exec() const
+{
+    std::shared_ptr<Executor> executor;
+    DispatchMode mode;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        executor = executor_;
+        mode = mode_;
+    }
+
+    std::shared_ptr<const slots_t> slots = getSlots();
+    if (slots->empty()) return;
+
+    if (mode == SYNCHRONOUS)
+    {
+        for (auto& slot: *slots) slot.second();
+        return;
+    }
+
+    std::function<void()> task = [slots]() { for (auto& slot: *slots) slot.second(); };
+    if (mode == COALESCED)
+        executor->post(this, std::move(task));
+    else
+        executor->post(std::move(task));
 }
 
 template<>
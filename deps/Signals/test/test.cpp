@@ -3,8 +3,16 @@
 #define SIGNALS_TEST
 #include <Signals.h>
 #include <SignalQueue.h>
+#include <Executor.h>
 
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 using namespace Signals;
 using namespace std;
@@ -71,5 +79,158 @@ int main()
     signalQueue.flush();
     signalQueue.flush();
 
+    cout << endl << "SignalQueue concurrent push test:" << endl;
+    std::atomic<int> flushed(0);
+    {
+        std::vector<std::thread> producers;
+        for (int i = 0; i < 4; i++)
+        {
+            producers.push_back(std::thread([&]()
+            {
+                for (int j = 0; j < 10000; j++) { signalQueue.push([&]() { flushed++; }); }
+            }));
+        }
+        for (auto& producer: producers) { producer.join(); }
+    }
+    signalQueue.flush();
+    cout << "flushed: " << flushed << " of 40000" << endl;
+
+    cout << endl << "SignalQueue reentrant flush test:" << endl;
+    signalQueue.push([&]() { signalQueue.push(std::bind(&coutString, "pushed by handler")); });
+    signalQueue.flush();
+
+    cout << endl << "SignalQueue throwing handler test:" << endl;
+    std::vector<int> delivered;
+    signalQueue.push([&]() { delivered.push_back(1); });
+    signalQueue.push([&]() { throw std::runtime_error("handler failed"); });
+    signalQueue.push([&]() { delivered.push_back(2); });
+    signalQueue.push([&]() { delivered.push_back(3); });
+    try
+    {
+        signalQueue.flush();
+        cout << "no exception" << endl;
+    }
+    catch (const std::exception& e)
+    {
+        cout << "rethrown: " << e.what() << endl;
+    }
+    cout << "delivered:";
+    for (int i: delivered) { cout << " " << i; }
+    cout << ", pending: " << signalQueue.size() << endl;
+
+    cout << endl << "SignalQueue concurrent flush test:" << endl;
+    delivered.clear();
+    bool ordered = true;
+    {
+        std::atomic<bool> done(false);
+        std::thread producer([&]()
+        {
+            for (int i = 0; i < 20000; i++) { signalQueue.push([&, i]() { if (!delivered.empty() && delivered.back() != i - 1) ordered = false; delivered.push_back(i); }); }
+            done = true;
+        });
+        std::vector<std::thread> flushers;
+        for (int i = 0; i < 4; i++) { flushers.push_back(std::thread([&]() { while (!done) { signalQueue.flush(); } signalQueue.flush(); })); }
+        producer.join();
+        for (auto& flusher: flushers) { flusher.join(); }
+    }
+    cout << "delivered: " << delivered.size() << " of 20000, " << (ordered ? "in order" : "OUT OF ORDER") << endl;
+
+    cout << endl << "LockFreeQueue throwing consumer test:" << endl;
+    {
+        LockFreeQueue<int> queue;
+        for (int i = 0; i < 5; i++) { queue.push(i); }
+        std::vector<int> consumed;
+        try
+        {
+            queue.consume([&](int& i)
+            {
+                if (i == 2)
+                {
+                    queue.push(5);
+                    throw std::runtime_error("consumer failed");
+                }
+                consumed.push_back(i);
+            });
+        }
+        catch (const std::exception& e)
+        {
+            cout << "rethrown: " << e.what() << endl;
+        }
+        queue.consume([&](int& i) { consumed.push_back(i); });
+        cout << "consumed:";
+        for (int i: consumed) { cout << " " << i; }
+        cout << endl;
+    }
+
+    cout << endl << "Executor stop from task test:" << endl;
+    {
+        // Owned jointly with the task, which outlives both the executor and this scope's locals
+        struct StopState
+        {
+            std::promise<void> deleted;
+            std::promise<void> finished;
+            std::atomic<int> ran;
+            StopState() : ran(0) { }
+        };
+        std::shared_ptr<StopState> state = std::make_shared<StopState>();
+        std::future<void> finished = state->finished.get_future();
+
+        Executor* selfStopping = new Executor();
+        selfStopping->post([selfStopping, state]()
+        {
+            selfStopping->stop();
+            state->deleted.get_future().wait();
+            state->ran++;
+            state->finished.set_value();
+        });
+        selfStopping->post([state]() { state->ran += 10; });
+        while (selfStopping->isRunning()) { std::this_thread::yield(); }
+
+        // The task is still running on the detached thread when the executor goes away
+        delete selfStopping;
+        state->deleted.set_value();
+        finished.wait();
+        int ran = state->ran;
+        cout << "tasks run: " << ran << endl;
+    }
+
+    cout << endl << "Executor dispatch test:" << endl;
+    std::shared_ptr<Executor> executor = std::make_shared<Executor>();
+    std::thread::id emitter = std::this_thread::get_id();
+    bool sameThread = true;
+    int last = -1;
+    int calls = 0;
+    notifyInt.clear();
+    notifyInt.connect([&](int i) { sameThread = (std::this_thread::get_id() == emitter); last = i; calls++; });
+    notifyInt(1);
+    cout << "synchronous: " << (sameThread ? "emitting thread" : "other thread") << ", last: " << last << endl;
+
+    notifyInt.setExecutor(executor);
+    calls = 0;
+    for (int i = 0; i < 100; i++) { notifyInt(i); }
+    executor->wait();
+    cout << "asynchronous: " << (sameThread ? "emitting thread" : "other thread") << ", calls: " << calls << ", last: " << last << endl;
+
+    cout << endl << "Executor coalescing test:" << endl;
+    notifyInt.setExecutor(executor, COALESCED);
+    calls = 0;
+    std::mutex gate;
+    {
+        // Hold the executor thread so all emissions are pending together
+        std::unique_lock<std::mutex> lock(gate);
+        executor->post([&]() { std::lock_guard<std::mutex> lock(gate); });
+        for (int i = 0; i < 100; i++) { notifyInt(i); }
+    }
+    executor->wait();
+    cout << "coalesced: calls: " << calls << ", last: " << last << endl;
+
+    cout << endl << "Signal reentrant connect test:" << endl;
+    notifyInt.setExecutor(nullptr);
+    notifyVoid.clear();
+    notifyVoid.connect([&]() { notifyVoid.connect([]() { }); cout << "connected from slot" << endl; });
+    notifyVoid();
+    cout << "notifyVoid state:" << endl << notifyVoid.getTextualState();
+
+    executor->stop();
     return 0;
 }
@@ -11,27 +11,486 @@
 
 #include "logger.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 #include <time.h>
 
 namespace logger {
-    std::ofstream file;
+    namespace {
+        std::string format_time(std::time_t rawtime)
+        {
+            struct tm* timeinfo = gmtime(&rawtime);
+
+            char buffer[20];
+            strftime(buffer, 20, "%F %T",timeinfo);
+            return std::string(buffer);
+        }
+
+        // Formats at most once a second per thread.
+        class time_cache
+        {
+        public:
+            time_cache() : time_(-1) { }
+
+            const std::string& get(std::time_t rawtime)
+            {
+                if (rawtime != time_)
+                {
+                    time_ = rawtime;
+                    text_ = format_time(rawtime);
+                }
+                return text_;
+            }
+
+        private:
+            std::time_t time_;
+            std::string text_;
+        };
+
+        struct entry
+        {
+            level_t level;
+            std::time_t time;
+            std::string text;
+        };
+
+        // Bounded multi-producer ring. Each cell's sequence number tells whether it is
+        // free for the producer at that position or holds a line for the consumer.
+        class ring
+        {
+        public:
+            static const size_t CAPACITY = 8192;
+
+            ring() : cells_(CAPACITY), enqueue_pos_(0), dequeue_pos_(0)
+            {
+                for (size_t i = 0; i < CAPACITY; i++) { cells_[i].seq.store(i, std::memory_order_relaxed); }
+            }
+
+            // Returns false if full.
+            bool push(entry& e)
+            {
+                size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+                cell* c;
+                while (true)
+                {
+                    c = &cells_[pos & (CAPACITY - 1)];
+                    size_t seq = c->seq.load(std::memory_order_acquire);
+                    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                    if (diff == 0)
+                    {
+                        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                    }
+                    else if (diff < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        pos = enqueue_pos_.load(std::memory_order_relaxed);
+                    }
+                }
+                c->e = std::move(e);
+                c->seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Single consumer only.
+            bool pop(entry& e)
+            {
+                size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+                cell* c = &cells_[pos & (CAPACITY - 1)];
+                if (c->seq.load(std::memory_order_acquire) != pos + 1) return false;
+
+                e = std::move(c->e);
+                c->seq.store(pos + CAPACITY, std::memory_order_release);
+                dequeue_pos_.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            size_t pushed() const { return enqueue_pos_.load(std::memory_order_acquire); }
+            size_t popped() const { return dequeue_pos_.load(std::memory_order_acquire); }
+
+        private:
+            struct cell
+            {
+                std::atomic<size_t> seq;
+                entry e;
+            };
+
+            std::vector<cell> cells_;
+            std::atomic<size_t> enqueue_pos_;
+            std::atomic<size_t> dequeue_pos_;
+        };
+
+        class writer
+        {
+        public:
+            writer() : running_(false), wake_requested_(false), written_(0) { }
+
+            bool running() const { return running_; }
+
+            void start(const char* filename)
+            {
+                std::lock_guard<std::mutex> lock(control_mutex_);
+                stop_unlocked();
+
+                file_.open(filename, std::ios_base::app);
+                running_ = true;
+                thread_ = std::thread(&writer::run, this);
+            }
+
+            void stop()
+            {
+                std::lock_guard<std::mutex> lock(control_mutex_);
+                stop_unlocked();
+            }
+
+            void push(entry& e)
+            {
+                if (!running_) return;
+
+                level_t level = e.level;
+                while (!ring_.push(e))
+                {
+                    // Full: the writer is behind, so wait for it rather than lose lines.
+                    wake();
+                    std::this_thread::yield();
+                    if (!running_) return;
+                }
+
+                if (level == fatal)                                             { flush(); }
+                else if (level >= error ||
+                         ring_.pushed() - ring_.popped() > ring::CAPACITY / 4)  { wake(); }
+            }
+
+            void flush()
+            {
+                size_t target = ring_.pushed();
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_requested_ = true;
+                wake_condition_.notify_one();
+                flushed_condition_.wait(lock, [&]() { return written_ >= target || !running_; });
+            }
+
+        private:
+            void wake()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                wake_requested_ = true;
+                wake_condition_.notify_one();
+            }
+
+            void stop_unlocked()
+            {
+                if (!thread_.joinable()) return;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    running_ = false;
+                    wake_condition_.notify_one();
+                }
+                thread_.join();
+                file_.close();
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                flushed_condition_.notify_all();
+            }
+
+            void run()
+            {
+                time_cache times;
+                entry e;
+                while (true)
+                {
+                    bool wrote = false;
+                    while (ring_.pop(e))
+                    {
+                        file_ << times.get(e.time) << " [" << level_to_string(e.level) << "] " << e.text;
+                        if (e.text.empty() || e.text.back() != '\n') { file_ << '\n'; }
+                        e.text.clear();
+                        wrote = true;
+                    }
+
+                    if (wrote) continue;
+
+                    file_.flush();
+
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    written_ = ring_.popped();
+                    flushed_condition_.notify_all();
+                    if (!running_) return;
+
+                    wake_condition_.wait_for(lock, std::chrono::milliseconds(50), [this]() { return wake_requested_ || !running_; });
+                    wake_requested_ = false;
+                }
+            }
+
+            ring ring_;
+            std::ofstream file_;
+
+            std::atomic<bool> running_;
+            std::mutex control_mutex_;
+            std::thread thread_;
+
+            std::mutex mutex_;
+            std::condition_variable wake_condition_;
+            std::condition_variable flushed_condition_;
+            bool wake_requested_;
+            size_t written_;
+        };
+
+        // Never destroyed so statements in static destructors stay safe.
+        writer& the_writer()
+        {
+            static writer* w = new writer();
+            return *w;
+        }
+
+        std::string module_name(const char* file_or_name)
+        {
+            std::string name(file_or_name);
+            size_t slash = name.find_last_of("/\\");
+            if (slash != std::string::npos) { name = name.substr(slash + 1); }
+            size_t dot = name.find('.');
+            if (dot != std::string::npos) { name = name.substr(0, dot); }
+            return name;
+        }
+
+        struct line_stream
+        {
+            line_stream() : busy(false) { }
+
+            std::ostringstream stream;
+            bool busy;
+        };
+
+        thread_local line_stream this_thread_stream;
+    }
+
+    class registry
+    {
+    public:
+        registry() : default_level_(trace) { }
+
+        const module& get(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = modules_.find(name);
+            if (it != modules_.end()) return *it->second;
+
+            module* m = new module(name);
+            modules_[name] = m;
+            apply(*m);
+            return *m;
+        }
+
+        void set_default(level_t level)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            default_level_ = level;
+            apply_all();
+        }
+
+        void set_override(const std::string& name, level_t level)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            overrides_[name] = level;
+            auto it = modules_.find(name);
+            if (it != modules_.end()) { apply(*it->second); }
+        }
+
+        void set(level_t default_level, const std::map<std::string, level_t>& overrides)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            default_level_ = default_level;
+            overrides_ = overrides;
+            apply_all();
+        }
+
+        // Call after the writer starts or stops.
+        void refresh()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            apply_all();
+        }
+
+    private:
+        void apply(module& m)
+        {
+            auto it = overrides_.find(m.name_);
+            level_t level = (it != overrides_.end()) ? it->second : default_level_;
+            m.level_.store(the_writer().running() ? level : off, std::memory_order_relaxed);
+        }
+
+        void apply_all()
+        {
+            for (auto& m: modules_) { apply(*m.second); }
+        }
+
+        std::mutex mutex_;
+        level_t default_level_;
+        std::map<std::string, level_t> overrides_;
+        std::map<std::string, module*> modules_;
+    };
+
+    namespace {
+        registry& the_registry()
+        {
+            static registry* r = new registry();
+            return *r;
+        }
+    }
+
     void init_logger(const char* filename)
     {
-        file.open(filename, std::ios_base::app);
+        static std::once_flag at_exit;
+        std::call_once(at_exit, []() { std::atexit(shutdown); });
+
+        the_writer().start(filename);
+        the_registry().refresh();
+
+        const char* levels = std::getenv("LOGGER_LEVELS");
+        if (levels)
+        {
+            try
+            {
+                set_levels(levels);
+            }
+            catch (const std::exception& e)
+            {
+                LOGGER(warning) << "LOGGER_LEVELS ignored: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    void set_level(level_t level)
+    {
+        the_registry().set_default(level);
+    }
+
+    void set_level(const std::string& module, level_t level)
+    {
+        the_registry().set_override(module, level);
+    }
+
+    void set_levels(const std::string& spec)
+    {
+        level_t default_level = trace;
+        std::map<std::string, level_t> overrides;
+
+        std::istringstream ss(spec);
+        std::string item;
+        bool first = true;
+        while (std::getline(ss, item, ','))
+        {
+            size_t eq = item.find('=');
+            if (eq == std::string::npos)
+            {
+                if (!first) throw std::invalid_argument("Default level must come first.");
+                default_level = level_from_string(item);
+            }
+            else
+            {
+                std::string name = item.substr(0, eq);
+                if (name.empty()) throw std::invalid_argument("Missing module name.");
+                overrides[name] = level_from_string(item.substr(eq + 1));
+            }
+            first = false;
+        }
+
+        the_registry().set(default_level, overrides);
+    }
+
+    level_t level_from_string(const std::string& name)
+    {
+        if (name == "trace")    return trace;
+        if (name == "debug")    return debug;
+        if (name == "info")     return info;
+        if (name == "warning")  return warning;
+        if (name == "error")    return error;
+        if (name == "fatal")    return fatal;
+        if (name == "off")      return off;
+        throw std::invalid_argument("Invalid log level: " + name);
+    }
+
+    const char* level_to_string(level_t level)
+    {
+        switch (level)
+        {
+        case trace:     return "trace";
+        case debug:     return "debug";
+        case info:      return "info";
+        case warning:   return "warning";
+        case error:     return "error";
+        case fatal:     return "fatal";
+        default:        return "off";
+        }
+    }
+
+    void flush()
+    {
+        if (the_writer().running()) { the_writer().flush(); }
+    }
+
+    void shutdown()
+    {
+        the_writer().stop();
+        the_registry().refresh();
     }
 
     std::string timestamp()
     {
-        time_t rawtime;
-        time(&rawtime);
-        struct tm* timeinfo = gmtime(&rawtime);
+        static thread_local time_cache times;
+        return times.get(std::time(nullptr));
+    }
+
+    const module& get_module(const char* file_or_name)
+    {
+        return the_registry().get(module_name(file_or_name));
+    }
+
+    record::record(level_t level) : level_(level), time_(std::time(nullptr))
+    {
+        line_stream& ls = this_thread_stream;
+        if (ls.busy)
+        {
+            // A value being logged is itself logging
+            stream_ = new std::ostringstream();
+            owns_stream_ = true;
+        }
+        else
+        {
+            ls.busy = true;
+            ls.stream.str(std::string());
+            ls.stream.clear();
+            stream_ = &ls.stream;
+            owns_stream_ = false;
+        }
+    }
+
+    record::~record()
+    {
+        try
+        {
+            entry e;
+            e.level = level_;
+            e.time = time_;
+            e.text = stream_->str();
+            the_writer().push(e);
+        }
+        catch (...)
+        {
+        }
 
-        char buffer[20];
-        strftime(buffer, 20, "%F %T",timeinfo);
-        return std::string(buffer);
+        if (owns_stream_)   { delete stream_; }
+        else                { this_thread_stream.busy = false; }
     }
 
-    std::ostream out(file.rdbuf());
     std::ostream no_out(NULL);
 }
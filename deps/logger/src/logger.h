@@ -12,14 +12,86 @@
 #ifndef _LOGGER_H__
 #define _LOGGER_H__
 
+#include <atomic>
+#include <ctime>
 #include <sstream>
 #include <string>
 
+// Log statements are written as LOGGER(level) << ... << std::endl;
+//
+// The LOGGER_<LEVEL> macros set the lowest level compiled in. Above that, the
+// level is chosen at runtime per module, where a module is the source file name
+// without directory or extension (e.g. "Peer" or "SynchedVault") unless
+// LOGGER_MODULE is defined before including this header. A statement below its
+// module's level does not evaluate its arguments.
+//
+// Lines are queued to a background writer thread started by INIT_LOGGER. Until
+// then, and after logger::shutdown(), nothing is logged.
+
 namespace logger {
+    enum level_t { trace, debug, info, warning, error, fatal, off };
+
+    // Levels are given as a default optionally followed by per-module overrides,
+    // e.g. "info,Peer=trace,CoinQ_netsync=debug". INIT_LOGGER applies the
+    // LOGGER_LEVELS environment variable, if set, on top of the default of trace.
     void init_logger(const char* filename);
+    void set_level(level_t level);
+    void set_level(const std::string& module, level_t level);
+    void set_levels(const std::string& spec); // throws std::invalid_argument
+    level_t level_from_string(const std::string& name); // throws std::invalid_argument
+    const char* level_to_string(level_t level);
+
+    // Blocks until everything logged so far is written out.
+    void flush();
+
+    // Writes out pending lines and stops the writer thread. Called at exit.
+    void shutdown();
+
     std::string timestamp();
-    extern "C" std::ostream out;
     extern "C" std::ostream no_out;
+
+    class module
+    {
+    public:
+        explicit module(const std::string& name) : name_(name), level_(off) { }
+
+        const std::string& name() const { return name_; }
+        bool enabled(level_t level) const { return level >= level_.load(std::memory_order_relaxed); }
+
+    private:
+        friend class registry;
+
+        std::string name_;
+        std::atomic<int> level_;
+    };
+
+    // Returns the module for a source file or module name. Modules live until exit.
+    const module& get_module(const char* file_or_name);
+
+    // Collects one line and queues it when the statement ends.
+    class record
+    {
+    public:
+        explicit record(level_t level);
+        ~record();
+
+        std::ostream& stream() { return *stream_; }
+
+    private:
+        record(const record&) = delete;
+        record& operator=(const record&) = delete;
+
+        level_t level_;
+        std::time_t time_;
+        std::ostringstream* stream_;
+        bool owns_stream_;
+    };
+
+    // Gives the enabled branch of LOGGER_STATEMENT the same type as the disabled one.
+    struct voidify
+    {
+        void operator&(std::ostream&) { }
+    };
 }
 
 #define INIT_LOGGER(filename) logger::init_logger(filename)
@@ -28,38 +100,54 @@ namespace logger {
     #define LOGGER_TRACE
 #endif
 
+#if defined(LOGGER_MODULE)
+    #define LOGGER_MODULE_NAME LOGGER_MODULE
+#else
+    #define LOGGER_MODULE_NAME __FILE__
+#endif
+
+// The module is looked up once per statement site and cached.
+#define LOGGER_THIS_MODULE \
+    ([]() -> const logger::module& { static const logger::module& m = logger::get_module(LOGGER_MODULE_NAME); return m; }())
+
+#define LOGGER_STATEMENT(level) \
+    !LOGGER_THIS_MODULE.enabled(level) ? (void)0 : logger::voidify() & logger::record(level).stream()
+
+#define LOGGER_DISABLED \
+    true ? (void)0 : logger::voidify() & logger::no_out
+
 #define LOGGER(level) LOGGER_##level
 
 #if defined(LOGGER_TRACE)
-    #define LOGGER_trace logger::out << logger::timestamp() << " [trace] "
+    #define LOGGER_trace LOGGER_STATEMENT(logger::trace)
 #else
-    #define LOGGER_trace logger::no_out
+    #define LOGGER_trace LOGGER_DISABLED
 #endif
 
 #if defined(LOGGER_TRACE) || defined(LOGGER_DEBUG)
-    #define LOGGER_debug logger::out << logger::timestamp() << " [debug] "
+    #define LOGGER_debug LOGGER_STATEMENT(logger::debug)
 #else
-    #define LOGGER_debug logger::no_out
+    #define LOGGER_debug LOGGER_DISABLED
 #endif
 
 #if defined(LOGGER_TRACE) || defined(LOGGER_DEBUG) || defined(LOGGER_INFO)
-    #define LOGGER_info logger::out << logger::timestamp() << " [info] "
+    #define LOGGER_info LOGGER_STATEMENT(logger::info)
 #else
-    #define LOGGER_info logger::no_out
+    #define LOGGER_info LOGGER_DISABLED
 #endif
 
 #if defined(LOGGER_TRACE) || defined(LOGGER_DEBUG) || defined(LOGGER_INFO) || defined(LOGGER_WARNING)
-    #define LOGGER_warning logger::out << logger::timestamp() << " [warning] "
+    #define LOGGER_warning LOGGER_STATEMENT(logger::warning)
 #else
-    #define LOGGER_warning logger::no_out
+    #define LOGGER_warning LOGGER_DISABLED
 #endif
 
 #if defined(LOGGER_TRACE) || defined(LOGGER_DEBUG) || defined(LOGGER_INFO) || defined(LOGGER_WARNING) || defined(LOGGER_ERROR)
-    #define LOGGER_error logger::out << logger::timestamp() << " [error] "
+    #define LOGGER_error LOGGER_STATEMENT(logger::error)
 #else
-    #define LOGGER_error logger:no_out
+    #define LOGGER_error LOGGER_DISABLED
 #endif
 
-#define LOGGER_fatal logger::out << logger::timestamp() << " [fatal] "
+#define LOGGER_fatal LOGGER_STATEMENT(logger::fatal)
 
 #endif // _LOGGER_H__
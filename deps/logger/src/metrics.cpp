@@ -0,0 +1,187 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// metrics.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "metrics.h"
+
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+namespace metrics {
+    namespace {
+        int bucket_index(uint64_t micros)
+        {
+            int i = 0;
+            while (micros > 0 && i < histogram::BUCKETS - 1)
+            {
+                micros >>= 1;
+                i++;
+            }
+            return i;
+        }
+
+        class registry
+        {
+        public:
+            registry() : since_(std::chrono::steady_clock::now()) { }
+
+            template<typename T>
+            T& get(std::map<std::string, T*>& metrics, const std::string& name)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                T*& metric = metrics[name];
+                if (!metric) { metric = new T(); }
+                return *metric;
+            }
+
+            std::string report()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - since_).count();
+
+                std::stringstream ss;
+                ss << std::fixed << std::setprecision(1);
+                ss << "interval: " << seconds << " s";
+
+                if (!counters.empty())
+                {
+                    ss << std::endl << "counters:";
+                    for (auto& item: counters)
+                    {
+                        uint64_t value = item.second->value();
+                        ss << std::endl << "  " << std::left << std::setw(40) << item.first << std::right << std::setw(14) << value;
+                        if (seconds > 0) { ss << "  " << value / seconds << "/s"; }
+                    }
+                }
+
+                if (!gauges.empty())
+                {
+                    ss << std::endl << "gauges:";
+                    for (auto& item: gauges)
+                    {
+                        ss << std::endl << "  " << std::left << std::setw(40) << item.first << std::right << std::setw(14) << item.second->value();
+                    }
+                }
+
+                if (!histograms.empty())
+                {
+                    ss << std::endl << "histograms (us):";
+                    for (auto& item: histograms)
+                    {
+                        const histogram& h = *item.second;
+                        uint64_t count = h.count();
+                        ss << std::endl << "  " << std::left << std::setw(40) << item.first << std::right << std::setw(14) << count;
+                        if (count == 0) continue;
+                        ss << "  mean " << (double)h.sum() / count
+                           << "  p50 <" << h.percentile(0.5)
+                           << "  p90 <" << h.percentile(0.9)
+                           << "  p99 <" << h.percentile(0.99)
+                           << "  max " << h.max();
+                    }
+                }
+
+                return ss.str();
+            }
+
+            void reset()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (auto& item: counters)      { item.second->reset(); }
+                for (auto& item: histograms)    { item.second->reset(); }
+                since_ = std::chrono::steady_clock::now();
+            }
+
+            std::map<std::string, counter*> counters;
+            std::map<std::string, gauge*> gauges;
+            std::map<std::string, histogram*> histograms;
+
+        private:
+            std::mutex mutex_;
+            std::chrono::steady_clock::time_point since_;
+        };
+
+        // Never destroyed so metrics can be updated from static destructors.
+        registry& the_registry()
+        {
+            static registry* r = new registry();
+            return *r;
+        }
+    }
+
+    void histogram::record(uint64_t micros)
+    {
+        buckets_[bucket_index(micros)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(micros, std::memory_order_relaxed);
+
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (micros > max && !max_.compare_exchange_weak(max, micros, std::memory_order_relaxed));
+    }
+
+    void histogram::reset()
+    {
+        for (int i = 0; i < BUCKETS; i++) { buckets_[i].store(0, std::memory_order_relaxed); }
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t histogram::percentile(double fraction) const
+    {
+        uint64_t total = 0;
+        uint64_t counts[BUCKETS];
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            counts[i] = buckets_[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (total == 0) return 0;
+
+        uint64_t target = (uint64_t)(fraction * total);
+        if (target == 0) { target = 1; }
+
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i];
+            if (seen >= target) return (uint64_t)1 << i;
+        }
+        return (uint64_t)1 << (BUCKETS - 1);
+    }
+
+    counter& get_counter(const std::string& name)
+    {
+        registry& r = the_registry();
+        return r.get(r.counters, name);
+    }
+
+    gauge& get_gauge(const std::string& name)
+    {
+        registry& r = the_registry();
+        return r.get(r.gauges, name);
+    }
+
+    histogram& get_histogram(const std::string& name)
+    {
+        registry& r = the_registry();
+        return r.get(r.histograms, name);
+    }
+
+    std::string report()
+    {
+        return the_registry().report();
+    }
+
+    void reset()
+    {
+        the_registry().reset();
+    }
+}
@@ -0,0 +1,112 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// metrics.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#ifndef _METRICS_H__
+#define _METRICS_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Process-wide counters, gauges and latency histograms, looked up by name.
+// Updates are single atomic operations, so instrumented code should look up
+// each metric once, e.g.
+//
+//     static metrics::histogram& h = metrics::get_histogram("vault.insert_tx");
+//     metrics::scoped_timer timer(h);
+//
+// Names are dotted paths, subsystem first. Metrics live until exit.
+
+namespace metrics {
+    class counter
+    {
+    public:
+        counter() : value_(0) { }
+
+        void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+        void reset() { value_.store(0, std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> value_;
+    };
+
+    class gauge
+    {
+    public:
+        gauge() : value_(0) { }
+
+        void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+        void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+        int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<int64_t> value_;
+    };
+
+    // Microsecond latencies in power of two buckets, so percentiles are upper bounds
+    // within a factor of two.
+    class histogram
+    {
+    public:
+        static const int BUCKETS = 40;
+
+        histogram() { reset(); }
+
+        void record(uint64_t micros);
+        void reset();
+
+        uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+        uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+        uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+        // Upper bound of the bucket holding the given fraction of samples.
+        uint64_t percentile(double fraction) const;
+
+    private:
+        std::atomic<uint64_t> buckets_[BUCKETS];
+        std::atomic<uint64_t> count_;
+        std::atomic<uint64_t> sum_;
+        std::atomic<uint64_t> max_;
+    };
+
+    // Records the time from construction to destruction.
+    class scoped_timer
+    {
+    public:
+        explicit scoped_timer(histogram& h) : histogram_(h), start_(std::chrono::steady_clock::now()) { }
+        ~scoped_timer() { histogram_.record(elapsed()); }
+
+        uint64_t elapsed() const
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count();
+        }
+
+    private:
+        scoped_timer(const scoped_timer&) = delete;
+        scoped_timer& operator=(const scoped_timer&) = delete;
+
+        histogram& histogram_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    counter& get_counter(const std::string& name);
+    gauge& get_gauge(const std::string& name);
+    histogram& get_histogram(const std::string& name);
+
+    // Text table of all metrics sorted by name. Counters show their rate since the last reset.
+    std::string report();
+
+    // Zeroes counters and histograms. Gauges hold current state and are left alone.
+    void reset();
+}
+
+#endif // _METRICS_H__
@@ -200,6 +200,7 @@ LIBS += \
     -lboost_thread$$BOOST_THREAD_LIB_SUFFIX$$BOOST_LIB_SUFFIX \
     -lboost_serialization$$BOOST_LIB_SUFFIX \
     -lcrypto \
+    -lz \
     -lodb-sqlite \
     -lodb \
     -lsqlite3
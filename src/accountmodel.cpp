@@ -16,6 +16,8 @@
 
 #include "accountmodel.h"
 
+#include <CoinDB/VaultSnapshot.h>
+
 #include <CoinQ/CoinQ_coinparams.h>
 #include <CoinQ/CoinQ_script.h>
 #include <CoinQ/CoinQ_netsync.h>
@@ -88,15 +90,17 @@ void AccountModel::update()
         return;
     }
 
+    // Read from a snapshot so a sync write in progress doesn't block the UI
+    CoinDB::VaultSnapshot snapshot(*vault);
     QStringList accountNames;
-    std::vector<AccountInfo> accounts = vault->getAllAccountInfo();
+    std::vector<AccountInfo> accounts = snapshot.getAllAccountInfo();
     for (auto& account: accounts) {
         QString accountName = QString::fromStdString(account.name());
         QString policy = QString::number(account.minsigs()) + tr(" of ") + QString::fromStdString(stdutils::delimited_list(account.keychain_names(), ", "));
         //QString balance = QString::number(vault->getAccountBalance(account.name(), 0)/(1.0 * currency_divisor), 'g', 8);
 
-        uint64_t total = vault->getAccountBalance(account.name(), 0);
-        uint64_t confirmed = vault->getAccountBalance(account.name(), 1);
+        uint64_t total = snapshot.getAccountBalance(account.name(), 0);
+        uint64_t confirmed = snapshot.getAccountBalance(account.name(), 1);
         uint64_t pending = total - confirmed;
         QString confirmedBalance = getFormattedCurrencyAmount(confirmed);
         QString pendingBalance = tr("+") + getFormattedCurrencyAmount(pending);
@@ -135,6 +139,35 @@ void AccountModel::update()
     emit updated(accountNames);
 }
 
+void AccountModel::updateBalances(const QStringList& accountNames)
+{
+    CoinDB::Vault* vault = m_synchedVault.getVault();
+    if (!vault) return;
+
+    if (getCurrencySymbol() != currencySymbol) {
+        update();
+        return;
+    }
+
+    CoinDB::VaultSnapshot snapshot(*vault);
+    int found = 0;
+    for (int row = 0; row < rowCount(); row++) {
+        QString accountName = item(row, 0)->text();
+        if (!accountNames.isEmpty() && !accountNames.contains(accountName)) continue;
+
+        uint64_t total = snapshot.getAccountBalance(accountName.toStdString(), 0);
+        uint64_t confirmed = snapshot.getAccountBalance(accountName.toStdString(), 1);
+        uint64_t pending = total - confirmed;
+        item(row, 2)->setText(getFormattedCurrencyAmount(confirmed));
+        item(row, 3)->setText(tr("+") + getFormattedCurrencyAmount(pending));
+        item(row, 4)->setText(getFormattedCurrencyAmount(total));
+        found++;
+    }
+
+    // An account we don't have a row for yet
+    if (found < accountNames.size()) { update(); }
+}
+
 CoinDB::Vault* AccountModel::getVault() const
 {
     return m_synchedVault.getVault();
@@ -102,6 +102,9 @@ signals:
 public slots:
     void update();
 
+    // Refreshes the balance columns of the named accounts, or of all accounts if the list is empty.
+    void updateBalances(const QStringList& accountNames = QStringList());
+
 private:
     void setColumns();
 
@@ -13,6 +13,8 @@
 
 #include "keychainmodel.h"
 
+#include <CoinDB/VaultSnapshot.h>
+
 #include <QStandardItemModel>
 
 using namespace CoinDB;
@@ -39,7 +41,8 @@ void KeychainModel::update()
 
     if (!vault) return;
 
-    std::vector<KeychainView> keychains = vault->getRootKeychainViews();
+    // Shared copy, only reloaded after keychains change
+    std::vector<KeychainView> keychains = CoinDB::VaultSnapshot(*vault).getRootKeychainViews();
     for (auto& keychain: keychains)
     {
         QList<QStandardItem*> row;
@@ -173,12 +173,20 @@ MainWindow::MainWindow() :
     //synchedVault.subscribeVaultError([this](const std::string& error, int /*code*/) { emit signal_error(tr("Vault error: ") + QString::fromStdString(error)); });
     connect(this, SIGNAL(signal_error(const QString&)), this, SLOT(showError(const QString&)));
 
-    synchedVault.subscribeTxInserted([this](std::shared_ptr<CoinDB::Tx> /*tx*/) { if (isSynched()) emit signal_newTx(); });
-    synchedVault.subscribeTxUpdated([this](std::shared_ptr<CoinDB::Tx> /*tx*/) { if (isSynched()) emit signal_newTx(); });
-    synchedVault.subscribeMerkleBlockInserted([this](std::shared_ptr<CoinDB::MerkleBlock> /*merkleblock*/) { emit signal_newBlock(); });
+    // Change sets arrive on the sync thread. They are merged and applied on the GUI thread
+    // when the timer fires, so a burst of blocks during sync costs a single model update.
+    changeSetTimer = new QTimer(this);
+    changeSetTimer->setSingleShot(true);
+    connect(changeSetTimer, SIGNAL(timeout()), this, SLOT(applyChangeSet()));
+    synchedVault.subscribeChangeSet([this](const CoinDB::VaultChangeSet& changes) {
+        {
+            std::lock_guard<std::mutex> lock(pendingChangesMutex);
+            pendingChanges.merge(changes);
+        }
+        emit signal_changeSet();
+    });
 
-    connect(this, SIGNAL(signal_newTx()), this, SLOT(newTx()));
-    connect(this, SIGNAL(signal_newBlock()), this, SLOT(newBlock()));
+    connect(this, SIGNAL(signal_changeSet()), this, SLOT(scheduleChangeSet()));
     connect(this, SIGNAL(signal_refreshAccounts()), this, SLOT(refreshAccounts()));
 
     accountSelectionModel = accountView->selectionModel();
@@ -236,6 +244,11 @@ MainWindow::MainWindow() :
     });
     connect(this, &MainWindow::vaultClosed, [this]() {
         if (bQuitting) return;
+        {
+            std::lock_guard<std::mutex> lock(pendingChangesMutex);
+            pendingChanges.clear();
+        }
+
         keychainModel->setVault(nullptr);
         keychainModel->update();
 
@@ -1930,9 +1943,45 @@ void MainWindow::newTx()
     refreshAccounts();
 }
 
-void MainWindow::newBlock()
+void MainWindow::scheduleChangeSet()
 {
-    if (isSynched() || syncHeight % 10 == 0) { refreshAccounts(); }
+    if (changeSetTimer->isActive()) return;
+    if (isSynched())    { changeSetTimer->start(CHANGESET_SYNCHED_DELAY_MS); }
+    else                { changeSetTimer->start(CHANGESET_SYNCHING_DELAY_MS); }
+}
+
+void MainWindow::applyChangeSet()
+{
+    if (bQuitting) return;
+
+    CoinDB::VaultChangeSet changes;
+    {
+        std::lock_guard<std::mutex> lock(pendingChangesMutex);
+        std::swap(changes, pendingChanges);
+    }
+    if (changes.empty() || !synchedVault.isVaultOpen()) return;
+
+    LOGGER(trace) << "MainWindow::applyChangeSet() - inserted: " << changes.inserted_tx_ids.size() << ", updated: " << changes.updated_tx_ids.size() << ", deleted: " << changes.deleted_tx_ids.size() << ", chain changed: " << (changes.chain_changed ? "true" : "false") << std::endl;
+
+    try {
+        // Confirmed balances of every account depend on the chain tip
+        if (changes.chain_changed) {
+            accountModel->updateBalances();
+        }
+        else if (!changes.account_names.empty()) {
+            QStringList accountNames;
+            for (auto& name: changes.account_names) { accountNames << QString::fromStdString(name); }
+            accountModel->updateBalances(accountNames);
+        }
+
+        if (!selectedAccount.isEmpty() && (changes.chain_changed || changes.account_names.count(selectedAccount.toStdString()))) {
+            txModel->applyChanges(changes);
+        }
+    }
+    catch (const exception& e) {
+        LOGGER(debug) << "MainWindow::applyChangeSet - " << e.what() << std::endl;
+        showError(e.what());
+    }
 }
 
 void MainWindow::syncBlocks()
@@ -35,6 +35,8 @@ class SignatureActions;
 
 class RequestPaymentDialog;
 
+class QTimer;
+
 #include <CoinDB/SynchedVault.h>
 //#include <CoinQ/CoinQ_netsync.h>
 
@@ -42,6 +44,7 @@ class RequestPaymentDialog;
 
 #include <QMainWindow>
 
+#include <mutex>
 #include <vector>
 
 enum fontsize_t { SMALL_FONTS , MEDIUM_FONTS , LARGE_FONTS };
@@ -92,8 +95,7 @@ signals:
     void signal_networkTimeout();
     void signal_networkDoneSync();
 
-    void signal_newTx();
-    void signal_newBlock();
+    void signal_changeSet();
     void signal_refreshAccounts();
 
     void signal_addBestChain(const chain_header_t& header);
@@ -202,7 +204,11 @@ private slots:
     void blocksSynched();
     void addBestChain(const chain_header_t& header);
     void removeBestChain(const chain_header_t& header);
-    void newBlock();
+
+    ///////////////////////
+    // VAULT CHANGE EVENTS
+    void scheduleChangeSet();
+    void applyChangeSet();
 
     /////////////////////
     // NETWORK OPERATIONS
@@ -360,6 +366,13 @@ private:
     // network sync state
     network_state_t networkState;
 
+    // vault changes not yet shown, merged until changeSetTimer fires
+    static const int CHANGESET_SYNCHED_DELAY_MS = 100;
+    static const int CHANGESET_SYNCHING_DELAY_MS = 1000;
+    QTimer* changeSetTimer;
+    std::mutex pendingChangesMutex;
+    CoinDB::VaultChangeSet pendingChanges;
+
     // network state icons
     QPixmap* stoppedIcon;
     QMovie* synchingMovie;
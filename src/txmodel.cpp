@@ -14,6 +14,7 @@
 #include "txmodel.h"
 
 #include <CoinDB/SynchedVault.h>
+#include <CoinDB/VaultSnapshot.h>
 
 #include <CoinQ/CoinQ_script.h>
 
@@ -101,6 +102,9 @@ void TxModel::setAccount(const QString& accountName)
 class SortableRow
 {
 public:
+    SortableRow(int status, uint32_t nConfirmations, int64_t value, uint32_t txindex) :
+        status_(status), nConfirmations_(nConfirmations), value_(value), txindex_(txindex) { }
+
     SortableRow(const QList<QStandardItem*>& row, int status, uint32_t nConfirmations, int64_t value, uint32_t txindex) :
         row_(row), status_(status), nConfirmations_(nConfirmations), value_(value), txindex_(txindex) { }
 
@@ -111,6 +115,26 @@ public:
     int64_t value() const { return value_; }
     uint32_t txindex() const { return txindex_; }
 
+    bool operator<(const SortableRow& other) const
+    {
+        // order by status first (unsigned, then propagated, then confirmed)
+        if (status_ < other.status_) return true;
+        if (status_ > other.status_) return false;
+
+        // if confirmation counts are equal
+        if (nConfirmations_ == other.nConfirmations_) {
+            // if one value is positive and the other is negative, sort so that running balance remains positive
+            if (value_ < 0 && other.value_ > 0) return true;
+            if (value_ > 0 && other.value_ < 0) return false;
+
+            // otherwise sort by ascending tx index
+            return (txindex_ < other.txindex_);
+        }
+
+        // otherwise sort by ascending confirmation count
+        return (nConfirmations_ < other.nConfirmations_);
+    }
+
 private:
     QList<QStandardItem*> row_;
 
@@ -135,140 +159,230 @@ void TxModel::update()
 
     if (!vault || accountName.isEmpty()) return;
 
-    std::shared_ptr<BlockHeader> bestHeader = vault->getBestBlockHeader();
+    // Height and history from the same snapshot, without waiting for sync writes
+    CoinDB::VaultSnapshot snapshot(*vault);
+    uint32_t bestHeight = snapshot.getBestHeight();
 
-    std::vector<TxOutView> txoutviews = vault->getTxOutViews(accountName.toStdString(), "", TxOut::ROLE_BOTH, TxOut::BOTH, Tx::ALL, true);
+    std::vector<TxOutView> txoutviews = snapshot.getTxOutViews(accountName.toStdString(), "", TxOut::ROLE_BOTH, TxOut::BOTH, Tx::ALL, true);
     bytes_t last_txhash;
     QList<SortableRow> rows;
     for (auto& item: txoutviews) {
-        QList<QStandardItem*> row;
-
-        QDateTime utc;
-        utc.setTime_t(item.tx_timestamp);
-        QString time = utc.toLocalTime().toString();
-
-        QString description = QString::fromStdString(item.role_label());
-
-        // The type stuff is just to test the new db schema. It's all wrong, we're not going to use TxOutViews for this.
-        TxType txType;
-        QString type;
-        QString amount;
-        QString fee;
-        int64_t value = 0;
-        bytes_t this_txhash = item.tx_status == Tx::UNSIGNED ? item.tx_unsigned_hash : item.tx_hash;
-        switch (item.role_flags) {
-        case TxOut::ROLE_NONE:
-            txType = NONE;
-            type = tr("None");
-            break;
-
-        case TxOut::ROLE_SENDER:
-            txType = SEND;
-            type = tr("Send");
-            amount = "-";
-            value -= item.value;
-            if (item.tx_has_all_outpoints && item.tx_fee() > 0) {
-                if (this_txhash != last_txhash) {
-                    fee = "-";
-                    //fee += QString::number(item.tx_fee()/(1.0 * currency_divisor), 'g', 8);
-                    fee += getFormattedCurrencyAmount(item.tx_fee());
-                    value -= item.tx_fee();
-                    last_txhash = this_txhash;
-                }
-                else {
-                    fee = "||";
-                }
-            }
-            break;
-
-        case TxOut::ROLE_RECEIVER:
-            txType = RECEIVE;
-            type = tr("Receive");
-            amount = "+";
-            value += item.value;
-            break;
-
-        default:
-            txType = UNKNOWN;
-            type = tr("Unknown");
-        }
+        rows.append(createRow(item, bestHeight, last_txhash));
+    }
 
-        //amount += QString::number(item.value/(1.0 * currency_divisor), 'g', 8);
-        amount += getFormattedCurrencyAmount(item.value);
+    qSort(rows.begin(), rows.end());
 
-        uint32_t nConfirmations = 0;
-        QString confirmations;
-        if (item.tx_status >= Tx::PROPAGATED) {
-            if (bestHeader && item.height) {
-                nConfirmations = bestHeader->height() + 1 - item.height;
-                confirmations = QString::number(nConfirmations);
-            }
-            else {
-                confirmations = "0";
-            }
-        }
-        else if (item.tx_status == Tx::UNSIGNED) {
-            confirmations = tr("Unsigned");
-        }
-        else if (item.tx_status == Tx::UNSENT) {
-            confirmations = tr("Unsent");
-        }
-        QStandardItem* confirmationsItem = new QStandardItem(confirmations);
-        confirmationsItem->setData(item.tx_status, Qt::UserRole);
-        confirmationsItem->setData((int)nConfirmations, Qt::UserRole + 1);
+    // iterate in reverse order to compute running balance
+    int64_t balance = 0;
+    for (int i = rows.size() - 1; i >= 0; i--) {
+        balance += rows[i].value();
+        (rows[i].row())[5]->setText(getFormattedCurrencyAmount(balance));
+        (rows[i].row())[5]->setData((qlonglong)balance, Qt::UserRole);
+    }
 
-        QString address = QString::fromStdString(getAddressForTxOutScript(item.script, base58_versions));
-        QString hash = QString::fromStdString(uchar_vector(this_txhash).getHex());
+    // iterate in forward order to display
+    for (auto& row: rows) appendRow(row.row());
+}
 
-        row.append(new QStandardItem(time));
-        row.append(new QStandardItem(description));
+void TxModel::applyChanges(const VaultChangeSet& changes)
+{
+    if (!vault || accountName.isEmpty()) return;
 
-        QStandardItem* typeItem = new QStandardItem(type);
-        typeItem->setData(txType, Qt::UserRole);
-        row.append(typeItem);
+    if (getCurrencySymbol() != currencySymbol)
+    {
+        // Every row needs reformatting anyway
+        update();
+        return;
+    }
 
-        row.append(new QStandardItem(amount));
-        row.append(new QStandardItem(fee));
-        row.append(new QStandardItem("")); // placeholder for balance, once sorted
-        row.append(confirmationsItem);
-        row.append(new QStandardItem(address));
+    CoinDB::VaultSnapshot snapshot(*vault);
+    uint32_t bestHeight = snapshot.getBestHeight();
 
-        // Store the tx hash and tx index to uniquely identify the output.
-        QStandardItem* hashItem = new QStandardItem(hash);
-        hashItem->setData(item.tx_index, Qt::UserRole);
-        row.append(hashItem);
+    // Lowest row whose running balance must be recomputed. Rows above it are shifted or changed.
+    int dirtyRow = -1;
 
-        rows.append(SortableRow(row, item.tx_status, nConfirmations, value, item.tx_index));
+    // Updated txs are removed and reinserted since their position can change.
+    for (int i = rowCount() - 1; i >= 0; i--) {
+        unsigned long txId = (unsigned long)item(i, 0)->data(Qt::UserRole).toULongLong();
+        if (changes.deleted_tx_ids.count(txId) || changes.updated_tx_ids.count(txId)) {
+            removeRow(i);
+            if (dirtyRow == -1) { dirtyRow = i; }
+        }
     }
 
-    qSort(rows.begin(), rows.end(), [](const SortableRow& a, const SortableRow& b) {
-        // order by status first (unsigned, then propagated, then confirmed)
-        if (a.status() < b.status()) return true;
-        if (a.status() > b.status()) return false;
-
-        // if confirmation counts are equal
-        if (a.nConfirmations() == b.nConfirmations()) {
-            // if one value is positive and the other is negative, sort so that running balance remains positive
-            if (a.value() < 0 && b.value() > 0) return true;
-            if (a.value() > 0 && b.value() < 0) return false;
+    if (changes.chain_changed) { updateConfirmations(bestHeight); }
 
-            // otherwise sort by ascending tx index
-            return (a.txindex() < b.txindex());
+    std::set<unsigned long> txIds(changes.inserted_tx_ids);
+    txIds.insert(changes.updated_tx_ids.begin(), changes.updated_tx_ids.end());
+    std::vector<TxOutView> txoutviews = snapshot.getTxOutViewsForTxs(accountName.toStdString(), txIds, TxOut::ROLE_BOTH, TxOut::BOTH, true);
+    bytes_t last_txhash;
+    for (auto& view: txoutviews) {
+        SortableRow row = createRow(view, bestHeight, last_txhash);
+
+        // binary search for the first row that sorts after the new one
+        int lo = 0;
+        int hi = rowCount();
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (row < getSortableRow(mid)) { hi = mid; }
+            else                            { lo = mid + 1; }
         }
 
-        // otherwise sort by ascending confirmation count
-        return (a.nConfirmations() < b.nConfirmations());
-    });
+        insertRow(lo, row.row());
+        if (lo <= dirtyRow) { dirtyRow++; }
+        else                { dirtyRow = lo; }
+    }
 
-    // iterate in reverse order to compute running balance
+    if (dirtyRow == -1) return;
+    if (dirtyRow >= rowCount()) { dirtyRow = rowCount() - 1; }
+
+    // Running balances below dirtyRow are unchanged
     int64_t balance = 0;
-    for (int i = rows.size() - 1; i >= 0; i--) {
-        balance += rows[i].value();
-        (rows[i].row())[5]->setText(getFormattedCurrencyAmount(balance));
+    if (dirtyRow + 1 < rowCount()) { balance = item(dirtyRow + 1, 5)->data(Qt::UserRole).toLongLong(); }
+    for (int i = dirtyRow; i >= 0; i--) {
+        balance += item(i, 3)->data(Qt::UserRole).toLongLong();
+        QStandardItem* balanceItem = item(i, 5);
+        balanceItem->setText(getFormattedCurrencyAmount(balance));
+        balanceItem->setData((qlonglong)balance, Qt::UserRole);
     }
+}
 
-    // iterate in forward order to display
-    for (auto& row: rows) appendRow(row.row());
+SortableRow TxModel::createRow(const TxOutView& item, uint32_t bestHeight, bytes_t& last_txhash) const
+{
+    QList<QStandardItem*> row;
+
+    QDateTime utc;
+    utc.setTime_t(item.tx_timestamp);
+    QString time = utc.toLocalTime().toString();
+
+    QString description = QString::fromStdString(item.role_label());
+
+    // The type stuff is just to test the new db schema. It's all wrong, we're not going to use TxOutViews for this.
+    TxType txType;
+    QString type;
+    QString amount;
+    QString fee;
+    int64_t value = 0;
+    bytes_t this_txhash = item.tx_status == Tx::UNSIGNED ? item.tx_unsigned_hash : item.tx_hash;
+    switch (item.role_flags) {
+    case TxOut::ROLE_NONE:
+        txType = NONE;
+        type = tr("None");
+        break;
+
+    case TxOut::ROLE_SENDER:
+        txType = SEND;
+        type = tr("Send");
+        amount = "-";
+        value -= item.value;
+        if (item.tx_has_all_outpoints && item.tx_fee() > 0) {
+            if (this_txhash != last_txhash) {
+                fee = "-";
+                //fee += QString::number(item.tx_fee()/(1.0 * currency_divisor), 'g', 8);
+                fee += getFormattedCurrencyAmount(item.tx_fee());
+                value -= item.tx_fee();
+                last_txhash = this_txhash;
+            }
+            else {
+                fee = "||";
+            }
+        }
+        break;
+
+    case TxOut::ROLE_RECEIVER:
+        txType = RECEIVE;
+        type = tr("Receive");
+        amount = "+";
+        value += item.value;
+        break;
+
+    default:
+        txType = UNKNOWN;
+        type = tr("Unknown");
+    }
+
+    //amount += QString::number(item.value/(1.0 * currency_divisor), 'g', 8);
+    amount += getFormattedCurrencyAmount(item.value);
+
+    QStandardItem* confirmationsItem = new QStandardItem();
+    confirmationsItem->setData(item.tx_status, Qt::UserRole);
+    confirmationsItem->setData((int)item.height, Qt::UserRole + 2);
+    uint32_t nConfirmations = setConfirmations(confirmationsItem, bestHeight);
+
+    QString address = QString::fromStdString(getAddressForTxOutScript(item.script, base58_versions));
+    QString hash = QString::fromStdString(uchar_vector(this_txhash).getHex());
+
+    // Store the tx id so change sets can find the rows of a tx.
+    QStandardItem* timeItem = new QStandardItem(time);
+    timeItem->setData((qulonglong)item.tx_id, Qt::UserRole);
+    row.append(timeItem);
+    row.append(new QStandardItem(description));
+
+    QStandardItem* typeItem = new QStandardItem(type);
+    typeItem->setData(txType, Qt::UserRole);
+    row.append(typeItem);
+
+    QStandardItem* amountItem = new QStandardItem(amount);
+    amountItem->setData((qlonglong)value, Qt::UserRole);
+    row.append(amountItem);
+    row.append(new QStandardItem(fee));
+    row.append(new QStandardItem("")); // placeholder for balance, once sorted
+    row.append(confirmationsItem);
+    row.append(new QStandardItem(address));
+
+    // Store the tx hash and tx index to uniquely identify the output.
+    QStandardItem* hashItem = new QStandardItem(hash);
+    hashItem->setData(item.tx_index, Qt::UserRole);
+    row.append(hashItem);
+
+    return SortableRow(row, item.tx_status, nConfirmations, value, item.tx_index);
+}
+
+SortableRow TxModel::getSortableRow(int row) const
+{
+    QStandardItem* confirmationsItem = item(row, 6);
+    return SortableRow(
+        confirmationsItem->data(Qt::UserRole).toInt(),
+        (uint32_t)confirmationsItem->data(Qt::UserRole + 1).toInt(),
+        item(row, 3)->data(Qt::UserRole).toLongLong(),
+        (uint32_t)item(row, 8)->data(Qt::UserRole).toInt());
+}
+
+uint32_t TxModel::setConfirmations(QStandardItem* confirmationsItem, uint32_t bestHeight) const
+{
+    int status = confirmationsItem->data(Qt::UserRole).toInt();
+    uint32_t height = (uint32_t)confirmationsItem->data(Qt::UserRole + 2).toInt();
+
+    uint32_t nConfirmations = 0;
+    QString confirmations;
+    if (status >= Tx::PROPAGATED) {
+        if (bestHeight && height) {
+            nConfirmations = bestHeight + 1 - height;
+            confirmations = QString::number(nConfirmations);
+        }
+        else {
+            confirmations = "0";
+        }
+    }
+    else if (status == Tx::UNSIGNED) {
+        confirmations = tr("Unsigned");
+    }
+    else if (status == Tx::UNSENT) {
+        confirmations = tr("Unsent");
+    }
+
+    confirmationsItem->setText(confirmations);
+    confirmationsItem->setData((int)nConfirmations, Qt::UserRole + 1);
+    return nConfirmations;
+}
+
+void TxModel::updateConfirmations(uint32_t bestHeight)
+{
+    // A new best block shifts every confirmed row by the same amount, so the order is kept.
+    for (int i = 0; i < rowCount(); i++) {
+        QStandardItem* confirmationsItem = item(i, 6);
+        if (confirmationsItem->data(Qt::UserRole + 2).toInt()) { setConfirmations(confirmationsItem, bestHeight); }
+    }
 }
 
 bytes_t TxModel::getTxHash(int row) const
@@ -22,6 +22,8 @@ namespace CoinDB
     class SynchedVault;
 }
 
+class SortableRow;
+
 class TxModel : public QStandardItemModel
 {
     Q_OBJECT
@@ -39,6 +41,9 @@ public:
     void setAccount(const QString& accountName);
     void update();
 
+    // Removes, reinserts and rebalances only the rows touched by the change set.
+    void applyChanges(const CoinDB::VaultChangeSet& changes);
+
     bytes_t getTxHash(int row) const;
     int getTxStatus(int row) const;
     int getTxConfirmations(int row) const;
@@ -66,6 +71,11 @@ private:
 
     void setColumns();
 
+    SortableRow createRow(const CoinDB::TxOutView& item, uint32_t bestHeight, bytes_t& last_txhash) const;
+    SortableRow getSortableRow(int row) const;
+    uint32_t setConfirmations(QStandardItem* confirmationsItem, uint32_t bestHeight) const;
+    void updateConfirmations(uint32_t bestHeight);
+
     CoinDB::Vault* vault;
     QString accountName; // empty when not loaded
     uint64_t confirmedBalance;
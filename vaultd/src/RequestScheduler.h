@@ -0,0 +1,190 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// RequestScheduler.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// vaultd - worker pool with per-vault ordering
+//
+
+#pragma once
+
+#include <logger.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs requests on a pool of worker threads.
+//
+// Requests for the same key (a vault) keep their arrival order around writes:
+// a write waits for everything before it and runs alone, while consecutive
+// reads run in parallel. Requests with an empty key run whenever a worker is
+// free.
+class RequestScheduler
+{
+public:
+    typedef std::function<void()> Task;
+
+    explicit RequestScheduler(size_t threads);
+    ~RequestScheduler() { stop(); }
+
+    void post(const std::string& key, bool write, Task task);
+
+    // Runs everything already posted, then joins the workers. Later posts are dropped.
+    void stop();
+
+private:
+    struct Job
+    {
+        std::string key;
+        bool write;
+        Task task;
+    };
+
+    struct KeyState
+    {
+        KeyState() : runningReads(0), runningWrite(false) { }
+
+        std::deque<Job> pending;
+        size_t runningReads;
+        bool runningWrite;
+    };
+
+    // Moves whatever may now run for the key onto the ready queue.
+    void schedule_unwrapped(const std::string& key);
+    void finish(const Job& job);
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<Job> ready_;
+    std::map<std::string, KeyState> keys_;
+    std::vector<std::thread> threads_;
+    bool stopping_;
+};
+
+inline RequestScheduler::RequestScheduler(size_t threads) : stopping_(false)
+{
+    if (threads == 0) { threads = 1; }
+    for (size_t i = 0; i < threads; i++) { threads_.push_back(std::thread(&RequestScheduler::run, this)); }
+}
+
+inline void RequestScheduler::post(const std::string& key, bool write, Task task)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) return;
+
+    Job job;
+    job.key = key;
+    job.write = write;
+    job.task = std::move(task);
+
+    if (key.empty())
+    {
+        ready_.push_back(std::move(job));
+    }
+    else
+    {
+        keys_[key].pending.push_back(std::move(job));
+        schedule_unwrapped(key);
+    }
+    condition_.notify_all();
+}
+
+inline void RequestScheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) return;
+        stopping_ = true;
+        condition_.notify_all();
+    }
+
+    for (auto& thread: threads_) { thread.join(); }
+    threads_.clear();
+}
+
+inline void RequestScheduler::schedule_unwrapped(const std::string& key)
+{
+    KeyState& state = keys_[key];
+    while (!state.pending.empty() && !state.runningWrite)
+    {
+        Job& job = state.pending.front();
+        if (job.write)
+        {
+            if (state.runningReads > 0) break;
+            state.runningWrite = true;
+        }
+        else
+        {
+            state.runningReads++;
+        }
+
+        ready_.push_back(std::move(job));
+        state.pending.pop_front();
+    }
+
+    if (state.pending.empty() && state.runningReads == 0 && !state.runningWrite) { keys_.erase(key); }
+}
+
+inline void RequestScheduler::finish(const Job& job)
+{
+    if (job.key.empty()) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    KeyState& state = keys_[job.key];
+    if (job.write)  { state.runningWrite = false; }
+    else            { state.runningReads--; }
+
+    schedule_unwrapped(job.key);
+    condition_.notify_all();
+}
+
+inline void RequestScheduler::run()
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this]() { return !ready_.empty() || (stopping_ && keys_.empty()); });
+            if (ready_.empty()) return;
+
+            job = std::move(ready_.front());
+            ready_.pop_front();
+        }
+
+        // The key is released however the task ends, or its vault would never run another request.
+        struct Finisher
+        {
+            Finisher(RequestScheduler& scheduler, const Job& job) : scheduler(scheduler), job(job) { }
+            ~Finisher() { scheduler.finish(job); }
+
+            RequestScheduler& scheduler;
+            const Job& job;
+        } finisher(*this, job);
+
+        // An exception escaping a worker thread would terminate the daemon.
+        try
+        {
+            job.task();
+        }
+        catch (const std::exception& e)
+        {
+            LOGGER(error) << "RequestScheduler - " << e.what() << std::endl;
+        }
+        catch (...)
+        {
+            LOGGER(error) << "RequestScheduler - unknown exception." << std::endl;
+        }
+    }
+}
@@ -0,0 +1,288 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// VaultCache.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+// vaultd - open vaults shared across requests
+//
+
+#pragma once
+
+#include <Vault.h>
+
+#include <logger.h>
+
+#include <boost/filesystem.hpp>
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Keeps vaults open between requests so each request does not reopen the
+// database, recheck the schema and discard prepared statements. Keychains
+// unlocked by one request stay unlocked for later ones until the vault is
+// evicted.
+//
+// Handles are counted: a vault is only closed once no request holds a handle
+// to it and it has been idle for the timeout, or the cache is full. If the file at
+// a path is replaced or deleted, the next get() opens it afresh and the old
+// vault closes when its last holder lets go.
+//
+// Vaults are opened outside the cache lock. Concurrent requests for a vault
+// that is still opening wait for that one open rather than the whole cache.
+//
+// A cached vault keeps state in memory between requests, such as unlocked
+// keychains and metadata read from the database, so vaultd must be the only
+// writer of the files it serves. Changes made by other processes to a file
+// that stays in place are not noticed until the vault is evicted.
+class VaultCache
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    explicit VaultCache(std::chrono::seconds idleTimeout = std::chrono::seconds(300), size_t maxOpen = 16)
+        : idleTimeout_(idleTimeout), maxOpen_(maxOpen), nextOpenId_(0) { }
+
+    ~VaultCache() { closeAll(); }
+
+    // Opens the vault at path or returns the open one. The vault counts as in use until the
+    // returned handle and all its copies are gone, which must happen before the cache is destroyed.
+    // Throws whatever Vault's constructor throws.
+    std::shared_ptr<CoinDB::Vault> get(const std::string& path);
+
+    // Closes vaults that are not in use and have been idle for the timeout.
+    void evictIdle();
+
+    // Forgets all vaults. Those still in use close when released.
+    void closeAll();
+
+    size_t size() const;
+
+private:
+    struct FileId
+    {
+        FileId() : exists(false), dev(0), ino(0) { }
+
+        bool operator==(const FileId& other) const { return exists == other.exists && dev == other.dev && ino == other.ino; }
+        bool operator!=(const FileId& other) const { return !(*this == other); }
+
+        bool exists;
+        uint64_t dev;
+        uint64_t ino;
+    };
+
+    typedef std::shared_future<std::shared_ptr<CoinDB::Vault>> vault_future_t;
+
+    struct Entry
+    {
+        // Ready once the vault is open. Entries whose open failed are removed before the failure is reported.
+        vault_future_t vault;
+        uint64_t openId;
+        FileId fileId;
+        clock::time_point lastUsed;
+
+        // Handles given out by get() and not yet released. Only changed under the cache lock, and
+        // shared with the handles so that they can still release once the entry is gone.
+        std::shared_ptr<size_t> holders;
+
+        bool isOpen() const { return vault.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+
+        // Vaults still opening count as in use.
+        bool inUse() const { return !isOpen() || *holders > 0; }
+    };
+
+    // Owned by the handles get() returns. Counted as a holder of the entry from inside the cache
+    // lock, before the vault is waited for, so eviction never sees a vault about to be used as idle.
+    struct Hold
+    {
+        explicit Hold(VaultCache& cache) : cache(cache) { }
+        ~Hold()
+        {
+            if (!holders) return;
+            std::lock_guard<std::mutex> lock(cache.mutex_);
+            --*holders;
+        }
+
+        VaultCache& cache;
+        std::shared_ptr<size_t> holders;
+        std::shared_ptr<CoinDB::Vault> vault;
+    };
+
+    typedef std::map<std::string, Entry> entries_t;
+
+    static FileId getFileId(const std::string& path);
+    static void release(entries_t::iterator it);
+
+    void evictIdle_unwrapped(clock::time_point now);
+    void makeRoom_unwrapped();
+
+    std::chrono::seconds idleTimeout_;
+    size_t maxOpen_;
+
+    mutable std::mutex mutex_;
+    entries_t entries_;
+    uint64_t nextOpenId_;
+};
+
+inline std::shared_ptr<CoinDB::Vault> VaultCache::get(const std::string& path)
+{
+    std::string key = boost::filesystem::absolute(path).string();
+    FileId fileId = getFileId(key);
+    clock::time_point now = clock::now();
+
+    // Released here if waiting for the vault or opening it throws
+    std::shared_ptr<Hold> hold(std::make_shared<Hold>(*this));
+
+    std::promise<std::shared_ptr<CoinDB::Vault>> opened;
+    vault_future_t pending;
+    uint64_t openId = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it != entries_.end())
+        {
+            if (it->second.fileId == fileId)
+            {
+                it->second.lastUsed = now;
+                pending = it->second.vault;
+                hold->holders = it->second.holders;
+            }
+            else
+            {
+                LOGGER(debug) << "VaultCache::get(" << key << ") - file changed, reopening." << std::endl;
+                release(it);
+                entries_.erase(it);
+            }
+        }
+
+        if (!pending.valid())
+        {
+            evictIdle_unwrapped(now);
+            makeRoom_unwrapped();
+
+            openId = nextOpenId_++;
+            Entry& entry = entries_[key];
+            entry.vault = opened.get_future().share();
+            entry.openId = openId;
+            entry.fileId = fileId;
+            entry.lastUsed = now;
+            entry.holders = std::make_shared<size_t>(0);
+            hold->holders = entry.holders;
+        }
+        ++*hold->holders;
+    }
+
+    // Open or opening already: wait outside the lock. Rethrows if the open failed.
+    if (pending.valid())
+    {
+        hold->vault = pending.get();
+        return std::shared_ptr<CoinDB::Vault>(hold, hold->vault.get());
+    }
+
+    std::shared_ptr<CoinDB::Vault> vault;
+    try
+    {
+        vault = std::make_shared<CoinDB::Vault>(path, false);
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = entries_.find(key);
+            if (it != entries_.end() && it->second.openId == openId) { entries_.erase(it); }
+        }
+
+        // Requests waiting on this open get the same error
+        opened.set_exception(std::current_exception());
+        throw;
+    }
+
+    opened.set_value(vault);
+    LOGGER(debug) << "VaultCache::get(" << key << ") - opened." << std::endl;
+    hold->vault = vault;
+    return std::shared_ptr<CoinDB::Vault>(hold, vault.get());
+}
+
+inline void VaultCache::evictIdle()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    evictIdle_unwrapped(clock::now());
+}
+
+inline void VaultCache::closeAll()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) { release(it); }
+    entries_.clear();
+}
+
+inline size_t VaultCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+inline VaultCache::FileId VaultCache::getFileId(const std::string& path)
+{
+    FileId id;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0)
+    {
+        id.exists = true;
+        id.dev = st.st_dev;
+        id.ino = st.st_ino;
+    }
+    return id;
+}
+
+inline void VaultCache::release(entries_t::iterator it)
+{
+    // Holders keep the vault open, but nothing should stay unlocked once we let go of it.
+    if (!it->second.inUse()) { it->second.vault.get()->lockAllKeychains(); }
+}
+
+inline void VaultCache::evictIdle_unwrapped(clock::time_point now)
+{
+    for (auto it = entries_.begin(); it != entries_.end();)
+    {
+        if (!it->second.inUse() && now - it->second.lastUsed >= idleTimeout_)
+        {
+            LOGGER(debug) << "VaultCache - closing idle vault " << it->first << std::endl;
+            release(it);
+            it = entries_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+inline void VaultCache::makeRoom_unwrapped()
+{
+    while (entries_.size() >= maxOpen_)
+    {
+        auto lru = entries_.end();
+        for (auto it = entries_.begin(); it != entries_.end(); ++it)
+        {
+            if (it->second.inUse()) continue;
+            if (lru == entries_.end() || it->second.lastUsed < lru->second.lastUsed) { lru = it; }
+        }
+
+        // Everything is in use, so go over the limit rather than fail the request.
+        if (lru == entries_.end()) return;
+
+        LOGGER(debug) << "VaultCache - closing least recently used vault " << lru->first << std::endl;
+        release(lru);
+        entries_.erase(lru);
+    }
+}
@@ -15,16 +15,27 @@
 #include <formatting.h>
 
 #include <Vault.h>
+#include <VaultSnapshot.h>
+#include <Passphrase.h>
 #include <Schema-odb.hxx>
 
+#include "RequestScheduler.h"
+#include "VaultCache.h"
+
 #include <random.h>
 
 #include <logger.h>
+#include <metrics.h>
 
 #include <Base58Check.h>
 
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 
 #include <iostream>
 #include <sstream>
@@ -41,6 +52,8 @@ const string WS_PORT = "12345";
 
 bool g_bShutdown = false;
 
+VaultCache g_vaultCache;
+
 void finish(int sig)
 {
     LOGGER(debug) << "Stopping..." << endl;
@@ -59,7 +72,8 @@ cli::result_t cmd_create(const cli::params_t& params)
 
 cli::result_t cmd_info(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     uint32_t schema_version = vault.getSchemaVersion();
     uint32_t horizon_timestamp = vault.getHorizonTimestamp();
 
@@ -73,7 +87,8 @@ cli::result_t cmd_info(const cli::params_t& params)
 // Keychain operations
 cli::result_t cmd_keychainexists(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     bool bExists = vault.keychainExists(params[1]);
 
     stringstream ss;
@@ -83,7 +98,8 @@ cli::result_t cmd_keychainexists(const cli::params_t& params)
 
 cli::result_t cmd_newkeychain(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     vault.newKeychain(params[1], random_bytes(32));
 
     stringstream ss;
@@ -97,7 +113,8 @@ cli::result_t cmd_erasekeychain(bool bHelp, const cli::params_t& params)
         return "erasekeychain <db file> <keychain_name> - erase a keychain.";
     }
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     if (!vault.keychainExists(params[1]))
         throw runtime_error("Keychain not found.");
 
@@ -110,7 +127,8 @@ cli::result_t cmd_erasekeychain(bool bHelp, const cli::params_t& params)
 */
 cli::result_t cmd_renamekeychain(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     vault.renameKeychain(params[1], params[2]);
 
     stringstream ss;
@@ -120,7 +138,8 @@ cli::result_t cmd_renamekeychain(const cli::params_t& params)
 
 cli::result_t cmd_keychaininfo(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     shared_ptr<Keychain> keychain = vault.getKeychain(params[1]);
 
     stringstream ss;
@@ -141,7 +160,8 @@ cli::result_t cmd_keychains(const cli::params_t& params)
 
     bool show_hidden = params.size() > 2 && params[2] == "true";
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     vector<KeychainView> views = vault.getRootKeychainViews(account_name, show_hidden);
 
     stringstream ss;
@@ -158,7 +178,8 @@ cli::result_t cmd_listkeychains(bool bHelp, const cli::params_t& params)
 
     bool root_only = params.size() > 1 ? (params[1] == "true") : false;
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     vector<shared_ptr<Keychain>> keychains = vault.getAllKeychains(root_only);
 
     stringstream ss;
@@ -177,7 +198,8 @@ cli::result_t cmd_exportkeychain(const cli::params_t& params)
     if (params.size() > 3)  { output_file = params[3]; }
     else                    { output_file = params[1] + (export_privkey ? ".priv" : ".pub"); }
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     vault.exportKeychain(params[1], output_file, export_privkey);
 
     stringstream ss;
@@ -189,7 +211,8 @@ cli::result_t cmd_importkeychain(const cli::params_t& params)
 {
     bool import_privkey = params.size() > 2 ? (params[2] == "true") : true;
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     std::shared_ptr<Keychain> keychain = vault.importKeychain(params[1], import_privkey);
 
     stringstream ss;
@@ -201,7 +224,8 @@ cli::result_t cmd_exportbip32(const cli::params_t& params)
 {
     bool export_privkey = params.size() > 2;
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     vault.unlockChainCodes(uchar_vector("1234"));
     if (export_privkey)
     {
@@ -229,7 +253,8 @@ cli::result_t cmd_importbip32(const cli::params_t& params)
     secure_bytes_t extkey;
     if (!fromBase58Check(params[2], extkey)) throw std::runtime_error("Invalid BIP32.");
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     std::shared_ptr<Keychain> keychain = vault.importKeychainExtendedKey(params[1], extkey, import_privkey, lock_key);
 
     stringstream ss;
@@ -240,8 +265,9 @@ cli::result_t cmd_importbip32(const cli::params_t& params)
 // Account operations
 cli::result_t cmd_accountexists(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    bool bExists = vault.accountExists(params[1]);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    VaultSnapshot snapshot(*handle);
+    bool bExists = snapshot.accountExists(params[1]);
 
     stringstream ss;
     ss << (bExists ? "true" : "false");
@@ -259,7 +285,8 @@ cli::result_t cmd_newaccount(const cli::params_t& params)
     for (size_t i = 3; i < params.size(); i++)
         keychain_names.push_back(params[i]);
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     vault.unlockChainCodes(secure_bytes_t());
     vault.newAccount(params[1], minsigs, keychain_names);
 
@@ -270,7 +297,8 @@ cli::result_t cmd_newaccount(const cli::params_t& params)
 
 cli::result_t cmd_renameaccount(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     vault.renameAccount(params[1], params[2]);
 
     stringstream ss;
@@ -280,10 +308,11 @@ cli::result_t cmd_renameaccount(const cli::params_t& params)
 
 cli::result_t cmd_accountinfo(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    AccountInfo accountInfo = vault.getAccountInfo(params[1]);
-    uint64_t balance = vault.getAccountBalance(params[1], 0);
-    uint64_t confirmed_balance = vault.getAccountBalance(params[1], 1);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    VaultSnapshot snapshot(*handle);
+    AccountInfo accountInfo = snapshot.getAccountInfo(params[1]);
+    uint64_t balance = snapshot.getAccountBalance(params[1], 0);
+    uint64_t confirmed_balance = snapshot.getAccountBalance(params[1], 1);
 
     using namespace stdutils;
     stringstream ss;
@@ -301,8 +330,9 @@ cli::result_t cmd_accountinfo(const cli::params_t& params)
 
 cli::result_t cmd_listaccounts(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    vector<AccountInfo> accounts = vault.getAllAccountInfo();
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    VaultSnapshot snapshot(*handle);
+    vector<AccountInfo> accounts = snapshot.getAllAccountInfo();
 
     stringstream ss;
     ss << formattedAccountHeader();
@@ -313,7 +343,8 @@ cli::result_t cmd_listaccounts(const cli::params_t& params)
 
 cli::result_t cmd_exportaccount(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
 
     secure_bytes_t exportChainCodeUnlockKey;
     if (params.size() > 2 && !params[2].empty())
@@ -332,7 +363,8 @@ cli::result_t cmd_exportaccount(const cli::params_t& params)
 
 cli::result_t cmd_importaccount(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
 
     unsigned int privkeycount = 1;
 
@@ -352,7 +384,8 @@ cli::result_t cmd_importaccount(const cli::params_t& params)
 
 cli::result_t cmd_newaccountbin(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     AccountInfo accountInfo = vault.getAccountInfo(params[1]);
     vault.unlockChainCodes(secure_bytes_t());
     vault.addAccountBin(params[1], params[2]);
@@ -364,8 +397,9 @@ cli::result_t cmd_newaccountbin(const cli::params_t& params)
 
 cli::result_t cmd_listbins(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    vector<AccountBinView> bins = vault.getAllAccountBinViews();
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    VaultSnapshot snapshot(*handle);
+    vector<AccountBinView> bins = snapshot.getAllAccountBinViews();
 
     stringstream ss;
     ss << formattedAccountBinViewHeader();
@@ -376,14 +410,15 @@ cli::result_t cmd_listbins(const cli::params_t& params)
 
 cli::result_t cmd_issuescript(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     std::string account_name;
     if (params[1] != "@null") account_name = params[1];
     std::string bin_name = params.size() > 2 ? params[2] : std::string(DEFAULT_BIN_NAME);
     std::string label = params.size() > 3 ? params[3] : std::string("");
     std::shared_ptr<SigningScript> script = vault.issueSigningScript(account_name, bin_name, label);
 
-    std::string address = getAddressFromScript(script->txoutscript());
+    std::string address = CoinQ::Script::getAddressForTxOutScript(script->txoutscript(), BASE58_VERSIONS);
 
     stringstream ss;
     ss << "account:     " << params[1] << endl
@@ -404,7 +439,8 @@ cli::result_t cmd_listscripts(const cli::params_t& params)
 
     int flags = params.size() > 3 ? (int)strtoul(params[3].c_str(), NULL, 0) : ((int)SigningScript::ISSUED | (int)SigningScript::USED);
     
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     vector<SigningScriptView> scriptViews = vault.getSigningScriptViews(account_name, bin_name, flags);
 
     stringstream ss;
@@ -424,19 +460,39 @@ cli::result_t cmd_history(const cli::params_t& params)
 
     bool hide_change = params.size() > 3 ? params[3] == "true" : true;
     
-    Vault vault(params[0], false);
-    uint32_t best_height = vault.getBestHeight();
-    vector<TxOutView> txOutViews = vault.getTxOutViews(account_name, bin_name, TxOut::ROLE_BOTH, TxOut::BOTH, Tx::ALL, hide_change);
+    unsigned int page_size = params.size() > 4 ? strtoul(params[4].c_str(), NULL, 0) : 0;
+
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    VaultSnapshot snapshot(*handle);
+    uint32_t best_height = snapshot.getBestHeight();
+    vector<TxOutView> txOutViews;
+    HistoryCursor cursor;
+    if (page_size > 0)
+    {
+        HistoryFilter filter;
+        filter.account_name = account_name;
+        filter.bin_name = bin_name;
+        filter.hide_change = hide_change;
+        cursor = HistoryCursor(params.size() > 5 ? params[5] : std::string());
+        txOutViews = snapshot.getTxOutViewsPage(filter, cursor, page_size);
+    }
+    else
+    {
+        txOutViews = snapshot.getTxOutViews(account_name, bin_name, TxOut::ROLE_BOTH, TxOut::BOTH, Tx::ALL, hide_change);
+    }
     stringstream ss;
     ss << formattedTxOutViewHeader();
     for (auto& txOutView: txOutViews)
         ss << endl << formattedTxOutView(txOutView, best_height);
+    if (page_size > 0 && !cursor.isEnd())
+        ss << endl << "Resume token: " << cursor.token();
     return ss.str();
 }
 
 cli::result_t cmd_refillaccountpool(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     AccountInfo accountInfo = vault.getAccountInfo(params[1]);
     vault.unlockChainCodes(secure_bytes_t());
     vault.refillAccountPool(params[1]);
@@ -449,7 +505,8 @@ cli::result_t cmd_refillaccountpool(const cli::params_t& params)
 // Account bin operations
 cli::result_t cmd_exportbin(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
 
     string export_name = params.size() > 3 ? params[3] : (params[1].empty() ? params[2] : params[1] + "-" + params[2]);
     secure_bytes_t exportChainCodeUnlockKey;
@@ -468,7 +525,8 @@ cli::result_t cmd_exportbin(const cli::params_t& params)
 
 cli::result_t cmd_importbin(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
 
     secure_bytes_t importChainCodeUnlockKey;
     if (params.size() > 2 && !params[2].empty())
@@ -488,7 +546,8 @@ cli::result_t cmd_txinfo(const cli::params_t& params)
 {
     bool raw = params.size() > 2 ? params[2] == "true" : false;
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     std::shared_ptr<Tx> tx = vault.getTx(uchar_vector(params[1]));
 
     if (raw) return uchar_vector(tx->raw()).getHex();
@@ -515,7 +574,8 @@ cli::result_t cmd_txinfo(const cli::params_t& params)
 
 cli::result_t cmd_insertrawtx(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
 
     std::shared_ptr<Tx> tx(new Tx());
     tx->set(uchar_vector(params[1]));
@@ -540,7 +600,8 @@ cli::result_t cmd_newrawtx(const cli::params_t& params)
     using namespace CoinQ::Script;
     const size_t MAX_VERSION_LEN = 2;
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
 
     // Get outputs
     size_t i = 2;
@@ -562,9 +623,38 @@ cli::result_t cmd_newrawtx(const cli::params_t& params)
     return uchar_vector(tx->raw()).getHex();
 }
 
+cli::result_t cmd_newrawtxfeerate(const cli::params_t& params)
+{
+    using namespace CoinQ::Script;
+    const size_t MAX_VERSION_LEN = 2;
+
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
+
+    // Get outputs
+    size_t i = 2;
+    txouts_t txouts;
+    do
+    {
+        bytes_t txoutscript  = getTxOutScriptForAddress(params[i++], BASE58_VERSIONS);
+        uint64_t value = strtoull(params[i++].c_str(), NULL, 0);
+        std::shared_ptr<TxOut> txout(new TxOut(value, txoutscript));
+        txouts.push_back(txout);
+         
+    } while (i < (params.size() - 1) && params[i].size() > MAX_VERSION_LEN);
+
+    uint64_t fee_rate = i < params.size() ? strtoull(params[i++].c_str(), NULL, 0) : 1;
+    uint32_t version = i < params.size() ? strtoul(params[i++].c_str(), NULL, 0) : 1;
+    uint32_t locktime = i < params.size() ? strtoul(params[i++].c_str(), NULL, 0) : 0;
+
+    std::shared_ptr<Tx> tx = vault.createTxWithFeeRate(params[1], version, locktime, ids_t(), txouts, fee_rate, 0, true);
+    return uchar_vector(tx->raw()).getHex();
+}
+
 cli::result_t cmd_deletetx(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     uchar_vector hash(params[1]);
     vault.deleteTx(hash);
 
@@ -575,7 +665,8 @@ cli::result_t cmd_deletetx(const cli::params_t& params)
 
 cli::result_t cmd_signingrequest(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     uchar_vector hash(params[1]);
 
     SigningRequest req = vault.getSigningRequest(hash, true);
@@ -596,12 +687,11 @@ cli::result_t cmd_signingrequest(const cli::params_t& params)
     return ss.str();
 }
 
-// TODO: do something with passphrase
 cli::result_t cmd_signtx(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    vault.unlockChainCodes(uchar_vector("1234"));
-    vault.unlockKeychain(params[2], secure_bytes_t());
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
+    vault.unlockKeychain(params[2], params[3].empty() ? secure_bytes_t() : passphraseHash(params[3]));
 
     stringstream ss;
     std::vector<std::string> keychain_names;
@@ -617,11 +707,27 @@ cli::result_t cmd_signtx(const cli::params_t& params)
     return ss.str();
 }
 
+cli::result_t cmd_signaccounttxs(const cli::params_t& params)
+{
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
+    vault.unlockKeychain(params[2], params[3].empty() ? secure_bytes_t() : passphraseHash(params[3]));
+
+    std::vector<std::string> keychain_names;
+    keychain_names.push_back(params[2]);
+    txs_t txs = vault.signTxs(params[1], keychain_names, true);
+
+    stringstream ss;
+    ss << "Signatures added to " << txs.size() << " transaction" << (txs.size() == 1 ? "." : "s.");
+    return ss.str();
+}
+
 // Blockchain operations
 cli::result_t cmd_bestheight(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    uint32_t best_height = vault.getBestHeight();
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    VaultSnapshot snapshot(*handle);
+    uint32_t best_height = snapshot.getBestHeight();
 
     stringstream ss;
     ss << best_height;
@@ -630,7 +736,8 @@ cli::result_t cmd_bestheight(const cli::params_t& params)
 
 cli::result_t cmd_horizonheight(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     uint32_t horizon_height = vault.getHorizonHeight();
 
     stringstream ss;
@@ -642,7 +749,8 @@ cli::result_t cmd_horizontimestamp(const cli::params_t& params)
 {
     bool use_gmt = params.size() > 1 && params[1] == "true";
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     long timestamp = vault.getHorizonTimestamp();
 
     std::function<struct tm*(const time_t*)> fConvert = use_gmt ? &gmtime : &localtime;
@@ -658,7 +766,8 @@ cli::result_t cmd_blockinfo(const cli::params_t& params)
 {
     uint32_t height = strtoul(params[1].c_str(), NULL, 0);
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     std::shared_ptr<BlockHeader> blockheader = vault.getBlockHeader(height);
 
     return blockheader->toCoinClasses().toIndentedString();
@@ -709,7 +818,8 @@ cli::result_t cmd_insertrawmerkleblock(const cli::params_t& params)
     std::shared_ptr<MerkleBlock> merkleblock(new MerkleBlock());
     merkleblock->fromCoinClasses(rawmerkleblock, height);
 
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     bool rval = (bool)vault.insertMerkleBlock(merkleblock);
 
     stringstream ss;
@@ -720,7 +830,8 @@ cli::result_t cmd_insertrawmerkleblock(const cli::params_t& params)
 cli::result_t cmd_deleteblock(const cli::params_t& params)
 {
     uint32_t height = strtoull(params[1].c_str(), NULL, 0);
-    Vault vault(params[0], false);
+    std::shared_ptr<Vault> handle = g_vaultCache.get(params[0]);
+    Vault& vault = *handle;
     unsigned int count = vault.deleteMerkleBlock(height);
 
     stringstream ss;
@@ -734,38 +845,255 @@ cli::result_t cmd_randombytes(const cli::params_t& params)
     return bytes.getHex();
 }
 
+// Diagnostics
+cli::result_t cmd_metrics(const cli::params_t& params)
+{
+    if (params.size() > 0 && params[0] != "reset") throw std::runtime_error("Invalid option: " + params[0]);
+    bool bReset = params.size() > 0;
+
+    std::string report = metrics::report();
+    if (bReset) { metrics::reset(); }
+    return report;
+}
+
+// Request handling
+const size_t STREAM_CHUNK_SIZE = 64 * 1024;
+
+// Commands that only read from a vault, so they can run alongside each other.
+// Anything else that takes a db file is a write and runs alone, in order.
+const std::set<std::string> READ_COMMANDS = {
+    "info", "keychainexists", "keychaininfo", "keychains", "exportkeychain", "accountexists", "accountinfo", "listaccounts",
+    "listscripts", "history", "listbins", "txinfo", "signingrequest", "bestheight", "horizonheight", "horizontimestamp", "blockinfo"
+};
+
+// Commands that do not take a db file.
+const std::set<std::string> NO_VAULT_COMMANDS = { "help", "rawblockheader", "rawmerkleblock", "randombytes", "metrics" };
+
+struct Connection
+{
+    Connection() : closed(false), streaming(false) { }
+
+    // Requests still queued when the client disconnects are dropped, and
+    // results of ones already running are discarded.
+    std::atomic<bool> closed;
+
+    // Large results are sent as a sequence of partial responses.
+    std::atomic<bool> streaming;
+};
+
+typedef std::shared_ptr<Connection> ConnectionPtr;
+typedef std::function<void(const json_spirit::Value& /*result*/, const json_spirit::Value& /*error*/)> command_callback_t;
+
+std::mutex g_connectionsMutex;
+std::map<websocketpp::connection_hdl, ConnectionPtr, std::owner_less<websocketpp::connection_hdl>> g_connections;
+
+std::mutex g_sendMutex;
+std::unique_ptr<RequestScheduler> g_scheduler;
+
+using namespace cli;
+Shell shell("vaultd by Eric Lombrozo v0.0.1");
+
+ConnectionPtr getConnection(websocketpp::connection_hdl hdl)
+{
+    std::lock_guard<std::mutex> lock(g_connectionsMutex);
+    ConnectionPtr& connection = g_connections[hdl];
+    if (!connection) { connection = std::make_shared<Connection>(); }
+    return connection;
+}
+
+void send(WebSocket::Server& server, websocketpp::connection_hdl hdl, ConnectionPtr connection, const JsonRpc::Response& response)
+{
+    if (connection->closed) return;
+
+    std::lock_guard<std::mutex> lock(g_sendMutex);
+    server.send(hdl, response);
+}
+
+void sendResult(WebSocket::Server& server, websocketpp::connection_hdl hdl, ConnectionPtr connection, const json_spirit::Value& result, const json_spirit::Value& id)
+{
+    JsonRpc::Response response;
+    if (!connection->streaming || result.type() != json_spirit::str_type || result.get_str().size() <= STREAM_CHUNK_SIZE)
+    {
+        response.setResult(result, id);
+        send(server, hdl, connection, response);
+        return;
+    }
+
+    const std::string& text = result.get_str();
+    int seq = 0;
+    for (size_t offset = 0; offset < text.size() && !connection->closed; offset += STREAM_CHUNK_SIZE)
+    {
+        json_spirit::Object chunk;
+        chunk.push_back(json_spirit::Pair("stream", seq++));
+        chunk.push_back(json_spirit::Pair("more", offset + STREAM_CHUNK_SIZE < text.size()));
+        chunk.push_back(json_spirit::Pair("data", text.substr(offset, STREAM_CHUNK_SIZE)));
+        response.setResult(chunk, id);
+        send(server, hdl, connection, response);
+    }
+}
+
+void scheduleCommand(ConnectionPtr connection, const std::string& cmdname, const params_t& params, command_callback_t callback)
+{
+    std::string key;
+    if (!NO_VAULT_COMMANDS.count(cmdname) && !params.empty()) { key = boost::filesystem::absolute(params[0]).string(); }
+    bool write = !READ_COMMANDS.count(cmdname);
+
+    g_scheduler->post(key, write, [=]()
+    {
+        if (connection->closed) return;
+
+        try
+        {
+            result_t result = shell.exec(cmdname, params);
+            callback(result, json_spirit::Value());
+        }
+        catch (const std::exception& e)
+        {
+            callback(json_spirit::Value(), e.what());
+        }
+    });
+}
+
+params_t getParams(const json_spirit::Array& values)
+{
+    params_t params;
+    for (auto& value: values)
+    {
+        if (value.type() != json_spirit::str_type) throw std::runtime_error("Parameters must be strings.");
+        params.push_back(value.get_str());
+    }
+    return params;
+}
+
+// Runs each request in params, in order for any one vault, and sends all their
+// responses back as one array once the last completes.
+void scheduleBatch(WebSocket::Server& server, websocketpp::connection_hdl hdl, ConnectionPtr connection, const json_spirit::Array& requests, const json_spirit::Value& id)
+{
+    struct BatchState
+    {
+        std::mutex mutex;
+        json_spirit::Array responses;
+        size_t remaining;
+    };
+
+    if (requests.empty()) throw std::runtime_error("Empty batch.");
+
+    std::shared_ptr<BatchState> state = std::make_shared<BatchState>();
+    state->responses.resize(requests.size());
+    state->remaining = requests.size();
+
+    auto complete = [&server, hdl, connection, state, id](size_t i, const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& subid)
+    {
+        json_spirit::Object response;
+        response.push_back(json_spirit::Pair("result", result));
+        response.push_back(json_spirit::Pair("error", error));
+        response.push_back(json_spirit::Pair("id", subid));
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->responses[i] = response;
+        if (--state->remaining == 0) { sendResult(server, hdl, connection, state->responses, id); }
+    };
+
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        std::string method;
+        json_spirit::Value subid;
+        try
+        {
+            if (requests[i].type() != json_spirit::obj_type) throw std::runtime_error("Batch items must be request objects.");
+
+            params_t params;
+            for (auto& pair: requests[i].get_obj())
+            {
+                if (pair.name_ == "method")         { method = pair.value_.get_str(); }
+                else if (pair.name_ == "params")    { params = getParams(pair.value_.get_array()); }
+                else if (pair.name_ == "id")        { subid = pair.value_; }
+            }
+            if (method.empty()) throw std::runtime_error("Missing method.");
+            if (method == "batch") throw std::runtime_error("Batches cannot be nested.");
+
+            scheduleCommand(connection, method, params, [complete, i, subid](const json_spirit::Value& result, const json_spirit::Value& error)
+            {
+                complete(i, result, error, subid);
+            });
+        }
+        catch (const std::exception& e)
+        {
+            complete(i, json_spirit::Value(), e.what(), subid);
+        }
+    }
+}
+
 // WebSocket callbacks
 void openCallback(WebSocket::Server& server, websocketpp::connection_hdl hdl)
 {
     LOGGER(debug) << "Client " << hdl.lock().get() << " connected." << endl;
+    getConnection(hdl);
 }
 
 void closeCallback(WebSocket::Server& server, websocketpp::connection_hdl hdl)
 {
     LOGGER(debug) << "Client " << hdl.lock().get() << " disconnected." << endl;
-}
 
-using namespace cli;
-Shell shell("vaultd by Eric Lombrozo v0.0.1");
+    std::lock_guard<std::mutex> lock(g_connectionsMutex);
+    auto it = g_connections.find(hdl);
+    if (it == g_connections.end()) return;
 
+    it->second->closed = true;
+    g_connections.erase(it);
+}
+
+// Requests are handed to the worker pool so a slow command never holds up other clients.
+//
+// Two methods are handled here rather than by the shell:
+//   batch        - params are JSON-RPC request objects. The result is the array of their responses.
+//   setstreaming - "true" or "false". When on, results over 64 KiB arrive as several responses
+//                  with the same id, each with result {"stream": n, "more": bool, "data": "..."}.
 void requestCallback(WebSocket::Server& server, const WebSocket::Server::client_request_t& req)
 {
-    JsonRpc::Response response;
+    websocketpp::connection_hdl hdl = req.first;
+    ConnectionPtr connection = getConnection(hdl);
 
     const string& cmdname = req.second.getMethod();
-    params_t params;
-    for (auto& param: req.second.getParams()) { params.push_back(param.get_str()); }
+    json_spirit::Value id = req.second.getId();
+
     try
     {
-        result_t result = shell.exec(cmdname, params);
-        response.setResult(result, req.second.getId());
+        if (cmdname == "batch")
+        {
+            scheduleBatch(server, hdl, connection, req.second.getParams(), id);
+            return;
+        }
+
+        params_t params = getParams(req.second.getParams());
+        if (cmdname == "setstreaming")
+        {
+            if (params.size() != 1 || (params[0] != "true" && params[0] != "false")) throw std::runtime_error("setstreaming <true|false>");
+            connection->streaming = (params[0] == "true");
+            sendResult(server, hdl, connection, params[0], id);
+            return;
+        }
+
+        scheduleCommand(connection, cmdname, params, [&server, hdl, connection, id](const json_spirit::Value& result, const json_spirit::Value& error)
+        {
+            if (error.is_null())
+            {
+                sendResult(server, hdl, connection, result, id);
+            }
+            else
+            {
+                JsonRpc::Response response;
+                response.setError(error, id);
+                send(server, hdl, connection, response);
+            }
+        });
     }
     catch (const std::exception& e)
     {
-        response.setError(e.what(), req.second.getId());        
+        JsonRpc::Response response;
+        response.setError(e.what(), id);
+        send(server, hdl, connection, response);
     }
-
-    server.send(req.first, response);
 }
 
 int main(int argc, char* argv[])
@@ -801,7 +1129,7 @@ int main(int argc, char* argv[])
     shell.add(command(&cmd_issuescript, "issuescript", "issue a new signing script", command::params(2, "db file", "account name"), command::params(1, (std::string("bin name = ") + DEFAULT_BIN_NAME).c_str())));
     shell.add(command(&cmd_listscripts, "listscripts", "display list of signing scripts (flags: UNUSED=1, CHANGE=2, PENDING=4, RECEIVED=8, CANCELED=16)", command::params(1, "db file"),
         command::params(3, "account name = @all", "bin name = @all", "flags = PENDING | RECEIVED")));
-    shell.add(command(&cmd_history, "history", "display transaction history", command::params(1, "db file"), command::params(3, "account name = @all", "bin name = @all", "hide change = true")));
+    shell.add(command(&cmd_history, "history", "display transaction history", command::params(1, "db file"), command::params(5, "account name = @all", "bin name = @all", "hide change = true", "page size = 0 (all)", "resume token = newest")));
     shell.add(command(&cmd_refillaccountpool, "refillaccountpool", "refill signing script pool for account", command::params(2, "db file", "account name")));
 
     // Account bin operations
@@ -813,9 +1141,11 @@ int main(int argc, char* argv[])
     shell.add(command(&cmd_txinfo, "txinfo", "display transaction information", command::params(2, "db file", "tx hash"), command::params(1, "raw hex = false")));
     shell.add(command(&cmd_insertrawtx, "insertrawtx", "insert a raw hex transaction into database", command::params(2, "db file", "tx raw hex")));
     shell.add(command(&cmd_newrawtx, "newrawtx", "create a new raw transaction", command::params(4, "db file", "account name", "address 1", "value 1"), command::params(6, "address 2", "value 2", "...", "fee = 0", "version = 1", "locktime = 0")));
+    shell.add(command(&cmd_newrawtxfeerate, "newrawtxfeerate", "create a new raw transaction paying a fee rate in satoshis per vbyte", command::params(4, "db file", "account name", "address 1", "value 1"), command::params(6, "address 2", "value 2", "...", "fee rate = 1", "version = 1", "locktime = 0")));
     shell.add(command(&cmd_deletetx, "deletetx", "delete a transaction", command::params(2, "db file", "tx hash")));
     shell.add(command(&cmd_signingrequest, "signingrequest", "gets signing request for transaction with missing signatures", command::params(2, "db file", "tx hash")));
-    shell.add(command(&cmd_signtx, "signtx", "add signatures to transaction for specified keychain", command::params(4, "db file", "tx hash", "keychain name", "passphrase")));
+    shell.add(command(&cmd_signtx, "signtx", "add signatures to transaction for specified keychain", command::params(4, "db file", "tx hash", "keychain name", "passphrase (empty if unencrypted)")));
+    shell.add(command(&cmd_signaccounttxs, "signaccounttxs", "add signatures to all unsigned transactions of an account for specified keychain", command::params(4, "db file", "account name", "keychain name", "passphrase (empty if unencrypted)")));
 
     // Blockchain operations
     shell.add(command(&cmd_bestheight, "bestheight", "display the best block height", command::params(1, "db file")));
@@ -830,6 +1160,12 @@ int main(int argc, char* argv[])
     // Miscellaneous
     shell.add(command(&cmd_randombytes, "randombytes", "output random bytes in hex", command::params(1, "length")));
 
+    // Diagnostics
+    shell.add(command(&cmd_metrics, "metrics", "display counters, gauges and latency histograms, then zero them if reset is given", command::params(0), command::params(1, "reset")));
+
+    size_t threads = std::thread::hardware_concurrency();
+    g_scheduler.reset(new RequestScheduler(threads ? threads : 4));
+
     WebSocket::Server wsServer(WS_PORT);
     wsServer.setOpenCallback(&openCallback);
     wsServer.setCloseCallback(&closeCallback);
@@ -847,7 +1183,20 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    while (!g_bShutdown) { std::this_thread::sleep_for(std::chrono::microseconds(200)); }
+    std::chrono::steady_clock::time_point nextEviction = std::chrono::steady_clock::now();
+    while (!g_bShutdown)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+        if (std::chrono::steady_clock::now() >= nextEviction)
+        {
+            g_vaultCache.evictIdle();
+            nextEviction += std::chrono::seconds(1);
+        }
+    }
+
+    LOGGER(debug) << "Finishing queued requests..." << endl;
+    g_scheduler->stop();
 
     try
     {
@@ -858,9 +1207,13 @@ int main(int argc, char* argv[])
     catch (const std::exception& e)
     {
         LOGGER(error) << "Error stopping websocket server: " << e.what() << endl;
+        g_vaultCache.closeAll();
         return 2;
     }
 
+    LOGGER(debug) << "Closing " << g_vaultCache.size() << " open vaults..." << endl;
+    g_vaultCache.closeAll();
+
     return 0;
 }
 